@@ -21,6 +21,7 @@
 
 #include "utils.h"
 #include "io.h"
+#include "logfile.h"
 #include <xenevtchn.h>
 #include <xengnttab.h>
 #include <xenstore.h>
@@ -37,8 +38,13 @@
 #include <stdarg.h>
 #include <sys/mman.h>
 #include <time.h>
+#include <limits.h>
 #include <assert.h>
 #include <sys/types.h>
+#if defined(__linux__)
+#include <sys/epoll.h>
+#define USE_EPOLL
+#endif
 #if defined(__NetBSD__) || defined(__OpenBSD__)
 #include <util.h>
 #elif defined(__linux__)
@@ -60,24 +66,282 @@
 #define RATE_LIMIT_PERIOD 200
 
 extern int log_reload;
+extern int terminate;
 extern int log_guest;
 extern int log_hv;
 extern int log_time_hv;
 extern int log_time_guest;
 extern char *log_dir;
 extern int discard_overflowed_data;
-extern int replace_escape;
+extern unsigned int rate_limit;
 
-static int log_time_hv_needts = 1;
-static int log_time_guest_needts = 1;
-static int log_hv_fd = -1;
+static struct logfile *log_hv_file;
 
 static xengnttab_handle *xgt_handle = NULL;
 
-static struct pollfd  *fds;
+/*
+ * A file descriptor and the events wanted on it.  Watches stay registered
+ * (with epoll, where available) for as long as they want any events, and
+ * only have their events updated as the state of their console changes,
+ * rather than all fds being handed to poll() afresh on every iteration.
+ */
+struct watch {
+	int fd;
+	short events;
+	unsigned int since;	/* Wait since which fd is being watched. */
+#ifndef USE_EPOLL
+	unsigned int idx;	/* In fds[] and fd_watches[]. */
+#endif
+	void (*handle)(struct watch *w, short revents);
+	void *data;
+};
+
+static unsigned int nr_waits;
+
+#ifdef USE_EPOLL
+
+static int epoll_fd = -1;
+
+static int watch_ctl(struct watch *w, int op, short events)
+{
+	struct epoll_event ev = { .data.ptr = w };
+
+	if (events & POLLIN)
+		ev.events |= EPOLLIN;
+	if (events & POLLOUT)
+		ev.events |= EPOLLOUT;
+	if (events & POLLPRI)
+		ev.events |= EPOLLPRI;
+
+	return epoll_ctl(epoll_fd, op, w->fd, &ev);
+}
+
+static int watch_add(struct watch *w, short events)
+{
+	return watch_ctl(w, EPOLL_CTL_ADD, events);
+}
+
+static int watch_mod(struct watch *w, short events)
+{
+	return watch_ctl(w, EPOLL_CTL_MOD, events);
+}
+
+static void watch_del(struct watch *w)
+{
+	(void)watch_ctl(w, EPOLL_CTL_DEL, 0);
+}
+
+static int watch_open(void)
+{
+	epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	return epoll_fd == -1 ? -1 : 0;
+}
+
+static void watch_close(void)
+{
+	if (epoll_fd != -1)
+		close(epoll_fd);
+	epoll_fd = -1;
+}
+
+/* Waits for events for up to timeout ms, and handles them. */
+static int watch_wait(int timeout)
+{
+	struct epoll_event ev[64];
+	int i, ret;
+
+	ret = epoll_wait(epoll_fd, ev, ARRAY_SIZE(ev), timeout);
+	if (ret <= 0)
+		return ret;
+
+	nr_waits++;
+
+	for (i = 0; i < ret; i++) {
+		struct watch *w = ev[i].data.ptr;
+		short revents = 0;
+
+		if (ev[i].events & EPOLLIN)
+			revents |= POLLIN;
+		if (ev[i].events & EPOLLOUT)
+			revents |= POLLOUT;
+		if (ev[i].events & EPOLLPRI)
+			revents |= POLLPRI;
+		if (ev[i].events & EPOLLERR)
+			revents |= POLLERR;
+		if (ev[i].events & EPOLLHUP)
+			revents |= POLLHUP;
+
+		/* An earlier handler may have stopped or moved the watch. */
+		if (w->events && w->since != nr_waits)
+			w->handle(w, revents);
+	}
+
+	return ret;
+}
+
+#else /* !USE_EPOLL */
+
+static struct pollfd *fds;
+static struct watch **fd_watches;
 static unsigned int current_array_size;
 static unsigned int nr_fds;
 
+static int watch_add(struct watch *w, short events)
+{
+	if (current_array_size < nr_fds + 1) {
+		/* Round up to 2^8 boundary, in practice this just
+		 * make newsize larger than current_array_size.
+		 */
+		unsigned long newsize = ROUNDUP(nr_fds + 1, 8);
+		struct pollfd *new_fds;
+		struct watch **new_watches;
+
+		new_fds = realloc(fds, sizeof(*fds) * newsize);
+		if (!new_fds)
+			return -1;
+		fds = new_fds;
+		new_watches = realloc(fd_watches, sizeof(*fd_watches) * newsize);
+		if (!new_watches)
+			return -1;
+		fd_watches = new_watches;
+		current_array_size = newsize;
+	}
+
+	fds[nr_fds].fd = w->fd;
+	fds[nr_fds].events = events;
+	fds[nr_fds].revents = 0;
+	fd_watches[nr_fds] = w;
+	w->idx = nr_fds++;
+
+	return 0;
+}
+
+static int watch_mod(struct watch *w, short events)
+{
+	fds[w->idx].events = events;
+	return 0;
+}
+
+static void watch_del(struct watch *w)
+{
+	unsigned int last = --nr_fds;
+
+	fds[w->idx] = fds[last];
+	fd_watches[w->idx] = fd_watches[last];
+	fd_watches[w->idx]->idx = w->idx;
+}
+
+static int watch_open(void)
+{
+	return 0;
+}
+
+static void watch_close(void)
+{
+	free(fds);
+	free(fd_watches);
+	fds = NULL;
+	fd_watches = NULL;
+	current_array_size = 0;
+	nr_fds = 0;
+}
+
+/* Waits for events for up to timeout ms, and handles them. */
+static int watch_wait(int timeout)
+{
+	static struct {
+		struct watch *w;
+		short revents;
+	} *ready;
+	static unsigned int ready_size;
+	unsigned int i, n = 0;
+	int ret;
+
+	if (ready_size < nr_fds) {
+		void *new_ready = realloc(ready, sizeof(*ready) * nr_fds);
+
+		if (!new_ready) {
+			errno = ENOMEM;
+			return -1;
+		}
+		ready = new_ready;
+		ready_size = nr_fds;
+	}
+
+	ret = poll(fds, nr_fds, timeout);
+	if (ret <= 0)
+		return ret;
+
+	nr_waits++;
+
+	/* Handlers update the watches, and with them fds[]. */
+	for (i = 0; i < nr_fds; i++) {
+		if (!fds[i].revents)
+			continue;
+		ready[n].w = fd_watches[i];
+		ready[n++].revents = fds[i].revents;
+	}
+
+	for (i = 0; i < n; i++) {
+		struct watch *w = ready[i].w;
+
+		/* An earlier handler may have stopped or moved the watch. */
+		if (w->events && w->since != nr_waits)
+			w->handle(w, ready[i].revents);
+	}
+
+	return ret;
+}
+
+#endif /* USE_EPOLL */
+
+static void watch_init(struct watch *w,
+		       void (*handle)(struct watch *w, short revents),
+		       void *data)
+{
+	w->fd = -1;
+	w->events = 0;
+	w->handle = handle;
+	w->data = data;
+}
+
+/*
+ * Sets the fd to watch, and the events wanted on it.  The registration
+ * only changes if these do, and must be dropped (by wanting no events)
+ * before the fd gets closed.
+ */
+static void watch_set(struct watch *w, int fd, short events)
+{
+	if (fd == -1)
+		events = 0;
+
+	if (w->events && (!events || fd != w->fd)) {
+		watch_del(w);
+		w->events = 0;
+	}
+
+	if (!events || (events == w->events && fd == w->fd))
+		return;
+
+	if (!w->events) {
+		w->fd = fd;
+		w->since = nr_waits;
+		if (watch_add(w, events)) {
+			dolog(LOG_ERR, "Failed to watch fd %d: %d (%s)",
+			      fd, errno, strerror(errno));
+			return;
+		}
+	} else if (watch_mod(w, events)) {
+		dolog(LOG_ERR, "Failed to update watch on fd %d: %d (%s)",
+		      fd, errno, strerror(errno));
+		watch_del(w);
+		w->events = 0;
+		return;
+	}
+
+	w->events = events;
+}
+
 struct buffer {
 	char *data;
 	size_t consumed;
@@ -89,16 +353,19 @@ struct buffer {
 struct console {
 	const char *ttyname;
 	int master_fd;
-	int master_pollfd_idx;
+	struct watch tty_watch;
 	int slave_fd;
-	int log_fd;
+	struct logfile *log;
 	struct buffer buffer;
 	char *xspath;
 	const char *log_suffix;
 	int ring_ref;
 	xenevtchn_handle *xce_handle;
-	int xce_pollfd_idx;
+	struct watch xce_watch;
 	int event_count;
+	size_t period_bytes;
+	unsigned int rate_limit;	/* Bytes per second, 0 for no limit. */
+	bool throttled;
 	long long next_period;
 	xenevtchn_port_or_error_t local_port;
 	xenevtchn_port_or_error_t remote_port;
@@ -224,76 +491,6 @@ static inline int console_iter_int_arg3(struct domain *d,
 	return ret;
 }
 
-static void do_replace_escape(const char *src, char *dest, int len)
-{
-	int i;
-
-	for (i = 0; i < len; i++) {
-		if (src[i] == '\033')
-			dest[i] = '.';
-		else
-			dest[i] = src[i];
-	}
-}
-
-static int write_all(int fd, const char* buf, size_t len)
-{
-	while (len) {
-		ssize_t ret;
-		if (replace_escape) {
-			char buf_replaced[1024];
-			size_t this_round;
-
-			if (len > sizeof(buf_replaced))
-				this_round = sizeof(buf_replaced);
-			else
-				this_round = len;
-			do_replace_escape(buf, buf_replaced, this_round);
-			ret = write(fd, buf_replaced, this_round);
-		} else
-			ret = write(fd, buf, len);
-		if (ret == -1 && errno == EINTR)
-			continue;
-		if (ret <= 0)
-			return -1;
-		len -= ret;
-		buf += ret;
-	}
-
-	return 0;
-}
-
-static int write_with_timestamp(int fd, const char *data, size_t sz,
-				int *needts)
-{
-	char ts[32];
-	time_t now = time(NULL);
-	const struct tm *tmnow = localtime(&now);
-	size_t tslen = strftime(ts, sizeof(ts), "[%Y-%m-%d %H:%M:%S] ", tmnow);
-	const char *last_byte = data + sz - 1;
-
-	while (data <= last_byte) {
-		const char *nl = memchr(data, '\n', last_byte + 1 - data);
-		int found_nl = (nl != NULL);
-		if (!found_nl)
-			nl = last_byte;
-
-		if ((*needts && write_all(fd, ts, tslen))
-		    || write_all(fd, data, nl + 1 - data))
-			return -1;
-
-		*needts = found_nl;
-		data = nl + 1;
-		if (found_nl) {
-			// If we printed a newline, strip all \r following it
-			while (data <= last_byte && *data == '\r')
-				data++;
-		}
-	}
-
-	return 0;
-}
-
 static inline bool buffer_available(struct console *con)
 {
 	if (discard_overflowed_data ||
@@ -304,10 +501,17 @@ static inline bool buffer_available(struct console *con)
 		return false;
 }
 
+/* How many bytes the console may output in each time period. */
+static size_t console_byte_allowance(struct console *con)
+{
+	size_t bytes = (size_t)con->rate_limit * RATE_LIMIT_PERIOD / 1000;
+
+	return bytes ?: 1;
+}
+
 static void buffer_append(struct console *con)
 {
 	struct buffer *buffer = &con->buffer;
-	struct domain *dom = con->d;
 	XENCONS_RING_IDX cons, prod, size;
 	struct xencons_interface *intf = con->interface;
 
@@ -319,6 +523,22 @@ static void buffer_append(struct console *con)
 	if ((size == 0) || (size > sizeof(intf->out)))
 		return;
 
+	/*
+	 * Leave what is over the allowance in the ring, for the guest to
+	 * block on once it is full, until the next period.
+	 */
+	if (con->rate_limit) {
+		size_t allowance = console_byte_allowance(con);
+
+		if (con->period_bytes >= allowance)
+			return;
+		if (size > allowance - con->period_bytes) {
+			size = allowance - con->period_bytes;
+			prod = cons + size;
+		}
+	}
+	con->period_bytes += size;
+
 	if ((buffer->capacity - buffer->size) < size) {
 		buffer->capacity += (size + 1024);
 		buffer->data = realloc(buffer->data, buffer->capacity);
@@ -338,26 +558,12 @@ static void buffer_append(struct console *con)
 
 	/* Get the data to the logfile as early as possible because if
 	 * no one is listening on the console pty then it will fill up
-	 * and handle_tty_write will stop being called.
+	 * and handle_tty_write will stop being called.  The log buffers
+	 * it, to write out in batches.
 	 */
-	if (con->log_fd != -1) {
-		int logret;
-		if (log_time_guest) {
-			logret = write_with_timestamp(
-				con->log_fd,
-				buffer->data + buffer->size - size,
-				size, &log_time_guest_needts);
-		} else {
-			logret = write_all(
-				con->log_fd,
-				buffer->data + buffer->size - size,
-				size);
-		}
-		if (logret < 0)
-			dolog(LOG_ERR, "Write to log failed "
-			      "on domain %d: %d (%s)\n",
-			      dom->domid, errno, strerror(errno));
-	}
+	if (con->log)
+		logfile_append(con->log, buffer->data + buffer->size - size,
+			       size);
 
 	if (discard_overflowed_data && buffer->max_capacity &&
 	    buffer->size > 5 * buffer->max_capacity / 4) {
@@ -412,36 +618,19 @@ static bool domain_is_valid(int domid)
 	return ret;
 }
 
-static int create_hv_log(void)
+static struct logfile *create_hv_log(void)
 {
 	char logfile[PATH_MAX];
-	int fd;
 	snprintf(logfile, PATH_MAX-1, "%s/hypervisor.log", log_dir);
 	logfile[PATH_MAX-1] = '\0';
 
-	fd = open(logfile, O_WRONLY|O_CREAT|O_APPEND, 0644);
-	if (fd == -1)
-		dolog(LOG_ERR, "Failed to open log %s: %d (%s)",
-		      logfile, errno, strerror(errno));
-	if (fd != -1 && log_time_hv) {
-		if (write_with_timestamp(fd, "Logfile Opened\n",
-					 strlen("Logfile Opened\n"),
-					 &log_time_hv_needts) < 0) {
-			dolog(LOG_ERR, "Failed to log opening timestamp "
-				       "in %s: %d (%s)", logfile, errno,
-				       strerror(errno));
-			close(fd);
-			return -1;
-		}
-	}
-	return fd;
+	return logfile_open(logfile, log_time_hv);
 }
 
-static int create_console_log(struct console *con)
+static struct logfile *create_console_log(struct console *con)
 {
 	char logfile[PATH_MAX];
 	char *namepath, *data, *s;
-	int fd;
 	unsigned int len;
 	struct domain *dom = con->d;
 
@@ -449,17 +638,17 @@ static int create_console_log(struct console *con)
 	s = realloc(namepath, strlen(namepath) + 6);
 	if (s == NULL) {
 		free(namepath);
-		return -1;
+		return NULL;
 	}
 	namepath = s;
 	strcat(namepath, "/name");
 	data = xs_read(xs, XBT_NULL, namepath, &len);
 	free(namepath);
 	if (!data)
-		return -1;
+		return NULL;
 	if (!len) {
 		free(data);
-		return -1;
+		return NULL;
 	}
 
 	snprintf(logfile, PATH_MAX-1, "%s/guest-%s%s.log",
@@ -468,27 +657,13 @@ static int create_console_log(struct console *con)
 	free(data);
 	logfile[PATH_MAX-1] = '\0';
 
-	fd = open(logfile, O_WRONLY|O_CREAT|O_APPEND, 0644);
-	if (fd == -1)
-		dolog(LOG_ERR, "Failed to open log %s: %d (%s)",
-		      logfile, errno, strerror(errno));
-	if (fd != -1 && log_time_guest) {
-		if (write_with_timestamp(fd, "Logfile Opened\n",
-					 strlen("Logfile Opened\n"),
-					 &log_time_guest_needts) < 0) {
-			dolog(LOG_ERR, "Failed to log opening timestamp "
-				       "in %s: %d (%s)", logfile, errno,
-				       strerror(errno));
-			close(fd);
-			return -1;
-		}
-	}
-	return fd;
+	return logfile_open(logfile, log_time_guest);
 }
 
 static void console_close_tty(struct console *con)
 {
 	if (con->master_fd != -1) {
+		watch_set(&con->tty_watch, -1, 0);
 		close(con->master_fd);
 		con->master_fd = -1;
 	}
@@ -616,6 +791,24 @@ static int console_create_tty(struct console *con)
 	}
 	free(path);
 
+	success = asprintf(&path, "%s/rate-limit", con->xspath) != -1;
+	if (!success)
+		goto out;
+	/*
+	 * The guest can write to its console directory, so the node may only
+	 * make the limit stricter than the daemon's.
+	 */
+	data = xs_read(xs, XBT_NULL, path, &len);
+	if (data) {
+		unsigned long limit = strtoul(data, 0, 0);
+
+		if (limit && limit <= UINT_MAX &&
+		    (!con->rate_limit || limit < con->rate_limit))
+			con->rate_limit = limit;
+		free(data);
+	}
+	free(path);
+
 	success = (asprintf(&path, "%s/%s", con->xspath, con->ttyname) != -1);
 	if (!success)
 		goto out;
@@ -680,6 +873,10 @@ static void console_unmap_interface(struct console *con)
 	con->ring_ref = -1;
 }
  
+static void console_update_watches(struct console *con);
+static void handle_console_tty(struct watch *w, short revents);
+static void handle_console_ring(struct watch *w, short revents);
+
 static int console_create_ring(struct console *con)
 {
 	int err, remote_port, ring_ref, rc;
@@ -746,8 +943,10 @@ static int console_create_ring(struct console *con)
 
 	con->local_port = -1;
 	con->remote_port = -1;
-	if (con->xce_handle != NULL)
+	if (con->xce_handle != NULL) {
+		watch_set(&con->xce_watch, -1, 0);
 		xenevtchn_close(con->xce_handle);
+	}
 
 	/* Opening evtchn independently for each console is a bit
 	 * wasteful, but that's how the code is structured... */
@@ -780,10 +979,11 @@ static int console_create_ring(struct console *con)
 		}
 	}
 
-	if (log_guest && (con->log_fd == -1))
-		con->log_fd = create_console_log(con);
+	if (log_guest && !con->log)
+		con->log = create_console_log(con);
 
  out:
+	console_update_watches(con);
 	return err;
 }
 
@@ -823,13 +1023,13 @@ static int console_init(struct console *con, struct domain *dom, void **data)
 	}
 
 	con->master_fd = -1;
-	con->master_pollfd_idx = -1;
+	watch_init(&con->tty_watch, handle_console_tty, con);
 	con->slave_fd = -1;
-	con->log_fd = -1;
 	con->ring_ref = -1;
 	con->local_port = -1;
 	con->remote_port = -1;
-	con->xce_pollfd_idx = -1;
+	watch_init(&con->xce_watch, handle_console_ring, con);
+	con->rate_limit = rate_limit;
 	con->next_period = ((long long)ts.tv_sec * 1000) + (ts.tv_nsec / 1000000) + RATE_LIMIT_PERIOD;
 	con->d = dom;
 	con->ttyname = (*con_type)->ttyname;
@@ -917,10 +1117,8 @@ static void remove_domain(struct domain *dom)
 
 static void console_cleanup(struct console *con)
 {
-	if (con->log_fd != -1) {
-		close(con->log_fd);
-		con->log_fd = -1;
-	}
+	logfile_close(con->log);
+	con->log = NULL;
 
 	free(con->buffer.data);
 	con->buffer.data = NULL;
@@ -940,18 +1138,26 @@ static void cleanup_domain(struct domain *d)
 
 static void console_close_evtchn(struct console *con)
 {
-	if (con->xce_handle != NULL)
+	if (con->xce_handle != NULL) {
+		watch_set(&con->xce_watch, -1, 0);
 		xenevtchn_close(con->xce_handle);
+	}
 
 	con->xce_handle = NULL;
+	con->throttled = false;
 }
 
+/* Whether any domain is dead, and waiting for cleanup_domain(). */
+static bool dead_domains;
+
 static void shutdown_domain(struct domain *d)
 {
 	d->is_dead = true;
+	dead_domains = true;
 	watch_domain(d, false);
 	console_iter_void_arg1(d, console_unmap_interface);
 	console_iter_void_arg1(d, console_close_evtchn);
+	console_iter_void_arg1(d, console_update_watches);
 }
 
 static unsigned enum_pass = 0;
@@ -977,6 +1183,10 @@ static void enum_domains(void)
 			dom->last_seen = enum_pass;
 		domid = dominfo.domid + 1;
 	}
+
+	for (dom = dom_head; dom; dom = dom->next)
+		if (dom->last_seen != enum_pass && !dom->is_dead)
+			shutdown_domain(dom);
 }
 
 static int ring_free_bytes(struct console *con)
@@ -1031,7 +1241,9 @@ static void handle_tty_read(struct console *con)
 	 * is no problem, but Linux can't handle this usefully, so we
 	 * keep the slave open for the duration.
 	 */
-	if (len < 0) {
+	if (len < 0 && (errno == EAGAIN || errno == EINTR)) {
+		return;
+	} else if (len < 0) {
 		console_handle_broken_tty(con, domain_is_valid(dom->domid));
 	} else if (domain_is_valid(dom->domid)) {
 		prod = intf->in_prod;
@@ -1058,6 +1270,8 @@ static void handle_tty_write(struct console *con)
 
 	len = write(con->master_fd, con->buffer.data + con->buffer.consumed,
 		    con->buffer.size - con->buffer.consumed);
+	if (len < 0 && (errno == EAGAIN || errno == EINTR))
+		return;
  	if (len < 1) {
 		dolog(LOG_DEBUG, "Write failed on domain %d: %zd, %d\n",
 		      dom->domid, len, errno);
@@ -1067,11 +1281,71 @@ static void handle_tty_write(struct console *con)
 	}
 }
 
+static long long now_ms(void)
+{
+	struct timespec ts;
+
+	if (clock_gettime(CLOCK_MONOTONIC, &ts) < 0)
+		return -1;
+
+	return ((long long)ts.tv_sec * 1000) + (ts.tv_nsec / 1000000);
+}
+
+/* The earliest end of period of any throttled console, 0 if none is. */
+static long long next_unthrottle;
+
+static void console_new_period(struct console *con, long long now)
+{
+	con->next_period = now + RATE_LIMIT_PERIOD;
+	con->event_count = 0;
+	con->period_bytes = 0;
+}
+
+static bool console_over_allowance(struct console *con)
+{
+	return con->event_count >= RATE_LIMIT_ALLOWANCE ||
+	       (con->rate_limit &&
+		con->period_bytes >= console_byte_allowance(con));
+}
+
+/* Leaves the event channel masked until the end of the period. */
+static void console_throttle(struct console *con)
+{
+	con->throttled = true;
+	if (!next_unthrottle || con->next_period < next_unthrottle)
+		next_unthrottle = con->next_period;
+}
+
+static void console_update_watches(struct console *con)
+{
+	short events = 0;
+
+	if (con->master_fd != -1 && !con->d->is_dead) {
+		if (con->interface && ring_free_bytes(con))
+			events |= POLLIN;
+
+		if (!buffer_empty(&con->buffer))
+			events |= POLLOUT;
+
+		if (events)
+			events |= POLLPRI;
+	}
+	watch_set(&con->tty_watch, con->master_fd, events);
+
+	events = 0;
+	if (con->xce_handle != NULL && !con->d->is_dead &&
+	    !con->throttled && buffer_available(con))
+		events = POLLIN|POLLPRI;
+	watch_set(&con->xce_watch,
+		  con->xce_handle ? xenevtchn_fd(con->xce_handle) : -1,
+		  events);
+}
+
 static void console_evtchn_unmask(struct console *con, void *data)
 {
 	long long now = *(long long *)data;
 
-	if (!console_enabled(con))
+	if (!con->throttled)
 		return;
 
 	/* CS 16257:955ee4fa1345 introduces a 5ms fuzz
@@ -1081,16 +1355,27 @@ static void console_evtchn_unmask(struct console *con, void *data)
 	 * the fuzz here. Remove it with a separate
 	 * patch if necessary */
 	if ((now+5) > con->next_period) {
-		con->next_period = now + RATE_LIMIT_PERIOD;
-		if (con->event_count >= RATE_LIMIT_ALLOWANCE)
+		console_new_period(con, now);
+		con->throttled = false;
+
+		/* Pick up what the byte allowance left in the ring. */
+		if (con->interface && buffer_available(con))
+			buffer_append(con);
+
+		if (console_over_allowance(con))
+			console_throttle(con);
+		else
 			(void)xenevtchn_unmask(con->xce_handle, con->local_port);
-		con->event_count = 0;
-	}
+
+		console_update_watches(con);
+	} else
+		console_throttle(con);
 }
 
 static void handle_ring_read(struct console *con)
 {
 	xenevtchn_port_or_error_t port;
+	long long now;
 
 	if (con->d->is_dead)
 		return;
@@ -1105,27 +1390,44 @@ static void handle_ring_read(struct console *con)
 		return;
 	}
 
+	now = now_ms();
+	if ((now+5) > con->next_period)
+		console_new_period(con, now);
+
 	con->event_count++;
 
 	buffer_append(con);
 
-	if (con->event_count < RATE_LIMIT_ALLOWANCE)
+	if (console_over_allowance(con))
+		console_throttle(con);
+	else
 		(void)xenevtchn_unmask(con->xce_handle, port);
 }
 
-static void handle_console_ring(struct console *con)
+static void handle_console_ring(struct watch *w, short revents)
+{
+	struct console *con = w->data;
+
+	if (!(revents & ~(POLLIN|POLLOUT|POLLPRI)) && (revents & POLLIN))
+		handle_ring_read(con);
+
+	console_update_watches(con);
+}
+
+static void handle_console_tty(struct watch *w, short revents)
 {
-	if (con->event_count < RATE_LIMIT_ALLOWANCE) {
-		if (con->xce_handle != NULL &&
-		    con->xce_pollfd_idx != -1 &&
-		    !(fds[con->xce_pollfd_idx].revents &
-		      ~(POLLIN|POLLOUT|POLLPRI)) &&
-		    (fds[con->xce_pollfd_idx].revents &
-		     POLLIN))
-			handle_ring_read(con);
+	struct console *con = w->data;
+
+	if (revents & ~(POLLIN|POLLOUT|POLLPRI))
+		console_handle_broken_tty(con, domain_is_valid(con->d->domid));
+	else {
+		if (revents & POLLIN)
+			handle_tty_read(con);
+		if (revents & POLLOUT)
+			handle_tty_write(con);
 	}
 
-	con->xce_pollfd_idx = -1;
+	console_update_watches(con);
 }
 
 static void handle_xs(void)
@@ -1165,34 +1467,47 @@ static void handle_hv_logs(xenevtchn_handle *xce_handle, bool force)
 
 	do
 	{
-		int logret;
-
 		size = sizeof(buffer);
 		if (xc_readconsolering(xc, bufptr, &size, 0, 1, &index) != 0 ||
 		    size == 0)
 			break;
 
-		if (log_time_hv)
-			logret = write_with_timestamp(log_hv_fd, buffer, size,
-						      &log_time_hv_needts);
-		else
-			logret = write_all(log_hv_fd, buffer, size);
-
-		if (logret < 0)
-			dolog(LOG_ERR, "Failed to write hypervisor log: "
-				       "%d (%s)", errno, strerror(errno));
+		if (log_hv_file)
+			logfile_append(log_hv_file, buffer, size);
 	} while (size == sizeof(buffer));
 
 	if (port != -1)
 		(void)xenevtchn_unmask(xce_handle, port);
 }
 
+/* Set on a failure of the xenstore or hypervisor log fd. */
+static bool io_failed;
+
+static void handle_xs_watch(struct watch *w, short revents)
+{
+	if (revents & ~(POLLIN|POLLOUT|POLLPRI)) {
+		dolog(LOG_ERR, "Failure in poll xs_handle: %d (%s)",
+		      errno, strerror(errno));
+		io_failed = true;
+	} else if (revents & POLLIN)
+		handle_xs();
+}
+
+static void handle_hv_watch(struct watch *w, short revents)
+{
+	if (revents & ~(POLLIN|POLLOUT|POLLPRI)) {
+		dolog(LOG_ERR, "Failure in poll xce_handle: %d (%s)",
+		      errno, strerror(errno));
+		io_failed = true;
+	} else if (revents & POLLIN)
+		handle_hv_logs(w->data, false);
+}
+
 static void console_open_log(struct console *con)
 {
 	if (console_enabled(con)) {
-		if (con->log_fd != -1)
-			close(con->log_fd);
-		con->log_fd = create_console_log(con);
+		logfile_close(con->log);
+		con->log = create_console_log(con);
 	}
 }
 
@@ -1206,114 +1521,25 @@ static void handle_log_reload(void)
 	}
 
 	if (log_hv) {
-		if (log_hv_fd != -1)
-			close(log_hv_fd);
-		log_hv_fd = create_hv_log();
-	}
-}
-
-/* Returns index inside fds array if succees, -1 if fail */
-static int set_fds(int fd, short events)
-{
-	int ret;
-	if (current_array_size < nr_fds + 1) {
-		struct pollfd  *new_fds = NULL;
-		unsigned long newsize;
-
-		/* Round up to 2^8 boundary, in practice this just
-		 * make newsize larger than current_array_size.
-		 */
-		newsize = ROUNDUP(nr_fds + 1, 8);
-
-		new_fds = realloc(fds, sizeof(struct pollfd)*newsize);
-		if (!new_fds)
-			goto fail;
-		fds = new_fds;
-
-		memset(&fds[0] + current_array_size, 0,
-		       sizeof(struct pollfd) * (newsize-current_array_size));
-		current_array_size = newsize;
-	}
-
-	fds[nr_fds].fd = fd;
-	fds[nr_fds].events = events;
-	ret = nr_fds;
-	nr_fds++;
-
-	return ret;
-fail:
-	dolog(LOG_ERR, "realloc failed, ignoring fd %d\n", fd);
-	return -1;
-}
-
-static void reset_fds(void)
-{
-	nr_fds = 0;
-	if (fds)
-		memset(fds, 0, sizeof(struct pollfd) * current_array_size);
-}
-
-static void maybe_add_console_evtchn_fd(struct console *con, void *data)
-{
-	long long next_timeout = *((long long *)data);
-
-	if (con->event_count >= RATE_LIMIT_ALLOWANCE) {
-		/* Determine if we're going to be the next time slice to expire */
-		if (!next_timeout ||
-		    con->next_period < next_timeout)
-			next_timeout = con->next_period;
-	} else if (con->xce_handle != NULL) {
-		if (buffer_available(con)) {
-			int evtchn_fd = xenevtchn_fd(con->xce_handle);
-			con->xce_pollfd_idx = set_fds(evtchn_fd,
-						      POLLIN|POLLPRI);
-		}
+		logfile_close(log_hv_file);
+		log_hv_file = create_hv_log();
 	}
-
-	*((long long *)data) = next_timeout;
-}
-
-static void maybe_add_console_tty_fd(struct console *con)
-{
-	if (con->master_fd != -1) {
-		short events = 0;
-		if (!con->d->is_dead && ring_free_bytes(con))
-			events |= POLLIN;
-
-		if (!buffer_empty(&con->buffer))
-			events |= POLLOUT;
-
-		if (events)
-			con->master_pollfd_idx =
-				set_fds(con->master_fd, events|POLLPRI);
-	}
-}
-
-static void handle_console_tty(struct console *con)
-{
-	if (con->master_fd != -1 && con->master_pollfd_idx != -1) {
-		if (fds[con->master_pollfd_idx].revents &
-		    ~(POLLIN|POLLOUT|POLLPRI))
-			console_handle_broken_tty(con, domain_is_valid(con->d->domid));
-		else {
-			if (fds[con->master_pollfd_idx].revents &
-			    POLLIN)
-				handle_tty_read(con);
-			if (fds[con->master_pollfd_idx].revents &
-			    POLLOUT)
-				handle_tty_write(con);
-		}
-	}
-	con->master_pollfd_idx = -1;
 }
 
 void handle_io(void)
 {
 	int ret;
 	xenevtchn_port_or_error_t log_hv_evtchn = -1;
-	int xce_pollfd_idx = -1;
-	int xs_pollfd_idx = -1;
 	xenevtchn_handle *xce_handle = NULL;
+	struct watch xs_watch, hv_watch;
+
+	if (watch_open()) {
+		dolog(LOG_ERR, "Failed to set up polling: %d (%s)",
+		      errno, strerror(errno));
+		return;
+	}
+	watch_init(&xs_watch, handle_xs_watch, NULL);
+	watch_init(&hv_watch, handle_hv_watch, NULL);
 
 	if (log_hv) {
 		xce_handle = xenevtchn_open(NULL, 0);
@@ -1322,8 +1548,8 @@ void handle_io(void)
 			      errno, strerror(errno));
 			goto out;
 		}
-		log_hv_fd = create_hv_log();
-		if (log_hv_fd == -1)
+		log_hv_file = create_hv_log();
+		if (log_hv_file == NULL)
 			goto out;
 		log_hv_evtchn = xenevtchn_bind_virq(xce_handle, VIRQ_CON_RING);
 		if (log_hv_evtchn == -1) {
@@ -1333,6 +1559,9 @@ void handle_io(void)
 		}
 		/* Log the boot dmesg even if VIRQ_CON_RING isn't pending. */
 		handle_hv_logs(xce_handle, true);
+
+		hv_watch.data = xce_handle;
+		watch_set(&hv_watch, xenevtchn_fd(xce_handle), POLLIN|POLLPRI);
 	}
 
 	xgt_handle = xengnttab_open(NULL, 0);
@@ -1341,40 +1570,35 @@ void handle_io(void)
 		      errno, strerror(errno));
 	}
 
+	watch_set(&xs_watch, xs_fileno(xs), POLLIN|POLLPRI);
+
 	enum_domains();
 
 	for (;;) {
 		struct domain *d, *n;
-		int poll_timeout; /* timeout in milliseconds */
-		struct timespec ts;
-		long long now, next_timeout = 0;
-
-		reset_fds();
-
-		xs_pollfd_idx = set_fds(xs_fileno(xs), POLLIN|POLLPRI);
-
-		if (log_hv)
-			xce_pollfd_idx = set_fds(xenevtchn_fd(xce_handle),
-						 POLLIN|POLLPRI);
+		int poll_timeout = -1; /* timeout in milliseconds */
+		long long now, next_timeout, next_flush;
 
-		if (clock_gettime(CLOCK_MONOTONIC, &ts) < 0)
+		now = now_ms();
+		if (now < 0)
 			break;
-		now = ((long long)ts.tv_sec * 1000) + (ts.tv_nsec / 1000000);
 
-		/* Re-calculate any event counter allowances & unblock
-		   domains with new allowance */
-		for (d = dom_head; d; d = d->next) {
-
-			console_iter_void_arg2(d, console_evtchn_unmask, (void *)&now);
-
-			console_iter_void_arg2(d, maybe_add_console_evtchn_fd, 
-					       (void *)&next_timeout);
-
-			console_iter_void_arg1(d, maybe_add_console_tty_fd);
+		/* Give throttled consoles whose period is over a new
+		   allowance */
+		if (next_unthrottle && (now+5) > next_unthrottle) {
+			next_unthrottle = 0;
+			for (d = dom_head; d; d = d->next)
+				console_iter_void_arg2(d, console_evtchn_unmask,
+						       (void *)&now);
 		}
 
-		/* If any domain has been rate limited, we need to work
-		   out what timeout to supply to poll */
+		/* Wake up for the next throttled console or log write,
+		   whichever is due first */
+		next_timeout = next_unthrottle;
+		next_flush = logfile_flush_due(now);
+		if (next_flush && (!next_timeout || next_flush < next_timeout))
+			next_timeout = next_flush;
+
 		if (next_timeout) {
 			long long duration = (next_timeout - now);
 			if (duration <= 0) /* sanity check */
@@ -1382,7 +1606,7 @@ void handle_io(void)
 			poll_timeout = (int)duration;
 		}
 
-		ret = poll(fds, nr_fds, next_timeout ? poll_timeout : -1);
+		ret = watch_wait(poll_timeout);
 
 		if (log_reload) {
 			int saved_errno = errno;
@@ -1393,6 +1617,9 @@ void handle_io(void)
 			errno = saved_errno;
 		}
 
+		if (terminate)
+			break;
+
 		/* Abort if poll failed, except for EINTR cases
 		   which indicate a possible log reload */
 		if (ret == -1) {
@@ -1403,57 +1630,25 @@ void handle_io(void)
 			break;
 		}
 
-		if (log_hv && xce_pollfd_idx != -1) {
-			if (fds[xce_pollfd_idx].revents & ~(POLLIN|POLLOUT|POLLPRI)) {
-				dolog(LOG_ERR,
-				      "Failure in poll xce_handle: %d (%s)",
-				      errno, strerror(errno));
-				break;
-			} else if (fds[xce_pollfd_idx].revents & POLLIN)
-				handle_hv_logs(xce_handle, false);
-
-			xce_pollfd_idx = -1;
-		}
-
-		if (ret <= 0)
-			continue;
-
-		if (xs_pollfd_idx != -1) {
-			if (fds[xs_pollfd_idx].revents & ~(POLLIN|POLLOUT|POLLPRI)) {
-				dolog(LOG_ERR,
-				      "Failure in poll xs_handle: %d (%s)",
-				      errno, strerror(errno));
-				break;
-			} else if (fds[xs_pollfd_idx].revents & POLLIN)
-				handle_xs();
-
-			xs_pollfd_idx = -1;
-		}
-
-		for (d = dom_head; d; d = n) {
-
-			n = d->next;
-
-			console_iter_void_arg1(d, handle_console_ring);
-
-			console_iter_void_arg1(d, handle_console_tty);
-
-			if (d->last_seen != enum_pass)
-				shutdown_domain(d);
+		if (io_failed)
+			break;
 
-			if (d->is_dead)
-				cleanup_domain(d);
+		if (dead_domains) {
+			dead_domains = false;
+			for (d = dom_head; d; d = n) {
+				n = d->next;
+				if (d->is_dead)
+					cleanup_domain(d);
+			}
 		}
 	}
 
-	free(fds);
-	current_array_size = 0;
-
  out:
-	if (log_hv_fd != -1) {
-		close(log_hv_fd);
-		log_hv_fd = -1;
-	}
+	logfile_flush_all();
+	logfile_close(log_hv_file);
+	log_hv_file = NULL;
+	watch_set(&xs_watch, -1, 0);
+	watch_set(&hv_watch, -1, 0);
 	if (xce_handle != NULL) {
 		xenevtchn_close(xce_handle);
 		xce_handle = NULL;
@@ -1463,6 +1658,7 @@ void handle_io(void)
 		xgt_handle = NULL;
 	}
 	log_hv_evtchn = -1;
+	watch_close();
 }
 
 /*
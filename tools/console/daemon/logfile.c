@@ -0,0 +1,354 @@
+/*
+ *  Xen Console Daemon
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; under version 2 of the License.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define _GNU_SOURCE
+
+#include "utils.h"
+#include "logfile.h"
+
+#include <stdlib.h>
+#include <errno.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <zlib.h>
+
+#define LOG_BUFFER_SIZE (64 * 1024)
+
+extern int replace_escape;
+extern unsigned int log_flush_ms;
+extern unsigned long long log_max_size;
+extern unsigned int log_rotate;
+extern int log_compress;
+
+struct logfile {
+	char *path;		/* Without the ".gz" of compressed logs. */
+	int fd;
+	gzFile gz;
+	unsigned long long size;	/* Uncompressed bytes written so far. */
+	bool timestamps;
+	bool needts;
+	char *buf;
+	size_t len;
+	long long due;		/* When buf is to be written out at the latest. */
+	struct logfile *prev, *next;	/* In the dirty list, while len != 0. */
+};
+
+/*
+ * Logs with data buffered, in the order they got it.  As all of them get
+ * the same delay, this is also the order in which they are due.
+ */
+static struct logfile *dirty_head, *dirty_tail;
+
+static long long now_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ((long long)ts.tv_sec * 1000) + (ts.tv_nsec / 1000000);
+}
+
+static void dirty_add(struct logfile *log)
+{
+	log->due = now_ms() + log_flush_ms;
+	log->prev = dirty_tail;
+	log->next = NULL;
+	if (dirty_tail)
+		dirty_tail->next = log;
+	else
+		dirty_head = log;
+	dirty_tail = log;
+}
+
+static void dirty_del(struct logfile *log)
+{
+	if (log->prev)
+		log->prev->next = log->next;
+	else
+		dirty_head = log->next;
+	if (log->next)
+		log->next->prev = log->prev;
+	else
+		dirty_tail = log->prev;
+	log->prev = log->next = NULL;
+}
+
+static int write_all(int fd, const char *buf, size_t len)
+{
+	while (len) {
+		ssize_t ret = write(fd, buf, len);
+
+		if (ret == -1 && errno == EINTR)
+			continue;
+		if (ret <= 0)
+			return -1;
+		len -= ret;
+		buf += ret;
+	}
+
+	return 0;
+}
+
+static int open_file(struct logfile *log)
+{
+	char *gzpath = NULL;
+	const char *path = log->path;
+	struct stat st;
+
+	if (log_compress) {
+		if (asprintf(&gzpath, "%s.gz", log->path) == -1)
+			return -1;
+		path = gzpath;
+	}
+
+	log->fd = open(path, O_WRONLY|O_CREAT|O_APPEND, 0644);
+	if (log->fd == -1) {
+		dolog(LOG_ERR, "Failed to open log %s: %d (%s)",
+		      path, errno, strerror(errno));
+		free(gzpath);
+		return -1;
+	}
+
+	/* Compressed logs only approximate the size to rotate them at. */
+	log->size = fstat(log->fd, &st) ? 0 : st.st_size;
+
+	if (log_compress) {
+		/* Appending adds a gzip member, which gunzip handles fine. */
+		log->gz = gzdopen(log->fd, "ab");
+		if (log->gz == NULL) {
+			dolog(LOG_ERR, "Failed to open log %s: %d (%s)",
+			      path, errno, strerror(errno));
+			close(log->fd);
+			log->fd = -1;
+			free(gzpath);
+			return -1;
+		}
+	}
+
+	free(gzpath);
+	return 0;
+}
+
+static void close_file(struct logfile *log)
+{
+	if (log->gz)
+		gzclose(log->gz);
+	else if (log->fd != -1)
+		close(log->fd);
+	log->gz = NULL;
+	log->fd = -1;
+}
+
+/* Renames path to path.1, path.1 to path.2 etc, keeping log_rotate. */
+static void rotate_file(struct logfile *log)
+{
+	const char *ext = log_compress ? ".gz" : "";
+	char *from, *to;
+	unsigned int i;
+
+	close_file(log);
+
+	if (!log_rotate) {
+		if (asprintf(&from, "%s%s", log->path, ext) != -1) {
+			unlink(from);
+			free(from);
+		}
+	}
+
+	for (i = log_rotate; i > 0; i--) {
+		if (asprintf(&to, "%s.%u%s", log->path, i, ext) == -1)
+			break;
+		if ((i > 1 ? asprintf(&from, "%s.%u%s", log->path, i - 1, ext)
+			   : asprintf(&from, "%s%s", log->path, ext)) == -1) {
+			free(to);
+			break;
+		}
+		if (rename(from, to) == -1 && errno != ENOENT)
+			dolog(LOG_ERR, "Failed to rotate log %s: %d (%s)",
+			      from, errno, strerror(errno));
+		free(from);
+		free(to);
+	}
+
+	open_file(log);
+}
+
+static void logfile_write(struct logfile *log)
+{
+	int ret;
+
+	if (!log->len)
+		return;
+
+	dirty_del(log);
+
+	if (log_max_size && log->size &&
+	    log->size + log->len > log_max_size)
+		rotate_file(log);
+
+	if (log->gz)
+		ret = (gzwrite(log->gz, log->buf, log->len) == (int)log->len &&
+		       gzflush(log->gz, Z_SYNC_FLUSH) == Z_OK) ? 0 : -1;
+	else if (log->fd != -1)
+		ret = write_all(log->fd, log->buf, log->len);
+	else
+		ret = 0;
+
+	if (ret < 0)
+		dolog(LOG_ERR, "Write to log %s failed: %d (%s)",
+		      log->path, errno, strerror(errno));
+	else
+		log->size += log->len;
+
+	log->len = 0;
+}
+
+static void put(struct logfile *log, const char *data, size_t len)
+{
+	while (len) {
+		size_t i, n = LOG_BUFFER_SIZE - log->len;
+		char *dest = log->buf + log->len;
+
+		if (n > len)
+			n = len;
+
+		if (!log->len)
+			dirty_add(log);
+
+		if (replace_escape) {
+			for (i = 0; i < n; i++)
+				dest[i] = data[i] == '\033' ? '.' : data[i];
+		} else
+			memcpy(dest, data, n);
+
+		log->len += n;
+		data += n;
+		len -= n;
+
+		if (log->len == LOG_BUFFER_SIZE)
+			logfile_write(log);
+	}
+}
+
+void logfile_append(struct logfile *log, const char *data, size_t sz)
+{
+	char ts[32];
+	size_t tslen = 0;
+	const char *last_byte = data + sz - 1;
+
+	if (!sz)
+		return;
+
+	if (!log->timestamps) {
+		put(log, data, sz);
+		goto out;
+	}
+
+	while (data <= last_byte) {
+		const char *nl = memchr(data, '\n', last_byte + 1 - data);
+		bool found_nl = (nl != NULL);
+		if (!found_nl)
+			nl = last_byte;
+
+		if (log->needts) {
+			if (!tslen) {
+				time_t now = time(NULL);
+
+				tslen = strftime(ts, sizeof(ts),
+						 "[%Y-%m-%d %H:%M:%S] ",
+						 localtime(&now));
+			}
+			put(log, ts, tslen);
+		}
+		put(log, data, nl + 1 - data);
+
+		log->needts = found_nl;
+		data = nl + 1;
+		if (found_nl) {
+			// If we printed a newline, strip all \r following it
+			while (data <= last_byte && *data == '\r')
+				data++;
+		}
+	}
+
+ out:
+	if (!log_flush_ms)
+		logfile_write(log);
+}
+
+struct logfile *logfile_open(const char *path, bool timestamps)
+{
+	struct logfile *log = calloc(1, sizeof(*log));
+
+	if (log == NULL)
+		return NULL;
+
+	log->fd = -1;
+	log->timestamps = timestamps;
+	log->needts = true;
+	log->path = strdup(path);
+	log->buf = malloc(LOG_BUFFER_SIZE);
+	if (log->path == NULL || log->buf == NULL || open_file(log)) {
+		free(log->buf);
+		free(log->path);
+		free(log);
+		return NULL;
+	}
+
+	if (timestamps)
+		logfile_append(log, "Logfile Opened\n",
+			       strlen("Logfile Opened\n"));
+
+	return log;
+}
+
+void logfile_close(struct logfile *log)
+{
+	if (log == NULL)
+		return;
+
+	logfile_write(log);
+	close_file(log);
+	free(log->buf);
+	free(log->path);
+	free(log);
+}
+
+long long logfile_flush_due(long long now)
+{
+	while (dirty_head && dirty_head->due <= now)
+		logfile_write(dirty_head);
+
+	return dirty_head ? dirty_head->due : 0;
+}
+
+void logfile_flush_all(void)
+{
+	while (dirty_head)
+		logfile_write(dirty_head);
+}
+
+/*
+ * Local variables:
+ *  mode: C
+ *  c-file-style: "linux"
+ *  indent-tabs-mode: t
+ *  c-basic-offset: 8
+ *  tab-width: 8
+ * End:
+ */
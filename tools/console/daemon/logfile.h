@@ -0,0 +1,44 @@
+/*
+ *  Xen Console Daemon
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; under version 2 of the License.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef CONSOLED_LOGFILE_H
+#define CONSOLED_LOGFILE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/*
+ * A console log.  What is appended to it is buffered, and written out
+ * once the buffer is full or, at the latest, log_flush_ms after it was
+ * first buffered.  Logs may be gzip compressed and rotated once they
+ * reach log_max_size bytes.
+ */
+struct logfile;
+
+/* Opens (or creates) path, with ".gz" appended if logs are compressed. */
+struct logfile *logfile_open(const char *path, bool timestamps);
+/* Writes out what is buffered and closes the log. */
+void logfile_close(struct logfile *log);
+void logfile_append(struct logfile *log, const char *data, size_t len);
+
+/*
+ * Writes out the logs whose data is due by now (in ms of CLOCK_MONOTONIC).
+ * Returns when the next one is due, or 0 if nothing is buffered.
+ */
+long long logfile_flush_due(long long now);
+void logfile_flush_all(void);
+
+#endif
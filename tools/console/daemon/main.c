@@ -41,16 +41,32 @@ int log_time_guest = 0;
 char *log_dir = NULL;
 int discard_overflowed_data = 1;
 int replace_escape = 0;
+unsigned int rate_limit = 0;
+unsigned int log_flush_ms = 1000;
+unsigned long long log_max_size = 0;
+unsigned int log_rotate = 5;
+int log_compress = 0;
+int terminate = 0;
 
 static void handle_hup(int sig)
 {
         log_reload = 1;
 }
 
+static void handle_term(int sig)
+{
+	terminate = 1;
+}
+
 static void usage(char *name)
 {
-	printf("Usage: %s [-h] [-V] [-v] [-i] [--log=none|guest|hv|all] [--log-dir=DIR] [--pid-file=PATH] [-t, --timestamp=none|guest|hv|all] [-o, --overflow-data=discard|keep] [--replace-escape]\n", name);
+	printf("Usage: %s [-h] [-V] [-v] [-i] [--log=none|guest|hv|all] [--log-dir=DIR] [--pid-file=PATH] [-t, --timestamp=none|guest|hv|all] [-o, --overflow-data=discard|keep] [--replace-escape] [--rate-limit=BYTES] [--log-flush=MS] [--log-max-size=BYTES] [--log-rotate=N] [--log-compress]\n", name);
 	printf("  --replace-escape  - replace ESC character with dot when writing console log\n");
+	printf("  --rate-limit      - bytes per second each console may output (default unlimited); a lower value in its rate-limit xenstore node takes precedence\n");
+	printf("  --log-flush       - write buffered console log data at the latest after MS milliseconds (default 1000, 0 to write unbuffered)\n");
+	printf("  --log-max-size    - rotate console logs once they reach BYTES (default 0, never)\n");
+	printf("  --log-rotate      - number of rotated console logs to keep (default 5)\n");
+	printf("  --log-compress    - gzip console logs\n");
 }
 
 static void version(char *name)
@@ -107,6 +123,11 @@ int main(int argc, char **argv)
 		{ "timestamp", 1, 0, 't' },
 		{ "overflow-data", 1, 0, 'o'},
 		{ "replace-escape", 0, 0, 'e'},
+		{ "rate-limit", 1, 0, 'R'},
+		{ "log-flush", 1, 0, 'F'},
+		{ "log-max-size", 1, 0, 'M'},
+		{ "log-rotate", 1, 0, 'N'},
+		{ "log-compress", 0, 0, 'z'},
 		{ 0 },
 	};
 	bool is_interactive = false;
@@ -174,6 +195,21 @@ int main(int argc, char **argv)
 		case 'e':
 			replace_escape = 1;
 			break;
+		case 'R':
+			rate_limit = strtoul(optarg, NULL, 0);
+			break;
+		case 'F':
+			log_flush_ms = strtoul(optarg, NULL, 0);
+			break;
+		case 'M':
+			log_max_size = strtoull(optarg, NULL, 0);
+			break;
+		case 'N':
+			log_rotate = strtoul(optarg, NULL, 0);
+			break;
+		case 'z':
+			log_compress = 1;
+			break;
 		case '?':
 			fprintf(stderr,
 				"Try `%s --help' for more information\n",
@@ -192,6 +228,9 @@ int main(int argc, char **argv)
 	}
 
 	signal(SIGHUP, handle_hup);
+	/* Write out the buffered logs before exiting. */
+	signal(SIGTERM, handle_term);
+	signal(SIGINT, handle_term);
 
 	openlog("xenconsoled", syslog_option, LOG_DAEMON);
 	setlogmask(syslog_mask);
@@ -51,6 +51,9 @@
 /* Callers who don't care don't need to #include <xentoollog.h> */
 struct xentoollog_logger;
 
+/* Bulk transfer state, private to the library */
+struct libxenvchan_bulk;
+
 struct libxenvchan_ring {
 	/* Pointer into the shared page. Offsets into buffer. */
 	struct ring_shared* shr;
@@ -86,6 +89,16 @@ struct libxenvchan {
 	int blocking:1;
 	/* communication rings */
 	struct libxenvchan_ring read, write;
+	/* the peer domain */
+	int domain;
+	/**
+	 * How long (in microseconds) blocking operations poll the ring before
+	 * asking the peer for a notification and waiting for it.  While both
+	 * ends keep up with each other, no events need to be sent at all.
+	 */
+	unsigned int busy_poll_us;
+	/* set up by the first bulk operation */
+	struct libxenvchan_bulk *bulk;
 };
 
 /**
@@ -174,3 +187,66 @@ int libxenvchan_is_open(struct libxenvchan* ctrl);
 int libxenvchan_data_ready(struct libxenvchan *ctrl);
 /** Amount of data it is possible to send without blocking */
 int libxenvchan_buffer_space(struct libxenvchan *ctrl);
+
+/*
+ * Bulk transfers.  Rather than copying data through the ring, the sender
+ * grants the peer access to the pages holding it, and passes their grant
+ * references through the ring.  The receiver copies the data with a single
+ * grant copy, or maps the pages.  Both ends must use the bulk functions for
+ * the messages they exchange this way, which are framed in the ring
+ * (see struct vchan_bulk_msg).
+ */
+
+/**
+ * Allocate a buffer granted to the peer, to send bulk data from.
+ * @param ctrl The vchan control structure
+ * @param size Size of the buffer, which gets rounded up to whole pages
+ * @return The buffer, or NULL in case of an error
+ */
+void *libxenvchan_bulk_alloc(struct libxenvchan *ctrl, size_t size);
+/**
+ * Free a buffer from libxenvchan_bulk_alloc(), revoking the peer's access.
+ */
+void libxenvchan_bulk_free(struct libxenvchan *ctrl, void *buf);
+/**
+ * Whether the peer may still be reading from a buffer of
+ * libxenvchan_bulk_alloc(), which must not be changed meanwhile.  Like
+ * libxenvchan_buffer_space(), requests a notification when this changes.
+ * @return 1 if the buffer is still in use, 0 otherwise
+ */
+int libxenvchan_bulk_busy(struct libxenvchan *ctrl, const void *buf);
+/**
+ * Bulk send: send one message.  Data within a buffer of
+ * libxenvchan_bulk_alloc() is passed by grant reference, other data is copied
+ * through the ring.
+ * @param ctrl The vchan control structure
+ * @param data Data to send
+ * @param size Size of the data
+ * @return -1 on error, 0 if nonblocking and insufficient space is available, or $size
+ */
+int libxenvchan_send_bulk(struct libxenvchan *ctrl, const void *data, size_t size);
+/**
+ * Bulk receive: receive one message sent with libxenvchan_send_bulk(),
+ * copying it into the buffer.
+ * @param ctrl The vchan control structure
+ * @param data Buffer for the message
+ * @param size Size of the buffer, which must fit the message
+ * @return -1 on error, 0 if nonblocking and no message is available, or the
+ *         size of the message
+ */
+int libxenvchan_recv_bulk(struct libxenvchan *ctrl, void *data, size_t size);
+/**
+ * Zero-copy bulk receive: map the pages of the next message read-only.
+ * The message stays in the ring, and its pages mapped, until released with
+ * libxenvchan_bulk_release(), which has to be done before receiving anything
+ * else.
+ * @param ctrl The vchan control structure
+ * @param data Set to the message
+ * @return -1 on error, 0 if nonblocking and no message is available, or the
+ *         size of the message
+ */
+int libxenvchan_recv_bulk_map(struct libxenvchan *ctrl, const void **data);
+/**
+ * Release the message of libxenvchan_recv_bulk_map(), consuming it.
+ */
+int libxenvchan_bulk_release(struct libxenvchan *ctrl);
@@ -1361,6 +1361,13 @@ void libxl_mac_copy(libxl_ctx *ctx, libxl_mac *dst, const libxl_mac *src);
  */
 #define LIBXL_HAVE_CREATEINFO_XEND_SUSPEND_EVTCHN_COMPAT
 
+/*
+ * LIBXL_HAVE_DOMAIN_CREATE_FROM_TEMPLATE
+ *
+ * If this is defined, libxl_domain_create_from_template() is available.
+ */
+#define LIBXL_HAVE_DOMAIN_CREATE_FROM_TEMPLATE 1
+
 typedef char **libxl_string_list;
 void libxl_string_list_dispose(libxl_string_list *sl);
 int libxl_string_list_length(const libxl_string_list *sl);
@@ -1627,6 +1634,13 @@ int libxl_ctx_free(libxl_ctx *ctx /* 0 is OK */);
  * (in a half-created state).  *domid will be valid and will be the
  * domain id, or INVALID_DOMID, as appropriate */
 
+/* Any number of domains may be being created at once, asynchronously
+ * from the same ctx or from several ctxs and processes: libxl only
+ * serialises checking the uuid, making the domain and NUMA placement,
+ * including claiming its memory (if claim_mode is set).  Creating a domain
+ * with the uuid of an existing one which isn't dying fails, with
+ * ERROR_INVAL, unless it is being restored or migrated in. */
+
 int libxl_domain_create_new(libxl_ctx *ctx, libxl_domain_config *d_config,
                             uint32_t *domid,
                             const libxl_asyncop_how *ao_how,
@@ -1690,6 +1704,23 @@ int libxl_domain_soft_reset(libxl_ctx *ctx,
                             *aop_console_how)
                             LIBXL_EXTERNAL_CALLERS_ONLY;
 
+/* Creates a domain as a copy-on-write fork of template_domid, a PVH domain
+ * which was built paused and has never been unpaused.  Nothing is loaded
+ * or built: the new domain starts off with the template's memory and vCPU
+ * state, and gets its own xenstore and console rings, devices and so on
+ * from d_config, which must describe a PVH domain with as many vCPUs and
+ * as much memory as the template.  The template is kept paused by the
+ * hypervisor for as long as any domain created from it exists.
+ * Requires HAP and memory sharing support in the hypervisor. */
+int libxl_domain_create_from_template(libxl_ctx *ctx,
+                                      libxl_domain_config *d_config,
+                                      uint32_t *domid,
+                                      uint32_t template_domid,
+                                      const libxl_asyncop_how *ao_how,
+                                      const libxl_asyncprogress_how
+                                      *aop_console_how)
+                                      LIBXL_EXTERNAL_CALLERS_ONLY;
+
   /* A progress report will be made via ao_console_how, of type
    * domain_create_console_available, when the domain's primary
    * console is available and can be connected to.
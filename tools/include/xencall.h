@@ -33,6 +33,13 @@ typedef struct xencall_handle xencall_handle;
 /*
  */
 #define XENCALL_OPENFLAG_NON_REENTRANT (1U<<0)
+/*
+ * Back the pool of hypercall buffers with huge pages, where they can be
+ * had (not with Linux' hypercall buffer device, whose pages are allocated
+ * by the kernel).  Setting XENCALL_HUGEPAGES=1 in the environment has the
+ * same effect for all handles.
+ */
+#define XENCALL_OPENFLAG_HUGEPAGES     (1U<<1)
 
 /*
  * Return a handle onto the hypercall driver.  Logs errors.
@@ -127,6 +134,30 @@ void xencall_free_buffer_pages(xencall_handle *xcall, void *p, size_t nr_pages);
 void *xencall_alloc_buffer(xencall_handle *xcall, size_t size);
 void xencall_free_buffer(xencall_handle *xcall, void *p);
 
+/*
+ * Statistics of the hypercall buffer pool.  Buffers of up to 16 pages come
+ * from the pool, which only ever grows by allocating arenas; larger ones
+ * are allocated and freed individually ("toobig").  Allocations served by
+ * other threads' caches are only counted once those threads next allocate
+ * or free a buffer without them.
+ */
+struct xencall_buffer_stats {
+    uint64_t allocations;
+    uint64_t releases;
+    uint64_t current;
+    uint64_t maximum;
+    uint64_t pool_hits;
+    uint64_t thread_cache_hits; /* Pool hits which took no lock. */
+    uint64_t pool_misses;       /* Allocations which carved up arenas. */
+    uint64_t toobig;
+    uint64_t arenas;
+    uint64_t huge_arenas;
+    uint64_t arena_bytes;
+};
+
+void xencall_get_buffer_stats(xencall_handle *xcall,
+                              struct xencall_buffer_stats *stats);
+
 /*
  * Are allocated hypercall buffers safe to be accessed by the hypervisor all
  * the time?
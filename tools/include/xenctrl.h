@@ -871,6 +871,26 @@ int xc_vcpu_getinfo(xc_interface *xch,
                     uint32_t vcpu,
                     xc_vcpuinfo_t *info);
 
+typedef struct xen_sysctl_vcpuinfo xc_vcpuinfo_list_t;
+/**
+ * This function gets the runstate of the vCPUs of domains from
+ * *first_domain on (from vCPU *first_vcpu on, in that domain), with as
+ * few hypercalls as the size of the buffer and preemption allow.
+ *
+ * @parm xch a handle to an open hypervisor interface
+ * @parm first_domain IN: the first domain; OUT: the domain to continue
+ *                    from, or DOMID_INVALID once all have been reported
+ * @parm first_vcpu IN/OUT: the vCPU of *first_domain to start/continue at
+ * @parm max_vcpus the number of entries info can hold
+ * @parm info buffer for the vCPUs' runstates, by domain and vCPU id
+ * @return the number of entries filled in, or -1 on failure
+ */
+int xc_vcpu_getinfolist(xc_interface *xch,
+                        uint32_t *first_domain,
+                        unsigned int *first_vcpu,
+                        unsigned int max_vcpus,
+                        xc_vcpuinfo_list_t *info);
+
 long long xc_domain_get_cpu_usage(xc_interface *xch,
                                   uint32_t domid,
                                   int vcpu);
@@ -1521,6 +1541,18 @@ int xc_tbuf_set_cpu_mask(xc_interface *xch, xc_cpumap_t mask);
 
 int xc_tbuf_set_evt_mask(xc_interface *xch, uint32_t mask);
 
+/**
+ * Flight recorder control.  @mode is a combination of the
+ * XEN_SYSCTL_TBUF_MODE_* flags; 0 selects normal streaming.  The buffers
+ * may only be consumed in flight recorder mode once frozen.
+ *
+ * @return 0 on success, -1 on failure.
+ */
+int xc_tbuf_set_mode(xc_interface *xch, uint32_t mode);
+int xc_tbuf_get_mode(xc_interface *xch, uint32_t *mode);
+int xc_tbuf_freeze(xc_interface *xch);
+int xc_tbuf_thaw(xc_interface *xch);
+
 /**
  * Enable vmtrace for given vCPU.
  *
@@ -2291,6 +2323,40 @@ int xc_memshr_fork(xc_interface *xch,
  */
 int xc_memshr_fork_reset(xc_interface *xch, uint32_t forked_domain);
 
+/*
+ * Forks each of the nr domains in domids off source_domain in one go.  The
+ * pages at the nr_hot gfns in hot_gfns are populated in each fork right
+ * away rather than on their first access: shared with the parent, or
+ * copied if hot_private is set.  allow_with_iommu and block_interrupts are
+ * as for xc_memshr_fork.  Some forks may have been made when this
+ * fails: *nr_done (if not NULL) tells how many.
+ *
+ * Note that resetting a fork with xc_memshr_fork_reset only takes as long as
+ * the number of pages the fork made private since it was forked or last
+ * reset, provided it got no pages otherwise (e.g. by ballooning).
+ */
+int xc_memshr_fork_bulk(xc_interface *xch, uint32_t source_domain,
+                        const uint32_t *domids, unsigned int nr,
+                        const uint64_t *hot_gfns, unsigned int nr_hot,
+                        bool allow_with_iommu, bool block_interrupts,
+                        bool hot_private, unsigned int *nr_done);
+
+/*
+ * Shares the pages of each of the nr pairs, client_gfn of domid with
+ * source_gfn of source_domain, if their contents are the same.  Unlike
+ * xc_memshr_share_gfns, this is safe against the guests writing to the
+ * pages after they were compared by the caller: Xen compares them again
+ * once they are read-only.  Each pair's rc is set to 0 if it was shared,
+ * or to the negative errno why not, -ENODATA if the contents differ.
+ * *nr_shared (if not NULL) is set to the number of pairs shared.
+ *
+ * Only fails as a whole (e.g. with ENOMEM), in which case the pairs not
+ * processed get that error as their rc.
+ */
+int xc_memshr_dedup(xc_interface *xch, uint32_t domid,
+                    xen_mem_sharing_dedup_t *pairs, unsigned int nr,
+                    unsigned int *nr_shared);
+
 /* Debug calls: return the number of pages referencing the shared frame backing
  * the input argument. Should be one or greater.
  *
@@ -2348,6 +2414,12 @@ long xc_sharing_freed_pages(xc_interface *xch);
  * applies to some of the pages counted in dominfo(d)->shr_pages.
  */
 long xc_sharing_used_frames(xc_interface *xch);
+
+/*
+ * This function returns the number of times shared pages were written to,
+ * and had to be unshared, since boot.  The count wraps.
+ */
+long xc_sharing_cow_breaks(xc_interface *xch);
 /*** End sharing interface ***/
 
 int xc_flask_load(xc_interface *xc_handle, char *buf, uint32_t size);
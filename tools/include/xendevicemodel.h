@@ -365,6 +365,39 @@ int xendevicemodel_pin_memory_cacheattr(
 int xendevicemodel_nr_vcpus(
     xendevicemodel_handle *dmod, domid_t domid, unsigned int *vcpus);
 
+/**
+ * This function allows writes to a range of memory or I/O ports, already
+ * registered for emulation, to be posted to the IOREQ Server's buffered
+ * ring rather than forwarded synchronously.
+ *
+ * @parm dmod a handle to an open devicemodel interface.
+ * @parm domid the domain id to be serviced
+ * @parm id the IOREQ Server id.
+ * @parm is_mmio is this a range of ports or memory
+ * @parm start start of range
+ * @parm end end of range (inclusive).
+ * @return 0 on success, -1 on failure.
+ */
+int xendevicemodel_map_posted_io_range(
+    xendevicemodel_handle *dmod, domid_t domid, ioservid_t id, int is_mmio,
+    uint64_t start, uint64_t end);
+
+/**
+ * This function reverts writes to a range of memory or I/O ports to being
+ * forwarded synchronously.
+ *
+ * @parm dmod a handle to an open devicemodel interface.
+ * @parm domid the domain id to be serviced
+ * @parm id the IOREQ Server id.
+ * @parm is_mmio is this a range of ports or memory
+ * @parm start start of range
+ * @parm end end of range (inclusive).
+ * @return 0 on success, -1 on failure.
+ */
+int xendevicemodel_unmap_posted_io_range(
+    xendevicemodel_handle *dmod, domid_t domid, ioservid_t id, int is_mmio,
+    uint64_t start, uint64_t end);
+
 /**
  * This function restricts the use of this handle to the specified
  * domain.
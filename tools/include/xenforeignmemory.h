@@ -194,6 +194,84 @@ int xenforeignmemory_resource_size(
     xenforeignmemory_handle *fmem, domid_t domid, unsigned int type,
     unsigned int id, size_t *size);
 
+typedef struct xenforeignmemory_cache xenforeignmemory_cache;
+
+/**
+ * This function creates a cache of mappings of frames of one domain.
+ * Frames stay mapped after use, until their slot is needed for others
+ * (least recently used first) or they are invalidated, so that accessing
+ * the same frames again costs no further mmap(2) or munmap(2).
+ *
+ * @parm fmem handle to the open foreignmemory interface
+ * @parm dom the domain whose frames are mapped
+ * @parm prot passed through to mmap(2), as for all frames
+ * @parm max_pages the number of frames the cache keeps mapped at most
+ * @return the cache on success, NULL on failure with errno set
+ *
+ * A cache must not be used by several threads at once, and must be
+ * destroyed before the handle is closed.
+ */
+xenforeignmemory_cache *xenforeignmemory_cache_create(
+    xenforeignmemory_handle *fmem, uint32_t dom, int prot, size_t max_pages);
+
+/**
+ * This function destroys a cache, unmapping all frames mapped by it.
+ */
+void xenforeignmemory_cache_destroy(xenforeignmemory_cache *cache);
+
+/**
+ * This function looks up @num frames in the cache and maps those which
+ * aren't there, with as few mappings as possible.  On return @addrs[i]
+ * is where @gfns[i] is mapped.  The frames stay mapped, at least until
+ * they are released with xenforeignmemory_cache_put().
+ *
+ * @err is as for xenforeignmemory_map(): if it is given, frames may fail
+ * individually (with @addrs[i] NULL and @err[i] set), and -ENOSPC means
+ * that all the cache's slots were in use.  If it isn't, failure to get
+ * any frame fails the whole call.
+ *
+ * Returns 0 on success, or sets errno and returns -1.
+ */
+int xenforeignmemory_cache_get(xenforeignmemory_cache *cache, size_t num,
+                               const xen_pfn_t gfns[/*num*/],
+                               void *addrs[/*num*/], int err[/*num*/]);
+
+/**
+ * This function releases frames got with xenforeignmemory_cache_get().
+ * Their mappings stay cached.  NULL entries in @addrs are skipped.
+ */
+void xenforeignmemory_cache_put(xenforeignmemory_cache *cache, size_t num,
+                                void *const addrs[/*num*/]);
+
+/**
+ * This function drops the cached mappings of @num frames from @gfn on,
+ * which is needed when the domain's physmap changes underneath them.
+ * Frames currently got are unmapped once they are put.
+ */
+void xenforeignmemory_cache_invalidate(xenforeignmemory_cache *cache,
+                                       xen_pfn_t gfn, size_t num);
+
+/**
+ * This function drops all cached mappings.  Frames currently got are
+ * unmapped once they are put.
+ */
+void xenforeignmemory_cache_flush(xenforeignmemory_cache *cache);
+
+/**
+ * This function tells the cache that its domain is dying.  It drops all
+ * cached mappings, as xenforeignmemory_cache_flush() does, and from then
+ * on fails misses with -ESRCH rather than mapping frames again.
+ *
+ * Mapped frames keep a dying domain from being destroyed, and while any
+ * are, the domain can still be found and its frames mapped: the cache
+ * can't tell it is dying by itself.  Callers which may outlive the domain
+ * must watch for that, e.g. with a watch on @releaseDomain followed by
+ * checking XEN_DOMINF_dying with xc_domain_getinfolist(), and call this
+ * (or destroy the cache).  Otherwise the domain stays a zombie for as long
+ * as the cache holds any of its frames.
+ */
+void xenforeignmemory_cache_domain_dying(xenforeignmemory_cache *cache);
+
 #endif
 
 /*
@@ -50,6 +50,28 @@ xenstat_node *xenstat_get_node(xenstat_handle * handle, unsigned int flags);
 /* Free the information */
 void xenstat_free_node(xenstat_node * node);
 
+/*
+ * Shared snapshots - a collector (xenstatd) keeps one handle open, gets a
+ * node every interval and publishes it to a shared memory file.  Any
+ * number of readers can then get the latest node from there instead of
+ * each collecting it.  @path may be NULL for the default location.
+ */
+
+/* Publish @node, collected every @interval_ms.  Returns 0 on success, or
+ * -1 with errno set. */
+int xenstat_publish_node(xenstat_handle * handle, xenstat_node * node,
+			 const char *path, unsigned int interval_ms);
+
+/* Stop publishing, removing the shared file. */
+void xenstat_unpublish(xenstat_handle * handle);
+
+/* Get the latest published node, if it holds the @flags information and is
+ * no older than a few collection intervals.  Returns NULL otherwise; errno
+ * is ESTALE if a collector ran but is no longer publishing.  Free the node
+ * with xenstat_free_node as usual. */
+xenstat_node *xenstat_get_shared_node(xenstat_handle * handle,
+				      unsigned int flags, const char *path);
+
 /*
  * Node functions - extract information from a xenstat_node
  */
@@ -83,6 +105,9 @@ unsigned int xenstat_node_num_cpus(xenstat_node * node);
 /* Get information about the CPU speed */
 unsigned long long xenstat_node_cpu_hz(xenstat_node * node);
 
+/* Get the time the node was collected at (CLOCK_MONOTONIC, in ns) */
+unsigned long long xenstat_node_sample_ns(xenstat_node * node);
+
 /*
  * Domain functions - extract information from a xenstat_domain
  */
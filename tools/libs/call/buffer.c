@@ -14,6 +14,7 @@
  */
 
 #include <errno.h>
+#include <stdlib.h>
 #include <string.h>
 #include <pthread.h>
 #include <xen-tools/libs.h>
@@ -23,8 +24,40 @@
 #define DBGPRINTF(_m...) \
     xtl_log(xcall->logger, XTL_DEBUG, -1, "xencall:buffer", _m)
 
+/*
+ * Hypercall buffers of up to 16 pages come from a pool: arenas of locked
+ * pages are carved into buffers of power of two size classes, and freed
+ * buffers go on a free list per class, so that allocating a buffer rarely
+ * needs an mmap() and freeing one never needs a munmap().  The arenas are
+ * only released when the handle is closed.  Larger buffers are allocated
+ * and freed individually.
+ *
+ * Each thread also caches a few freed buffers of the smallest classes, of
+ * the last (reentrant) handle it used, which it can reuse without taking
+ * the lock.
+ */
+#define ARENA_PAGES      64
+#define HUGE_ARENA_PAGES 512     /* One 2MiB huge page on x86. */
+
+#ifndef __MINIOS__
+#define THREAD_CACHE
+#endif
+#define TCACHE_CLASSES   3       /* Of 1, 2 and 4 pages. */
+#define TCACHE_SIZE      4
+
+struct buffer_arena {
+    void *base;
+    size_t nr_pages;
+    size_t used;
+    struct buffer_arena *next;
+};
+
 pthread_mutex_t cache_mutex = PTHREAD_MUTEX_INITIALIZER;
 
+/* Reentrant handles, whose buffers threads may cache.  Under the lock. */
+static xencall_handle *pool_handles;
+static unsigned long pool_next_id = 1;
+
 static void cache_lock(xencall_handle *xcall)
 {
     int saved_errno = errno;
@@ -45,29 +78,245 @@ static void cache_unlock(xencall_handle *xcall)
     errno = saved_errno;
 }
 
-static void *cache_alloc(xencall_handle *xcall, size_t nr_pages)
+/* Returns the size class of nr_pages, or -1 if it is too big for any. */
+static int size_class(size_t nr_pages)
 {
-    void *p = NULL;
+    int c = 0;
 
-    cache_lock(xcall);
+    while ( (1UL << c) < nr_pages )
+        if ( ++c == BUFFER_NR_CLASSES )
+            return -1;
 
-    xcall->buffer_total_allocations++;
-    xcall->buffer_current_allocations++;
-    if ( xcall->buffer_current_allocations > xcall->buffer_maximum_allocations )
-        xcall->buffer_maximum_allocations = xcall->buffer_current_allocations;
+    return c;
+}
 
-    if ( nr_pages > 1 )
+static void pool_put(xencall_handle *xcall, int c, void *p)
+{
+    *(void **)p = xcall->buffer_free[c];
+    xcall->buffer_free[c] = p;
+}
+
+static void *pool_take(xencall_handle *xcall, int c)
+{
+    void *p = xcall->buffer_free[c];
+
+    if ( p )
+        xcall->buffer_free[c] = *(void **)p;
+
+    return p;
+}
+
+static struct buffer_arena *arena_new(xencall_handle *xcall)
+{
+    struct buffer_arena *a = malloc(sizeof(*a));
+
+    if ( !a )
+        return NULL;
+
+    a->base = NULL;
+    if ( xcall->flags & XENCALL_OPENFLAG_HUGEPAGES )
     {
-        xcall->buffer_cache_toobig++;
+        a->nr_pages = HUGE_ARENA_PAGES;
+        a->base = osdep_alloc_huge_pages(xcall, a->nr_pages);
+        if ( a->base )
+            xcall->buffer_huge_arenas_nr++;
+        else
+        {
+            DBGPRINTF("huge pages unavailable, using normal ones");
+            xcall->flags &= ~XENCALL_OPENFLAG_HUGEPAGES;
+        }
     }
-    else if ( xcall->buffer_cache_nr > 0 )
+    if ( !a->base )
     {
-        p = xcall->buffer_cache[--xcall->buffer_cache_nr];
-        xcall->buffer_cache_hits++;
+        a->nr_pages = ARENA_PAGES;
+        a->base = osdep_alloc_pages(xcall, a->nr_pages);
+    }
+    if ( !a->base )
+    {
+        free(a);
+        return NULL;
     }
+
+    a->used = 0;
+    a->next = xcall->buffer_arenas;
+    xcall->buffer_arenas = a;
+    xcall->buffer_arenas_nr++;
+    xcall->buffer_arena_pages += a->nr_pages;
+
+    return a;
+}
+
+static void *arena_carve(xencall_handle *xcall, int c)
+{
+    struct buffer_arena *a = xcall->buffer_arenas;
+    size_t nr_pages = 1UL << c;
+    void *p;
+
+    if ( !a || a->used + nr_pages > a->nr_pages )
+    {
+        /* Hand out what is left of the current arena as smaller buffers. */
+        while ( a && a->used < a->nr_pages )
+        {
+            int lc = BUFFER_NR_CLASSES - 1;
+
+            while ( a->used + (1UL << lc) > a->nr_pages )
+                lc--;
+            pool_put(xcall, lc, (char *)a->base + a->used * PAGE_SIZE);
+            a->used += 1UL << lc;
+        }
+
+        a = arena_new(xcall);
+        if ( !a )
+            return NULL;
+    }
+
+    p = (char *)a->base + a->used * PAGE_SIZE;
+    a->used += nr_pages;
+
+    return p;
+}
+
+#ifdef THREAD_CACHE
+struct thread_cache {
+    unsigned long owner;        /* buffer_pool_id of the handle, or 0. */
+    unsigned int nr[TCACHE_CLASSES];
+    void *bufs[TCACHE_CLASSES][TCACHE_SIZE];
+    /* Not yet added to the owner's statistics. */
+    unsigned long allocations, releases;
+};
+
+static __thread struct thread_cache tcache;
+static pthread_key_t tcache_key;
+static pthread_once_t tcache_once = PTHREAD_ONCE_INIT;
+
+/* Adds what the thread did without the lock to xcall's statistics. */
+static void tcache_account(xencall_handle *xcall)
+{
+    xcall->buffer_total_allocations += tcache.allocations;
+    xcall->buffer_thread_cache_hits += tcache.allocations;
+    xcall->buffer_total_releases += tcache.releases;
+    xcall->buffer_current_allocations += tcache.allocations;
+    xcall->buffer_current_allocations -= tcache.releases;
+    tcache.allocations = tcache.releases = 0;
+}
+
+/* Gives the thread's cached buffers back to their handle.  Lock held. */
+static void tcache_drain(void)
+{
+    xencall_handle *xcall = pool_handles;
+    int c;
+
+    while ( xcall && xcall->buffer_pool_id != tcache.owner )
+        xcall = xcall->buffer_pool_next;
+
+    /* If the handle has been closed, the buffers are gone already. */
+    if ( xcall )
+    {
+        for ( c = 0; c < TCACHE_CLASSES; c++ )
+            while ( tcache.nr[c] )
+                pool_put(xcall, c, tcache.bufs[c][--tcache.nr[c]]);
+        tcache_account(xcall);
+    }
+
+    memset(&tcache, 0, sizeof(tcache));
+}
+
+static void tcache_exit(void *unused)
+{
+    pthread_mutex_lock(&cache_mutex);
+    tcache_drain();
+    pthread_mutex_unlock(&cache_mutex);
+}
+
+static void tcache_init_key(void)
+{
+    pthread_key_create(&tcache_key, tcache_exit);
+}
+
+/* Makes xcall the owner of the thread's cache.  Lock held. */
+static void tcache_adopt(xencall_handle *xcall)
+{
+    if ( xcall->flags & XENCALL_OPENFLAG_NON_REENTRANT )
+        return;
+
+    if ( tcache.owner == xcall->buffer_pool_id )
+    {
+        tcache_account(xcall);
+        return;
+    }
+
+    if ( tcache.owner )
+        tcache_drain();
+    tcache.owner = xcall->buffer_pool_id;
+
+    /* Have the cache drained when the thread exits. */
+    pthread_once(&tcache_once, tcache_init_key);
+    pthread_setspecific(tcache_key, &tcache);
+}
+
+static void *tcache_alloc(xencall_handle *xcall, int c)
+{
+    if ( c < 0 || c >= TCACHE_CLASSES || !tcache.owner ||
+         tcache.owner != xcall->buffer_pool_id || !tcache.nr[c] )
+        return NULL;
+
+    tcache.allocations++;
+    return tcache.bufs[c][--tcache.nr[c]];
+}
+
+static int tcache_free(xencall_handle *xcall, int c, void *p)
+{
+    if ( c < 0 || c >= TCACHE_CLASSES || !tcache.owner ||
+         tcache.owner != xcall->buffer_pool_id ||
+         tcache.nr[c] == TCACHE_SIZE )
+        return 0;
+
+    tcache.releases++;
+    tcache.bufs[c][tcache.nr[c]++] = p;
+    return 1;
+}
+#else
+static inline void tcache_adopt(xencall_handle *xcall) {}
+static inline void *tcache_alloc(xencall_handle *xcall, int c)
+{
+    return NULL;
+}
+static inline int tcache_free(xencall_handle *xcall, int c, void *p)
+{
+    return 0;
+}
+#endif
+
+static void *pool_alloc(xencall_handle *xcall, size_t nr_pages)
+{
+    int c = size_class(nr_pages);
+    void *p = NULL;
+
+    if ( c < 0 )
+        p = osdep_alloc_pages(xcall, nr_pages);
+
+    cache_lock(xcall);
+
+    tcache_adopt(xcall);
+
+    if ( c < 0 )
+        xcall->buffer_cache_toobig++;
+    else if ( (p = pool_take(xcall, c)) != NULL )
+        xcall->buffer_cache_hits++;
     else
     {
         xcall->buffer_cache_misses++;
+        p = arena_carve(xcall, c);
+    }
+
+    if ( p )
+    {
+        xcall->buffer_total_allocations++;
+        xcall->buffer_current_allocations++;
+        if ( xcall->buffer_current_allocations >
+             xcall->buffer_maximum_allocations )
+            xcall->buffer_maximum_allocations =
+                xcall->buffer_current_allocations;
     }
 
     cache_unlock(xcall);
@@ -75,61 +324,130 @@ static void *cache_alloc(xencall_handle *xcall, size_t nr_pages)
     return p;
 }
 
-static int cache_free(xencall_handle *xcall, void *p, size_t nr_pages)
+static void pool_free(xencall_handle *xcall, void *p, size_t nr_pages)
 {
-    int rc = 0;
+    int c = size_class(nr_pages);
+
+    if ( c < 0 )
+        osdep_free_pages(xcall, p, nr_pages);
 
     cache_lock(xcall);
 
+    tcache_adopt(xcall);
+
     xcall->buffer_total_releases++;
     xcall->buffer_current_allocations--;
 
-    if ( nr_pages == 1 &&
-         xcall->buffer_cache_nr < BUFFER_CACHE_SIZE )
-    {
-        xcall->buffer_cache[xcall->buffer_cache_nr++] = p;
-        rc = 1;
-    }
+    if ( c >= 0 && !tcache_free(xcall, c, p) )
+        pool_put(xcall, c, p);
 
     cache_unlock(xcall);
+}
 
-    return rc;
+void buffer_init_pool(xencall_handle *xcall)
+{
+    const char *huge = getenv("XENCALL_HUGEPAGES");
+    int c;
+
+    if ( huge && *huge && strcmp(huge, "0") )
+        xcall->flags |= XENCALL_OPENFLAG_HUGEPAGES;
+
+    for ( c = 0; c < BUFFER_NR_CLASSES; c++ )
+        xcall->buffer_free[c] = NULL;
+    xcall->buffer_arenas = NULL;
+    xcall->buffer_pool_id = 0;
+    xcall->buffer_pool_next = NULL;
+
+    if ( xcall->flags & XENCALL_OPENFLAG_NON_REENTRANT )
+        return;
+
+    cache_lock(xcall);
+    xcall->buffer_pool_id = pool_next_id++;
+    xcall->buffer_pool_next = pool_handles;
+    pool_handles = xcall;
+    cache_unlock(xcall);
 }
 
 void buffer_release_cache(xencall_handle *xcall)
 {
-    void *p;
+    struct buffer_arena *a;
+    xencall_handle **pp;
 
     cache_lock(xcall);
 
-    DBGPRINTF("total allocations:%d total releases:%d",
+    for ( pp = &pool_handles; *pp; pp = &(*pp)->buffer_pool_next )
+    {
+        if ( *pp == xcall )
+        {
+            *pp = xcall->buffer_pool_next;
+            break;
+        }
+    }
+#ifdef THREAD_CACHE
+    /* Other threads find out when they next take the lock. */
+    if ( tcache.owner && tcache.owner == xcall->buffer_pool_id )
+    {
+        tcache_account(xcall);
+        memset(&tcache, 0, sizeof(tcache));
+    }
+#endif
+
+    DBGPRINTF("total allocations:%lu total releases:%lu",
               xcall->buffer_total_allocations,
               xcall->buffer_total_releases);
-    DBGPRINTF("current allocations:%d maximum allocations:%d",
+    DBGPRINTF("current allocations:%lu maximum allocations:%lu",
               xcall->buffer_current_allocations,
               xcall->buffer_maximum_allocations);
-    DBGPRINTF("cache current size:%d",
-              xcall->buffer_cache_nr);
-    DBGPRINTF("cache hits:%d misses:%d toobig:%d",
-              xcall->buffer_cache_hits,
+    DBGPRINTF("pool hits:%lu (thread cache:%lu) misses:%lu toobig:%lu",
+              xcall->buffer_cache_hits + xcall->buffer_thread_cache_hits,
+              xcall->buffer_thread_cache_hits,
               xcall->buffer_cache_misses,
               xcall->buffer_cache_toobig);
+    DBGPRINTF("arenas:%lu (huge:%lu) pages:%lu",
+              xcall->buffer_arenas_nr,
+              xcall->buffer_huge_arenas_nr,
+              xcall->buffer_arena_pages);
 
-    while ( xcall->buffer_cache_nr > 0 )
+    while ( (a = xcall->buffer_arenas) != NULL )
     {
-        p = xcall->buffer_cache[--xcall->buffer_cache_nr];
-        osdep_free_pages(xcall, p, 1);
+        xcall->buffer_arenas = a->next;
+        osdep_free_pages(xcall, a->base, a->nr_pages);
+        free(a);
     }
 
     cache_unlock(xcall);
 }
 
+void xencall_get_buffer_stats(xencall_handle *xcall,
+                              struct xencall_buffer_stats *stats)
+{
+    cache_lock(xcall);
+
+    tcache_adopt(xcall);
+
+    stats->allocations = xcall->buffer_total_allocations;
+    stats->releases = xcall->buffer_total_releases;
+    stats->current = xcall->buffer_current_allocations;
+    stats->maximum = xcall->buffer_maximum_allocations;
+    stats->pool_hits = xcall->buffer_cache_hits +
+                       xcall->buffer_thread_cache_hits;
+    stats->thread_cache_hits = xcall->buffer_thread_cache_hits;
+    stats->pool_misses = xcall->buffer_cache_misses;
+    stats->toobig = xcall->buffer_cache_toobig;
+    stats->arenas = xcall->buffer_arenas_nr;
+    stats->huge_arenas = xcall->buffer_huge_arenas_nr;
+    stats->arena_bytes = (uint64_t)xcall->buffer_arena_pages * PAGE_SIZE;
+
+    cache_unlock(xcall);
+}
+
 void *xencall_alloc_buffer_pages(xencall_handle *xcall, size_t nr_pages)
 {
-    void *p = cache_alloc(xcall, nr_pages);
+    int c = size_class(nr_pages);
+    void *p = tcache_alloc(xcall, c);
 
     if ( !p )
-        p = osdep_alloc_pages(xcall, nr_pages);
+        p = pool_alloc(xcall, nr_pages);
 
     if (!p)
         return NULL;
@@ -144,8 +462,8 @@ void xencall_free_buffer_pages(xencall_handle *xcall, void *p, size_t nr_pages)
     if ( p == NULL )
         return;
 
-    if ( !cache_free(xcall, p, nr_pages) )
-        osdep_free_pages(xcall, p, nr_pages);
+    if ( !tcache_free(xcall, size_class(nr_pages), p) )
+        pool_free(xcall, p, nr_pages);
 }
 
 struct allocation_header {
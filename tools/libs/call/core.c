@@ -44,7 +44,6 @@ xencall_handle *xencall_open(xentoollog_logger *logger, unsigned open_flags)
     xentoolcore__register_active_handle(&xcall->tc_ah);
 
     xcall->flags = open_flags;
-    xcall->buffer_cache_nr = 0;
 
     xcall->buffer_total_allocations = 0;
     xcall->buffer_total_releases = 0;
@@ -53,6 +52,10 @@ xencall_handle *xencall_open(xentoollog_logger *logger, unsigned open_flags)
     xcall->buffer_cache_hits = 0;
     xcall->buffer_cache_misses = 0;
     xcall->buffer_cache_toobig = 0;
+    xcall->buffer_thread_cache_hits = 0;
+    xcall->buffer_arenas_nr = 0;
+    xcall->buffer_huge_arenas_nr = 0;
+    xcall->buffer_arena_pages = 0;
     xcall->logger = logger;
     xcall->logger_tofree = NULL;
 
@@ -66,6 +69,8 @@ xencall_handle *xencall_open(xentoollog_logger *logger, unsigned open_flags)
     rc = osdep_xencall_open(xcall);
     if ( rc  < 0 ) goto err;
 
+    buffer_init_pool(xcall);
+
     return xcall;
 
 err:
@@ -158,6 +158,34 @@ void *osdep_alloc_pages(xencall_handle *xcall, size_t npages)
     return p;
 }
 
+void *osdep_alloc_huge_pages(xencall_handle *xcall, size_t npages)
+{
+    size_t size = npages * PAGE_SIZE;
+    void *p;
+    int i;
+
+    /* Pages of the hypercall buffer device are allocated by the kernel. */
+    if ( xcall->buf_fd >= 0 )
+        return NULL;
+
+    p = mmap(NULL, size, PROT_READ|PROT_WRITE,
+             MAP_PRIVATE|MAP_ANONYMOUS|MAP_LOCKED|MAP_HUGETLB, -1, 0);
+    if ( p == MAP_FAILED )
+        return NULL;
+
+    if ( madvise(p, size, MADV_DONTFORK) < 0 )
+    {
+        (void)munmap(p, size);
+        return NULL;
+    }
+
+    /* Un-CoW, as for alloc_pages_nobufdev(). */
+    for ( i = 0; i < npages; i++ )
+        *((char *)p + (i * PAGE_SIZE)) = 0;
+
+    return p;
+}
+
 void osdep_free_pages(xencall_handle *xcall, void *ptr, size_t npages)
 {
     int saved_errno = errno;
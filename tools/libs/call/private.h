@@ -31,25 +31,30 @@ struct xencall_handle {
     Xentoolcore__Active_Handle tc_ah;
 
     /*
-     * A simple cache of unused, single page, hypercall buffers
-     *
-     * Protected by a global lock.
+     * Pool of hypercall buffers, see buffer.c.  Protected by the global
+     * buffer lock, except for per-thread caches.
      */
-#define BUFFER_CACHE_SIZE 4
-    int buffer_cache_nr;
-    void *buffer_cache[BUFFER_CACHE_SIZE];
+#define BUFFER_NR_CLASSES 5  /* Of 1, 2, 4, 8 and 16 pages. */
+    unsigned long buffer_pool_id;
+    xencall_handle *buffer_pool_next;   /* In the list of pooling handles. */
+    void *buffer_free[BUFFER_NR_CLASSES];
+    struct buffer_arena *buffer_arenas;
 
     /*
      * Hypercall buffer statistics. All protected by the global
      * buffer_cache lock.
      */
-    int buffer_total_allocations;
-    int buffer_total_releases;
-    int buffer_current_allocations;
-    int buffer_maximum_allocations;
-    int buffer_cache_hits;
-    int buffer_cache_misses;
-    int buffer_cache_toobig;
+    unsigned long buffer_total_allocations;
+    unsigned long buffer_total_releases;
+    unsigned long buffer_current_allocations;
+    unsigned long buffer_maximum_allocations;
+    unsigned long buffer_cache_hits;
+    unsigned long buffer_cache_misses;
+    unsigned long buffer_cache_toobig;
+    unsigned long buffer_thread_cache_hits;
+    unsigned long buffer_arenas_nr;
+    unsigned long buffer_huge_arenas_nr;
+    unsigned long buffer_arena_pages;
 };
 
 int osdep_xencall_open(xencall_handle *xcall);
@@ -60,6 +65,18 @@ long osdep_hypercall(xencall_handle *xcall, privcmd_hypercall_t *hypercall);
 void *osdep_alloc_pages(xencall_handle *xcall, size_t nr_pages);
 void osdep_free_pages(xencall_handle *xcall, void *p, size_t nr_pages);
 
+#if defined(__linux__)
+/* Returns NULL, without logging, if huge pages can't be had. */
+void *osdep_alloc_huge_pages(xencall_handle *xcall, size_t nr_pages);
+#else
+static inline void *osdep_alloc_huge_pages(xencall_handle *xcall,
+                                           size_t nr_pages)
+{
+    return NULL;
+}
+#endif
+
+void buffer_init_pool(xencall_handle *xcall);
 void buffer_release_cache(xencall_handle *xcall);
 
 #define PERROR(_f...) xtl_log(xcall->logger, XTL_ERROR, errno, "xencall", _f)
@@ -1342,6 +1342,48 @@ int xc_vcpu_getinfo(xc_interface *xch,
     return rc;
 }
 
+int xc_vcpu_getinfolist(xc_interface *xch,
+                        uint32_t *first_domain,
+                        unsigned int *first_vcpu,
+                        unsigned int max_vcpus,
+                        xc_vcpuinfo_list_t *info)
+{
+    unsigned int done = 0;
+    DECLARE_SYSCTL;
+    DECLARE_HYPERCALL_BOUNCE(info, max_vcpus * sizeof(*info),
+                             XC_HYPERCALL_BUFFER_BOUNCE_OUT);
+
+    if ( xc_hypercall_bounce_pre(xch, info) )
+        return -1;
+
+    sysctl.cmd = XEN_SYSCTL_getvcpuinfolist;
+    sysctl.u.getvcpuinfolist.first_domain = *first_domain;
+    sysctl.u.getvcpuinfolist.first_vcpu = *first_vcpu;
+
+    /* Carry on where Xen stopped, should it have been preempted. */
+    do {
+        sysctl.u.getvcpuinfolist.max_vcpus = max_vcpus - done;
+        set_xen_guest_handle_offset(sysctl.u.getvcpuinfolist.buffer, info,
+                                    done);
+
+        if ( do_sysctl(xch, &sysctl) < 0 )
+        {
+            xc_hypercall_bounce_post(xch, info);
+            return -1;
+        }
+
+        done += sysctl.u.getvcpuinfolist.num_vcpus;
+    } while ( done < max_vcpus &&
+              sysctl.u.getvcpuinfolist.first_domain != DOMID_INVALID );
+
+    xc_hypercall_bounce_post(xch, info);
+
+    *first_domain = sysctl.u.getvcpuinfolist.first_domain;
+    *first_vcpu = sysctl.u.getvcpuinfolist.first_vcpu;
+
+    return done;
+}
+
 int xc_domain_ioport_permission(xc_interface *xch,
                                 uint32_t domid,
                                 uint32_t first_port,
@@ -267,6 +267,93 @@ int xc_memshr_fork_reset(xc_interface *xch, uint32_t domid)
     return xc_memshr_memop(xch, domid, &mso);
 }
 
+int xc_memshr_fork_bulk(xc_interface *xch, uint32_t pdomid,
+                        const uint32_t *domids, unsigned int nr,
+                        const uint64_t *hot_gfns, unsigned int nr_hot,
+                        bool allow_with_iommu, bool block_interrupts,
+                        bool hot_private, unsigned int *nr_done)
+{
+    xen_mem_sharing_op_t mso;
+    DECLARE_HYPERCALL_BUFFER(uint16_t, forks);
+    DECLARE_HYPERCALL_BOUNCE_IN(hot_gfns, nr_hot * sizeof(*hot_gfns));
+    unsigned int i;
+    int rc = -1;
+
+    if ( nr_done )
+        *nr_done = 0;
+
+    forks = xc_hypercall_buffer_alloc(xch, forks, nr * sizeof(*forks));
+    if ( !forks )
+        return -1;
+    for ( i = 0; i < nr; i++ )
+        forks[i] = domids[i];
+
+    if ( xc_hypercall_bounce_pre(xch, hot_gfns) )
+        goto out;
+
+    memset(&mso, 0, sizeof(mso));
+    mso.op = XENMEM_sharing_op_fork_bulk;
+    set_xen_guest_handle(mso.u.fork_bulk.forks, forks);
+    set_xen_guest_handle(mso.u.fork_bulk.hot_gfns, hot_gfns);
+    mso.u.fork_bulk.nr_forks = nr;
+    mso.u.fork_bulk.nr_hot = nr_hot;
+
+    if ( allow_with_iommu )
+        mso.u.fork_bulk.flags |= XENMEM_FORK_WITH_IOMMU_ALLOWED;
+    if ( block_interrupts )
+        mso.u.fork_bulk.flags |= XENMEM_FORK_BLOCK_INTERRUPTS;
+    if ( hot_private )
+        mso.u.fork_bulk.flags |= XENMEM_FORK_HOT_PRIVATE;
+
+    rc = xc_memshr_memop(xch, pdomid, &mso);
+
+    if ( nr_done )
+        *nr_done = rc ? mso.u.fork_bulk.nr_done : nr;
+
+    xc_hypercall_bounce_post(xch, hot_gfns);
+ out:
+    xc_hypercall_buffer_free(xch, forks);
+
+    return rc;
+}
+
+int xc_memshr_dedup(xc_interface *xch, uint32_t domid,
+                    xen_mem_sharing_dedup_t *pairs, unsigned int nr,
+                    unsigned int *nr_shared)
+{
+    xen_mem_sharing_op_t mso;
+    DECLARE_HYPERCALL_BOUNCE(pairs, nr * sizeof(*pairs),
+                             XC_HYPERCALL_BUFFER_BOUNCE_BOTH);
+    int rc;
+
+    if ( xc_hypercall_bounce_pre(xch, pairs) )
+        return -1;
+
+    memset(&mso, 0, sizeof(mso));
+    mso.op = XENMEM_sharing_op_dedup;
+    set_xen_guest_handle(mso.u.dedup.pairs, pairs);
+    mso.u.dedup.nr_pairs = nr;
+
+    rc = xc_memshr_memop(xch, domid, &mso);
+
+    if ( nr_shared )
+        *nr_shared = mso.u.dedup.nr_shared;
+
+    xc_hypercall_bounce_post(xch, pairs);
+
+    if ( rc )
+    {
+        int saved_errno = errno;
+        unsigned int i;
+
+        for ( i = mso.u.dedup.nr_done; i < nr; i++ )
+            pairs[i].rc = -saved_errno;
+        errno = saved_errno;
+    }
+
+    return rc;
+}
+
 int xc_memshr_audit(xc_interface *xch)
 {
     xen_mem_sharing_op_t mso;
@@ -287,3 +374,8 @@ long xc_sharing_used_frames(xc_interface *xch)
 {
     return do_memory_op(xch, XENMEM_get_sharing_shared_pages, NULL, 0);
 }
+
+long xc_sharing_cow_breaks(xc_interface *xch)
+{
+    return do_memory_op(xch, XENMEM_get_sharing_cow_breaks, NULL, 0);
+}
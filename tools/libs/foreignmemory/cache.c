@@ -0,0 +1,459 @@
+/*
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation;
+ * version 2.1 of the License.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Mapping cache: frames of one domain are kept mapped in slots of a
+ * single reserved address range, so that repeated accesses to the same
+ * frames cost neither an mmap()/munmap() pair nor the TLB flushes of
+ * tearing mappings down.  Misses are mapped a run of consecutive slots
+ * at a time, i.e. with one privcmd mapping each, and slots are reused
+ * by the clock algorithm, an approximation of least recently used.
+ */
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <assert.h>
+#include <errno.h>
+
+#include <sys/mman.h>
+
+#include "private.h"
+
+#define NO_SLOT UINT32_MAX
+
+struct cache_slot {
+    xen_pfn_t gfn;
+    uint32_t next;              /* Next slot in the hash chain. */
+    unsigned int pins;
+    bool hashed;                /* gfn is mapped here, and can be found. */
+    bool referenced;            /* Used since the clock hand last passed. */
+};
+
+struct xenforeignmemory_cache {
+    xenforeignmemory_handle *fmem;
+    uint32_t dom;
+    int prot;
+
+    char *base;
+    size_t nr_slots;
+    struct cache_slot *slots;
+    uint32_t *hash;
+    size_t hash_mask;
+    size_t hand;
+    bool dying;                 /* No more frames get mapped. */
+
+    /* Scratch space for mapping a run of slots. */
+    xen_pfn_t *run_gfns;
+    int *run_err;
+};
+
+static size_t hash_gfn(const xenforeignmemory_cache *cache, xen_pfn_t gfn)
+{
+    return (gfn * 0x9e3779b97f4a7c15ULL >> 32) & cache->hash_mask;
+}
+
+static uint32_t cache_find(const xenforeignmemory_cache *cache, xen_pfn_t gfn)
+{
+    uint32_t i;
+
+    for ( i = cache->hash[hash_gfn(cache, gfn)]; i != NO_SLOT;
+          i = cache->slots[i].next )
+        if ( cache->slots[i].gfn == gfn )
+            return i;
+
+    return NO_SLOT;
+}
+
+static void cache_insert(xenforeignmemory_cache *cache, uint32_t i,
+                         xen_pfn_t gfn)
+{
+    struct cache_slot *slot = &cache->slots[i];
+    uint32_t *head = &cache->hash[hash_gfn(cache, gfn)];
+
+    slot->gfn = gfn;
+    slot->next = *head;
+    slot->hashed = true;
+    *head = i;
+}
+
+static void cache_remove(xenforeignmemory_cache *cache, uint32_t i)
+{
+    struct cache_slot *slot = &cache->slots[i];
+    uint32_t *p;
+
+    if ( !slot->hashed )
+        return;
+
+    for ( p = &cache->hash[hash_gfn(cache, slot->gfn)]; *p != i;
+          p = &cache->slots[*p].next )
+        assert(*p != NO_SLOT);
+
+    *p = slot->next;
+    slot->hashed = false;
+}
+
+/*
+ * Replaces whatever is mapped in @num slots from @first with inaccessible
+ * anonymous memory, which drops the references to the foreign frames
+ * while keeping the address range reserved.
+ */
+static int cache_release(xenforeignmemory_cache *cache, size_t first,
+                         size_t num)
+{
+    xenforeignmemory_handle *fmem = cache->fmem;
+    void *addr = cache->base + (first << XC_PAGE_SHIFT);
+
+    if ( mmap(addr, num << XC_PAGE_SHIFT, PROT_NONE,
+              MAP_PRIVATE | MAP_ANON | MAP_FIXED | MAP_NORESERVE,
+              -1, 0) == MAP_FAILED )
+    {
+        PERROR("failed to release foreign mappings at %p", addr);
+        return -1;
+    }
+
+    return 0;
+}
+
+/*
+ * Finds up to @want consecutive slots to reuse.  The clock hand passes over
+ * pinned slots and gives those used since it last passed a second chance.
+ * Returns how many were found, from *first on, or 0 if all are pinned.
+ */
+static size_t cache_find_run(xenforeignmemory_cache *cache, size_t want,
+                             size_t *first)
+{
+    size_t n = 0, scanned;
+
+    for ( scanned = 0; scanned < 2 * cache->nr_slots; scanned++ )
+    {
+        struct cache_slot *slot = &cache->slots[cache->hand];
+        bool usable = !slot->pins && !slot->referenced;
+
+        slot->referenced = false;
+        if ( !usable && n )
+            break;
+        if ( usable && !n++ )
+            *first = cache->hand;
+
+        if ( ++cache->hand == cache->nr_slots )
+        {
+            /* Runs can't wrap around. */
+            cache->hand = 0;
+            if ( n )
+                break;
+        }
+        if ( n == want )
+            break;
+    }
+
+    return n;
+}
+
+/*
+ * Maps the frames of @num misses into consecutive slots, with as few
+ * mappings as the pinned slots allow.  @miss holds the indices into @gfns
+ * (and @addrs and @err) of the misses.
+ */
+static void cache_map_misses(xenforeignmemory_cache *cache, size_t num,
+                             const size_t miss[], const xen_pfn_t gfns[],
+                             void *addrs[], int err[])
+{
+    size_t first, n, i;
+    bool gone;
+    char *addr;
+
+    if ( cache->dying )
+    {
+        for ( i = 0; i < num; i++ )
+            err[miss[i]] = -ESRCH;
+        return;
+    }
+
+    while ( num )
+    {
+        n = cache_find_run(cache, num, &first);
+        if ( !n )
+        {
+            for ( i = 0; i < num; i++ )
+                err[miss[i]] = -ENOSPC;
+            return;
+        }
+
+        for ( i = 0; i < n; i++ )
+        {
+            cache_remove(cache, first + i);
+            cache->run_gfns[i] = gfns[miss[i]];
+        }
+
+        /* Maps over whatever the slots held, within the reserved range. */
+        addr = cache->base + (first << XC_PAGE_SHIFT);
+        addr = osdep_xenforeignmemory_map(cache->fmem, cache->dom, addr,
+                                          cache->prot, MAP_FIXED, n,
+                                          cache->run_gfns, cache->run_err);
+        if ( !addr )
+        {
+            int saved_errno = errno;
+
+            /* Failure may have left a hole in the range. */
+            cache_release(cache, first, n);
+            for ( i = 0; i < n; i++ )
+                cache->run_err[i] = -saved_errno;
+        }
+
+        gone = true;
+        for ( i = 0; i < n; i++ )
+        {
+            err[miss[i]] = cache->run_err[i];
+            if ( cache->run_err[i] )
+            {
+                gone = gone && cache->run_err[i] == -ESRCH;
+                continue;
+            }
+
+            gone = false;
+            cache_insert(cache, first + i, gfns[miss[i]]);
+            cache->slots[first + i].pins = 1;
+            cache->slots[first + i].referenced = true;
+            addrs[miss[i]] = cache->base + ((first + i) << XC_PAGE_SHIFT);
+        }
+
+        /*
+         * The domain is gone altogether (a dying one can still be found),
+         * and its id may be reused: don't map another domain's frames.
+         */
+        if ( gone )
+        {
+            xenforeignmemory_cache_domain_dying(cache);
+            for ( i = n; i < num; i++ )
+                err[miss[i]] = -ESRCH;
+            return;
+        }
+
+        miss += n;
+        num -= n;
+    }
+}
+
+xenforeignmemory_cache *xenforeignmemory_cache_create(
+    xenforeignmemory_handle *fmem, uint32_t dom, int prot, size_t max_pages)
+{
+    xenforeignmemory_cache *cache;
+    size_t i, hash_size = 1;
+    void *base;
+
+#ifdef __MINIOS__
+    /* Mappings can't be placed at a given address. */
+    errno = EOPNOTSUPP;
+    return NULL;
+#endif
+
+    if ( !max_pages || max_pages >= NO_SLOT )
+    {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    while ( hash_size < max_pages )
+        hash_size <<= 1;
+
+    cache = calloc(1, sizeof(*cache));
+    if ( !cache )
+        return NULL;
+
+    cache->fmem = fmem;
+    cache->dom = dom;
+    cache->prot = prot;
+    cache->nr_slots = max_pages;
+    cache->hash_mask = hash_size - 1;
+    cache->slots = calloc(max_pages, sizeof(*cache->slots));
+    cache->hash = malloc(hash_size * sizeof(*cache->hash));
+    cache->run_gfns = malloc(max_pages * sizeof(*cache->run_gfns));
+    cache->run_err = malloc(max_pages * sizeof(*cache->run_err));
+    if ( !cache->slots || !cache->hash || !cache->run_gfns || !cache->run_err )
+        goto err;
+
+    for ( i = 0; i < hash_size; i++ )
+        cache->hash[i] = NO_SLOT;
+
+    base = mmap(NULL, max_pages << XC_PAGE_SHIFT, PROT_NONE,
+                MAP_PRIVATE | MAP_ANON | MAP_NORESERVE, -1, 0);
+    if ( base == MAP_FAILED )
+    {
+        PERROR("failed to reserve %zu pages for a mapping cache", max_pages);
+        goto err;
+    }
+    cache->base = base;
+
+    return cache;
+
+ err:
+    free(cache->run_err);
+    free(cache->run_gfns);
+    free(cache->hash);
+    free(cache->slots);
+    free(cache);
+    return NULL;
+}
+
+void xenforeignmemory_cache_destroy(xenforeignmemory_cache *cache)
+{
+    if ( !cache )
+        return;
+
+    (void)munmap(cache->base, cache->nr_slots << XC_PAGE_SHIFT);
+    free(cache->run_err);
+    free(cache->run_gfns);
+    free(cache->hash);
+    free(cache->slots);
+    free(cache);
+}
+
+int xenforeignmemory_cache_get(xenforeignmemory_cache *cache, size_t num,
+                               const xen_pfn_t gfns[/*num*/],
+                               void *addrs[/*num*/], int err[/*num*/])
+{
+    int *err_to_free = NULL;
+    size_t *miss, nr_miss = 0, i;
+    uint32_t slot;
+
+    if ( err == NULL )
+        err = err_to_free = malloc(num * sizeof(*err));
+    miss = malloc(num * sizeof(*miss));
+    if ( err == NULL || miss == NULL )
+    {
+        free(err_to_free);
+        free(miss);
+        return -1;
+    }
+
+    for ( i = 0; i < num; i++ )
+    {
+        slot = cache_find(cache, gfns[i]);
+        if ( slot == NO_SLOT )
+        {
+            addrs[i] = NULL;
+            miss[nr_miss++] = i;
+            continue;
+        }
+
+        cache->slots[slot].pins++;
+        cache->slots[slot].referenced = true;
+        addrs[i] = cache->base + ((size_t)slot << XC_PAGE_SHIFT);
+        err[i] = 0;
+    }
+
+    cache_map_misses(cache, nr_miss, miss, gfns, addrs, err);
+    free(miss);
+
+    if ( err_to_free )
+    {
+        for ( i = 0; i < num; i++ )
+        {
+            if ( err[i] )
+            {
+                errno = -err[i];
+                xenforeignmemory_cache_put(cache, num, addrs);
+                free(err_to_free);
+                return -1;
+            }
+        }
+        free(err_to_free);
+    }
+
+    return 0;
+}
+
+void xenforeignmemory_cache_put(xenforeignmemory_cache *cache, size_t num,
+                                void *const addrs[/*num*/])
+{
+    struct cache_slot *slot;
+    size_t i, idx;
+
+    for ( i = 0; i < num; i++ )
+    {
+        if ( !addrs[i] )
+            continue;
+
+        idx = ((char *)addrs[i] - cache->base) >> XC_PAGE_SHIFT;
+        assert(idx < cache->nr_slots);
+        slot = &cache->slots[idx];
+        assert(slot->pins);
+
+        /* Mappings invalidated while pinned go once the last pin does. */
+        if ( !--slot->pins && !slot->hashed )
+            cache_release(cache, idx, 1);
+    }
+}
+
+static void cache_invalidate_slot(xenforeignmemory_cache *cache, uint32_t i)
+{
+    cache_remove(cache, i);
+    if ( !cache->slots[i].pins )
+        cache_release(cache, i, 1);
+}
+
+void xenforeignmemory_cache_invalidate(xenforeignmemory_cache *cache,
+                                       xen_pfn_t gfn, size_t num)
+{
+    uint32_t slot;
+    size_t i;
+
+    if ( num > cache->nr_slots )
+    {
+        for ( i = 0; i < cache->nr_slots; i++ )
+            if ( cache->slots[i].hashed && cache->slots[i].gfn - gfn < num )
+                cache_invalidate_slot(cache, i);
+        return;
+    }
+
+    /* A frame may be in more than one slot, if it was asked for twice. */
+    for ( i = 0; i < num; i++ )
+        while ( (slot = cache_find(cache, gfn + i)) != NO_SLOT )
+            cache_invalidate_slot(cache, slot);
+}
+
+void xenforeignmemory_cache_flush(xenforeignmemory_cache *cache)
+{
+    size_t i, first = 0;
+
+    for ( i = 0; i <= cache->nr_slots; i++ )
+    {
+        /* Release runs of unpinned slots with one mmap() each. */
+        if ( i < cache->nr_slots && !cache->slots[i].pins )
+        {
+            cache_remove(cache, i);
+            continue;
+        }
+        if ( i > first )
+            cache_release(cache, first, i - first);
+        if ( i < cache->nr_slots )
+            cache_remove(cache, i);
+        first = i + 1;
+    }
+}
+
+void xenforeignmemory_cache_domain_dying(xenforeignmemory_cache *cache)
+{
+    cache->dying = true;
+    xenforeignmemory_cache_flush(cache);
+}
+
+/*
+ * Local variables:
+ * mode: C
+ * c-file-style: "BSD"
+ * c-basic-offset: 4
+ * tab-width: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
@@ -438,6 +438,7 @@ int libxl_cpupool_movedomain(libxl_ctx *ctx, uint32_t poolid, uint32_t domid)
         GC_FREE;
         return ERROR_FAIL;
     }
+    libxl__numa_cache_invalidate(gc, domid);
 
     GC_FREE;
     return 0;
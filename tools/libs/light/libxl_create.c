@@ -553,7 +553,10 @@ int libxl__domain_build(libxl__gc *gc,
                     info->u.pvh.pvshim_extra ? " " : "",
                     info->u.pvh.pvshim_extra ? info->u.pvh.pvshim_extra : "");
 
-        ret = libxl__build_hvm(gc, domid, d_config, state);
+        if (state->template_domid != INVALID_DOMID)
+            ret = libxl__build_from_template(gc, domid, d_config, state);
+        else
+            ret = libxl__build_hvm(gc, domid, d_config, state);
         if (ret)
             goto out;
 
@@ -573,6 +576,38 @@ out:
     return ret;
 }
 
+/*
+ * Refuse to create a second live domain with the same uuid, as they would
+ * share /vm/<uuid> in xenstore. Dying domains don't count, for a domain
+ * being rebooted to be able to come back while the old one is cleaned up.
+ * Must be called with the domain creation lock held, up to the domain
+ * being made.
+ */
+static int domain_check_uuid(libxl__gc *gc, const libxl_uuid *uuid)
+{
+    libxl_dominfo *info;
+    int i, nb, rc = 0;
+
+    if (libxl_uuid_is_nil(uuid))
+        return 0;
+
+    info = libxl_list_domain(CTX, &nb);
+    if (!info)
+        return ERROR_FAIL;
+
+    for (i = 0; i < nb; i++) {
+        if (!info[i].dying && !libxl_uuid_compare(&info[i].uuid, uuid)) {
+            LOGD(ERROR, info[i].domid, "domain with uuid "LIBXL_UUID_FMT
+                 " already exists", LIBXL_UUID_BYTES(*uuid));
+            rc = ERROR_INVAL;
+            break;
+        }
+    }
+
+    libxl_dominfo_list_free(info, nb);
+    return rc;
+}
+
 int libxl__domain_make(libxl__gc *gc, libxl_domain_config *d_config,
                        libxl__domain_build_state *state,
                        uint32_t *domid, bool soft_reset)
@@ -912,6 +947,9 @@ static int store_libxl_entry(libxl__gc *gc, uint32_t domid,
 void libxl__domain_build_state_init(libxl__domain_build_state *state)
 {
     state->dm_monitor_fd = -1;
+    state->template_domid = INVALID_DOMID;
+    state->placed = false;
+    state->claimed = false;
 }
 
 void libxl__domain_build_state_dispose(libxl__domain_build_state *state)
@@ -934,6 +972,10 @@ void libxl__domain_build_state_dispose(libxl__domain_build_state *state)
  */
 
 /* Event callbacks, in this order: */
+static void domcreate_create_locked(libxl__egc *egc,
+                                    libxl__ev_slowlock *lock, int rc);
+static void domcreate_domain_made(libxl__egc *egc,
+                                  libxl__domain_create_state *dcs, int ret);
 static void domcreate_bootloader_console_available(libxl__egc *egc,
                                                    libxl__bootloader_state *bl);
 static void domcreate_console_available(libxl__egc *egc,
@@ -1204,35 +1246,161 @@ int libxl__domain_config_setdefault(libxl__gc *gc,
     return ret;
 }
 
+/*
+ * Only PVH domains can be forked off a template, as there is no device
+ * model state to fork along, and the fork must have as many vCPUs and as
+ * much memory as the template, whose kernel was set up for those.
+ */
+static int domain_check_template(libxl__gc *gc,
+                                 const libxl_domain_config *d_config,
+                                 uint32_t template_domid)
+{
+    const libxl_domain_build_info *b_info = &d_config->b_info;
+    libxl_domain_config t_config;
+    libxl_dominfo info;
+    int rc;
+
+    libxl_dominfo_init(&info);
+    libxl_domain_config_init(&t_config);
+
+    rc = libxl_domain_info(CTX, &info, template_domid);
+    if (rc) {
+        LOGD(ERROR, template_domid, "Template domain doesn't exist");
+        goto out;
+    }
+
+    if (d_config->c_info.type != LIBXL_DOMAIN_TYPE_PVH ||
+        libxl__domain_type(gc, template_domid) != LIBXL_DOMAIN_TYPE_PVH) {
+        LOGD(ERROR, template_domid,
+             "Only PVH domains can be created from a PVH template");
+        rc = ERROR_INVAL;
+        goto out;
+    }
+
+    if (!info.paused || info.dying) {
+        LOGD(ERROR, template_domid, "Template domain isn't paused");
+        rc = ERROR_INVAL;
+        goto out;
+    }
+
+    if (info.vcpu_max_id + 1 != b_info->max_vcpus) {
+        LOGD(ERROR, template_domid, "Template domain has %u vCPUs, not %d",
+             info.vcpu_max_id + 1, b_info->max_vcpus);
+        rc = ERROR_INVAL;
+        goto out;
+    }
+
+    rc = libxl__get_domain_configuration(gc, template_domid, &t_config);
+    if (rc) {
+        LOGD(ERROR, template_domid,
+             "Couldn't retrieve the template domain's configuration");
+        goto out;
+    }
+
+    if ((t_config.b_info.max_memkb != LIBXL_MEMKB_DEFAULT &&
+         t_config.b_info.max_memkb != b_info->max_memkb) ||
+        (t_config.b_info.target_memkb != LIBXL_MEMKB_DEFAULT &&
+         t_config.b_info.target_memkb != b_info->target_memkb)) {
+        LOGD(ERROR, template_domid,
+             "Template domain has %"PRIu64"kB (max %"PRIu64"kB) of memory,"
+             " not %"PRIu64"kB (max %"PRIu64"kB)",
+             t_config.b_info.target_memkb, t_config.b_info.max_memkb,
+             b_info->target_memkb, b_info->max_memkb);
+        rc = ERROR_INVAL;
+    }
+
+ out:
+    libxl_domain_config_dispose(&t_config);
+    libxl_dominfo_dispose(&info);
+    return rc;
+}
+
 static void initiate_domain_create(libxl__egc *egc,
                                    libxl__domain_create_state *dcs)
 {
     STATE_AO_GC(dcs->ao);
-    uint32_t domid;
-    int i, ret;
+    int ret;
 
     /* convenience aliases */
     libxl_domain_config *const d_config = dcs->guest_config;
     libxl__domain_build_state *dbs = &dcs->build_state;
 
     libxl__xswait_init(&dcs->console_xswait);
+    libxl__ev_createlock_init(&dcs->create_lock);
 
-    domid = dcs->domid;
     libxl__domain_build_state_init(dbs);
     dbs->restore = dcs->restore_fd >= 0;
+    dbs->template_domid = dcs->template_domid;
 
-    ret = libxl__domain_config_setdefault(gc,d_config,domid);
+    ret = libxl__domain_config_setdefault(gc,d_config,dcs->domid);
     if (ret) goto error_out;
 
-    ret = libxl__domain_make(gc, d_config, dbs, &domid, dcs->soft_reset);
-    if (ret) {
-        LOGD(ERROR, domid, "cannot make domain: %d", ret);
-        dcs->guest_domid = domid;
-        ret = ERROR_FAIL;
-        goto error_out;
+    if (dbs->template_domid != INVALID_DOMID) {
+        ret = domain_check_template(gc, d_config, dbs->template_domid);
+        if (ret) goto error_out;
+    }
+
+    dcs->create_lock.ao = ao;
+    dcs->create_lock.domid = INVALID_DOMID;
+    dcs->create_lock.callback = domcreate_create_locked;
+    libxl__ev_slowlock_lock(egc, &dcs->create_lock);
+    return;
+
+error_out:
+    assert(ret);
+    domcreate_complete(egc, dcs, ret);
+}
+
+static void domcreate_create_locked(libxl__egc *egc,
+                                    libxl__ev_slowlock *lock, int rc)
+{
+    libxl__domain_create_state *dcs = CONTAINER_OF(lock, *dcs, create_lock);
+    STATE_AO_GC(dcs->ao);
+    uint32_t domid = dcs->domid;
+
+    /* convenience aliases */
+    libxl_domain_config *const d_config = dcs->guest_config;
+    libxl__domain_build_state *dbs = &dcs->build_state;
+
+    if (rc) goto out;
+
+    /* A domain being restored or migrated in may meet itself. */
+    if (!dbs->restore && !dcs->soft_reset) {
+        rc = domain_check_uuid(gc, &d_config->c_info.uuid);
+        if (rc) goto out;
     }
 
+    rc = libxl__domain_make(gc, d_config, dbs, &domid, dcs->soft_reset);
+    if (rc) {
+        LOGD(ERROR, domid, "cannot make domain: %d", rc);
+        dcs->guest_domid = domid;
+        rc = ERROR_FAIL;
+        goto out;
+    }
     dcs->guest_domid = domid;
+
+    /* A domain being soft reset has its memory already. */
+    if (!dcs->soft_reset)
+        rc = libxl__domain_place(gc, domid, d_config, dbs);
+
+ out:
+    libxl__ev_slowlock_unlock(gc, lock);
+    domcreate_domain_made(egc, dcs, rc);
+}
+
+static void domcreate_domain_made(libxl__egc *egc,
+                                  libxl__domain_create_state *dcs, int ret)
+{
+    STATE_AO_GC(dcs->ao);
+    int i;
+
+    /* convenience aliases */
+    const uint32_t domid = dcs->guest_domid;
+    libxl_domain_config *const d_config = dcs->guest_config;
+    libxl__domain_build_state *dbs = &dcs->build_state;
+
+    if (ret) goto error_out;
+
     dcs->sdss.dm.guest_domid = 0; /* means we haven't spawned */
 
     /* post-4.13 todo: move these next bits of defaulting to
@@ -1268,7 +1436,8 @@ static void initiate_domain_create(libxl__egc *egc,
     if (ret)
         goto error_out;
 
-    if (dbs->restore || dcs->soft_reset) {
+    if (dbs->restore || dcs->soft_reset ||
+        dbs->template_domid != INVALID_DOMID) {
         LOGD(DEBUG, domid, "restoring, not running bootloader");
         domcreate_bootloader_done(egc, &dcs->bl, 0);
     } else  {
@@ -2008,6 +2177,7 @@ static void domain_create_cb(libxl__egc *egc,
 static int do_domain_create(libxl_ctx *ctx, libxl_domain_config *d_config,
                             uint32_t *domid, int restore_fd, int send_back_fd,
                             const libxl_domain_restore_params *params,
+                            uint32_t template_domid,
                             const libxl_asyncop_how *ao_how,
                             const libxl_asyncprogress_how *aop_console_how)
 {
@@ -2032,6 +2202,7 @@ static int do_domain_create(libxl_ctx *ctx, libxl_domain_config *d_config,
     cdcs->dcs.callback = domain_create_cb;
     cdcs->dcs.domid = INVALID_DOMID;
     cdcs->dcs.soft_reset = false;
+    cdcs->dcs.template_domid = template_domid;
 
     if (cdcs->dcs.restore_params.checkpointed_stream ==
         LIBXL_CHECKPOINTED_STREAM_COLO) {
@@ -2131,6 +2302,7 @@ static int do_domain_soft_reset(libxl_ctx *ctx,
     cdcs->dcs.restore_fd = -1;
     cdcs->dcs.domid = domid;
     cdcs->dcs.soft_reset = true;
+    cdcs->dcs.template_domid = INVALID_DOMID;
     cdcs->dcs.callback = domain_create_cb;
     libxl__ao_progress_gethow(&srs->cdcs.dcs.aop_console_how,
                               aop_console_how);
@@ -2267,7 +2439,23 @@ int libxl_domain_create_new(libxl_ctx *ctx, libxl_domain_config *d_config,
                             const libxl_asyncprogress_how *aop_console_how)
 {
     unset_disk_colo_restore(d_config);
-    return do_domain_create(ctx, d_config, domid, -1, -1, NULL,
+    return do_domain_create(ctx, d_config, domid, -1, -1, NULL, INVALID_DOMID,
+                            ao_how, aop_console_how);
+}
+
+int libxl_domain_create_from_template(libxl_ctx *ctx,
+                                      libxl_domain_config *d_config,
+                                      uint32_t *domid,
+                                      uint32_t template_domid,
+                                      const libxl_asyncop_how *ao_how,
+                                      const libxl_asyncprogress_how
+                                      *aop_console_how)
+{
+    if (!libxl_domid_valid_guest(template_domid))
+        return ERROR_INVAL;
+
+    unset_disk_colo_restore(d_config);
+    return do_domain_create(ctx, d_config, domid, -1, -1, NULL, template_domid,
                             ao_how, aop_console_how);
 }
 
@@ -2292,7 +2480,7 @@ int libxl_domain_create_restore(libxl_ctx *ctx, libxl_domain_config *d_config,
     libxl_defbool_setdefault(&d_config->b_info.arch_x86.msr_relaxed, true);
 
     return do_domain_create(ctx, d_config, domid, restore_fd, send_back_fd,
-                            params, ao_how, aop_console_how);
+                            params, INVALID_DOMID, ao_how, aop_console_how);
 }
 
 int libxl_domain_soft_reset(libxl_ctx *ctx,
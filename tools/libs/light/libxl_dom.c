@@ -242,12 +242,11 @@ static int numa_place_domain(libxl__gc *gc, uint32_t domid,
     return rc;
 }
 
-int libxl__build_pre(libxl__gc *gc, uint32_t domid,
-              libxl_domain_config *d_config, libxl__domain_build_state *state)
+static int place_domain(libxl__gc *gc, uint32_t domid,
+                        libxl_domain_config *d_config)
 {
     libxl_domain_build_info *const info = &d_config->b_info;
     libxl_ctx *ctx = libxl__gc_owner(gc);
-    char *xs_domid, *con_domid;
     int rc;
     uint64_t size;
 
@@ -367,6 +366,127 @@ int libxl__build_pre(libxl__gc *gc, uint32_t domid,
         return ERROR_FAIL;
     }
 
+    return 0;
+}
+
+/*
+ * The free memory of the nodes only goes down as domains get populated,
+ * and claims are host-wide, so placements done in between would keep
+ * picking the same nodes.  Record how much memory the domain is going to
+ * take from which nodes, in /libxl/<domid>/numa-pending/<node>, for
+ * libxl__get_numa_candidate() to take it into account until
+ * libxl__build_post() removes the record.  Without node affinity, the
+ * memory is assumed to come from all the nodes evenly.
+ */
+static int numa_pending_record(libxl__gc *gc, uint32_t domid,
+                               libxl_domain_build_info *info)
+{
+    const char *path = GCSPRINTF("%s/numa-pending",
+                                 libxl__xs_libxl_path(gc, domid));
+    xs_transaction_t t = XBT_NULL;
+    uint64_t memkb;
+    int i, n = 0, nr_nodes, rc;
+
+    nr_nodes = libxl_get_max_nodes(CTX);
+    if (nr_nodes <= 1)
+        return 0;
+
+    rc = libxl__domain_need_memory_calculate(gc, info, &memkb);
+    if (rc)
+        return rc;
+
+    for (i = 0; i < nr_nodes; i++)
+        if (!info->nodemap.size || libxl_bitmap_test(&info->nodemap, i))
+            n++;
+    if (!n)
+        return 0;
+
+    for (;;) {
+        rc = libxl__xs_transaction_start(gc, &t);
+        if (rc) goto out;
+
+        rc = libxl__xs_rm_checked(gc, t, path);
+        if (rc) goto out;
+
+        for (i = 0; i < nr_nodes; i++) {
+            if (info->nodemap.size && !libxl_bitmap_test(&info->nodemap, i))
+                continue;
+            rc = libxl__xs_printf(gc, t, GCSPRINTF("%s/%d", path, i),
+                                  "%"PRIu64, (memkb + n - 1) / n);
+            if (rc) goto out;
+        }
+
+        rc = libxl__xs_transaction_commit(gc, &t);
+        if (!rc) break;
+        if (rc < 0) goto out;
+    }
+
+    return 0;
+
+ out:
+    libxl__xs_transaction_abort(gc, &t);
+    return rc;
+}
+
+int libxl__domain_place(libxl__gc *gc, uint32_t domid,
+                        libxl_domain_config *d_config,
+                        libxl__domain_build_state *state)
+{
+    libxl_domain_build_info *const info = &d_config->b_info;
+    libxl_ctx *ctx = libxl__gc_owner(gc);
+    int rc;
+
+    rc = place_domain(gc, domid, d_config);
+    if (rc)
+        return rc;
+
+    /*
+     * Claim the memory now, rather than in the builder, for creations
+     * going on at the same time to find it gone from the host.  A fork
+     * only gets memory of its own as it writes to the template's.
+     */
+    if (state->template_domid == INVALID_DOMID) {
+        if (libxl_defbool_val(info->claim_mode) && !state->restore) {
+            uint64_t claim_kb = info->target_memkb;
+
+            if (info->type != LIBXL_DOMAIN_TYPE_PV)
+                claim_kb -= info->video_memkb;
+            if (xc_domain_claim_pages(ctx->xch, domid, claim_kb >> 2)) {
+                LOGE(ERROR, "Couldn't claim %"PRIu64" kB of memory",
+                     claim_kb);
+                return ERROR_NOMEM;
+            }
+            state->claimed = true;
+        }
+
+        rc = numa_pending_record(gc, domid, info);
+        if (rc)
+            return rc;
+    }
+
+    state->placed = true;
+    return 0;
+}
+
+int libxl__build_pre(libxl__gc *gc, uint32_t domid,
+              libxl_domain_config *d_config, libxl__domain_build_state *state)
+{
+    libxl_domain_build_info *const info = &d_config->b_info;
+    libxl_ctx *ctx = libxl__gc_owner(gc);
+    char *xs_domid, *con_domid;
+    int rc;
+
+    /*
+     * Domains not placed under the domain creation lock (stub domains,
+     * and domains being soft reset, which have their memory already) are
+     * placed here, like they always were.
+     */
+    if (!state->placed) {
+        rc = place_domain(gc, domid, d_config);
+        if (rc)
+            return rc;
+    }
+
     xs_domid = xs_read(ctx->xsh, XBT_NULL, "/tool/xenstored/domid", NULL);
     state->store_domid = xs_domid ? atoi(xs_domid) : 0;
     free(xs_domid);
@@ -443,6 +563,19 @@ int libxl__build_post(libxl__gc *gc, uint32_t domid,
     char **ents;
     int i, rc;
 
+    /* Whatever the builder didn't allocate of the early claim goes back. */
+    if (state->claimed)
+        xc_domain_claim_pages(ctx->xch, domid, 0);
+
+    /* The domain's memory now shows in the free memory of the nodes. */
+    if (state->placed) {
+        rc = libxl__xs_rm_checked(gc, XBT_NULL,
+                                  GCSPRINTF("%s/numa-pending",
+                                            libxl__xs_libxl_path(gc, domid)));
+        if (rc)
+            return rc;
+    }
+
     if (info->num_vnuma_nodes && !info->num_vcpu_soft_affinity) {
         rc = set_vnuma_affinity(gc, domid, info);
         if (rc)
@@ -667,7 +800,8 @@ int libxl__build_pv(libxl__gc *gc, uint32_t domid,
     dom->console_domid = state->console_domid;
     dom->xenstore_evtchn = state->store_port;
     dom->xenstore_domid = state->store_domid;
-    dom->claim_enabled = libxl_defbool_val(info->claim_mode);
+    dom->claim_enabled = libxl_defbool_val(info->claim_mode) &&
+                         !state->claimed;
     dom->max_vcpus = info->max_vcpus;
 
     if (info->num_vnuma_nodes != 0) {
@@ -1073,7 +1207,8 @@ int libxl__build_hvm(libxl__gc *gc, uint32_t domid,
      */
     mem_size = (uint64_t)(info->max_memkb - info->video_memkb) << 10;
     dom->target_pages = (uint64_t)(info->target_memkb - info->video_memkb) >> 2;
-    dom->claim_enabled = libxl_defbool_val(info->claim_mode);
+    dom->claim_enabled = libxl_defbool_val(info->claim_mode) &&
+                         !state->claimed;
     if (info->u.hvm.mmio_hole_memkb) {
         uint64_t max_ram_below_4g = (1ULL << 32) -
             (info->u.hvm.mmio_hole_memkb << 10);
@@ -1194,6 +1329,60 @@ out:
     return rc;
 }
 
+int libxl__build_from_template(libxl__gc *gc, uint32_t domid,
+              libxl_domain_config *d_config,
+              libxl__domain_build_state *state)
+{
+    libxl_ctx *ctx = libxl__gc_owner(gc);
+    uint64_t store_pfn = 0, console_pfn = 0;
+    int rc;
+
+    /*
+     * The fork gets the template's vCPU state, HVM context and parameters,
+     * special pages and, lazily, the rest of its memory.
+     */
+    rc = xc_memshr_fork(ctx->xch, state->template_domid, domid, false, false);
+    if (rc) {
+        LOGED(ERROR, domid, "Couldn't fork template domain %u",
+              state->template_domid);
+        return ERROR_FAIL;
+    }
+
+    /*
+     * Event channels and grants aren't copied though, so point the guest
+     * at those allocated by libxl__build_pre().  The template never ran,
+     * so the guest will only look at them once the fork is unpaused.
+     */
+    if (xc_hvm_param_get(ctx->xch, domid, HVM_PARAM_STORE_PFN, &store_pfn) ||
+        xc_hvm_param_get(ctx->xch, domid, HVM_PARAM_CONSOLE_PFN,
+                         &console_pfn) ||
+        xc_hvm_param_set(ctx->xch, domid, HVM_PARAM_STORE_EVTCHN,
+                         state->store_port) ||
+        xc_hvm_param_set(ctx->xch, domid, HVM_PARAM_CONSOLE_EVTCHN,
+                         state->console_port)) {
+        LOGED(ERROR, domid, "Couldn't set up the fork's parameters");
+        return ERROR_FAIL;
+    }
+
+    /* Whatever the template's backends left in the rings isn't ours. */
+    if ((store_pfn && xc_clear_domain_page(ctx->xch, domid, store_pfn)) ||
+        (console_pfn && xc_clear_domain_page(ctx->xch, domid, console_pfn))) {
+        LOGED(ERROR, domid, "Couldn't clear the fork's rings");
+        return ERROR_FAIL;
+    }
+
+    if (xc_dom_gnttab_seed(ctx->xch, domid, true, console_pfn, store_pfn,
+                           state->console_domid, state->store_domid)) {
+        LOGED(ERROR, domid, "Couldn't seed the fork's grant table");
+        return ERROR_FAIL;
+    }
+
+    state->store_mfn = store_pfn;
+    state->console_mfn = console_pfn;
+
+    return 0;
+}
+
 int libxl__qemu_traditional_cmd(libxl__gc *gc, uint32_t domid,
                                 const char *cmd)
 {
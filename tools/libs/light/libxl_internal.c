@@ -619,6 +619,11 @@ void libxl__ev_qmplock_init(libxl__ev_slowlock *lock)
     ev_slowlock_init_internal(lock, "qmp-socket-lock");
 }
 
+void libxl__ev_createlock_init(libxl__ev_slowlock *lock)
+{
+    ev_slowlock_init_internal(lock, NULL);
+}
+
 static void ev_lock_prepare_fork(libxl__egc *egc, libxl__ev_slowlock *lock);
 static void ev_lock_child_callback(libxl__egc *egc, libxl__ev_child *child,
                                    pid_t pid, int status);
@@ -628,8 +633,12 @@ void libxl__ev_slowlock_lock(libxl__egc *egc, libxl__ev_slowlock *lock)
     STATE_AO_GC(lock->ao);
     const char *lockfile;
 
-    lockfile = libxl__userdata_path(gc, lock->domid,
-                                    lock->userdata_userid, "l");
+    if (lock->userdata_userid)
+        lockfile = libxl__userdata_path(gc, lock->domid,
+                                        lock->userdata_userid, "l");
+    else
+        lockfile = GCSPRINTF("%s/domain-create-lock",
+                             libxl__run_dir_path());
     if (!lockfile) goto out;
     lock->path = libxl__strdup(NOGC, lockfile);
 
@@ -755,7 +764,7 @@ static void ev_lock_child_callback(libxl__egc *egc, libxl__ev_child *child,
     return;
 
 out:
-    if (lock->held) {
+    if (lock->held && lock->userdata_userid) {
         /* Check the domain is still there, if not we should release the
          * lock and clean up.  */
         if (libxl_domain_info(CTX, NULL, domid))
@@ -763,7 +772,7 @@ out:
     }
     if (rc) {
         LOGD(ERROR, domid, "Failed to grab lock for %s",
-             lock->userdata_userid);
+             lock->userdata_userid ? : "domain creation");
         libxl__ev_slowlock_unlock(gc, lock);
     }
     lock->callback(egc, lock, rc);
@@ -376,7 +376,7 @@ struct libxl__ev_immediate {
 void libxl__ev_immediate_register(libxl__egc *, libxl__ev_immediate *);
 
 /*
- * Lock for device hotplug, qmp_lock.
+ * Lock for device hotplug, qmp_lock, and for domain creation.
  *
  * libxl__ev_slowlock implement a lock that is outside of CTX_LOCK in the
  * lock hierarchy. It can be used when one want to make QMP calls to QEMU,
@@ -427,6 +427,11 @@ struct libxl__ev_slowlock {
 };
 _hidden void libxl__ev_devlock_init(libxl__ev_slowlock *);
 _hidden void libxl__ev_qmplock_init(libxl__ev_slowlock *);
+/* Host-wide lock, in any process, for the steps of domain creation which
+ * must not interleave with those of other creations: checking the uuid is
+ * unique, making the domain and placing it (see libxl__domain_place).
+ * domid is not used. */
+_hidden void libxl__ev_createlock_init(libxl__ev_slowlock *);
 _hidden void libxl__ev_slowlock_lock(libxl__egc *, libxl__ev_slowlock *);
 _hidden void libxl__ev_slowlock_unlock(libxl__gc *, libxl__ev_slowlock *);
 _hidden void libxl__ev_slowlock_dispose(libxl__gc *, libxl__ev_slowlock *);
@@ -666,6 +671,28 @@ struct libxl__gc {
     libxl_ctx *owner;
 };
 
+/*
+ * Number of vcpus of each domain able to run on each NUMA node, kept
+ * across placements (see nr_vcpus_on_nodes() in libxl_numa.c), for each
+ * of the last few sets of cpus (i.e., usually, cpupools) placement was
+ * done onto.
+ */
+#define LIBXL__NUMA_CACHE_SLOTS 4
+
+typedef struct {
+    uint32_t domid;
+    libxl_uuid uuid;
+    int *vcpus_on_node; /* NULL if it needs computing again */
+} libxl__numa_dom_load;
+
+typedef struct {
+    time_t expires;        /* CLOCK_MONOTONIC seconds */
+    int nr_nodes;
+    libxl_bitmap cpumap;   /* Suitable cpus the load was computed for */
+    int nr_doms;
+    libxl__numa_dom_load *doms; /* Sorted by domid */
+} libxl__numa_cache;
+
 struct libxl__ctx {
     xentoollog_logger *lg;
     xc_interface *xch;
@@ -736,6 +763,8 @@ struct libxl__ctx {
 
     bool libxl_domain_need_memory_0x041200_called,
          libxl_domain_need_memory_called;
+
+    libxl__numa_cache numa_cache[LIBXL__NUMA_CACHE_SLOTS];
 };
 
 /*
@@ -1407,11 +1436,27 @@ typedef struct {
     /* Whether this domain is being migrated/restored, or booting fresh.  Only
      * applicable to the primary domain, not support domains (e.g. stub QEMU). */
     bool restore;
+
+    /* Placed by libxl__domain_place(), so libxl__build_pre() needn't. */
+    bool placed;
+    /* Memory claimed by libxl__domain_place(), so the builder needn't. */
+    bool claimed;
+
+    /* Domain to fork instead of building one, or INVALID_DOMID. */
+    uint32_t template_domid;
 } libxl__domain_build_state;
 
 _hidden void libxl__domain_build_state_init(libxl__domain_build_state *s);
 _hidden void libxl__domain_build_state_dispose(libxl__domain_build_state *s);
 
+/* The part of libxl__build_pre() which must be done under the domain
+ * creation lock (see libxl__ev_createlock_init): sets the vcpu count,
+ * places the domain and claims its memory.  Until libxl__build_post(),
+ * that memory is accounted to the nodes it was placed on, as it only
+ * shows up in their free memory as it gets populated. */
+_hidden int libxl__domain_place(libxl__gc *gc, uint32_t domid,
+              libxl_domain_config *d_config,
+              libxl__domain_build_state *state);
 _hidden int libxl__build_pre(libxl__gc *gc, uint32_t domid,
               libxl_domain_config * const d_config,
               libxl__domain_build_state *state);
@@ -1424,6 +1469,10 @@ _hidden int libxl__build_pv(libxl__gc *gc, uint32_t domid,
 _hidden int libxl__build_hvm(libxl__gc *gc, uint32_t domid,
               libxl_domain_config *d_config,
               libxl__domain_build_state *state);
+/* Builds a PVH domain by forking state->template_domid. */
+_hidden int libxl__build_from_template(libxl__gc *gc, uint32_t domid,
+              libxl_domain_config *d_config,
+              libxl__domain_build_state *state);
 
 _hidden int libxl__qemu_traditional_cmd(libxl__gc *gc, uint32_t domid,
                                         const char *cmd);
@@ -4203,12 +4252,14 @@ struct libxl__domain_create_state {
     libxl_domain_restore_params restore_params;
     uint32_t domid;
     bool soft_reset;
+    uint32_t template_domid; /* INVALID_DOMID unless forking a template */
     libxl__domain_create_cb *callback;
     libxl_asyncprogress_how aop_console_how;
     /* private to domain_create */
     int guest_domid;
     int device_type_idx;
     const char *colo_proxy_script;
+    libxl__ev_slowlock create_lock;
     libxl__domain_build_state build_state;
     libxl__colo_restore_state crs;
     libxl__checkpoint_devices_state cds;
@@ -4490,13 +4541,19 @@ typedef int (*libxl__numa_candidate_cmpf)(const libxl__numa_candidate *c1,
  * is where the heuristics for determining which candidate is the best
  * one is actually implemented. The only bit of it that is hardcoded in
  * this function is the fact that candidates with fewer nodes are always
- * preferrable.
+ * preferrable. When there are too many candidates with a given number of
+ * nodes for all of them to be compared, only the ones made of each node
+ * and of the nodes closest to it are.
  *
  * If at least one suitable candidate is found, it is returned in cndt_out,
  * cndt_found is set to one, and the function returns successfully. On the
  * other hand, if not even one single candidate can be found, the function
  * still returns successfully but cndt_found will be zero.
  *
+ * The free memory of the nodes does not include the memory domains which
+ * have been placed but not populated yet are going to take from them (see
+ * libxl__domain_place()).
+ *
  * Finally, suitable_cpumap is useful for telling that only the cpus in that
  * mask should be considered when generating placement candidates (for
  * example because of cpupools).
@@ -4514,6 +4571,15 @@ _hidden int libxl__get_numa_candidate(libxl__gc *gc,
                                       libxl__numa_candidate *cndt_out,
                                       int *cndt_found);
 
+/*
+ * The load of the domains is cached in the ctx between placements.
+ * Whoever changes the affinity or the cpupool of a domain via the same
+ * ctx invalidates it for that domain; changes done elsewhere show up
+ * when the cache expires.
+ */
+_hidden void libxl__numa_cache_invalidate(libxl__gc *gc, uint32_t domid);
+_hidden void libxl__numa_cache_dispose(libxl_ctx *ctx);
+
 /* Initialization, allocation and deallocation for placement candidates */
 static inline void libxl__numa_candidate_init(libxl__numa_candidate *cndt)
 {
@@ -105,163 +105,249 @@ static int comb_next(comb_iter_t it, int n, int k)
 /* NUMA automatic placement (see libxl_internal.h for details) */
 
 /*
- * This function turns a k-combination iterator into a node map,
- * given another map, telling us which nodes should be considered.
+ * Counting the vcpus able to run on each node means looking at the
+ * affinities of all the vcpus of all the domains, which is by far the most
+ * expensive part of placement on a busy host. The contribution of each
+ * domain is therefore cached in the ctx, and only computed for the domains
+ * that were not there the last time. Affinity changes done via the same
+ * ctx drop the affected domain from the cache (see
+ * libxl__numa_cache_invalidate()), while the ones done by anyone else are
+ * picked up when the cache expires, NUMA_CACHE_TIMEOUT seconds after it
+ * was filled.
  *
- * This means the bits that are set in suitable_nodemap and that
- * corresponds to the indexes of the given combination are the ones
- * that will be set in nodemap.
- *
- * For example, given a fully set suitable_nodemap, if the iterator
- * represents the combination { 0, 2, 4}, nodmeap will have bits #0,
- * #2 and #4 set.
- * On the other hand, if, say,  suitable_nodemap=01011011, the same
- * iterator will cause bits #1, #4 and #7 of nodemap to be set.
+ * What a domain contributes depends on the cpus placement is restricted
+ * to, so there is one cache per set of them, up to LIBXL__NUMA_CACHE_SLOTS
+ * different ones.
  */
-static void comb_get_nodemap(comb_iter_t it, libxl_bitmap *suitable_nodemap,
-                             libxl_bitmap *nodemap, int k)
+#define NUMA_CACHE_TIMEOUT 10
+
+static void numa_cache_clear(libxl__numa_cache *cache)
 {
-    int i, m = 0, n = 0;
+    int i;
 
-    libxl_bitmap_set_none(nodemap);
-    libxl_for_each_set_bit(i, *suitable_nodemap) {
-        /* Check wether the n-th set bit of suitable_nodemap
-         * matches with the m-th element of the iterator (and,
-         * only if it does, advance to the next one) */
-        if (m < k && n == it[m]) {
-            libxl_bitmap_set(nodemap, i);
-            m++;
-        }
-        n++;
+    for (i = 0; i < cache->nr_doms; i++)
+        free(cache->doms[i].vcpus_on_node);
+    free(cache->doms);
+    cache->doms = NULL;
+    cache->nr_doms = 0;
+}
+
+void libxl__numa_cache_dispose(libxl_ctx *ctx)
+{
+    int s;
+
+    for (s = 0; s < LIBXL__NUMA_CACHE_SLOTS; s++) {
+        numa_cache_clear(&ctx->numa_cache[s]);
+        libxl_bitmap_dispose(&ctx->numa_cache[s].cpumap);
     }
 }
 
-/* Retrieve the number of cpus that the nodes that are part of the nodemap
- * span and are also set in suitable_cpumap. */
-static int nodemap_to_nr_cpus(libxl_cputopology *tinfo, int nr_cpus,
-                              const libxl_bitmap *suitable_cpumap,
-                              const libxl_bitmap *nodemap)
+void libxl__numa_cache_invalidate(libxl__gc *gc, uint32_t domid)
 {
-    int i, nodes_cpus = 0;
+    int s, i;
 
-    for (i = 0; i < nr_cpus; i++) {
-        if (libxl_bitmap_test(suitable_cpumap, i) &&
-            libxl_bitmap_test(nodemap, tinfo[i].node))
-            nodes_cpus++;
+    CTX_LOCK;
+    for (s = 0; s < LIBXL__NUMA_CACHE_SLOTS; s++) {
+        libxl__numa_cache *cache = &CTX->numa_cache[s];
+
+        for (i = 0; i < cache->nr_doms; i++) {
+            if (cache->doms[i].domid == domid) {
+                free(cache->doms[i].vcpus_on_node);
+                cache->doms[i].vcpus_on_node = NULL;
+                break;
+            }
+        }
     }
-    return nodes_cpus;
+    CTX_UNLOCK;
 }
 
-/* Retrieve the amount of free memory within the nodemap */
-static uint32_t nodemap_to_free_memkb(libxl_numainfo *ninfo,
-                                      libxl_bitmap *nodemap)
+/*
+ * The cache for placing onto suitable_cpumap: the one already there for it,
+ * if still valid, or else the least recently filled one, emptied.
+ */
+static libxl__numa_cache *numa_cache_get(libxl__gc *gc, int nr_nodes,
+                                         const libxl_bitmap *suitable_cpumap)
 {
-    uint32_t free_memkb = 0;
-    int i;
+    libxl__numa_cache *cache = NULL;
+    struct timespec now;
+    int s;
 
-    libxl_for_each_set_bit(i, *nodemap)
-        free_memkb += ninfo[i].free / 1024;
+    clock_gettime(CLOCK_MONOTONIC, &now);
 
-    return free_memkb;
+    for (s = 0; s < LIBXL__NUMA_CACHE_SLOTS; s++) {
+        libxl__numa_cache *c = &CTX->numa_cache[s];
+
+        if (c->nr_nodes == nr_nodes && now.tv_sec < c->expires &&
+            libxl_bitmap_equal(&c->cpumap, suitable_cpumap, 0))
+            return c;
+        if (!cache || c->expires < cache->expires)
+            cache = c;
+    }
+
+    numa_cache_clear(cache);
+    libxl_bitmap_dispose(&cache->cpumap);
+    libxl_bitmap_copy_alloc(CTX, &cache->cpumap, suitable_cpumap);
+    cache->nr_nodes = nr_nodes;
+    cache->expires = now.tv_sec + NUMA_CACHE_TIMEOUT;
+
+    return cache;
 }
 
-/* Retrieve the number of vcpus able to run on the nodes in nodemap */
-static int nodemap_to_nr_vcpus(libxl__gc *gc, int vcpus_on_node[],
-                               const libxl_bitmap *nodemap)
+/* Number of vcpus of a domain able to run on the cpus of the various nodes
+ * (reported by incrementing the elements of the array vcpus_on_node[]). */
+static int dom_vcpus_on_nodes(libxl__gc *gc, libxl_cputopology *tinfo,
+                              size_t tinfo_elements,
+                              const libxl_bitmap *suitable_cpumap,
+                              uint32_t domid,
+                              const libxl_bitmap *cpupool_cpumap,
+                              libxl_bitmap *dom_nodemap,
+                              libxl_bitmap *nodes_counted,
+                              int vcpus_on_node[])
 {
-    int i, nr_vcpus = 0;
+    libxl_vcpuinfo *vinfo;
+    int nr_dom_vcpus = 0, nr_cpus;
+    int j, k;
 
-    libxl_for_each_set_bit(i, *nodemap)
-        nr_vcpus += vcpus_on_node[i];
+    vinfo = libxl_list_vcpu(CTX, domid, &nr_dom_vcpus, &nr_cpus);
+    if (vinfo == NULL)
+        return ERROR_FAIL;
+
+    /* Retrieve the domain's node-affinity map */
+    libxl_domain_get_nodeaffinity(CTX, domid, dom_nodemap);
 
-    return nr_vcpus;
+    for (j = 0; j < nr_dom_vcpus; j++) {
+        /*
+         * For each vcpu of each domain, it must have both vcpu-affinity
+         * and node-affinity to (a pcpu belonging to) a certain node to
+         * cause an increment in the corresponding element of the array.
+         *
+         * Note that we also need to check whether the cpu actually
+         * belongs to the domain's cpupool (the cpupool of the domain
+         * being checked). In fact, it could be that the vcpu has affinity
+         * with cpus in suitable_cpumask, but that are not in its own
+         * cpupool, and we don't want to consider those!
+         */
+        libxl_bitmap_set_none(nodes_counted);
+        libxl_for_each_set_bit(k, vinfo[j].cpumap) {
+            if (k >= tinfo_elements)
+                break;
+            int node = tinfo[k].node;
+
+            if (libxl_bitmap_test(suitable_cpumap, k) &&
+                libxl_bitmap_test(cpupool_cpumap, k) &&
+                libxl_bitmap_test(dom_nodemap, node) &&
+                !libxl_bitmap_test(nodes_counted, node)) {
+                libxl_bitmap_set(nodes_counted, node);
+                vcpus_on_node[node]++;
+            }
+        }
+    }
+
+    libxl_vcpuinfo_list_free(vinfo, nr_dom_vcpus);
+    return 0;
 }
 
 /* Number of vcpus able to run on the cpus of the various nodes
  * (reported by filling the array vcpus_on_node[]). */
 static int nr_vcpus_on_nodes(libxl__gc *gc, libxl_cputopology *tinfo,
-                             size_t tinfo_elements,
+                             size_t tinfo_elements, int nr_nodes,
                              const libxl_bitmap *suitable_cpumap,
                              int vcpus_on_node[])
 {
+    libxl__numa_cache *cache;
+    libxl__numa_dom_load *doms;
     libxl_dominfo *dinfo = NULL;
+    libxl_cpupoolinfo *pinfo = NULL;
     libxl_bitmap dom_nodemap, nodes_counted;
-    int nr_doms, nr_cpus;
-    int i, j, k;
+    int nr_doms, nr_pools = 0, nr_cached = 0;
+    int i, j, c, rc;
+
+    libxl_bitmap_init(&dom_nodemap);
+    libxl_bitmap_init(&nodes_counted);
 
     dinfo = libxl_list_domain(CTX, &nr_doms);
     if (dinfo == NULL)
         return ERROR_FAIL;
 
-    if (libxl_node_bitmap_alloc(CTX, &nodes_counted, 0) < 0) {
-        libxl_dominfo_list_free(dinfo, nr_doms);
-        return ERROR_FAIL;
-    }
+    rc = libxl_node_bitmap_alloc(CTX, &nodes_counted, 0);
+    if (rc)
+        goto out;
+    rc = libxl_node_bitmap_alloc(CTX, &dom_nodemap, 0);
+    if (rc)
+        goto out;
 
-    if (libxl_node_bitmap_alloc(CTX, &dom_nodemap, 0) < 0) {
-        libxl_bitmap_dispose(&nodes_counted);
-        libxl_dominfo_list_free(dinfo, nr_doms);
-        return ERROR_FAIL;
-    }
+    CTX_LOCK;
 
-    for (i = 0; i < nr_doms; i++) {
-        libxl_vcpuinfo *vinfo = NULL;
-        int nr_dom_vcpus = 0;
-        libxl_cpupoolinfo cpupool_info;
-        int cpupool;
-
-        libxl_cpupoolinfo_init(&cpupool_info);
-
-        cpupool = libxl__domain_cpupool(gc, dinfo[i].domid);
-        if (cpupool < 0)
-            goto next;
-        if (libxl_cpupool_info(CTX, &cpupool_info, cpupool))
-            goto next;
-
-        vinfo = libxl_list_vcpu(CTX, dinfo[i].domid, &nr_dom_vcpus, &nr_cpus);
-        if (vinfo == NULL)
-            goto next;
-
-        /* Retrieve the domain's node-affinity map */
-        libxl_domain_get_nodeaffinity(CTX, dinfo[i].domid, &dom_nodemap);
-
-        for (j = 0; j < nr_dom_vcpus; j++) {
-            /*
-             * For each vcpu of each domain, it must have both vcpu-affinity
-             * and node-affinity to (a pcpu belonging to) a certain node to
-             * cause an increment in the corresponding element of the array.
-             *
-             * Note that we also need to check whether the cpu actually
-             * belongs to the domain's cpupool (the cpupool of the domain
-             * being checked). In fact, it could be that the vcpu has affinity
-             * with cpus in suitable_cpumask, but that are not in its own
-             * cpupool, and we don't want to consider those!
-             */
-            libxl_bitmap_set_none(&nodes_counted);
-            libxl_for_each_set_bit(k, vinfo[j].cpumap) {
-                if (k >= tinfo_elements)
-                    break;
-                int node = tinfo[k].node;
-
-                if (libxl_bitmap_test(suitable_cpumap, k) &&
-                    libxl_bitmap_test(&cpupool_info.cpumap, k) &&
-                    libxl_bitmap_test(&dom_nodemap, node) &&
-                    !libxl_bitmap_test(&nodes_counted, node)) {
-                    libxl_bitmap_set(&nodes_counted, node);
-                    vcpus_on_node[node]++;
-                }
-            }
+    cache = numa_cache_get(gc, nr_nodes, suitable_cpumap);
+
+    /*
+     * Both the domain list and the cache are sorted by domid, so walk them
+     * in parallel, taking over what is in the cache for the domains that
+     * are still there, and computing the rest.
+     */
+    doms = libxl__calloc(NOGC, nr_doms, sizeof(*doms));
+    for (i = 0, c = 0; i < nr_doms; i++) {
+        libxl__numa_dom_load *dom = &doms[i];
+
+        dom->domid = dinfo[i].domid;
+        libxl_uuid_copy(CTX, &dom->uuid, &dinfo[i].uuid);
+
+        while (c < cache->nr_doms && cache->doms[c].domid < dom->domid)
+            c++;
+        if (c < cache->nr_doms && cache->doms[c].domid == dom->domid &&
+            !libxl_uuid_compare(&cache->doms[c].uuid, &dom->uuid) &&
+            cache->doms[c].vcpus_on_node) {
+            dom->vcpus_on_node = cache->doms[c].vcpus_on_node;
+            cache->doms[c].vcpus_on_node = NULL;
+            nr_cached++;
+            continue;
         }
 
- next:
-        libxl_cpupoolinfo_dispose(&cpupool_info);
-        libxl_vcpuinfo_list_free(vinfo, nr_dom_vcpus);
+        if (pinfo == NULL) {
+            pinfo = libxl_list_cpupool(CTX, &nr_pools);
+            if (pinfo == NULL)
+                nr_pools = 0;
+        }
+        for (j = 0; j < nr_pools; j++)
+            if (pinfo[j].poolid == dinfo[i].cpupool)
+                break;
+        if (j == nr_pools)
+            continue;
+
+        /* Domains going away meanwhile are neither counted nor cached. */
+        dom->vcpus_on_node = libxl__calloc(NOGC, nr_nodes,
+                                           sizeof(*dom->vcpus_on_node));
+        if (dom_vcpus_on_nodes(gc, tinfo, tinfo_elements, suitable_cpumap,
+                               dom->domid, &pinfo[j].cpumap, &dom_nodemap,
+                               &nodes_counted, dom->vcpus_on_node)) {
+            free(dom->vcpus_on_node);
+            dom->vcpus_on_node = NULL;
+        }
     }
 
+    numa_cache_clear(cache);
+    cache->doms = doms;
+    cache->nr_doms = nr_doms;
+
+    for (i = 0; i < nr_doms; i++) {
+        if (!doms[i].vcpus_on_node)
+            continue;
+        for (j = 0; j < nr_nodes; j++)
+            vcpus_on_node[j] += doms[i].vcpus_on_node[j];
+    }
+
+    CTX_UNLOCK;
+
+    LOG(DEBUG, "NUMA placement: load of %d domains counted, %d of them "
+               "from the cache", nr_doms, nr_cached);
+
+ out:
+    if (pinfo)
+        libxl_cpupoolinfo_list_free(pinfo, nr_pools);
     libxl_bitmap_dispose(&dom_nodemap);
     libxl_bitmap_dispose(&nodes_counted);
     libxl_dominfo_list_free(dinfo, nr_doms);
-    return 0;
+    return rc;
 }
 
 /*
@@ -298,6 +384,310 @@ static int count_cpus_per_node(libxl_cputopology *tinfo, int nr_cpus,
     return cpus_per_node;
 }
 
+/*
+ * Everything the search needs to know about the suitable nodes, indexed
+ * by their position among the suitable nodes (which is what the elements
+ * of a combination iterator are), so that evaluating a candidate only
+ * means summing up k elements of a few arrays.
+ */
+typedef struct {
+    int nr;             /* Number of suitable nodes */
+    int *node;          /* Node ids */
+    uint64_t *free_memkb;
+    int *nr_cpus;       /* Suitable cpus on the node */
+    int *nr_vcpus;      /* Vcpus able to run on the node */
+    unsigned int *dist; /* nr x nr distances, if known */
+    uint64_t *max_memkb; /* max_memkb[k] is the most free memory k nodes
+                          * can have, max_cpus[k] the most cpus */
+    int *max_cpus;
+} numa_nodes;
+
+static int cmp_desc_u64(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+
+    return x < y ? 1 : x > y ? -1 : 0;
+}
+
+static int cmp_desc_int(const void *a, const void *b)
+{
+    return *(const int *)b - *(const int *)a;
+}
+
+/*
+ * Take the memory domains are still to get from each node, as recorded
+ * when they were placed (see numa_pending_record() in libxl_dom.c), off
+ * the free memory of the nodes.
+ */
+static int numa_pending_subtract(libxl__gc *gc, libxl_numainfo *ninfo,
+                                 int nr_nodes)
+{
+    char **doms, **nodes;
+    const char *path, *val;
+    unsigned int nr_doms, nr, i, j;
+    unsigned long node;
+    uint64_t b;
+    int rc;
+
+    doms = libxl__xs_directory(gc, XBT_NULL, "/libxl", &nr_doms);
+    if (!doms)
+        return 0;
+
+    for (i = 0; i < nr_doms; i++) {
+        path = GCSPRINTF("/libxl/%s/numa-pending", doms[i]);
+        nodes = libxl__xs_directory(gc, XBT_NULL, path, &nr);
+        for (j = 0; nodes && j < nr; j++) {
+            rc = libxl__xs_read_checked(gc, XBT_NULL,
+                                        GCSPRINTF("%s/%s", path, nodes[j]),
+                                        &val);
+            if (rc)
+                return rc;
+            node = strtoul(nodes[j], NULL, 10);
+            /* The domain may have got populated in the meantime. */
+            if (!val || node >= nr_nodes)
+                continue;
+
+            b = strtoull(val, NULL, 10) << 10;
+            ninfo[node].free -= b < ninfo[node].free ? b : ninfo[node].free;
+        }
+    }
+
+    return 0;
+}
+
+static void numa_nodes_init(libxl__gc *gc, numa_nodes *nodes,
+                            const libxl_bitmap *suitable_nodemap,
+                            const libxl_bitmap *suitable_cpumap,
+                            libxl_numainfo *ninfo, int nr_nodes,
+                            libxl_cputopology *tinfo, int nr_cpus,
+                            const int vcpus_on_node[])
+{
+    uint64_t *mem;
+    int *cpus;
+    int i, j, n = libxl_bitmap_count_set(suitable_nodemap);
+
+    nodes->nr = n;
+    GCNEW_ARRAY(nodes->node, n);
+    GCNEW_ARRAY(nodes->free_memkb, n);
+    GCNEW_ARRAY(nodes->nr_cpus, n);
+    GCNEW_ARRAY(nodes->nr_vcpus, n);
+    GCNEW_ARRAY(nodes->dist, n * n);
+    GCNEW_ARRAY(nodes->max_memkb, n + 1);
+    GCNEW_ARRAY(nodes->max_cpus, n + 1);
+
+    j = 0;
+    libxl_for_each_set_bit(i, *suitable_nodemap) {
+        if (i >= nr_nodes)
+            break;
+        nodes->node[j] = i;
+        nodes->free_memkb[j] = ninfo[i].free / 1024;
+        nodes->nr_vcpus[j] = vcpus_on_node[i];
+        j++;
+    }
+    nodes->nr = n = j;
+
+    for (i = 0; i < nr_cpus; i++) {
+        if (!libxl_bitmap_test(suitable_cpumap, i))
+            continue;
+        for (j = 0; j < n; j++) {
+            if (tinfo[i].node == nodes->node[j]) {
+                nodes->nr_cpus[j]++;
+                break;
+            }
+        }
+    }
+
+    /* Without distance information, every other node is as far away. */
+    for (i = 0; i < n; i++) {
+        const libxl_numainfo *ni = &ninfo[nodes->node[i]];
+
+        for (j = 0; j < n; j++)
+            nodes->dist[i * n + j] = nodes->node[j] < ni->num_dists ?
+                                     ni->dists[nodes->node[j]] : (i != j);
+    }
+
+    /* Upper bounds for pruning whole candidate sizes. */
+    GCNEW_ARRAY(mem, n);
+    GCNEW_ARRAY(cpus, n);
+    memcpy(mem, nodes->free_memkb, n * sizeof(*mem));
+    memcpy(cpus, nodes->nr_cpus, n * sizeof(*cpus));
+    qsort(mem, n, sizeof(*mem), cmp_desc_u64);
+    qsort(cpus, n, sizeof(*cpus), cmp_desc_int);
+    for (i = 0; i < n; i++) {
+        nodes->max_memkb[i + 1] = nodes->max_memkb[i] + mem[i];
+        nodes->max_cpus[i + 1] = nodes->max_cpus[i] + cpus[i];
+    }
+}
+
+/*
+ * Searching all the combinations of k nodes is only done when there are
+ * no more than this many of them. Larger sizes are searched greedily,
+ * starting from each node and growing towards the closest ones, which
+ * keeps placement time bounded on hosts with many nodes.
+ */
+#define NUMA_MAX_COMBINATIONS 65536
+
+static uint64_t binomial(int n, int k)
+{
+    uint64_t r = 1;
+    int i;
+
+    for (i = 1; i <= k; i++) {
+        r = r * (n - k + i) / i;
+        if (r > NUMA_MAX_COMBINATIONS)
+            break;
+    }
+    return r;
+}
+
+/* State of the search for the best candidate, and its result so far. */
+typedef struct {
+    const numa_nodes *nodes;
+    uint64_t min_free_memkb;
+    int min_cpus;
+    libxl__numa_candidate_cmpf numa_cmpf;
+    libxl__numa_candidate *new_cndt, *cndt_out;
+    libxl_bitmap *nodemap;
+    int found;
+    unsigned long evaluated;
+} numa_search;
+
+/*
+ * Check the combination of the k suitable nodes with indexes idx[] against
+ * the constraints, and compare it with the best candidate found so far.
+ * Returns 1 if the search can stop there.
+ */
+static int numa_consider(libxl__gc *gc, numa_search *s,
+                         const int *idx, int k)
+{
+    const numa_nodes *nodes = s->nodes;
+    libxl__numa_candidate *new_cndt = s->new_cndt;
+    uint64_t free_memkb = 0;
+    int i, nr_cpus = 0, nr_vcpus = 0;
+
+    s->evaluated++;
+
+    /* If there is not enough memory in this combination, skip it */
+    for (i = 0; i < k; i++)
+        free_memkb += nodes->free_memkb[idx[i]];
+    if (s->min_free_memkb && free_memkb < s->min_free_memkb)
+        return 0;
+
+    /* And the same applies if this combination is short in cpus */
+    for (i = 0; i < k; i++)
+        nr_cpus += nodes->nr_cpus[idx[i]];
+    if (s->min_cpus && nr_cpus < s->min_cpus)
+        return 0;
+
+    for (i = 0; i < k; i++)
+        nr_vcpus += nodes->nr_vcpus[idx[i]];
+
+    libxl_bitmap_set_none(s->nodemap);
+    for (i = 0; i < k; i++)
+        libxl_bitmap_set(s->nodemap, nodes->node[idx[i]]);
+
+    /*
+     * Conditions are met, we can compare this candidate with the
+     * current best one (if any).
+     */
+    libxl__numa_candidate_put_nodemap(gc, new_cndt, s->nodemap);
+    new_cndt->nr_vcpus = nr_vcpus;
+    new_cndt->free_memkb = free_memkb;
+    new_cndt->nr_nodes = k;
+    new_cndt->nr_cpus = nr_cpus;
+
+    /*
+     * Check if the new candidate we is better the what we found up
+     * to now by means of the comparison function. If no comparison
+     * function is provided, just return as soon as we find our first
+     * candidate.
+     */
+    if (!s->found || s->numa_cmpf(new_cndt, s->cndt_out) < 0) {
+        libxl__numa_candidate *cndt_out = s->cndt_out;
+
+        s->found = 1;
+
+        LOG(DEBUG, "New best NUMA placement candidate found: "
+                   "nr_nodes=%d, nr_cpus=%d, nr_vcpus=%d, "
+                   "free_memkb=%"PRIu64"", new_cndt->nr_nodes,
+                   new_cndt->nr_cpus, new_cndt->nr_vcpus,
+                   new_cndt->free_memkb / 1024);
+
+        libxl__numa_candidate_put_nodemap(gc, cndt_out, s->nodemap);
+        cndt_out->nr_vcpus = new_cndt->nr_vcpus;
+        cndt_out->free_memkb = new_cndt->free_memkb;
+        cndt_out->nr_nodes = new_cndt->nr_nodes;
+        cndt_out->nr_cpus = new_cndt->nr_cpus;
+
+        if (s->numa_cmpf == NULL)
+            return 1;
+    }
+
+    return 0;
+}
+
+/* Generate and check all the combinations of k suitable nodes. */
+static void numa_search_all(libxl__gc *gc, numa_search *s, int k)
+{
+    comb_iter_t comb_iter;
+    int comb_ok;
+
+    for (comb_ok = comb_init(gc, &comb_iter, s->nodes->nr, k);
+         comb_ok;
+         comb_ok = comb_next(comb_iter, s->nodes->nr, k)) {
+        if (numa_consider(gc, s, comb_iter, k))
+            break;
+    }
+}
+
+/*
+ * Check, for each suitable node, the candidate made of it and of the k-1
+ * nodes that are closest to it (as a group: each next node is the one
+ * with the smallest total distance from those already picked, the one
+ * with more free memory in case of ties).
+ */
+static void numa_search_greedy(libxl__gc *gc, numa_search *s, int k)
+{
+    const numa_nodes *nodes = s->nodes;
+    int n = nodes->nr;
+    int *idx, *dist;
+    bool *picked;
+    int seed, i, j;
+
+    GCNEW_ARRAY(idx, k);
+    GCNEW_ARRAY(dist, n);
+    GCNEW_ARRAY(picked, n);
+
+    for (seed = 0; seed < n; seed++) {
+        memset(picked, 0, n * sizeof(*picked));
+        memset(dist, 0, n * sizeof(*dist));
+
+        for (i = 0; i < k; i++) {
+            int best = seed;
+
+            if (i) {
+                best = -1;
+                for (j = 0; j < n; j++) {
+                    if (picked[j])
+                        continue;
+                    if (best < 0 || dist[j] < dist[best] ||
+                        (dist[j] == dist[best] &&
+                         nodes->free_memkb[j] > nodes->free_memkb[best]))
+                        best = j;
+                }
+            }
+
+            idx[i] = best;
+            picked[best] = true;
+            for (j = 0; j < n; j++)
+                dist[j] += nodes->dist[best * n + j];
+        }
+
+        if (numa_consider(gc, s, idx, k))
+            break;
+    }
+}
+
 /*
  * Looks for the placement candidates that satisfyies some specific
  * conditions and return the best one according to the provided
@@ -316,6 +706,8 @@ int libxl__get_numa_candidate(libxl__gc *gc,
     libxl_numainfo *ninfo = NULL;
     int nr_nodes = 0, nr_suit_nodes, nr_cpus = 0;
     libxl_bitmap suitable_nodemap, nodemap;
+    numa_nodes nodes;
+    numa_search search;
     int *vcpus_on_node, rc = 0;
 
     libxl_bitmap_init(&nodemap);
@@ -332,33 +724,11 @@ int libxl__get_numa_candidate(libxl__gc *gc,
         goto out;
     }
 
-    GCNEW_ARRAY(vcpus_on_node, nr_nodes);
-
-    /*
-     * The good thing about this solution is that it is based on heuristics
-     * (implemented in numa_cmpf() ), but we at least can evaluate it on
-     * all the possible placement candidates. That can happen because the
-     * number of nodes present in current NUMA systems is quite small.
-     * In fact, even if a sum of binomials is involved, if the system has
-     * up to 16 nodes it "only" takes 65535 steps. This is fine, as the
-     * number of nodes the biggest NUMA systems provide at the time of this
-     * writing is 8 (and it will probably continue to be so for a while).
-     * However, computanional complexity would explode on systems bigger
-     * than that, and it's really important we avoid trying to run this
-     * on monsters with 32, 64 or more nodes (if they ever pop into being).
-     * Therefore, here it comes a safety catch that disables the algorithm
-     * for the cases when it wouldn't work well.
-     */
-    if (nr_nodes > 16) {
-        /* Log we did nothing and return 0, as no real error occurred */
-        LOG(WARN, "System has %d NUMA nodes, which is too big for the "
-                  "placement algorithm to work effectively: skipping it. "
-                  "Consider manually pinning the vCPUs and/or looking at "
-                  "cpupools for manually partitioning the system.",
-                  nr_nodes);
-        *cndt_found = 0;
+    rc = numa_pending_subtract(gc, ninfo, nr_nodes);
+    if (rc)
         goto out;
-    }
+
+    GCNEW_ARRAY(vcpus_on_node, nr_nodes);
 
     tinfo = libxl_get_cpu_topology(CTX, &nr_cpus);
     if (tinfo == NULL) {
@@ -391,10 +761,14 @@ int libxl__get_numa_candidate(libxl__gc *gc,
      * all we have to do later is summing up the right elements of the
      * vcpus_on_node array.
      */
-    rc = nr_vcpus_on_nodes(gc, tinfo, nr_cpus, suitable_cpumap, vcpus_on_node);
+    rc = nr_vcpus_on_nodes(gc, tinfo, nr_cpus, nr_nodes, suitable_cpumap,
+                           vcpus_on_node);
     if (rc)
         goto out;
 
+    numa_nodes_init(gc, &nodes, &suitable_nodemap, suitable_cpumap,
+                    ninfo, nr_nodes, tinfo, nr_cpus, vcpus_on_node);
+
     /*
      * If the minimum number of NUMA nodes is not explicitly specified
      * (i.e., min_nodes == 0), we try to figure out a sensible number of nodes
@@ -414,7 +788,7 @@ int libxl__get_numa_candidate(libxl__gc *gc,
     }
     /* We also need to be sure we do not exceed the number of
      * nodes we are allowed to use. */
-    nr_suit_nodes = libxl_bitmap_count_set(&suitable_nodemap);
+    nr_suit_nodes = nodes.nr;
 
     if (min_nodes > nr_suit_nodes)
         min_nodes = nr_suit_nodes;
@@ -431,6 +805,16 @@ int libxl__get_numa_candidate(libxl__gc *gc,
     if (rc)
         goto out;
 
+    search.nodes = &nodes;
+    search.min_free_memkb = min_free_memkb;
+    search.min_cpus = min_cpus;
+    search.numa_cmpf = numa_cmpf;
+    search.new_cndt = &new_cndt;
+    search.cndt_out = cndt_out;
+    search.nodemap = &nodemap;
+    search.found = 0;
+    search.evaluated = 0;
+
     /*
      * Consider all the combinations with sizes in [min_nodes, max_nodes]
      * (see comb_init() and comb_next()). Note that, since the fewer the
@@ -439,83 +823,29 @@ int libxl__get_numa_candidate(libxl__gc *gc,
      * could find during the (i+1)-eth and all the subsequent steps (they
      * all will have more nodes). It's thus pointless to keep going if
      * we already found something.
+     *
+     * Sizes for which even the nodes with the most memory, or with the
+     * most cpus, are not enough can't produce any candidate, and are
+     * skipped without generating their combinations.
      */
-    *cndt_found = 0;
-    while (min_nodes <= max_nodes && *cndt_found == 0) {
-        comb_iter_t comb_iter;
-        int comb_ok;
-
-        /*
-         * And here it is. Each step of this cycle generates a combination of
-         * nodes as big as min_nodes mandates.  Each of these combinations is
-         * checked against the constraints provided by the caller (namely,
-         * amount of free memory and number of cpus) and it can concur to
-         * become our best placement iff it passes the check.
-         */
-        for (comb_ok = comb_init(gc, &comb_iter, nr_suit_nodes, min_nodes);
-             comb_ok;
-             comb_ok = comb_next(comb_iter, nr_suit_nodes, min_nodes)) {
-            uint64_t nodes_free_memkb;
-            int nodes_cpus;
-
-            /* Get the nodemap for the combination, only considering
-             * suitable nodes. */
-            comb_get_nodemap(comb_iter, &suitable_nodemap,
-                             &nodemap, min_nodes);
-
-            /* If there is not enough memory in this combination, skip it
-             * and go generating the next one... */
-            nodes_free_memkb = nodemap_to_free_memkb(ninfo, &nodemap);
-            if (min_free_memkb && nodes_free_memkb < min_free_memkb)
-                continue;
-
-            /* And the same applies if this combination is short in cpus */
-            nodes_cpus = nodemap_to_nr_cpus(tinfo, nr_cpus, suitable_cpumap,
-                                            &nodemap);
-            if (min_cpus && nodes_cpus < min_cpus)
-                continue;
-
-            /*
-             * Conditions are met, we can compare this candidate with the
-             * current best one (if any).
-             */
-            libxl__numa_candidate_put_nodemap(gc, &new_cndt, &nodemap);
-            new_cndt.nr_vcpus = nodemap_to_nr_vcpus(gc, vcpus_on_node,
-                                                    &nodemap);
-            new_cndt.free_memkb = nodes_free_memkb;
-            new_cndt.nr_nodes = libxl_bitmap_count_set(&nodemap);
-            new_cndt.nr_cpus = nodes_cpus;
-
-            /*
-             * Check if the new candidate we is better the what we found up
-             * to now by means of the comparison function. If no comparison
-             * function is provided, just return as soon as we find our first
-             * candidate.
-             */
-            if (*cndt_found == 0 || numa_cmpf(&new_cndt, cndt_out) < 0) {
-                *cndt_found = 1;
-
-                LOG(DEBUG, "New best NUMA placement candidate found: "
-                           "nr_nodes=%d, nr_cpus=%d, nr_vcpus=%d, "
-                           "free_memkb=%"PRIu64"", new_cndt.nr_nodes,
-                           new_cndt.nr_cpus, new_cndt.nr_vcpus,
-                           new_cndt.free_memkb / 1024);
-
-                libxl__numa_candidate_put_nodemap(gc, cndt_out, &nodemap);
-                cndt_out->nr_vcpus = new_cndt.nr_vcpus;
-                cndt_out->free_memkb = new_cndt.free_memkb;
-                cndt_out->nr_nodes = new_cndt.nr_nodes;
-                cndt_out->nr_cpus = new_cndt.nr_cpus;
-
-                if (numa_cmpf == NULL)
-                    break;
-            }
-        }
-        min_nodes++;
+    for (; min_nodes <= max_nodes && !search.found; min_nodes++) {
+        if ((min_free_memkb &&
+             nodes.max_memkb[min_nodes] < min_free_memkb) ||
+            (min_cpus && nodes.max_cpus[min_nodes] < min_cpus))
+            continue;
+
+        if (binomial(nr_suit_nodes, min_nodes) <= NUMA_MAX_COMBINATIONS)
+            numa_search_all(gc, &search, min_nodes);
+        else
+            numa_search_greedy(gc, &search, min_nodes);
     }
 
+    *cndt_found = search.found;
     if (*cndt_found == 0)
         LOG(NOTICE, "NUMA placement failed, performance might be affected");
+    else
+        LOG(DEBUG, "NUMA placement: %lu candidates evaluated",
+            search.evaluated);
 
  out:
     libxl_bitmap_dispose(&nodemap);
@@ -63,6 +63,7 @@ static int libxl__set_vcpuaffinity(libxl_ctx *ctx, uint32_t domid,
         rc = ERROR_FAIL;
         goto out;
     }
+    libxl__numa_cache_invalidate(gc, domid);
 
     /*
      * Let's check the results. Hard affinity will never be empty, but it
@@ -139,6 +140,7 @@ int libxl_domain_set_nodeaffinity(libxl_ctx *ctx, uint32_t domid,
         GC_FREE;
         return ERROR_FAIL;
     }
+    libxl__numa_cache_invalidate(gc, domid);
     GC_FREE;
     return 0;
 }
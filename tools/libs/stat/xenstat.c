@@ -20,13 +20,17 @@
  * Use is subject to license terms.
  */
 
+#include <errno.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
+#include <time.h>
 #include <unistd.h>
 
 #include "xenstat_priv.h"
 
+#include <xen/vcpu.h>
+
 /*
  * Data-collection types
  */
@@ -61,6 +65,9 @@ static void xenstat_free_vbds(xenstat_node * node);
 static void xenstat_uninit_vcpus(xenstat_handle * handle);
 static void xenstat_uninit_xen_version(xenstat_handle * handle);
 static char *xenstat_get_domain_name(xenstat_handle * handle, unsigned int domain_id);
+static char *xenstat_cached_domain_name(xenstat_handle * handle, unsigned int domain_id);
+static void xenstat_check_names(xenstat_handle * handle);
+static void xenstat_prune_names(xenstat_handle * handle);
 static void xenstat_prune_domain(xenstat_node *node, unsigned int entry);
 
 static xenstat_collector collectors[] = {
@@ -124,6 +131,10 @@ void xenstat_uninit(xenstat_handle * handle)
 	if (handle) {
 		for (i = 0; i < NUM_COLLECTORS; i++)
 			collectors[i].uninit(handle);
+		xenstat_uninit_shared(handle);
+		for (i = 0; i < handle->num_names; i++)
+			free(handle->names[i].name);
+		free(handle->names);
 		xc_interface_close(handle->xc_handle);
 		xs_close(handle->xshandle);
 		free(handle->priv);
@@ -139,6 +150,7 @@ xenstat_node *xenstat_get_node(xenstat_handle * handle, unsigned int flags)
 	xc_domaininfo_t domaininfo[DOMAIN_CHUNK_SIZE];
 	int new_domains;
 	unsigned int i;
+	struct timespec now;
 
 	/* Create the node */
 	node = (xenstat_node *) calloc(1, sizeof(xenstat_node));
@@ -148,6 +160,12 @@ xenstat_node *xenstat_get_node(xenstat_handle * handle, unsigned int flags)
 	/* Store the handle in the node for later access */
 	node->handle = handle;
 
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	node->sample_ns = now.tv_sec * 1000000000ULL + now.tv_nsec;
+
+	/* Forget the names xenstore has told us changed since last time */
+	xenstat_check_names(handle);
+
 	/* Get information about the physical system */
 	if (xc_physinfo(handle->xc_handle, &physinfo) < 0) {
 		free(node);
@@ -198,8 +216,8 @@ xenstat_node *xenstat_get_node(xenstat_handle * handle, unsigned int flags)
 		for (i = 0; i < new_domains; i++) {
 			/* Fill in domain using domaininfo[i] */
 			domain->id = domaininfo[i].domain;
-			domain->name = xenstat_get_domain_name(handle, 
-							       domain->id);
+			domain->name = xenstat_cached_domain_name(handle,
+								  domain->id);
 			if (domain->name == NULL) {
 				if (errno == ENOMEM) {
 					/* fatal error */
@@ -236,6 +254,7 @@ xenstat_node *xenstat_get_node(xenstat_handle * handle, unsigned int flags)
 		}
 	} while (new_domains == DOMAIN_CHUNK_SIZE);
 
+	xenstat_prune_names(handle);
 
 	/* Run all the extra data collectors requested */
 	node->flags = 0;
@@ -277,13 +296,18 @@ void xenstat_free_node(xenstat_node * node)
 
 xenstat_domain *xenstat_node_domain(xenstat_node * node, unsigned int domid)
 {
-	unsigned int i;
+	unsigned int lo = 0, hi = node->num_domains;
 
-	/* FIXME: binary search */
-	/* Find the appropriate domain entry in the node struct. */
-	for (i = 0; i < node->num_domains; i++) {
-		if (node->domains[i].id == domid)
-			return &(node->domains[i]);
+	/* Domains are listed in domid order, as Xen returns them. */
+	while (lo < hi) {
+		unsigned int mid = lo + (hi - lo) / 2;
+
+		if (node->domains[mid].id == domid)
+			return &(node->domains[mid]);
+		if (node->domains[mid].id < domid)
+			lo = mid + 1;
+		else
+			hi = mid;
 	}
 	return NULL;
 }
@@ -332,6 +356,11 @@ unsigned long long xenstat_node_cpu_hz(xenstat_node * node)
 	return node->cpu_hz;
 }
 
+unsigned long long xenstat_node_sample_ns(xenstat_node * node)
+{
+	return node->sample_ns;
+}
+
 /* Get the domain ID for this domain */
 unsigned xenstat_domain_id(xenstat_domain * domain)
 {
@@ -449,8 +478,8 @@ xenstat_vbd *xenstat_domain_vbd(xenstat_domain * domain,
 /*
  * VCPU functions
  */
-/* Collect information about VCPUs */
-static int xenstat_collect_vcpus(xenstat_node * node)
+/* Collect information about VCPUs, one hypercall per VCPU */
+static int xenstat_collect_vcpus_each(xenstat_node * node)
 {
 	unsigned int i, vcpu, inc_index;
 
@@ -458,13 +487,7 @@ static int xenstat_collect_vcpus(xenstat_node * node)
 	for (i = 0; i < node->num_domains; i+=inc_index) {
 		inc_index = 1; /* default is to increment to next domain */
 
-		node->domains[i].vcpus = malloc(node->domains[i].num_vcpus
-						* sizeof(xenstat_vcpu));
-		if (node->domains[i].vcpus == NULL)
-			return 0;
-	
 		for (vcpu = 0; vcpu < node->domains[i].num_vcpus; vcpu++) {
-			/* FIXME: need to be using a more efficient mechanism*/
 			xc_vcpuinfo_t info;
 
 			if (xc_vcpu_getinfo(node->handle->xc_handle,
@@ -476,6 +499,7 @@ static int xenstat_collect_vcpus(xenstat_node * node)
 				else {
 					/* domain is in transition - remove
 					   from list */
+					free(node->domains[i].vcpus);
 					xenstat_prune_domain(node, i);
 
 					/* remember not to increment index! */
@@ -492,6 +516,100 @@ static int xenstat_collect_vcpus(xenstat_node * node)
 	return 1;
 }
 
+/*
+ * Collect information about all VCPUs with one hypercall (unless domains
+ * appeared meanwhile).  Returns -1 if Xen doesn't support that.
+ */
+static int xenstat_collect_vcpus_list(xenstat_node * node,
+				      unsigned int total)
+{
+	xc_vcpuinfo_list_t *info;
+	unsigned char *seen;
+	uint32_t first_domain = node->domains[0].id;
+	unsigned int first_vcpu = 0, last_domain, i = 0, k;
+	int n, ret = 1;
+
+	info = malloc((total ? total : 1) * sizeof(*info));
+	seen = calloc(node->num_domains, 1);
+	if (info == NULL || seen == NULL) {
+		ret = 0;
+		goto out;
+	}
+
+	last_domain = node->domains[node->num_domains - 1].id;
+	while (first_domain <= last_domain) {
+		n = xc_vcpu_getinfolist(node->handle->xc_handle, &first_domain,
+					&first_vcpu, total ? total : 1, info);
+		if (n < 0) {
+			ret = (errno == ENOSYS || errno == EOPNOTSUPP) ? -1 : 0;
+			goto out;
+		}
+
+		/* Both are sorted by domain id. */
+		for (k = 0; k < n; k++) {
+			while (i < node->num_domains &&
+			       node->domains[i].id < info[k].domid)
+				i++;
+			if (i == node->num_domains)
+				break;
+			/* Skip domains created meanwhile. */
+			if (node->domains[i].id != info[k].domid ||
+			    info[k].vcpu >= node->domains[i].num_vcpus)
+				continue;
+
+			node->domains[i].vcpus[info[k].vcpu].online =
+				info[k].online;
+			node->domains[i].vcpus[info[k].vcpu].ns =
+				info[k].time[RUNSTATE_running];
+			seen[i] = 1;
+		}
+	}
+
+	/*
+	 * Domains whose VCPUs didn't get reported are in transition - remove
+	 * them.  Keep those without any VCPUs, as the per-VCPU path does.
+	 */
+	for (i = node->num_domains; i-- > 0; ) {
+		if (seen[i] || node->domains[i].num_vcpus == 0)
+			continue;
+		free(node->domains[i].vcpus);
+		xenstat_prune_domain(node, i);
+	}
+
+ out:
+	free(seen);
+	free(info);
+	return ret;
+}
+
+/* Collect information about VCPUs */
+static int xenstat_collect_vcpus(xenstat_node * node)
+{
+	unsigned int i, total = 0;
+	int ret;
+
+	for (i = 0; i < node->num_domains; i++) {
+		node->domains[i].vcpus = calloc(node->domains[i].num_vcpus,
+						sizeof(xenstat_vcpu));
+		if (node->domains[i].vcpus == NULL)
+			return 0;
+		total += node->domains[i].num_vcpus;
+	}
+
+	if (node->num_domains == 0)
+		return 1;
+
+	if (!node->handle->no_vcpuinfolist) {
+		ret = xenstat_collect_vcpus_list(node, total);
+		if (ret >= 0)
+			return ret;
+		/* Older Xen: fall back to one hypercall per VCPU. */
+		node->handle->no_vcpuinfolist = 1;
+	}
+
+	return xenstat_collect_vcpus_each(node);
+}
+
 /* Free VCPU information */
 static void xenstat_free_vcpus(xenstat_node * node)
 {
@@ -713,6 +831,119 @@ static char *xenstat_get_domain_name(xenstat_handle *handle, unsigned int domain
 	return xs_read(handle->xshandle, XBT_NULL, path, NULL);
 }
 
+/*
+ * Domain names rarely change, so rather than reading every domain's name
+ * from xenstore for every sample, keep them in the handle and watch each
+ * name for changes.
+ */
+#define NAME_WATCH_TOKEN "xenstat-name"
+
+static xenstat_name *xenstat_find_name(xenstat_handle *handle,
+				       unsigned int domid, unsigned int *pos)
+{
+	unsigned int lo = 0, hi = handle->num_names;
+
+	while (lo < hi) {
+		unsigned int mid = lo + (hi - lo) / 2;
+
+		if (handle->names[mid].domid == domid)
+			return &handle->names[mid];
+		if (handle->names[mid].domid < domid)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	if (pos)
+		*pos = lo;
+	return NULL;
+}
+
+static void xenstat_check_names(xenstat_handle *handle)
+{
+	char **vec;
+	unsigned int domid;
+	xenstat_name *n;
+
+	while ((vec = xs_check_watch(handle->xshandle)) != NULL) {
+		if (strcmp(vec[XS_WATCH_TOKEN], NAME_WATCH_TOKEN) == 0 &&
+		    sscanf(vec[XS_WATCH_PATH], "/local/domain/%u/name",
+			   &domid) == 1 &&
+		    (n = xenstat_find_name(handle, domid, NULL)) != NULL) {
+			if (n->initial) {
+				n->initial = false;
+			} else {
+				free(n->name);
+				n->name = NULL;
+			}
+		}
+		free(vec);
+	}
+}
+
+static char *xenstat_cached_domain_name(xenstat_handle *handle,
+					unsigned int domain_id)
+{
+	xenstat_name *n;
+	unsigned int pos;
+	char path[80];
+
+	n = xenstat_find_name(handle, domain_id, &pos);
+	if (n == NULL) {
+		n = realloc(handle->names,
+			    (handle->num_names + 1) * sizeof(*n));
+		if (n == NULL)
+			return NULL;
+		handle->names = n;
+		n += pos;
+		memmove(n + 1, n, (handle->num_names - pos) * sizeof(*n));
+		handle->num_names++;
+
+		memset(n, 0, sizeof(*n));
+		n->domid = domain_id;
+		snprintf(path, sizeof(path), "/local/domain/%i/name",
+			 domain_id);
+		/* Without a watch (e.g. over quota), read it every time. */
+		n->watched = n->initial = xs_watch(handle->xshandle, path,
+						   NAME_WATCH_TOKEN);
+	}
+
+	n->seen = true;
+	if (n->name == NULL || !n->watched) {
+		free(n->name);
+		n->name = xenstat_get_domain_name(handle, domain_id);
+		if (n->name == NULL)
+			return NULL;
+	}
+
+	return strdup(n->name);
+}
+
+/* Forget the domains which were not in this sample. */
+static void xenstat_prune_names(xenstat_handle *handle)
+{
+	unsigned int i, j;
+	char path[80];
+
+	for (i = j = 0; i < handle->num_names; i++) {
+		xenstat_name *n = &handle->names[i];
+
+		if (!n->seen) {
+			if (n->watched) {
+				snprintf(path, sizeof(path),
+					 "/local/domain/%i/name", n->domid);
+				xs_unwatch(handle->xshandle, path,
+					   NAME_WATCH_TOKEN);
+			}
+			free(n->name);
+			continue;
+		}
+
+		n->seen = false;
+		handle->names[j++] = *n;
+	}
+	handle->num_names = j;
+}
+
 /* Remove specified entry from list of domains */
 static void xenstat_prune_domain(xenstat_node *node, unsigned int entry)
 {
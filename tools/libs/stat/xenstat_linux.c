@@ -39,6 +39,8 @@
 struct priv_data {
 	FILE *procnetdev;
 	DIR *sysfsvbd;
+	regex_t netdev_re;	/* compiled once, see parseNetDevLine() */
+	bool netdev_re_ok;
 };
 
 static struct priv_data *
@@ -53,6 +55,7 @@ get_priv_data(xenstat_handle *handle)
 
 	((struct priv_data *)handle->priv)->procnetdev = NULL;
 	((struct priv_data *)handle->priv)->sysfsvbd = NULL;
+	((struct priv_data *)handle->priv)->netdev_re_ok = false;
 
 	return handle->priv;
 }
@@ -97,7 +100,7 @@ static void getBridge(const char *excludeName, char *result, size_t resultLen)
 
 /* parseNetLine provides regular expression based parsing for lines from /proc/net/dev, all the */
 /* information are parsed but not all are used in our case, ie. for xenstat */
-static int parseNetDevLine(char *line, char *iface, unsigned long long *rxBytes, unsigned long long *rxPackets,
+static int parseNetDevLine(regex_t *r, char *line, char *iface, unsigned long long *rxBytes, unsigned long long *rxPackets,
 		unsigned long long *rxErrs, unsigned long long *rxDrops, unsigned long long *rxFifo,
 		unsigned long long *rxFrames, unsigned long long *rxComp, unsigned long long *rxMcast,
 		unsigned long long *txBytes, unsigned long long *txPackets, unsigned long long *txErrs,
@@ -105,18 +108,11 @@ static int parseNetDevLine(char *line, char *iface, unsigned long long *rxBytes,
 		unsigned long long *txCarrier, unsigned long long *txComp)
 {
 	/* Temporary/helper variables */
-	int ret;
 	char *tmp;
 	int i = 0, x = 0, col = 0;
-	regex_t r;
 	regmatch_t matches[19];
 	int num = 19;
 
-	/* Regular exception to parse all the information from /proc/net/dev line */
-	const char *regex = "([^:]*):([^ ]*)[ ]*([^ ]*)[ ]*([^ ]*)[ ]*([^ ]*)[ ]*([^ ]*)[ ]*([^ ]*)"
-			"[ ]*([^ ]*)[ ]*([^ ]*)[ ]*([^ ]*)[ ]*([^ ]*)[ ]*([^ ]*)[ ]*([^ ]*)[ ]*"
-			"([^ ]*)[ ]*([^ ]*)[ ]*([^ ]*)[ ]*([^ ]*)[ ]*([^ ]*)";
-
 	/* Initialize all variables called has passed as non-NULL to zeros */
 	if (iface != NULL)
 		memset(iface, 0, sizeof(*iface));
@@ -153,13 +149,8 @@ static int parseNetDevLine(char *line, char *iface, unsigned long long *rxBytes,
 	if (txComp != NULL)
 		*txComp = 0;
 
-	if ((ret = regcomp(&r, regex, REG_EXTENDED))) {
-		regfree(&r);
-		return ret;
-	}
-
 	tmp = (char *)malloc( sizeof(char) );
-	if (regexec (&r, line, num, matches, REG_EXTENDED) == 0){
+	if (regexec (r, line, num, matches, REG_EXTENDED) == 0){
 		for (i = 1; i < num; i++) {
 			/* The expression matches are empty sometimes so we need to check it first */
 			if (matches[i].rm_eo - matches[i].rm_so > 0) {
@@ -239,7 +230,6 @@ static int parseNetDevLine(char *line, char *iface, unsigned long long *rxBytes,
 	}
 
 	free(tmp);
-	regfree(&r);
 
 	return 0;
 }
@@ -305,6 +295,19 @@ int xenstat_collect_networks(xenstat_node * node)
 		}
 	}
 
+	/* Regular expression to parse all the information from a /proc/net/dev line */
+	if (!priv->netdev_re_ok) {
+		if (regcomp(&priv->netdev_re,
+			    "([^:]*):([^ ]*)[ ]*([^ ]*)[ ]*([^ ]*)[ ]*([^ ]*)[ ]*([^ ]*)[ ]*([^ ]*)"
+			    "[ ]*([^ ]*)[ ]*([^ ]*)[ ]*([^ ]*)[ ]*([^ ]*)[ ]*([^ ]*)[ ]*([^ ]*)[ ]*"
+			    "([^ ]*)[ ]*([^ ]*)[ ]*([^ ]*)[ ]*([^ ]*)[ ]*([^ ]*)",
+			    REG_EXTENDED)) {
+			fprintf(stderr, "Failed to compile /proc/net/dev regex\n");
+			return 0;
+		}
+		priv->netdev_re_ok = true;
+	}
+
 	/* Fill in networks */
 	/* FIXME: optimize this */
 	fseek(priv->procnetdev, sizeof(PROCNETDEV_HEADER) - 1,
@@ -319,7 +322,7 @@ int xenstat_collect_networks(xenstat_node * node)
 		xenstat_network net;
 		unsigned int domid;
 
-		parseNetDevLine(line, iface, &rxBytes, &rxPackets, &rxErrs, &rxDrops, NULL, NULL, NULL,
+		parseNetDevLine(&priv->netdev_re, line, iface, &rxBytes, &rxPackets, &rxErrs, &rxDrops, NULL, NULL, NULL,
 				NULL, &txBytes, &txPackets, &txErrs, &txDrops, NULL, NULL, NULL, NULL);
 
 		/* If the device parsed is network bridge and both tx & rx packets are zero, we are most */
@@ -391,6 +394,8 @@ void xenstat_uninit_networks(xenstat_handle * handle)
 	struct priv_data *priv = get_priv_data(handle);
 	if (priv != NULL && priv->procnetdev != NULL)
 		fclose(priv->procnetdev);
+	if (priv != NULL && priv->netdev_re_ok)
+		regfree(&priv->netdev_re);
 }
 
 static int read_attributes_vbd(const char *vbd_directory, const char *what, char *ret, int cap)
@@ -32,12 +32,28 @@
 #define SHORT_ASC_LEN 5                 /* length of 65535 */
 #define VERSION_SIZE (2 * SHORT_ASC_LEN + 1 + sizeof(xen_extraversion_t) + 1)
 
+/* Domain name kept across samples, invalidated by a xenstore watch */
+typedef struct xenstat_name {
+	unsigned int domid;
+	char *name;		/* NULL if it must be (re-)read */
+	bool watched;		/* else re-read on every sample */
+	bool initial;		/* initial watch event still to come */
+	bool seen;		/* domain present in the current sample */
+} xenstat_name;
+
+struct xenstat_shared;
+
 struct xenstat_handle {
 	xc_interface *xc_handle;
 	struct xs_handle *xshandle; /* xenstore handle */
 	int page_size;
 	void *priv;
 	char xen_version[VERSION_SIZE]; /* xen version running on this node */
+	xenstat_name *names;	/* Array of length num_names, sorted by domid */
+	unsigned int num_names;
+	struct xenstat_shared *publisher;	/* xenstat_publish_node() */
+	struct xenstat_shared *reader;		/* xenstat_get_shared_node() */
+	int no_vcpuinfolist;	/* Xen lacks XEN_SYSCTL_getvcpuinfolist */
 };
 
 struct xenstat_node {
@@ -50,6 +66,7 @@ struct xenstat_node {
 	unsigned int num_domains;
 	xenstat_domain *domains;	/* Array of length num_domains */
 	long freeable_mb;
+	unsigned long long sample_ns;
 };
 
 struct xenstat_domain {
@@ -104,5 +121,6 @@ extern int xenstat_collect_vbds(xenstat_node * node);
 extern void xenstat_uninit_vbds(xenstat_handle * handle);
 extern void read_attributes_qdisk(xenstat_node * node);
 extern xenstat_vbd *xenstat_save_vbd(xenstat_domain * domain, xenstat_vbd * vbd);
+extern void xenstat_uninit_shared(xenstat_handle * handle);
 
 #endif /* XENSTAT_PRIV_H */
@@ -0,0 +1,562 @@
+/* libxenstat: statistics-collection library for Xen
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ */
+
+/*
+ * Shared snapshots of xenstat nodes.
+ *
+ * A collector publishes the nodes it gets to a file in XEN_RUN_DIR, which
+ * readers map.  The file holds a header and a ring of XENSTAT_SHARED_SLOTS
+ * slots.  Each slot holds one serialised node and is tagged with the
+ * generation it was written for: zero while it is being written, so
+ * readers copy a slot out and check its tag is unchanged afterwards.  The
+ * header holds the generation of the newest complete slot.
+ *
+ * When a node no longer fits in a slot, the collector writes a new, larger
+ * file, renames it into place and marks the old one stale, so that
+ * readers map the new one.
+ *
+ * Writer and readers are the same library on the same host, so node
+ * structures are copied as they are; the version guards their layout.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "xenstat_priv.h"
+#include "_paths.h"
+
+#define XENSTAT_SHARED_PATH    XEN_RUN_DIR "/xenstat"
+#define XENSTAT_SHARED_MAGIC   0x78737368 /* "hssx" */
+#define XENSTAT_SHARED_VERSION 1
+#define XENSTAT_SHARED_SLOTS   4
+#define XENSTAT_SHARED_MIN_SLOT (64 * 1024)
+
+/* Snapshots older than this many intervals are not handed out. */
+#define XENSTAT_SHARED_STALE   3
+
+struct shared_header {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t nr_slots;
+	uint32_t stale;		/* A newer file replaced this one */
+	uint64_t slot_size;	/* Bytes of node data each slot can hold */
+	uint64_t generation;	/* Of the newest complete slot */
+	uint64_t sample_ns;	/* Collection time of the newest slot */
+	uint32_t interval_ms;	/* Collection interval */
+	uint32_t pad;
+};
+
+struct shared_slot {
+	uint64_t generation;	/* 0 while being written */
+	uint64_t len;
+	/* Followed by slot_size bytes of node data */
+};
+
+struct xenstat_shared {
+	char *path;
+	int fd;
+	void *map;
+	size_t map_size;
+	uint64_t generation;	/* Writer: last published */
+	char *buf;		/* Serialisation buffer */
+	size_t buf_size, len;
+};
+
+/* Serialised node: */
+struct shared_node {
+	unsigned int flags;
+	unsigned int num_cpus;
+	unsigned int num_domains;
+	unsigned long long cpu_hz;
+	unsigned long long tot_mem;
+	unsigned long long free_mem;
+	long freeable_mb;
+	unsigned long long sample_ns;
+	char xen_version[VERSION_SIZE];
+};
+/* followed, for each domain, by its struct xenstat_domain (pointers
+ * unused), its name (NUL terminated), vcpus, networks and vbds. */
+
+static inline struct shared_slot *shared_slot(const struct xenstat_shared *s,
+					      uint64_t generation)
+{
+	const struct shared_header *hdr = s->map;
+
+	return (void *)((char *)s->map + sizeof(*hdr) +
+			(generation % hdr->nr_slots) *
+			(sizeof(struct shared_slot) + hdr->slot_size));
+}
+
+static void shared_close(struct xenstat_shared *s)
+{
+	if (s->map)
+		munmap(s->map, s->map_size);
+	if (s->fd >= 0)
+		close(s->fd);
+	s->map = NULL;
+	s->fd = -1;
+}
+
+static void shared_free(struct xenstat_shared *s)
+{
+	if (s) {
+		shared_close(s);
+		free(s->path);
+		free(s->buf);
+		free(s);
+	}
+}
+
+static struct xenstat_shared *shared_alloc(const char *path)
+{
+	struct xenstat_shared *s = calloc(1, sizeof(*s));
+
+	if (s == NULL)
+		return NULL;
+	s->fd = -1;
+	s->path = strdup(path ? path : XENSTAT_SHARED_PATH);
+	if (s->path == NULL) {
+		free(s);
+		return NULL;
+	}
+	return s;
+}
+
+/*
+ * Writer
+ */
+
+static int put(struct xenstat_shared *s, const void *data, size_t len)
+{
+	if (len == 0)
+		return 0;
+	if (s->len + len > s->buf_size) {
+		size_t size = s->buf_size ? s->buf_size : 4096;
+		char *buf;
+
+		while (size < s->len + len)
+			size *= 2;
+		buf = realloc(s->buf, size);
+		if (buf == NULL)
+			return -1;
+		s->buf = buf;
+		s->buf_size = size;
+	}
+	memcpy(s->buf + s->len, data, len);
+	s->len += len;
+	return 0;
+}
+
+static int serialise_node(struct xenstat_shared *s, xenstat_node *node)
+{
+	struct shared_node sn;
+	unsigned int i;
+
+	memset(&sn, 0, sizeof(sn));
+	sn.flags = node->flags;
+	sn.num_cpus = node->num_cpus;
+	sn.num_domains = node->num_domains;
+	sn.cpu_hz = node->cpu_hz;
+	sn.tot_mem = node->tot_mem;
+	sn.free_mem = node->free_mem;
+	sn.freeable_mb = node->freeable_mb;
+	sn.sample_ns = node->sample_ns;
+	memcpy(sn.xen_version, node->handle->xen_version, VERSION_SIZE);
+
+	s->len = 0;
+	if (put(s, &sn, sizeof(sn)))
+		return -1;
+
+	for (i = 0; i < node->num_domains; i++) {
+		xenstat_domain *d = &node->domains[i];
+
+		if (put(s, d, sizeof(*d)) ||
+		    put(s, d->name, strlen(d->name) + 1))
+			return -1;
+		if ((node->flags & XENSTAT_VCPU) &&
+		    put(s, d->vcpus, d->num_vcpus * sizeof(*d->vcpus)))
+			return -1;
+		if (put(s, d->networks, d->num_networks * sizeof(*d->networks)) ||
+		    put(s, d->vbds, d->num_vbds * sizeof(*d->vbds)))
+			return -1;
+	}
+
+	return 0;
+}
+
+/* Create a file with room for @slot_size bytes per slot, and put it in
+ * place of any existing one. */
+static int shared_create(struct xenstat_shared *s, size_t slot_size,
+			 unsigned int interval_ms)
+{
+	struct shared_header *hdr;
+	size_t size = sizeof(*hdr) +
+		XENSTAT_SHARED_SLOTS * (sizeof(struct shared_slot) + slot_size);
+	size_t plen = strlen(s->path);
+	char tmp[plen + 8];
+	int fd;
+	void *map;
+
+	snprintf(tmp, sizeof(tmp), "%s.new", s->path);
+	fd = open(tmp, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0640);
+	if (fd < 0)
+		return -1;
+	if (ftruncate(fd, size))
+		goto err;
+	map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (map == MAP_FAILED)
+		goto err;
+
+	hdr = map;
+	hdr->magic = XENSTAT_SHARED_MAGIC;
+	hdr->version = XENSTAT_SHARED_VERSION;
+	hdr->nr_slots = XENSTAT_SHARED_SLOTS;
+	hdr->slot_size = slot_size;
+	hdr->generation = s->generation;
+	hdr->interval_ms = interval_ms;
+
+	if (rename(tmp, s->path)) {
+		munmap(map, size);
+		goto err;
+	}
+
+	if (s->map) {
+		((struct shared_header *)s->map)->stale = 1;
+		shared_close(s);
+	}
+	s->fd = fd;
+	s->map = map;
+	s->map_size = size;
+	return 0;
+
+ err:
+	close(fd);
+	unlink(tmp);
+	return -1;
+}
+
+int xenstat_publish_node(xenstat_handle *handle, xenstat_node *node,
+			 const char *path, unsigned int interval_ms)
+{
+	struct xenstat_shared *s = handle->publisher;
+	struct shared_header *hdr;
+	struct shared_slot *slot;
+
+	if (s == NULL) {
+		s = handle->publisher = shared_alloc(path);
+		if (s == NULL)
+			return -1;
+	}
+
+	if (serialise_node(s, node))
+		return -1;
+
+	hdr = s->map;
+	if (hdr == NULL || s->len > hdr->slot_size) {
+		size_t slot_size = XENSTAT_SHARED_MIN_SLOT;
+
+		/* Leave room to grow. */
+		while (slot_size < s->len + s->len / 2)
+			slot_size *= 2;
+		if (shared_create(s, slot_size, interval_ms))
+			return -1;
+		hdr = s->map;
+	}
+
+	s->generation++;
+	slot = shared_slot(s, s->generation);
+
+	slot->generation = 0;
+	xen_wmb();
+	memcpy(slot + 1, s->buf, s->len);
+	slot->len = s->len;
+	xen_wmb();
+	slot->generation = s->generation;
+	xen_wmb();
+	hdr->interval_ms = interval_ms;
+	hdr->sample_ns = node->sample_ns;
+	hdr->generation = s->generation;
+
+	return 0;
+}
+
+void xenstat_unpublish(xenstat_handle *handle)
+{
+	struct xenstat_shared *s = handle->publisher;
+
+	if (s == NULL)
+		return;
+
+	if (s->map) {
+		((struct shared_header *)s->map)->stale = 1;
+		unlink(s->path);
+	}
+	shared_free(s);
+	handle->publisher = NULL;
+}
+
+/*
+ * Reader
+ */
+
+static int shared_map(struct xenstat_shared *s)
+{
+	const struct shared_header *hdr;
+	struct stat st;
+
+	s->fd = open(s->path, O_RDONLY | O_CLOEXEC);
+	if (s->fd < 0)
+		return -1;
+	if (fstat(s->fd, &st) || st.st_size < sizeof(*hdr))
+		goto err;
+
+	s->map_size = st.st_size;
+	s->map = mmap(NULL, s->map_size, PROT_READ, MAP_SHARED, s->fd, 0);
+	if (s->map == MAP_FAILED) {
+		s->map = NULL;
+		goto err;
+	}
+
+	hdr = s->map;
+	if (hdr->magic != XENSTAT_SHARED_MAGIC ||
+	    hdr->version != XENSTAT_SHARED_VERSION ||
+	    hdr->nr_slots == 0 ||
+	    s->map_size < sizeof(*hdr) + hdr->nr_slots *
+	    (sizeof(struct shared_slot) + hdr->slot_size))
+		goto err;
+
+	return 0;
+
+ err:
+	shared_close(s);
+	errno = ENOENT;
+	return -1;
+}
+
+/* Copy the newest complete slot into s->buf. */
+static int shared_read(struct xenstat_shared *s)
+{
+	const struct shared_header *hdr = s->map;
+	unsigned int tries;
+
+	for (tries = 0; tries < 10; tries++) {
+		uint64_t gen = hdr->generation;
+		const struct shared_slot *slot;
+		uint64_t len;
+
+		xen_rmb();
+		if (gen == 0)
+			break;
+		slot = shared_slot(s, gen);
+		if (slot->generation != gen)
+			continue;
+		xen_rmb();
+		len = slot->len;
+		if (len > hdr->slot_size)
+			continue;
+
+		s->len = 0;
+		if (len > s->buf_size) {
+			char *buf = realloc(s->buf, len);
+
+			if (buf == NULL)
+				return -1;
+			s->buf = buf;
+			s->buf_size = len;
+		}
+		memcpy(s->buf, slot + 1, len);
+		xen_rmb();
+		if (slot->generation != gen)
+			continue;
+
+		s->len = len;
+		return 0;
+	}
+
+	errno = EAGAIN;
+	return -1;
+}
+
+static const void *get(struct xenstat_shared *s, size_t *pos, size_t len)
+{
+	const void *p = s->buf + *pos;
+
+	if (len > s->len - *pos)
+		return NULL;
+	*pos += len;
+	return p;
+}
+
+static void *get_array(struct xenstat_shared *s, size_t *pos,
+		       unsigned int nr, size_t size, bool *err)
+{
+	const void *p;
+	void *a;
+
+	if (nr == 0)
+		return NULL;
+	p = get(s, pos, (size_t)nr * size);
+	a = p ? malloc((size_t)nr * size) : NULL;
+	if (a == NULL)
+		*err = true;
+	else
+		memcpy(a, p, (size_t)nr * size);
+	return a;
+}
+
+static xenstat_node *deserialise_node(xenstat_handle *handle,
+				      struct xenstat_shared *s)
+{
+	const struct shared_node *sn;
+	xenstat_node *node;
+	size_t pos = 0;
+	unsigned int i;
+	bool err = false;
+
+	sn = get(s, &pos, sizeof(*sn));
+	if (sn == NULL)
+		goto corrupt;
+
+	node = calloc(1, sizeof(*node));
+	if (node == NULL)
+		return NULL;
+	node->handle = handle;
+	node->flags = sn->flags;
+	node->num_cpus = sn->num_cpus;
+	node->cpu_hz = sn->cpu_hz;
+	node->tot_mem = sn->tot_mem;
+	node->free_mem = sn->free_mem;
+	node->freeable_mb = sn->freeable_mb;
+	node->sample_ns = sn->sample_ns;
+	memcpy(handle->xen_version, sn->xen_version, VERSION_SIZE);
+	handle->xen_version[VERSION_SIZE - 1] = '\0';
+
+	node->domains = calloc(sn->num_domains ? sn->num_domains : 1,
+			       sizeof(*node->domains));
+	if (node->domains == NULL) {
+		free(node);
+		return NULL;
+	}
+
+	for (i = 0; i < sn->num_domains; i++) {
+		xenstat_domain *d = &node->domains[node->num_domains];
+		const xenstat_domain *sd = get(s, &pos, sizeof(*sd));
+		const char *name = s->buf + pos;
+		size_t nlen;
+
+		if (sd == NULL)
+			break;
+		nlen = strnlen(name, s->len - pos);
+		if (!get(s, &pos, nlen + 1))
+			break;
+
+		*d = *sd;
+		d->vcpus = NULL;
+		d->networks = NULL;
+		d->vbds = NULL;
+		d->name = strdup(name);
+		if (d->name == NULL) {
+			err = true;
+			break;
+		}
+		node->num_domains++;
+
+		if (node->flags & XENSTAT_VCPU)
+			d->vcpus = get_array(s, &pos, d->num_vcpus,
+					     sizeof(*d->vcpus), &err);
+		else
+			d->num_vcpus = 0;
+		d->networks = get_array(s, &pos, d->num_networks,
+					sizeof(*d->networks), &err);
+		d->vbds = get_array(s, &pos, d->num_vbds,
+				    sizeof(*d->vbds), &err);
+		if (err)
+			break;
+	}
+
+	if (err || node->num_domains != sn->num_domains) {
+		/* Free with all per-domain arrays, whatever flags say. */
+		node->flags = XENSTAT_ALL;
+		xenstat_free_node(node);
+		if (!err)
+			goto corrupt;
+		errno = ENOMEM;
+		return NULL;
+	}
+
+	return node;
+
+ corrupt:
+	errno = EINVAL;
+	return NULL;
+}
+
+xenstat_node *xenstat_get_shared_node(xenstat_handle *handle,
+				      unsigned int flags, const char *path)
+{
+	struct xenstat_shared *s = handle->reader;
+	const struct shared_header *hdr;
+	struct timespec now;
+	unsigned long long now_ns, max_age_ns;
+	xenstat_node *node;
+
+	if (s == NULL) {
+		s = handle->reader = shared_alloc(path);
+		if (s == NULL)
+			return NULL;
+	}
+
+	/* (Re)map if we have not yet, or the collector replaced the file. */
+	if (s->map && ((const struct shared_header *)s->map)->stale)
+		shared_close(s);
+	if (s->map == NULL && shared_map(s))
+		return NULL;
+
+	hdr = s->map;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	now_ns = now.tv_sec * 1000000000ULL + now.tv_nsec;
+	max_age_ns = XENSTAT_SHARED_STALE * 1000000ULL *
+		(hdr->interval_ms ? hdr->interval_ms : 1000);
+	if (hdr->stale || hdr->generation == 0 ||
+	    now_ns - hdr->sample_ns > max_age_ns) {
+		errno = ESTALE;
+		return NULL;
+	}
+
+	if (shared_read(s))
+		return NULL;
+
+	node = deserialise_node(handle, s);
+	if (node && (node->flags & flags) != flags) {
+		xenstat_free_node(node);
+		errno = ENOENT;
+		return NULL;
+	}
+
+	return node;
+}
+
+void xenstat_uninit_shared(xenstat_handle *handle)
+{
+	xenstat_unpublish(handle);
+	shared_free(handle->reader);
+	handle->reader = NULL;
+}
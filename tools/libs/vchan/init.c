@@ -323,6 +323,9 @@ struct libxenvchan *libxenvchan_server_init(struct xentoollog_logger *logger,
 	ctrl->event = NULL;
 	ctrl->is_server = 1;
 	ctrl->server_persist = 0;
+	ctrl->domain = domain;
+	ctrl->busy_poll_us = 0;
+	ctrl->bulk = NULL;
 
 	ctrl->read.order = min_order(left_min);
 	ctrl->write.order = min_order(right_min);
@@ -407,6 +410,9 @@ struct libxenvchan *libxenvchan_client_init(struct xentoollog_logger *logger,
 	ctrl->gnttab = NULL;
 	ctrl->write.order = ctrl->read.order = 0;
 	ctrl->is_server = 0;
+	ctrl->domain = domain;
+	ctrl->busy_poll_us = 0;
+	ctrl->bulk = NULL;
 
 	xs = xs_open(0);
 	if (!xs)
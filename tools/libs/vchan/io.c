@@ -32,12 +32,16 @@
 #include <sys/mman.h>
 #include <sys/ioctl.h>
 #include <sys/uio.h>
+#include <errno.h>
+#include <stdbool.h>
 #include <stdlib.h>
 #include <stdint.h>
 #include <string.h>
+#include <time.h>
 #include <unistd.h>
 
 #include <xenctrl.h>
+#include <xen/grant_table.h>
 #include <libxenvchan.h>
 
 #ifndef PAGE_SHIFT
@@ -194,6 +198,27 @@ int libxenvchan_buffer_space(struct libxenvchan *ctrl)
 	return raw_get_buffer_space(ctrl);
 }
 
+/*
+ * Poll the ring for up to busy_poll_us, until avail() reaches request, before
+ * the caller falls back to asking the peer for a notification.
+ */
+static void busy_poll(struct libxenvchan *ctrl,
+                      int (*avail)(struct libxenvchan *), size_t request)
+{
+	struct timespec start, now;
+
+	if (!ctrl->busy_poll_us || avail(ctrl) >= request)
+		return;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	do {
+		if (avail(ctrl) >= request || !libxenvchan_is_open(ctrl))
+			return;
+		clock_gettime(CLOCK_MONOTONIC, &now);
+	} while ((now.tv_sec - start.tv_sec) * 1000000 +
+	         (now.tv_nsec - start.tv_nsec) / 1000 < ctrl->busy_poll_us);
+}
+
 int libxenvchan_wait(struct libxenvchan *ctrl)
 {
 	int ret = xenevtchn_pending(ctrl->event);
@@ -237,6 +262,8 @@ int libxenvchan_send(struct libxenvchan *ctrl, const void *data, size_t size)
 	while (1) {
 		if (!libxenvchan_is_open(ctrl))
 			return -1;
+		if (ctrl->blocking)
+			busy_poll(ctrl, raw_get_buffer_space, size);
 		avail = fast_get_buffer_space(ctrl, size);
 		if (size <= avail)
 			return do_send(ctrl, data, size);
@@ -257,6 +284,7 @@ int libxenvchan_write(struct libxenvchan *ctrl, const void *data, size_t size)
 	if (ctrl->blocking) {
 		size_t pos = 0;
 		while (1) {
+			busy_poll(ctrl, raw_get_buffer_space, 1);
 			avail = fast_get_buffer_space(ctrl, size - pos);
 			if (pos + avail > size)
 				avail = size - pos;
@@ -311,7 +339,10 @@ static int do_recv(struct libxenvchan *ctrl, void *data, size_t size)
 int libxenvchan_recv(struct libxenvchan *ctrl, void *data, size_t size)
 {
 	while (1) {
-		int avail = fast_get_data_ready(ctrl, size);
+		int avail;
+		if (ctrl->blocking)
+			busy_poll(ctrl, raw_get_data_ready, size);
+		avail = fast_get_data_ready(ctrl, size);
 		if (size <= avail)
 			return do_recv(ctrl, data, size);
 		if (!libxenvchan_is_open(ctrl))
@@ -328,7 +359,10 @@ int libxenvchan_recv(struct libxenvchan *ctrl, void *data, size_t size)
 int libxenvchan_read(struct libxenvchan *ctrl, void *data, size_t size)
 {
 	while (1) {
-		int avail = fast_get_data_ready(ctrl, size);
+		int avail;
+		if (ctrl->blocking)
+			busy_poll(ctrl, raw_get_data_ready, 1);
+		avail = fast_get_data_ready(ctrl, size);
 		if (avail && size > avail)
 			size = avail;
 		if (avail)
@@ -342,6 +376,449 @@ int libxenvchan_read(struct libxenvchan *ctrl, void *data, size_t size)
 	}
 }
 
+/*
+ * Bulk transfers: messages with a struct vchan_bulk_msg header.
+ */
+
+struct bulk_buf {
+	struct bulk_buf *next;
+	void *addr;
+	uint32_t nr_pages;
+	/* wr_prod after its last message, which the peer consumes when done */
+	uint32_t done_prod;
+	bool sent;
+	uint32_t refs[];
+};
+
+struct libxenvchan_bulk {
+	/* handles of our own, where the control structure has none */
+	xengntshr_handle *gntshr;
+	xengnttab_handle *gnttab;
+	struct bulk_buf *bufs;
+	/* message held by libxenvchan_recv_bulk_map() */
+	uint32_t held;
+	void *mapped;
+	uint32_t nr_mapped;
+	void *bounce;
+};
+
+static struct libxenvchan_bulk *get_bulk(struct libxenvchan *ctrl)
+{
+	if (!ctrl->bulk)
+		ctrl->bulk = calloc(1, sizeof(*ctrl->bulk));
+	return ctrl->bulk;
+}
+
+static xengntshr_handle *bulk_gntshr(struct libxenvchan *ctrl)
+{
+	struct libxenvchan_bulk *bulk = get_bulk(ctrl);
+
+	if (!bulk)
+		return NULL;
+	if (ctrl->is_server)
+		return ctrl->gntshr;
+	if (!bulk->gntshr)
+		bulk->gntshr = xengntshr_open(NULL, 0);
+	return bulk->gntshr;
+}
+
+static xengnttab_handle *bulk_gnttab(struct libxenvchan *ctrl)
+{
+	struct libxenvchan_bulk *bulk = get_bulk(ctrl);
+
+	if (!bulk)
+		return NULL;
+	if (!ctrl->is_server)
+		return ctrl->gnttab;
+	if (!bulk->gnttab)
+		bulk->gnttab = xengnttab_open(NULL, 0);
+	return bulk->gnttab;
+}
+
+static struct bulk_buf *find_bulk_buf(struct libxenvchan *ctrl,
+                                      const void *data, size_t size)
+{
+	struct bulk_buf *buf;
+
+	if (!ctrl->bulk)
+		return NULL;
+
+	for (buf = ctrl->bulk->bufs; buf; buf = buf->next) {
+		const void *end = buf->addr + ((size_t)buf->nr_pages << PAGE_SHIFT);
+
+		if (data >= buf->addr && data < end && size <= end - data)
+			return buf;
+	}
+
+	return NULL;
+}
+
+/* Copy to the ring offset bytes after wr_prod, without publishing it. */
+static void ring_put(struct libxenvchan *ctrl, uint32_t offset,
+                     const void *data, size_t size)
+{
+	int real_idx = (wr_prod(ctrl) + offset) & (wr_ring_size(ctrl) - 1);
+	int avail_contig = wr_ring_size(ctrl) - real_idx;
+	if (avail_contig > size)
+		avail_contig = size;
+	memcpy(wr_ring(ctrl) + real_idx, data, avail_contig);
+	if (avail_contig < size)
+		memcpy(wr_ring(ctrl), data + avail_contig, size - avail_contig);
+}
+
+/* Copy from the ring offset bytes after rd_cons, without consuming it. */
+static void ring_peek(struct libxenvchan *ctrl, uint32_t offset,
+                      void *data, size_t size)
+{
+	int real_idx = (rd_cons(ctrl) + offset) & (rd_ring_size(ctrl) - 1);
+	int avail_contig = rd_ring_size(ctrl) - real_idx;
+	if (avail_contig > size)
+		avail_contig = size;
+	xen_rmb(); /* data read must happen /after/ rd_cons read */
+	memcpy(data, rd_ring(ctrl) + real_idx, avail_contig);
+	if (avail_contig < size)
+		memcpy(data + avail_contig, rd_ring(ctrl), size - avail_contig);
+}
+
+static int ring_consume(struct libxenvchan *ctrl, uint32_t size)
+{
+	xen_mb(); /* consume /then/ notify */
+	rd_cons(ctrl) += size;
+	return send_notify(ctrl, VCHAN_NOTIFY_READ);
+}
+
+void *libxenvchan_bulk_alloc(struct libxenvchan *ctrl, size_t size)
+{
+	size_t nr_pages = (size + PAGE_SIZE - 1) >> PAGE_SHIFT;
+	xengntshr_handle *gntshr;
+	struct bulk_buf *buf;
+
+	/* All of its grants have to fit a message in the ring. */
+	if (!nr_pages || sizeof(struct vchan_bulk_msg) +
+	    nr_pages * sizeof(uint32_t) > wr_ring_size(ctrl)) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	gntshr = bulk_gntshr(ctrl);
+	if (!gntshr)
+		return NULL;
+
+	buf = calloc(1, sizeof(*buf) + nr_pages * sizeof(uint32_t));
+	if (!buf)
+		return NULL;
+
+	buf->addr = xengntshr_share_pages(gntshr, ctrl->domain, nr_pages,
+	                                  buf->refs, 0);
+	if (!buf->addr) {
+		free(buf);
+		return NULL;
+	}
+	buf->nr_pages = nr_pages;
+	buf->next = ctrl->bulk->bufs;
+	ctrl->bulk->bufs = buf;
+
+	return buf->addr;
+}
+
+void libxenvchan_bulk_free(struct libxenvchan *ctrl, void *addr)
+{
+	struct bulk_buf **pbuf, *buf;
+
+	if (!ctrl->bulk)
+		return;
+
+	for (pbuf = &ctrl->bulk->bufs; (buf = *pbuf); pbuf = &buf->next) {
+		if (buf->addr != addr)
+			continue;
+		*pbuf = buf->next;
+		xengntshr_unshare(bulk_gntshr(ctrl), buf->addr, buf->nr_pages);
+		free(buf);
+		return;
+	}
+}
+
+int libxenvchan_bulk_busy(struct libxenvchan *ctrl, const void *addr)
+{
+	struct bulk_buf *buf = find_bulk_buf(ctrl, addr, 0);
+
+	if (!buf || !buf->sent)
+		return 0;
+	if ((int32_t)(wr_cons(ctrl) - buf->done_prod) >= 0)
+		return 0;
+
+	request_notify(ctrl, VCHAN_NOTIFY_READ);
+	/* The peer may have consumed the message before the request. */
+	return (int32_t)(wr_cons(ctrl) - buf->done_prod) < 0;
+}
+
+int libxenvchan_send_bulk(struct libxenvchan *ctrl, const void *data, size_t size)
+{
+	struct vchan_bulk_msg msg = { .len = size };
+	struct bulk_buf *buf = size ? find_bulk_buf(ctrl, data, size) : NULL;
+	const void *payload = data;
+	size_t payload_size = size;
+	int avail;
+
+	if (buf) {
+		size_t first = (data - buf->addr) >> PAGE_SHIFT;
+		size_t last = (data + size - 1 - buf->addr) >> PAGE_SHIFT;
+
+		msg.offset = (data - buf->addr) & (PAGE_SIZE - 1);
+		msg.nr_grants = last - first + 1;
+		payload = &buf->refs[first];
+		payload_size = msg.nr_grants * sizeof(uint32_t);
+	}
+
+	if (size > UINT32_MAX ||
+	    sizeof(msg) + payload_size > wr_ring_size(ctrl)) {
+		errno = EMSGSIZE;
+		return -1;
+	}
+
+	while (1) {
+		if (!libxenvchan_is_open(ctrl))
+			return -1;
+		if (ctrl->blocking)
+			busy_poll(ctrl, raw_get_buffer_space,
+			          sizeof(msg) + payload_size);
+		avail = fast_get_buffer_space(ctrl, sizeof(msg) + payload_size);
+		if (sizeof(msg) + payload_size <= avail)
+			break;
+		if (!ctrl->blocking)
+			return 0;
+		if (libxenvchan_wait(ctrl))
+			return -1;
+	}
+
+	xen_mb(); /* read indexes /then/ write data */
+	ring_put(ctrl, 0, &msg, sizeof(msg));
+	ring_put(ctrl, sizeof(msg), payload, payload_size);
+	xen_wmb(); /* write data /then/ notify */
+	wr_prod(ctrl) += sizeof(msg) + payload_size;
+	if (buf) {
+		buf->done_prod = wr_prod(ctrl);
+		buf->sent = true;
+	}
+	if (send_notify(ctrl, VCHAN_NOTIFY_WRITE))
+		return -1;
+	return size;
+}
+
+/*
+ * Wait for a whole message to be in the ring, and copy its header.
+ * Returns the size of the message in the ring, 0 if nonblocking and there is
+ * none, or -1 on error.
+ */
+static int bulk_wait_msg(struct libxenvchan *ctrl, struct vchan_bulk_msg *msg)
+{
+	size_t need = sizeof(*msg);
+	bool have_header = false;
+	int avail;
+
+	if (ctrl->bulk && ctrl->bulk->held) {
+		errno = EBUSY;
+		return -1;
+	}
+
+	while (1) {
+		if (ctrl->blocking)
+			busy_poll(ctrl, raw_get_data_ready, need);
+		avail = fast_get_data_ready(ctrl, need);
+		if (!have_header && avail >= need) {
+			size_t max = rd_ring_size(ctrl) - sizeof(*msg);
+
+			ring_peek(ctrl, 0, msg, sizeof(*msg));
+			/*
+			 * The header comes from the peer: check it fits in the
+			 * ring, and that there is a grant for exactly each page
+			 * the data spans, before computing any size from it.
+			 */
+			if (msg->nr_grants ?
+			    (msg->nr_grants > max / sizeof(uint32_t) ||
+			     !msg->len || msg->offset >= PAGE_SIZE ||
+			     msg->nr_grants != ((uint64_t)msg->offset + msg->len +
+			                        PAGE_SIZE - 1) >> PAGE_SHIFT) :
+			    msg->len > max) {
+				errno = EPROTO;
+				return -1;
+			}
+			need += msg->nr_grants ?
+			        msg->nr_grants * sizeof(uint32_t) : msg->len;
+			have_header = true;
+			continue;
+		}
+		if (have_header && avail >= need)
+			return need;
+		if (!libxenvchan_is_open(ctrl))
+			return -1;
+		if (!ctrl->blocking)
+			return 0;
+		if (libxenvchan_wait(ctrl))
+			return -1;
+	}
+}
+
+static uint32_t *bulk_msg_grants(struct libxenvchan *ctrl,
+                                 const struct vchan_bulk_msg *msg)
+{
+	uint32_t *refs = malloc(msg->nr_grants * sizeof(*refs));
+
+	if (refs)
+		ring_peek(ctrl, sizeof(*msg), refs,
+		          msg->nr_grants * sizeof(*refs));
+	return refs;
+}
+
+static int bulk_copy(struct libxenvchan *ctrl, const struct vchan_bulk_msg *msg,
+                     void *data)
+{
+	xengnttab_handle *gnttab = bulk_gnttab(ctrl);
+	xengnttab_grant_copy_segment_t *segs;
+	uint32_t *refs, done = 0, i, nr = 0;
+	int ret = -1;
+
+	if (!gnttab)
+		return -1;
+
+	refs = bulk_msg_grants(ctrl, msg);
+	segs = calloc(msg->nr_grants, sizeof(*segs));
+	if (!refs || !segs)
+		goto out;
+
+	for (i = 0; i < msg->nr_grants && done < msg->len; i++, nr++) {
+		uint32_t offset = i ? 0 : msg->offset;
+		uint32_t len = PAGE_SIZE - offset;
+
+		if (len > msg->len - done)
+			len = msg->len - done;
+		segs[i].source.foreign.ref = refs[i];
+		segs[i].source.foreign.offset = offset;
+		segs[i].source.foreign.domid = ctrl->domain;
+		segs[i].dest.virt = data + done;
+		segs[i].len = len;
+		segs[i].flags = GNTCOPY_source_gref;
+		done += len;
+	}
+
+	if (xengnttab_grant_copy(gnttab, nr, segs))
+		goto out;
+	for (i = 0; i < nr; i++)
+		if (segs[i].status != GNTST_okay) {
+			errno = EIO;
+			goto out;
+		}
+	ret = 0;
+
+ out:
+	free(segs);
+	free(refs);
+	return ret;
+}
+
+int libxenvchan_recv_bulk(struct libxenvchan *ctrl, void *data, size_t size)
+{
+	struct vchan_bulk_msg msg;
+	int ret = bulk_wait_msg(ctrl, &msg);
+
+	if (ret <= 0)
+		return ret;
+	if (msg.len > size) {
+		errno = EMSGSIZE;
+		return -1;
+	}
+
+	if (!msg.nr_grants)
+		ring_peek(ctrl, sizeof(msg), data, msg.len);
+	else if (bulk_copy(ctrl, &msg, data))
+		return -1;
+
+	if (ring_consume(ctrl, ret))
+		return -1;
+	return msg.len;
+}
+
+int libxenvchan_recv_bulk_map(struct libxenvchan *ctrl, const void **data)
+{
+	struct libxenvchan_bulk *bulk;
+	xengnttab_handle *gnttab;
+	struct vchan_bulk_msg msg;
+	uint32_t *refs;
+	int ret = bulk_wait_msg(ctrl, &msg);
+
+	if (ret <= 0)
+		return ret;
+	bulk = get_bulk(ctrl);
+	if (!bulk)
+		return -1;
+
+	if (!msg.nr_grants) {
+		/* Small enough to have been copied through the ring anyway. */
+		if (!bulk->bounce)
+			bulk->bounce = malloc(rd_ring_size(ctrl));
+		if (!bulk->bounce)
+			return -1;
+		ring_peek(ctrl, sizeof(msg), bulk->bounce, msg.len);
+		*data = bulk->bounce;
+	} else {
+		gnttab = bulk_gnttab(ctrl);
+		if (!gnttab)
+			return -1;
+		refs = bulk_msg_grants(ctrl, &msg);
+		if (!refs)
+			return -1;
+		bulk->mapped = xengnttab_map_domain_grant_refs(gnttab,
+			msg.nr_grants, ctrl->domain, refs, PROT_READ);
+		free(refs);
+		if (!bulk->mapped)
+			return -1;
+		bulk->nr_mapped = msg.nr_grants;
+		*data = bulk->mapped + msg.offset;
+	}
+
+	bulk->held = ret;
+	return msg.len;
+}
+
+int libxenvchan_bulk_release(struct libxenvchan *ctrl)
+{
+	struct libxenvchan_bulk *bulk = ctrl->bulk;
+	uint32_t held;
+
+	if (!bulk || !bulk->held)
+		return 0;
+
+	if (bulk->mapped) {
+		xengnttab_unmap(bulk_gnttab(ctrl), bulk->mapped, bulk->nr_mapped);
+		bulk->mapped = NULL;
+		bulk->nr_mapped = 0;
+	}
+
+	held = bulk->held;
+	bulk->held = 0;
+	return ring_consume(ctrl, held);
+}
+
+static void bulk_close(struct libxenvchan *ctrl)
+{
+	struct libxenvchan_bulk *bulk = ctrl->bulk;
+
+	if (!bulk)
+		return;
+
+	if (bulk->mapped)
+		xengnttab_unmap(bulk_gnttab(ctrl), bulk->mapped, bulk->nr_mapped);
+	while (bulk->bufs)
+		libxenvchan_bulk_free(ctrl, bulk->bufs->addr);
+	if (bulk->gntshr)
+		xengntshr_close(bulk->gntshr);
+	if (bulk->gnttab)
+		xengnttab_close(bulk->gnttab);
+	free(bulk->bounce);
+	free(bulk);
+	ctrl->bulk = NULL;
+}
+
 int libxenvchan_is_open(struct libxenvchan* ctrl)
 {
 	if (ctrl->is_server)
@@ -359,6 +836,7 @@ void libxenvchan_close(struct libxenvchan *ctrl)
 {
 	if (!ctrl)
 		return;
+	bulk_close(ctrl);
 	if (ctrl->read.order >= PAGE_SHIFT)
 		munmap(ctrl->read.buffer, 1 << ctrl->read.order);
 	if (ctrl->write.order >= PAGE_SHIFT)
@@ -0,0 +1,619 @@
+/*
+ * xen-dedupd: share the pages HVM guests have with the same contents.
+ *
+ * Every pass hashes all pages of the domains, at a limited rate, and
+ * looks the hashes up in a table of the pages seen so far in the pass.
+ * Pages with matching contents are handed to Xen in batches to share
+ * (XENMEM_sharing_op_dedup), which compares them again once they are
+ * read-only.  Writing to a shared page then gets the writer its own copy.
+ *
+ * Only pages whose hash didn't change since the previous pass are shared,
+ * so that pages which are being written to aren't shared only to need
+ * copying again straight away.  That takes 8 bytes of memory per guest
+ * page, which also tell whether a previous pass shared the page: such pages
+ * are only ever what other pages get shared with, rather than being handed
+ * to Xen again on every pass.  Pages are only shared between domains with
+ * the same NUMA node affinity, so as not to turn local accesses of any
+ * domain into remote ones, unless told otherwise.
+ *
+ * Each pass logs the pages shared, the memory saved overall, and the rate
+ * at which writes broke the sharing of pages again (CoW breaks).
+ */
+
+#include <errno.h>
+#include <getopt.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <syslog.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <xenctrl.h>
+#include <xenforeignmemory.h>
+#include <xen-tools/libs.h>
+
+/* Pages mapped and hashed at a time. */
+#define CHUNK           256
+/* Pairs of pages handed to Xen per hypercall. */
+#define BATCH           1024
+#define NODE_ANY        (~0u)
+/* In dom->last[], for pages shared since they were last hashed. */
+#define HASH_SHARED     1ULL
+
+#define DEFAULT_INTERVAL 60
+#define DEFAULT_RATE    25000
+
+struct dom {
+    uint32_t domid;
+    xen_domain_handle_t handle;
+    bool seen;
+    bool unsharable;            /* Sharing couldn't be enabled. */
+    unsigned int node;
+    xen_pfn_t nr_gfns;
+    uint64_t *last;             /* Hash of each page in the last pass. */
+};
+
+/* The first page with some contents seen in a pass. */
+struct entry {
+    uint64_t key;               /* 0 for a free slot. */
+    uint64_t gfn;
+    uint32_t domid;
+};
+
+static xc_interface *xch;
+static xenforeignmemory_handle *fh;
+static volatile sig_atomic_t interrupted;
+
+static struct dom *doms;
+static unsigned int nr_doms;
+static uint32_t *wanted;        /* Domains to scan, or NULL for all. */
+static unsigned int nr_wanted;
+static bool ignore_numa;
+static unsigned int rate = DEFAULT_RATE;
+
+static struct entry *table;
+static unsigned long table_size, table_used;
+
+static xen_mem_sharing_dedup_t pairs[BATCH];
+static unsigned int nr_pairs;
+
+static struct {
+    unsigned long pages;
+    unsigned int shared, differed, failed;
+} pass;
+static double pass_start;
+
+static void usage(const char *prog)
+{
+    fprintf(stderr,
+            "Usage: %s [OPTION]... [DOMID]...\n"
+            "Share the pages of HVM guests which have the same contents.\n"
+            "\n"
+            "-a, --all          scan all HVM guests rather than DOMIDs\n"
+            "-i, --interval=S   start a pass every S seconds (default %u)\n"
+            "-r, --rate=N       hash at most N pages a second (default %u)\n"
+            "-N, --ignore-numa  share pages across NUMA nodes too\n"
+            "-F, --foreground   do not daemonize, and log to stderr too\n"
+            "-h, --help         display this help and exit\n",
+            prog, DEFAULT_INTERVAL, DEFAULT_RATE);
+    exit(1);
+}
+
+static void handle_signal(int sig)
+{
+    interrupted = 1;
+}
+
+static double now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void sleep_until(double t)
+{
+    double d = t - now();
+    struct timespec ts;
+
+    if ( d <= 0 )
+        return;
+
+    ts.tv_sec = d;
+    ts.tv_nsec = (d - ts.tv_sec) * 1e9;
+    nanosleep(&ts, NULL);
+}
+
+/* Four independent lanes, for the multiplications to overlap. */
+static uint64_t hash_page(const uint64_t *p)
+{
+    uint64_t h[4] = { 1, 2, 3, 4 }, r = 0;
+    unsigned int i;
+
+    for ( i = 0; i < XC_PAGE_SIZE / sizeof(*p); i += 4 )
+    {
+        h[0] = (h[0] ^ p[i + 0]) * 0x9e3779b97f4a7c15ULL;
+        h[1] = (h[1] ^ p[i + 1]) * 0x9e3779b97f4a7c15ULL;
+        h[2] = (h[2] ^ p[i + 2]) * 0x9e3779b97f4a7c15ULL;
+        h[3] = (h[3] ^ p[i + 3]) * 0x9e3779b97f4a7c15ULL;
+    }
+
+    for ( i = 0; i < 4; i++ )
+    {
+        r = (r ^ h[i] ^ (h[i] >> 29)) * 0xbf58476d1ce4e5b9ULL;
+        r ^= r >> 32;
+    }
+
+    /* 0 stands for not hashed yet. */
+    return (r & ~HASH_SHARED) ?: 2;
+}
+
+static struct entry *lookup(uint64_t key)
+{
+    unsigned long i = key & (table_size - 1);
+
+    while ( table[i].key && table[i].key != key )
+        i = (i + 1) & (table_size - 1);
+
+    return &table[i];
+}
+
+static int grow_table(void)
+{
+    struct entry *old = table;
+    unsigned long i, old_size = table_size;
+
+    table_size = old_size ? old_size * 2 : 1UL << 16;
+    table = calloc(table_size, sizeof(*table));
+    if ( !table )
+    {
+        table = old;
+        table_size = old_size;
+        return -1;
+    }
+
+    for ( i = 0; i < old_size; i++ )
+        if ( old[i].key )
+            *lookup(old[i].key) = old[i];
+    free(old);
+
+    return 0;
+}
+
+static struct dom *dom_by_id(uint32_t domid)
+{
+    unsigned int i;
+
+    for ( i = 0; i < nr_doms; i++ )
+        if ( doms[i].domid == domid )
+            return &doms[i];
+
+    return NULL;
+}
+
+static void flush_pairs(const struct dom *dom)
+{
+    unsigned int i;
+
+    if ( !nr_pairs )
+        return;
+
+    if ( xc_memshr_dedup(xch, dom->domid, pairs, nr_pairs, NULL) )
+        syslog(LOG_WARNING, "Failed to share pages of d%u: %s",
+               dom->domid, strerror(errno));
+
+    for ( i = 0; i < nr_pairs; i++ )
+    {
+        if ( !pairs[i].rc )
+        {
+            struct dom *sdom = dom_by_id(pairs[i].source_domain);
+
+            dom->last[pairs[i].client_gfn] |= HASH_SHARED;
+            if ( sdom && pairs[i].source_gfn < sdom->nr_gfns )
+                sdom->last[pairs[i].source_gfn] |= HASH_SHARED;
+            pass.shared++;
+        }
+        else if ( pairs[i].rc == -ENODATA )
+            pass.differed++;
+        else
+            pass.failed++;
+    }
+
+    nr_pairs = 0;
+}
+
+/*
+ * Pairs up gfn with the first page with the same hash in the pass, or
+ * makes it that page.  A page which is shared already is only ever made
+ * that page.
+ */
+static void candidate(const struct dom *dom, xen_pfn_t gfn, uint64_t hash)
+{
+    uint64_t key = hash & ~HASH_SHARED;
+    struct entry *e;
+
+    if ( dom->node != NODE_ANY )
+        key += (dom->node + 1) * 0xc2b2ae3d27d4eb4fULL;
+    key = key ?: 1;
+
+    if ( !table_size && grow_table() )
+        return;
+
+    e = lookup(key);
+    if ( e->key )
+    {
+        xen_mem_sharing_dedup_t *pair;
+
+        if ( hash & HASH_SHARED )
+            return;
+
+        pair = &pairs[nr_pairs++];
+
+        pair->source_gfn = e->gfn;
+        pair->source_domain = e->domid;
+        pair->client_gfn = gfn;
+        pair->pad = 0;
+        pair->rc = 0;
+        return;
+    }
+
+    /* Not sharing this page is better than running out of memory. */
+    if ( (table_used + 1) * 2 > table_size )
+    {
+        if ( grow_table() )
+            return;
+        e = lookup(key);
+    }
+
+    e->key = key;
+    e->gfn = gfn;
+    e->domid = dom->domid;
+    table_used++;
+}
+
+static void scan_domain(struct dom *dom)
+{
+    xen_pfn_t gfns[CHUNK], gfn;
+    int errs[CHUNK];
+
+    for ( gfn = 0; gfn < dom->nr_gfns && !interrupted; gfn += CHUNK )
+    {
+        unsigned int i, n = min(dom->nr_gfns - gfn, (xen_pfn_t)CHUNK);
+        const uint8_t *va;
+
+        for ( i = 0; i < n; i++ )
+            gfns[i] = gfn + i;
+
+        va = xenforeignmemory_map(fh, dom->domid, PROT_READ, n, gfns, errs);
+        if ( !va )
+        {
+            if ( errno == ESRCH )
+                break;
+            continue;
+        }
+
+        for ( i = 0; i < n; i++ )
+        {
+            uint64_t *last = &dom->last[gfn + i], hash;
+
+            /*
+             * A page which can't be mapped is a hole, or shared already
+             * if the hash of it is known: Xen refuses to map shared pages
+             * into HVM dom0s.  The contents of a shared page can't change.
+             */
+            if ( errs[i] )
+            {
+                if ( *last )
+                    candidate(dom, gfn + i, *last);
+                continue;
+            }
+
+            hash = hash_page((const void *)(va + i * XC_PAGE_SIZE));
+            if ( hash == (*last & ~HASH_SHARED) )
+                candidate(dom, gfn + i, *last);
+            else
+                *last = hash;
+        }
+
+        /* The pages can't be shared while mapped. */
+        xenforeignmemory_unmap(fh, (void *)va, n);
+
+        if ( nr_pairs > BATCH - CHUNK )
+            flush_pairs(dom);
+
+        pass.pages += n;
+        sleep_until(pass_start + (double)pass.pages / rate);
+    }
+
+    flush_pairs(dom);
+}
+
+static bool is_wanted(uint32_t domid)
+{
+    unsigned int i;
+
+    if ( !wanted )
+        return true;
+
+    for ( i = 0; i < nr_wanted; i++ )
+        if ( wanted[i] == domid )
+            return true;
+
+    return false;
+}
+
+static unsigned int domain_node(uint32_t domid)
+{
+    static xc_nodemap_t nodemap;
+    static int max_nodes;
+    unsigned int node = NODE_ANY;
+    int i;
+
+    if ( ignore_numa )
+        return NODE_ANY;
+
+    if ( !nodemap )
+    {
+        max_nodes = xc_get_max_nodes(xch);
+        nodemap = xc_nodemap_alloc(xch);
+        if ( !nodemap )
+            return NODE_ANY;
+    }
+
+    if ( xc_domain_node_getaffinity(xch, domid, nodemap) )
+        return NODE_ANY;
+
+    for ( i = 0; i < max_nodes; i++ )
+    {
+        if ( !(nodemap[i / 8] & (1 << (i % 8))) )
+            continue;
+        /* Spread over several nodes, no different from any node. */
+        if ( node != NODE_ANY )
+            return NODE_ANY;
+        node = i;
+    }
+
+    return node;
+}
+
+static struct dom *find_dom(const xc_domaininfo_t *info)
+{
+    struct dom *dom, *new;
+    unsigned int i;
+
+    for ( i = 0; i < nr_doms; i++ )
+    {
+        dom = &doms[i];
+        if ( dom->domid != info->domain )
+            continue;
+        if ( !memcmp(dom->handle, info->handle, sizeof(dom->handle)) )
+            return dom;
+
+        /* The domid was reused. */
+        free(dom->last);
+        goto init;
+    }
+
+    new = realloc(doms, (nr_doms + 1) * sizeof(*doms));
+    if ( !new )
+        return NULL;
+    doms = new;
+    dom = &doms[nr_doms++];
+
+ init:
+    memset(dom, 0, sizeof(*dom));
+    dom->domid = info->domain;
+    memcpy(dom->handle, info->handle, sizeof(dom->handle));
+    dom->node = domain_node(dom->domid);
+
+    if ( xc_memshr_control(xch, dom->domid, 1) )
+    {
+        syslog(LOG_WARNING, "Can't share pages of d%u: %s",
+               dom->domid, strerror(errno));
+        dom->unsharable = true;
+    }
+
+    return dom;
+}
+
+static void refresh_domains(void)
+{
+    xc_domaininfo_t info[64];
+    uint32_t first = 1;
+    unsigned int i, j;
+    int n;
+
+    for ( i = 0; i < nr_doms; i++ )
+        doms[i].seen = false;
+
+    while ( (n = xc_domain_getinfolist(xch, first, ARRAY_SIZE(info),
+                                       info)) > 0 )
+    {
+        for ( j = 0; j < n; j++ )
+        {
+            struct dom *dom;
+            xen_pfn_t nr_gfns;
+
+            if ( !(info[j].flags & XEN_DOMINF_hvm_guest) ||
+                 (info[j].flags & (XEN_DOMINF_dying | XEN_DOMINF_shutdown)) ||
+                 !is_wanted(info[j].domain) )
+                continue;
+
+            dom = find_dom(&info[j]);
+            if ( !dom )
+                continue;
+            dom->seen = true;
+
+            if ( dom->unsharable ||
+                 xc_domain_nr_gpfns(xch, dom->domid, &nr_gfns) ||
+                 nr_gfns <= dom->nr_gfns )
+                continue;
+
+            /* Memory was added, or this is a new domain. */
+            dom->last = realloc(dom->last, nr_gfns * sizeof(*dom->last));
+            if ( !dom->last )
+            {
+                dom->nr_gfns = 0;
+                continue;
+            }
+            memset(dom->last + dom->nr_gfns, 0,
+                   (nr_gfns - dom->nr_gfns) * sizeof(*dom->last));
+            dom->nr_gfns = nr_gfns;
+        }
+
+        first = info[n - 1].domain + 1;
+    }
+
+    for ( i = 0; i < nr_doms; )
+    {
+        if ( doms[i].seen )
+        {
+            i++;
+            continue;
+        }
+        free(doms[i].last);
+        doms[i] = doms[--nr_doms];
+    }
+}
+
+static void do_pass(void)
+{
+    static double last_time;
+    static long last_breaks = -1;
+    double t;
+    long saved, breaks;
+    unsigned int i;
+
+    memset(&pass, 0, sizeof(pass));
+    pass_start = now();
+
+    refresh_domains();
+
+    if ( table )
+        memset(table, 0, table_size * sizeof(*table));
+    table_used = 0;
+
+    for ( i = 0; i < nr_doms && !interrupted; i++ )
+        if ( !doms[i].unsharable )
+            scan_domain(&doms[i]);
+
+    t = now();
+    saved = xc_sharing_freed_pages(xch);
+    breaks = xc_sharing_cow_breaks(xch);
+
+    syslog(LOG_INFO,
+           "%lu pages of %u domains in %.1fs: %u pairs shared, %u differed,"
+           " %u failed; %ld MiB saved, %.1f CoW breaks/s",
+           pass.pages, nr_doms, t - pass_start, pass.shared, pass.differed,
+           pass.failed, saved >> (20 - XC_PAGE_SHIFT),
+           last_breaks >= 0 ? (unsigned int)(breaks - last_breaks) /
+                              (t - last_time) : 0.0);
+
+    last_time = t;
+    last_breaks = breaks;
+}
+
+int main(int argc, char **argv)
+{
+    static const struct option lopts[] = {
+        { "all",         no_argument,       NULL, 'a' },
+        { "interval",    required_argument, NULL, 'i' },
+        { "rate",        required_argument, NULL, 'r' },
+        { "ignore-numa", no_argument,       NULL, 'N' },
+        { "foreground",  no_argument,       NULL, 'F' },
+        { "help",        no_argument,       NULL, 'h' },
+        { 0, 0, 0, 0 },
+    };
+    unsigned int interval = DEFAULT_INTERVAL;
+    bool all = false, foreground = false;
+    struct sigaction sa;
+    unsigned int i;
+    int opt;
+
+    while ( (opt = getopt_long(argc, argv, "ai:r:NFh", lopts, NULL)) != -1 )
+    {
+        switch ( opt )
+        {
+        case 'a':
+            all = true;
+            break;
+        case 'i':
+            interval = strtoul(optarg, NULL, 0);
+            break;
+        case 'r':
+            rate = strtoul(optarg, NULL, 0);
+            break;
+        case 'N':
+            ignore_numa = true;
+            break;
+        case 'F':
+            foreground = true;
+            break;
+        default:
+            usage(argv[0]);
+        }
+    }
+    if ( all == (optind < argc) || !rate )
+        usage(argv[0]);
+
+    if ( !all )
+    {
+        nr_wanted = argc - optind;
+        wanted = calloc(nr_wanted, sizeof(*wanted));
+        if ( !wanted )
+            return 1;
+        for ( i = 0; i < nr_wanted; i++ )
+            wanted[i] = strtoul(argv[optind + i], NULL, 0);
+    }
+
+    openlog("xen-dedupd", LOG_PID | (foreground ? LOG_PERROR : 0),
+            LOG_DAEMON);
+
+    xch = xc_interface_open(NULL, NULL, 0);
+    fh = xenforeignmemory_open(NULL, 0);
+    if ( !xch || !fh )
+    {
+        syslog(LOG_ERR, "Failed to open Xen interfaces: %s", strerror(errno));
+        return 1;
+    }
+
+    if ( !foreground && daemon(0, 0) )
+    {
+        syslog(LOG_ERR, "Failed to daemonize: %s", strerror(errno));
+        return 1;
+    }
+
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = handle_signal;
+    sigaction(SIGTERM, &sa, NULL);
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGHUP, &sa, NULL);
+
+    while ( !interrupted )
+    {
+        double start = now();
+
+        do_pass();
+        sleep_until(start + interval);
+    }
+
+    xenforeignmemory_close(fh);
+    xc_interface_close(xch);
+
+    return 0;
+}
+
+/*
+ * Local variables:
+ * mode: C
+ * c-file-style: "BSD"
+ * c-basic-offset: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
@@ -71,6 +71,10 @@ int main(int argc, const char** argv)
         if ( rc < 0 )
             return 1;
         printf("freed = %ld\n", rc);
+        rc = xc_sharing_cow_breaks(xch);
+        if ( rc < 0 )
+            return 1;
+        printf("cow breaks = %ld\n", rc);
     }
     else if( !strcasecmp(cmd, "enable") )
     {
@@ -18,6 +18,90 @@
 #include <string.h>
 #include <inttypes.h>
 
+/* The locks of one name and type, e.g. the event locks of all domains. */
+struct lock_class {
+    const char *name;
+    uint32_t    type;
+    uint32_t    nr;
+    uint64_t    lock_cnt, block_cnt;
+    uint64_t    lock_time, block_time;
+    uint64_t    block_hist[XEN_SYSCTL_LOCKPROF_NR_BUCKETS];
+};
+
+/* Upper bound, in ns, of the wait times counted in a histogram bucket. */
+static uint64_t bucket_limit(unsigned int i)
+{
+    return 1ULL << (XEN_SYSCTL_LOCKPROF_HIST_SHIFT + i);
+}
+
+static void print_classes(const xc_lockprof_data_t *data, uint32_t nr)
+{
+    struct lock_class *classes = calloc(nr, sizeof(*classes)), *c;
+    uint32_t i, j, nr_classes = 0;
+    uint64_t sum;
+
+    if ( classes == NULL )
+    {
+        fprintf(stderr, "Could not allocate buffers: %d (%s)\n",
+                errno, strerror(errno));
+        return;
+    }
+
+    for ( i = 0; i < nr; i++ )
+    {
+        for ( j = 0; j < nr_classes; j++ )
+            if ( classes[j].type == data[i].type &&
+                 !strncmp(classes[j].name, data[i].name,
+                          sizeof(data[i].name)) )
+                break;
+        c = &classes[j];
+        if ( j == nr_classes )
+        {
+            c->name = data[i].name;
+            c->type = data[i].type;
+            nr_classes++;
+        }
+
+        c->nr++;
+        c->lock_cnt += data[i].lock_cnt;
+        c->block_cnt += data[i].block_cnt;
+        c->lock_time += data[i].lock_time;
+        c->block_time += data[i].block_time;
+        for ( j = 0; j < XEN_SYSCTL_LOCKPROF_NR_BUCKETS; j++ )
+            c->block_hist[j] += data[i].block_hist[j];
+    }
+
+    for ( i = 0; i < nr_classes; i++ )
+    {
+        c = &classes[i];
+        printf("%s lock %.40s (%u instance%s): lock:%12"PRIu64"(%20.9fs), "
+               "block:%12"PRIu64"(%20.9fs)\n",
+               c->type == LOCKPROF_TYPE_GLOBAL ? "global" :
+               c->type == LOCKPROF_TYPE_PERDOM ? "domain" : "unknown",
+               c->name, c->nr, c->nr == 1 ? "" : "s",
+               c->lock_cnt, (double)c->lock_time / 1E+09,
+               c->block_cnt, (double)c->block_time / 1E+09);
+        if ( !c->block_cnt )
+            continue;
+
+        printf("    wait time distribution:\n");
+        for ( sum = 0, j = 0; j < XEN_SYSCTL_LOCKPROF_NR_BUCKETS; j++ )
+        {
+            if ( !c->block_hist[j] )
+                continue;
+            sum += c->block_hist[j];
+            if ( j < XEN_SYSCTL_LOCKPROF_NR_BUCKETS - 1 )
+                printf("      < %10"PRIu64"ns", bucket_limit(j));
+            else
+                printf("     >= %10"PRIu64"ns", bucket_limit(j - 1));
+            printf(": %12"PRIu64" (%5.1f%% cumulative)\n", c->block_hist[j],
+                   sum * 100.0 / c->block_cnt);
+        }
+    }
+
+    free(classes);
+}
+
 int main(int argc, char *argv[])
 {
     xc_interface      *xc_handle;
@@ -25,13 +109,19 @@ int main(int argc, char *argv[])
     uint64_t           time;
     double             l, b, sl, sb;
     char               name[100];
+    int                reset = 0, classes = 0;
     DECLARE_HYPERCALL_BUFFER(xc_lockprof_data_t, data);
 
-    if ( (argc > 2) || ((argc == 2) && (strcmp(argv[1], "-r") != 0)) )
+    if ( argc == 2 && !strcmp(argv[1], "-r") )
+        reset = 1;
+    else if ( argc == 2 && !strcmp(argv[1], "-c") )
+        classes = 1;
+    else if ( argc != 1 )
     {
-        printf("%s: [-r]\n", argv[0]);
+        printf("%s: [-r|-c]\n", argv[0]);
         printf("no args: print lock profile data\n");
         printf("    -r : reset profile data\n");
+        printf("    -c : print profile data and wait times per lock class\n");
         return 1;
     }
 
@@ -42,7 +132,7 @@ int main(int argc, char *argv[])
         return 1;
     }
 
-    if ( argc > 1 )
+    if ( reset )
     {
         if ( xc_lockprof_reset(xc_handle) != 0 )
         {
@@ -84,6 +174,13 @@ int main(int argc, char *argv[])
         i = n;
     }
 
+    if ( classes )
+    {
+        print_classes(data, i);
+        xc_hypercall_buffer_free(xc_handle, data);
+        return 0;
+    }
+
     sl = 0;
     sb = 0;
     for ( j = 0; j < i; j++ )
@@ -0,0 +1,346 @@
+/*
+ * Checks and times forking of VMs: one at a time against XENMEM sharing
+ * fork_bulk, with a hot set of pages, and fork_reset of forks which dirtied
+ * a few pages.  Requires HAP and a hypervisor built with CONFIG_MEM_SHARING.
+ */
+#include <err.h>
+#include <errno.h>
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+
+#include <xenctrl.h>
+#include <xenforeignmemory.h>
+#include <xen-tools/libs.h>
+
+static unsigned int nr_failures;
+#define fail(fmt, ...)                          \
+({                                              \
+    nr_failures++;                              \
+    (void)printf(fmt, ##__VA_ARGS__);           \
+})
+
+static xc_interface *xch;
+static xenforeignmemory_handle *fh;
+
+static unsigned int nr_forks = 64;
+static unsigned int nr_pages = 4096;
+static unsigned int nr_hot = 256;
+static unsigned int nr_dirty = 32;
+static unsigned int nr_resets = 1000;
+
+static struct xen_domctl_createdomain create = {
+    .flags = XEN_DOMCTL_CDF_hvm | XEN_DOMCTL_CDF_hap,
+    .max_vcpus = 1,
+    .max_grant_frames = 1,
+    .arch = {
+        .emulation_flags = XEN_X86_EMU_LAPIC,
+    },
+};
+
+static double now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static unsigned char pattern(xen_pfn_t gfn)
+{
+    return 0x5a ^ gfn;
+}
+
+/* Maps nr pages of domid from gfn on, for reading or writing. */
+static unsigned char *map(uint32_t domid, xen_pfn_t gfn, unsigned int nr,
+                          int prot)
+{
+    xen_pfn_t gfns[nr];
+    unsigned char *va;
+
+    for ( unsigned int i = 0; i < nr; i++ )
+        gfns[i] = gfn + i;
+
+    va = xenforeignmemory_map(fh, domid, prot, nr, gfns, NULL);
+    if ( !va )
+        fail("  Fail: map d%u gfn %#lx: %d - %s\n",
+             domid, (unsigned long)gfn, errno, strerror(errno));
+
+    return va;
+}
+
+static void check_pages(uint32_t domid, xen_pfn_t gfn, unsigned int nr,
+                        const char *what)
+{
+    unsigned char *va = map(domid, gfn, nr, PROT_READ);
+
+    if ( !va )
+        return;
+
+    for ( unsigned int i = 0; i < nr; i++ )
+        if ( va[i * XC_PAGE_SIZE] != pattern(gfn + i) ||
+             va[i * XC_PAGE_SIZE + XC_PAGE_SIZE - 1] != pattern(gfn + i) )
+        {
+            fail("  Fail: d%u gfn %#lx %s\n",
+                 domid, (unsigned long)(gfn + i), what);
+            break;
+        }
+
+    xenforeignmemory_unmap(fh, va, nr);
+}
+
+static int create_parent(uint32_t *domid)
+{
+    xen_pfn_t *gfns = calloc(nr_pages, sizeof(*gfns));
+    unsigned char *va;
+    int rc = -1;
+
+    if ( !gfns )
+        err(1, "calloc");
+
+    for ( unsigned int i = 0; i < nr_pages; i++ )
+        gfns[i] = i;
+
+    *domid = 0;
+    if ( xc_domain_create(xch, domid, &create) )
+    {
+        if ( errno == EINVAL || errno == EOPNOTSUPP )
+            printf("  Skip: no HAP guests: %d - %s\n", errno, strerror(errno));
+        else
+            fail("  Fail: create parent: %d - %s\n", errno, strerror(errno));
+        goto out;
+    }
+
+    if ( xc_domain_setmaxmem(xch, *domid, nr_pages * (XC_PAGE_SIZE >> 10)) ||
+         xc_domain_populate_physmap_exact(xch, *domid, nr_pages, 0, 0, gfns) )
+    {
+        fail("  Fail: populate parent: %d - %s\n", errno, strerror(errno));
+        goto out;
+    }
+
+    va = map(*domid, 0, nr_pages, PROT_READ | PROT_WRITE);
+    if ( !va )
+        goto out;
+    for ( unsigned int i = 0; i < nr_pages; i++ )
+        memset(va + i * XC_PAGE_SIZE, pattern(i), XC_PAGE_SIZE);
+    xenforeignmemory_unmap(fh, va, nr_pages);
+
+    rc = 0;
+ out:
+    free(gfns);
+    return rc;
+}
+
+static int create_forks(uint32_t *domids)
+{
+    for ( unsigned int i = 0; i < nr_forks; i++ )
+    {
+        domids[i] = 0;
+        if ( xc_domain_create(xch, &domids[i], &create) )
+        {
+            fail("  Fail: create fork %u: %d - %s\n",
+                 i, errno, strerror(errno));
+            while ( i-- )
+                xc_domain_destroy(xch, domids[i]);
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+static void destroy_forks(const uint32_t *domids)
+{
+    for ( unsigned int i = 0; i < nr_forks; i++ )
+        xc_domain_destroy(xch, domids[i]);
+}
+
+/* Returns false if the hypervisor can't fork at all. */
+static bool test_fork(uint32_t parent, uint32_t *domids)
+{
+    double t;
+
+    printf("Test fork of %u domains one by one\n", nr_forks);
+
+    if ( create_forks(domids) )
+        return true;
+
+    t = now();
+    for ( unsigned int i = 0; i < nr_forks; i++ )
+        if ( xc_memshr_fork(xch, parent, domids[i], false, false) )
+        {
+            if ( !i && (errno == EOPNOTSUPP || errno == ENODEV ||
+                        errno == ENOSYS) )
+            {
+                printf("  Skip: no memory sharing: %d - %s\n",
+                       errno, strerror(errno));
+                destroy_forks(domids);
+                return false;
+            }
+            fail("  Fail: fork %u: %d - %s\n", i, errno, strerror(errno));
+            break;
+        }
+    t = now() - t;
+
+    printf("  %u forks in %.3fms: %.0f forks/s\n",
+           nr_forks, t * 1e3, nr_forks / t);
+
+    check_pages(domids[nr_forks - 1], 0, nr_hot, "differs from the parent");
+    destroy_forks(domids);
+
+    return true;
+}
+
+static void test_fork_bulk(uint32_t parent, uint32_t *domids, bool private)
+{
+    uint64_t *hot = calloc(nr_hot, sizeof(*hot));
+    unsigned int done;
+    double t;
+
+    if ( !hot )
+        err(1, "calloc");
+
+    printf("Test bulk fork of %u domains, %u hot pages %s\n",
+           nr_forks, nr_hot, private ? "copied" : "shared");
+
+    /* Every other page, to not just be one range. */
+    for ( unsigned int i = 0; i < nr_hot; i++ )
+        hot[i] = (i * 2) % nr_pages;
+
+    if ( create_forks(domids) )
+        goto out;
+
+    t = now();
+    if ( xc_memshr_fork_bulk(xch, parent, domids, nr_forks, hot, nr_hot,
+                             false, false, private, &done) )
+        fail("  Fail: bulk fork, %u of %u done: %d - %s\n",
+             done, nr_forks, errno, strerror(errno));
+    t = now() - t;
+
+    printf("  %u forks in %.3fms: %.0f forks/s\n",
+           nr_forks, t * 1e3, nr_forks / t);
+
+    check_pages(domids[0], 0, 2 * nr_hot, "differs from the parent");
+    destroy_forks(domids);
+
+ out:
+    free(hot);
+}
+
+static void test_fork_reset(uint32_t parent, uint32_t *domids)
+{
+    double t = 0;
+    unsigned int i;
+    uint32_t fork;
+
+    printf("Test reset of a fork dirtying %u pages, %u times\n",
+           nr_dirty, nr_resets);
+
+    if ( xc_domain_create(xch, &domids[0], &create) )
+    {
+        fail("  Fail: create fork: %d - %s\n", errno, strerror(errno));
+        return;
+    }
+    fork = domids[0];
+
+    if ( xc_memshr_fork(xch, parent, fork, false, false) )
+    {
+        fail("  Fail: fork: %d - %s\n", errno, strerror(errno));
+        goto out;
+    }
+
+    for ( i = 0; i < nr_resets; i++ )
+    {
+        /* A different set of pages every time, as a fuzzer's inputs would. */
+        xen_pfn_t gfn = (i * nr_dirty) % (nr_pages - nr_dirty + 1);
+        unsigned char *va = map(fork, gfn, nr_dirty, PROT_READ | PROT_WRITE);
+        double start;
+
+        if ( !va )
+            break;
+        for ( unsigned int j = 0; j < nr_dirty; j++ )
+            va[j * XC_PAGE_SIZE] = ~pattern(gfn + j);
+        xenforeignmemory_unmap(fh, va, nr_dirty);
+
+        start = now();
+        if ( xc_memshr_fork_reset(xch, fork) )
+        {
+            fail("  Fail: reset: %d - %s\n", errno, strerror(errno));
+            break;
+        }
+        t += now() - start;
+
+        if ( !i )
+            check_pages(fork, gfn, nr_dirty, "not reset");
+    }
+
+    if ( i )
+        printf("  %u resets in %.3fms: %.0f resets/s\n", i, t * 1e3, i / t);
+
+ out:
+    xc_domain_destroy(xch, fork);
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr,
+            "Usage: %s [-n forks] [-p pages] [-H hot pages] [-d dirty pages]"
+            " [-r resets]\n", prog);
+    exit(2);
+}
+
+int main(int argc, char **argv)
+{
+    uint32_t parent, *domids;
+    int opt;
+
+    while ( (opt = getopt(argc, argv, "n:p:H:d:r:")) != -1 )
+    {
+        switch ( opt )
+        {
+        case 'n': nr_forks = strtoul(optarg, NULL, 0); break;
+        case 'p': nr_pages = strtoul(optarg, NULL, 0); break;
+        case 'H': nr_hot = strtoul(optarg, NULL, 0); break;
+        case 'd': nr_dirty = strtoul(optarg, NULL, 0); break;
+        case 'r': nr_resets = strtoul(optarg, NULL, 0); break;
+        default: usage(argv[0]);
+        }
+    }
+    if ( !nr_forks || !nr_dirty || nr_dirty > nr_pages ||
+         2 * nr_hot > nr_pages )
+        usage(argv[0]);
+
+    printf("VM fork tests\n");
+
+    xch = xc_interface_open(NULL, NULL, 0);
+    fh = xenforeignmemory_open(NULL, 0);
+
+    if ( !xch )
+        err(1, "xc_interface_open");
+    if ( !fh )
+        err(1, "xenforeignmemory_open");
+
+    domids = calloc(nr_forks, sizeof(*domids));
+    if ( !domids )
+        err(1, "calloc");
+
+    if ( create_parent(&parent) )
+        return !!nr_failures;
+
+    /* The parent must stay paused for forks to be made of it. */
+    if ( test_fork(parent, domids) )
+    {
+        test_fork_bulk(parent, domids, false);
+        test_fork_bulk(parent, domids, true);
+        test_fork_reset(parent, domids);
+    }
+
+    xc_domain_destroy(xch, parent);
+    free(domids);
+
+    return !!nr_failures;
+}
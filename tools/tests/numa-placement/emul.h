@@ -0,0 +1,288 @@
+/*
+ * Test harness for the libxl automatic NUMA placement code: just enough
+ * of libxl for libxl_numa.c to build, on top of a synthetic host.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms and conditions of the GNU General Public
+ * License, version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program; If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _TEST_NUMA_PLACEMENT_
+#define _TEST_NUMA_PLACEMENT_
+
+#include <assert.h>
+#include <inttypes.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define _hidden
+
+#define ERROR_FAIL  -3
+#define ERROR_INVAL -6
+
+typedef struct {
+    uint32_t size;          /* number of bytes in map */
+    uint8_t *map;
+} libxl_bitmap;
+
+typedef struct {
+    uint8_t uuid[16];
+} libxl_uuid;
+
+typedef struct {
+    uint32_t core, socket, node;
+} libxl_cputopology;
+
+typedef struct {
+    uint64_t size, free;
+    uint32_t *dists;
+    int num_dists;
+} libxl_numainfo;
+
+typedef struct {
+    libxl_uuid uuid;
+    uint32_t domid;
+    uint32_t cpupool;
+} libxl_dominfo;
+
+typedef struct {
+    libxl_bitmap cpumap;
+} libxl_vcpuinfo;
+
+typedef struct {
+    uint32_t poolid;
+    libxl_bitmap cpumap;
+} libxl_cpupoolinfo;
+
+typedef struct {
+    uint32_t domid;
+    libxl_uuid uuid;
+    int *vcpus_on_node;
+} libxl__numa_dom_load;
+
+#define LIBXL__NUMA_CACHE_SLOTS 4
+
+typedef struct {
+    time_t expires;
+    int nr_nodes;
+    libxl_bitmap cpumap;
+    int nr_doms;
+    libxl__numa_dom_load *doms;
+} libxl__numa_cache;
+
+typedef struct {
+    libxl__numa_cache numa_cache[LIBXL__NUMA_CACHE_SLOTS];
+} libxl_ctx;
+
+/* Allocations are kept track of, and freed by gc_free(), unless NOGC. */
+typedef struct {
+    libxl_ctx *owner;
+    void **ptrs;
+    unsigned int nr, max;
+} libxl__gc;
+
+#define CTX         (gc->owner)
+#define NOGC        NULL
+#define CTX_LOCK
+#define CTX_UNLOCK
+#define LOG(l, f, ...)
+
+void *libxl__calloc(libxl__gc *gc, size_t nmemb, size_t size);
+void gc_free(libxl__gc *gc);
+
+#define GCNEW_ARRAY(var, nmemb)                                 \
+    ((var) = libxl__calloc((gc), (nmemb), sizeof(*(var))))
+
+char *libxl__sprintf(libxl__gc *gc, const char *fmt, ...);
+#define GCSPRINTF(fmt, ...) (libxl__sprintf((gc), (fmt), __VA_ARGS__))
+
+/* Xenstore, holding just the records of pending placements (main.c). */
+typedef uint32_t xs_transaction_t;
+#define XBT_NULL ((xs_transaction_t)0)
+
+char **libxl__xs_directory(libxl__gc *gc, xs_transaction_t t,
+                           const char *path, unsigned int *nb);
+int libxl__xs_read_checked(libxl__gc *gc, xs_transaction_t t,
+                           const char *path, const char **result_out);
+
+/* Bitmaps, as in libxl_utils.h. */
+static inline void libxl_bitmap_init(libxl_bitmap *map)
+{
+    memset(map, 0, sizeof(*map));
+}
+
+static inline void libxl_bitmap_dispose(libxl_bitmap *map)
+{
+    free(map->map);
+    libxl_bitmap_init(map);
+}
+
+static inline int libxl_bitmap_alloc(libxl_ctx *ctx, libxl_bitmap *map,
+                                     int n_bits)
+{
+    map->size = (n_bits + 7) / 8;
+    map->map = calloc(map->size, 1);
+    return 0;
+}
+
+static inline int libxl_bitmap_test(const libxl_bitmap *map, int bit)
+{
+    if (bit >= map->size * 8)
+        return 0;
+    return (map->map[bit / 8] & (1 << (bit & 7))) ? 1 : 0;
+}
+
+static inline void libxl_bitmap_set(libxl_bitmap *map, int bit)
+{
+    if (bit < map->size * 8)
+        map->map[bit / 8] |= 1 << (bit & 7);
+}
+
+static inline void libxl_bitmap_set_none(libxl_bitmap *map)
+{
+    memset(map->map, 0, map->size);
+}
+
+static inline int libxl_bitmap_count_set(const libxl_bitmap *map)
+{
+    int i, nr = 0;
+
+    for (i = 0; i < map->size * 8; i++)
+        nr += libxl_bitmap_test(map, i);
+    return nr;
+}
+
+static inline int libxl_bitmap_equal(const libxl_bitmap *a,
+                                     const libxl_bitmap *b, int nr_bits)
+{
+    int i;
+
+    if (!nr_bits)
+        nr_bits = (a->size > b->size ? a->size : b->size) * 8;
+    for (i = 0; i < nr_bits; i++)
+        if (libxl_bitmap_test(a, i) != libxl_bitmap_test(b, i))
+            return 0;
+    return 1;
+}
+
+static inline void libxl_bitmap_copy(libxl_ctx *ctx, libxl_bitmap *dptr,
+                                     const libxl_bitmap *sptr)
+{
+    int sz = dptr->size < sptr->size ? dptr->size : sptr->size;
+
+    memcpy(dptr->map, sptr->map, sz);
+}
+
+static inline int libxl_bitmap_copy_alloc(libxl_ctx *ctx, libxl_bitmap *dptr,
+                                          const libxl_bitmap *sptr)
+{
+    dptr->map = calloc(sptr->size, 1);
+    dptr->size = sptr->size;
+    memcpy(dptr->map, sptr->map, sptr->size);
+    return 0;
+}
+
+#define libxl_for_each_set_bit(v, m) for (v = 0; v < (m).size * 8; v++) \
+                                             if (libxl_bitmap_test(&(m), v))
+
+static inline void libxl_uuid_copy(libxl_ctx *ctx, libxl_uuid *dst,
+                                   const libxl_uuid *src)
+{
+    *dst = *src;
+}
+
+static inline int libxl_uuid_compare(const libxl_uuid *a, const libxl_uuid *b)
+{
+    return memcmp(a, b, sizeof(*a));
+}
+
+/* The synthetic host, see main.c. */
+int libxl_node_bitmap_alloc(libxl_ctx *ctx, libxl_bitmap *nodemap,
+                            int max_nodes);
+libxl_numainfo *libxl_get_numainfo(libxl_ctx *ctx, int *nr);
+void libxl_numainfo_list_free(libxl_numainfo *list, int nr);
+libxl_cputopology *libxl_get_cpu_topology(libxl_ctx *ctx, int *nb_cpu_out);
+void libxl_cputopology_list_free(libxl_cputopology *list, int nr);
+int libxl_cpumap_to_nodemap(libxl_ctx *ctx, const libxl_bitmap *cpumap,
+                            libxl_bitmap *nodemap);
+libxl_dominfo *libxl_list_domain(libxl_ctx *ctx, int *nb_domain_out);
+void libxl_dominfo_list_free(libxl_dominfo *list, int nr);
+libxl_cpupoolinfo *libxl_list_cpupool(libxl_ctx *ctx, int *nb_pool_out);
+void libxl_cpupoolinfo_list_free(libxl_cpupoolinfo *list, int nr);
+libxl_vcpuinfo *libxl_list_vcpu(libxl_ctx *ctx, uint32_t domid,
+                                int *nb_vcpu, int *nr_cpus_out);
+void libxl_vcpuinfo_list_free(libxl_vcpuinfo *list, int nr);
+int libxl_domain_get_nodeaffinity(libxl_ctx *ctx, uint32_t domid,
+                                  libxl_bitmap *nodemap);
+
+/* Placement candidates, as in libxl_internal.h. */
+typedef struct {
+    int nr_cpus, nr_nodes;
+    int nr_vcpus;
+    uint64_t free_memkb;
+    libxl_bitmap nodemap;
+} libxl__numa_candidate;
+
+typedef int (*libxl__numa_candidate_cmpf)(const libxl__numa_candidate *c1,
+                                          const libxl__numa_candidate *c2);
+
+int libxl__get_numa_candidate(libxl__gc *gc,
+                              uint64_t min_free_memkb, int min_cpus,
+                              int min_nodes, int max_nodes,
+                              const libxl_bitmap *suitable_cpumap,
+                              libxl__numa_candidate_cmpf numa_cmpf,
+                              libxl__numa_candidate *cndt_out,
+                              int *cndt_found);
+void libxl__numa_cache_invalidate(libxl__gc *gc, uint32_t domid);
+void libxl__numa_cache_dispose(libxl_ctx *ctx);
+
+static inline void libxl__numa_candidate_init(libxl__numa_candidate *cndt)
+{
+    cndt->free_memkb = 0;
+    cndt->nr_cpus = cndt->nr_nodes = cndt->nr_vcpus = 0;
+    libxl_bitmap_init(&cndt->nodemap);
+}
+
+static inline int libxl__numa_candidate_alloc(libxl__gc *gc,
+                                              libxl__numa_candidate *cndt)
+{
+    libxl_bitmap_dispose(&cndt->nodemap);
+    return libxl_node_bitmap_alloc(CTX, &cndt->nodemap, 0);
+}
+
+static inline void libxl__numa_candidate_dispose(libxl__numa_candidate *cndt)
+{
+    libxl_bitmap_dispose(&cndt->nodemap);
+}
+
+static inline
+void libxl__numa_candidate_put_nodemap(libxl__gc *gc,
+                                       libxl__numa_candidate *cndt,
+                                       const libxl_bitmap *nodemap)
+{
+    libxl_bitmap_copy(CTX, &cndt->nodemap, nodemap);
+}
+
+#endif
+
+/*
+ * Local variables:
+ * mode: C
+ * c-file-style: "BSD"
+ * c-basic-offset: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
@@ -0,0 +1,1128 @@
+/*
+ * Unit tests and benchmark for the libxl automatic NUMA placement code.
+ *
+ * The placement libxl does is compared with the one of the original
+ * exhaustive search (kept below as reference), on synthetic hosts onto
+ * which domains keep being created.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms and conditions of the GNU General Public
+ * License, version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program; If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "emul.h"
+
+#define MAX_NODES        64
+#define CPUS_PER_NODE    8
+#define MAX_CPUS         (MAX_NODES * CPUS_PER_NODE)
+#define MAX_DOMS         4096
+
+struct host_dom {
+    uint32_t domid;
+    libxl_uuid uuid;
+    uint32_t cpupool;
+    int nr_vcpus;
+    uint64_t memkb;
+    libxl_bitmap cpumap;        /* Hard affinity of all the vcpus */
+    libxl_bitmap nodemap;       /* Node affinity */
+};
+
+/*
+ * The host: nodes of CPUS_PER_NODE cpus, with pairs of nodes sharing a
+ * socket; cpupool 1 has the cpus of the last quarter of the nodes, and
+ * cpupool 0 all the others.
+ */
+static struct {
+    int nr_nodes, nr_cpus;
+    uint64_t free[MAX_NODES];   /* bytes */
+    uint32_t dists[MAX_NODES][MAX_NODES];
+    libxl_bitmap pool_cpumap[2];
+    uint64_t pending[MAX_NODES]; /* kB, of a domain placed but not built */
+    int nr_doms;
+    uint32_t next_domid;
+    struct host_dom doms[MAX_DOMS];
+} host;
+
+static unsigned long nr_list_vcpu;
+
+void *libxl__calloc(libxl__gc *gc, size_t nmemb, size_t size)
+{
+    void *p = calloc(nmemb ? nmemb : 1, size ? size : 1);
+
+    assert(p);
+    if (gc) {
+        if (gc->nr == gc->max) {
+            gc->max = gc->max ? gc->max * 2 : 64;
+            gc->ptrs = realloc(gc->ptrs, gc->max * sizeof(*gc->ptrs));
+            assert(gc->ptrs);
+        }
+        gc->ptrs[gc->nr++] = p;
+    }
+    return p;
+}
+
+void gc_free(libxl__gc *gc)
+{
+    while (gc->nr)
+        free(gc->ptrs[--gc->nr]);
+}
+
+char *libxl__sprintf(libxl__gc *gc, const char *fmt, ...)
+{
+    va_list ap;
+    char *s;
+    int len;
+
+    va_start(ap, fmt);
+    len = vsnprintf(NULL, 0, fmt, ap);
+    va_end(ap);
+
+    s = libxl__calloc(gc, len + 1, 1);
+    va_start(ap, fmt);
+    vsnprintf(s, len + 1, fmt, ap);
+    va_end(ap);
+    return s;
+}
+
+/* The pending domain, if any, is domain 0 in /libxl. */
+char **libxl__xs_directory(libxl__gc *gc, xs_transaction_t t,
+                           const char *path, unsigned int *nb)
+{
+    char **ents;
+    int i;
+
+    GCNEW_ARRAY(ents, host.nr_nodes);
+    *nb = 0;
+    if (!strcmp(path, "/libxl")) {
+        for (i = 0; i < host.nr_nodes; i++)
+            if (host.pending[i]) {
+                ents[(*nb)++] = "0";
+                break;
+            }
+    } else if (!strcmp(path, "/libxl/0/numa-pending")) {
+        for (i = 0; i < host.nr_nodes; i++)
+            if (host.pending[i])
+                ents[(*nb)++] = GCSPRINTF("%d", i);
+    }
+
+    return *nb ? ents : NULL;
+}
+
+int libxl__xs_read_checked(libxl__gc *gc, xs_transaction_t t,
+                           const char *path, const char **result_out)
+{
+    int node;
+
+    *result_out = NULL;
+    if (sscanf(path, "/libxl/0/numa-pending/%d", &node) == 1 &&
+        node < host.nr_nodes && host.pending[node])
+        *result_out = GCSPRINTF("%"PRIu64, host.pending[node]);
+    return 0;
+}
+
+int libxl_node_bitmap_alloc(libxl_ctx *ctx, libxl_bitmap *nodemap,
+                            int max_nodes)
+{
+    return libxl_bitmap_alloc(ctx, nodemap, host.nr_nodes);
+}
+
+libxl_numainfo *libxl_get_numainfo(libxl_ctx *ctx, int *nr)
+{
+    libxl_numainfo *ninfo = calloc(host.nr_nodes, sizeof(*ninfo));
+    int i;
+
+    for (i = 0; i < host.nr_nodes; i++) {
+        ninfo[i].free = host.free[i];
+        ninfo[i].num_dists = host.nr_nodes;
+        ninfo[i].dists = malloc(host.nr_nodes * sizeof(*ninfo[i].dists));
+        memcpy(ninfo[i].dists, host.dists[i],
+               host.nr_nodes * sizeof(*ninfo[i].dists));
+    }
+    *nr = host.nr_nodes;
+    return ninfo;
+}
+
+void libxl_numainfo_list_free(libxl_numainfo *list, int nr)
+{
+    int i;
+
+    for (i = 0; list && i < nr; i++)
+        free(list[i].dists);
+    free(list);
+}
+
+libxl_cputopology *libxl_get_cpu_topology(libxl_ctx *ctx, int *nb_cpu_out)
+{
+    libxl_cputopology *tinfo = calloc(host.nr_cpus, sizeof(*tinfo));
+    int i;
+
+    for (i = 0; i < host.nr_cpus; i++) {
+        tinfo[i].node = i / CPUS_PER_NODE;
+        tinfo[i].socket = tinfo[i].node / 2;
+        tinfo[i].core = i;
+    }
+    *nb_cpu_out = host.nr_cpus;
+    return tinfo;
+}
+
+void libxl_cputopology_list_free(libxl_cputopology *list, int nr)
+{
+    free(list);
+}
+
+int libxl_cpumap_to_nodemap(libxl_ctx *ctx, const libxl_bitmap *cpumap,
+                            libxl_bitmap *nodemap)
+{
+    int i;
+
+    libxl_bitmap_set_none(nodemap);
+    libxl_for_each_set_bit(i, *cpumap)
+        libxl_bitmap_set(nodemap, i / CPUS_PER_NODE);
+    return 0;
+}
+
+libxl_dominfo *libxl_list_domain(libxl_ctx *ctx, int *nb_domain_out)
+{
+    libxl_dominfo *dinfo = calloc(host.nr_doms, sizeof(*dinfo));
+    int i;
+
+    for (i = 0; i < host.nr_doms; i++) {
+        dinfo[i].domid = host.doms[i].domid;
+        dinfo[i].uuid = host.doms[i].uuid;
+        dinfo[i].cpupool = host.doms[i].cpupool;
+    }
+    *nb_domain_out = host.nr_doms;
+    return dinfo;
+}
+
+void libxl_dominfo_list_free(libxl_dominfo *list, int nr)
+{
+    free(list);
+}
+
+libxl_cpupoolinfo *libxl_list_cpupool(libxl_ctx *ctx, int *nb_pool_out)
+{
+    libxl_cpupoolinfo *pinfo = calloc(2, sizeof(*pinfo));
+    int i;
+
+    for (i = 0; i < 2; i++) {
+        pinfo[i].poolid = i;
+        libxl_bitmap_copy_alloc(ctx, &pinfo[i].cpumap, &host.pool_cpumap[i]);
+    }
+    *nb_pool_out = 2;
+    return pinfo;
+}
+
+void libxl_cpupoolinfo_list_free(libxl_cpupoolinfo *list, int nr)
+{
+    int i;
+
+    for (i = 0; list && i < nr; i++)
+        libxl_bitmap_dispose(&list[i].cpumap);
+    free(list);
+}
+
+static struct host_dom *find_dom(uint32_t domid)
+{
+    int i;
+
+    for (i = 0; i < host.nr_doms; i++)
+        if (host.doms[i].domid == domid)
+            return &host.doms[i];
+    return NULL;
+}
+
+libxl_vcpuinfo *libxl_list_vcpu(libxl_ctx *ctx, uint32_t domid,
+                                int *nb_vcpu, int *nr_cpus_out)
+{
+    const struct host_dom *d = find_dom(domid);
+    libxl_vcpuinfo *vinfo;
+    int i;
+
+    nr_list_vcpu++;
+    if (!d)
+        return NULL;
+
+    vinfo = calloc(d->nr_vcpus, sizeof(*vinfo));
+    for (i = 0; i < d->nr_vcpus; i++)
+        libxl_bitmap_copy_alloc(ctx, &vinfo[i].cpumap, &d->cpumap);
+    *nb_vcpu = d->nr_vcpus;
+    *nr_cpus_out = host.nr_cpus;
+    return vinfo;
+}
+
+void libxl_vcpuinfo_list_free(libxl_vcpuinfo *list, int nr)
+{
+    int i;
+
+    for (i = 0; list && i < nr; i++)
+        libxl_bitmap_dispose(&list[i].cpumap);
+    free(list);
+}
+
+int libxl_domain_get_nodeaffinity(libxl_ctx *ctx, uint32_t domid,
+                                  libxl_bitmap *nodemap)
+{
+    const struct host_dom *d = find_dom(domid);
+
+    if (!d)
+        return ERROR_FAIL;
+    libxl_bitmap_copy(ctx, nodemap, &d->nodemap);
+    return 0;
+}
+
+/* Only used by the reference implementation. */
+static int libxl__domain_cpupool(libxl__gc *gc, uint32_t domid)
+{
+    const struct host_dom *d = find_dom(domid);
+
+    return d ? d->cpupool : ERROR_FAIL;
+}
+
+static void libxl_cpupoolinfo_init(libxl_cpupoolinfo *info)
+{
+    memset(info, 0, sizeof(*info));
+}
+
+static void libxl_cpupoolinfo_dispose(libxl_cpupoolinfo *info)
+{
+    libxl_bitmap_dispose(&info->cpumap);
+}
+
+static int libxl_cpupool_info(libxl_ctx *ctx, libxl_cpupoolinfo *info,
+                              uint32_t poolid)
+{
+    info->poolid = poolid;
+    return libxl_bitmap_copy_alloc(ctx, &info->cpumap,
+                                   &host.pool_cpumap[poolid]);
+}
+
+/*
+ * Reference implementation: the exhaustive search libxl used to do, only
+ * without its refusal to deal with more than 16 nodes.
+ */
+typedef int* ref_comb_iter_t;
+
+static int ref_comb_init(libxl__gc *gc, ref_comb_iter_t *it, int n, int k)
+{
+    ref_comb_iter_t new_iter;
+    int i;
+
+    if (n < k)
+        return 0;
+
+    /* First set is always { 0, 1, 2, ..., k-1 } */
+    GCNEW_ARRAY(new_iter, k);
+    for (i = 0; i < k; i++)
+        new_iter[i] = i;
+
+    *it = new_iter;
+    return 1;
+}
+
+static int ref_comb_next(ref_comb_iter_t it, int n, int k)
+{
+    int i;
+
+    /*
+     * The idea here is to find the leftmost element from where
+     * we should start incrementing the indexes of the iterator.
+     * This means looking for the highest index that can be increased
+     * while still producing value smaller than n-1. In the example
+     * above, when dealing with { 0, 1, 4 }, such an element is the
+     * second one, as the third is already equal to 4 (which actually
+     * is n-1).
+     * Once we found from where to start, we increment that element
+     * and override the right-hand rest of the iterator with its
+     * successors, thus achieving lexicographic ordering.
+     *
+     * Regarding the termination of the generation process, when we
+     * manage in bringing n-k at the very first position of the iterator,
+     * we know that is the last valid combination ( { 2, 3, 4 }, with
+     * n - k = 5 - 2 = 2, in the example above), and thus we start
+     * returning 0 as soon as we cross that border.
+     */
+    for (i = k - 1; it[i] == n - k + i; i--) {
+        if (i <= 0)
+            return 0;
+    }
+    for (it[i]++, i++; i < k; i++)
+        it[i] = it[i - 1] + 1;
+    return 1;
+}
+
+/*
+ * This function turns a k-combination iterator into a node map,
+ * given another map, telling us which nodes should be considered.
+ *
+ * This means the bits that are set in suitable_nodemap and that
+ * corresponds to the indexes of the given combination are the ones
+ * that will be set in nodemap.
+ *
+ * For example, given a fully set suitable_nodemap, if the iterator
+ * represents the combination { 0, 2, 4}, nodmeap will have bits #0,
+ * #2 and #4 set.
+ * On the other hand, if, say,  suitable_nodemap=01011011, the same
+ * iterator will cause bits #1, #4 and #7 of nodemap to be set.
+ */
+static void ref_comb_get_nodemap(ref_comb_iter_t it,
+                                 libxl_bitmap *suitable_nodemap,
+                                 libxl_bitmap *nodemap, int k)
+{
+    int i, m = 0, n = 0;
+
+    libxl_bitmap_set_none(nodemap);
+    libxl_for_each_set_bit(i, *suitable_nodemap) {
+        /* Check wether the n-th set bit of suitable_nodemap
+         * matches with the m-th element of the iterator (and,
+         * only if it does, advance to the next one) */
+        if (m < k && n == it[m]) {
+            libxl_bitmap_set(nodemap, i);
+            m++;
+        }
+        n++;
+    }
+}
+
+/* Retrieve the number of cpus that the nodes that are part of the nodemap
+ * span and are also set in suitable_cpumap. */
+static int ref_nodemap_to_nr_cpus(libxl_cputopology *tinfo, int nr_cpus,
+                                  const libxl_bitmap *suitable_cpumap,
+                                  const libxl_bitmap *nodemap)
+{
+    int i, nodes_cpus = 0;
+
+    for (i = 0; i < nr_cpus; i++) {
+        if (libxl_bitmap_test(suitable_cpumap, i) &&
+            libxl_bitmap_test(nodemap, tinfo[i].node))
+            nodes_cpus++;
+    }
+    return nodes_cpus;
+}
+
+/* Retrieve the amount of free memory within the nodemap */
+static uint32_t ref_nodemap_to_free_memkb(libxl_numainfo *ninfo,
+                                          libxl_bitmap *nodemap)
+{
+    uint32_t free_memkb = 0;
+    int i;
+
+    libxl_for_each_set_bit(i, *nodemap)
+        free_memkb += ninfo[i].free / 1024;
+
+    return free_memkb;
+}
+
+/* Retrieve the number of vcpus able to run on the nodes in nodemap */
+static int ref_nodemap_to_nr_vcpus(libxl__gc *gc, int vcpus_on_node[],
+                                   const libxl_bitmap *nodemap)
+{
+    int i, nr_vcpus = 0;
+
+    libxl_for_each_set_bit(i, *nodemap)
+        nr_vcpus += vcpus_on_node[i];
+
+    return nr_vcpus;
+}
+
+/* Number of vcpus able to run on the cpus of the various nodes
+ * (reported by filling the array vcpus_on_node[]). */
+static int ref_nr_vcpus_on_nodes(libxl__gc *gc, libxl_cputopology *tinfo,
+                                 size_t tinfo_elements,
+                                 const libxl_bitmap *suitable_cpumap,
+                                 int vcpus_on_node[])
+{
+    libxl_dominfo *dinfo = NULL;
+    libxl_bitmap dom_nodemap, nodes_counted;
+    int nr_doms, nr_cpus;
+    int i, j, k;
+
+    dinfo = libxl_list_domain(CTX, &nr_doms);
+    if (dinfo == NULL)
+        return ERROR_FAIL;
+
+    if (libxl_node_bitmap_alloc(CTX, &nodes_counted, 0) < 0) {
+        libxl_dominfo_list_free(dinfo, nr_doms);
+        return ERROR_FAIL;
+    }
+
+    if (libxl_node_bitmap_alloc(CTX, &dom_nodemap, 0) < 0) {
+        libxl_bitmap_dispose(&nodes_counted);
+        libxl_dominfo_list_free(dinfo, nr_doms);
+        return ERROR_FAIL;
+    }
+
+    for (i = 0; i < nr_doms; i++) {
+        libxl_vcpuinfo *vinfo = NULL;
+        int nr_dom_vcpus = 0;
+        libxl_cpupoolinfo cpupool_info;
+        int cpupool;
+
+        libxl_cpupoolinfo_init(&cpupool_info);
+
+        cpupool = libxl__domain_cpupool(gc, dinfo[i].domid);
+        if (cpupool < 0)
+            goto next;
+        if (libxl_cpupool_info(CTX, &cpupool_info, cpupool))
+            goto next;
+
+        vinfo = libxl_list_vcpu(CTX, dinfo[i].domid, &nr_dom_vcpus, &nr_cpus);
+        if (vinfo == NULL)
+            goto next;
+
+        /* Retrieve the domain's node-affinity map */
+        libxl_domain_get_nodeaffinity(CTX, dinfo[i].domid, &dom_nodemap);
+
+        for (j = 0; j < nr_dom_vcpus; j++) {
+            /*
+             * For each vcpu of each domain, it must have both vcpu-affinity
+             * and node-affinity to (a pcpu belonging to) a certain node to
+             * cause an increment in the corresponding element of the array.
+             *
+             * Note that we also need to check whether the cpu actually
+             * belongs to the domain's cpupool (the cpupool of the domain
+             * being checked). In fact, it could be that the vcpu has affinity
+             * with cpus in suitable_cpumask, but that are not in its own
+             * cpupool, and we don't want to consider those!
+             */
+            libxl_bitmap_set_none(&nodes_counted);
+            libxl_for_each_set_bit(k, vinfo[j].cpumap) {
+                if (k >= tinfo_elements)
+                    break;
+                int node = tinfo[k].node;
+
+                if (libxl_bitmap_test(suitable_cpumap, k) &&
+                    libxl_bitmap_test(&cpupool_info.cpumap, k) &&
+                    libxl_bitmap_test(&dom_nodemap, node) &&
+                    !libxl_bitmap_test(&nodes_counted, node)) {
+                    libxl_bitmap_set(&nodes_counted, node);
+                    vcpus_on_node[node]++;
+                }
+            }
+        }
+
+ next:
+        libxl_cpupoolinfo_dispose(&cpupool_info);
+        libxl_vcpuinfo_list_free(vinfo, nr_dom_vcpus);
+    }
+
+    libxl_bitmap_dispose(&dom_nodemap);
+    libxl_bitmap_dispose(&nodes_counted);
+    libxl_dominfo_list_free(dinfo, nr_doms);
+    return 0;
+}
+
+/*
+ * This function tries to figure out if the host has a consistent number
+ * of cpus along all its NUMA nodes. In fact, if that is the case, we can
+ * calculate the minimum number of nodes needed for a domain by just
+ * dividing its total number of vcpus by this value computed here.
+ * However, we are not allowed to assume that all the nodes have the
+ * same number of cpus. Therefore, in case discrepancies among different
+ * nodes are found, this function just returns 0, for the caller to know
+ * it shouldn't rely on this 'optimization', and sort out things in some
+ * other way (by doing something basic, like starting trying with
+ * candidates with just one node).
+ */
+static int ref_count_cpus_per_node(libxl_cputopology *tinfo, int nr_cpus,
+                                   int nr_nodes)
+{
+    int cpus_per_node = 0;
+    int j, i;
+
+    /* This makes sense iff # of PCPUs is the same for all nodes */
+    for (j = 0; j < nr_nodes; j++) {
+        int curr_cpus = 0;
+
+        for (i = 0; i < nr_cpus; i++) {
+            if (tinfo[i].node == j)
+                curr_cpus++;
+        }
+        /* So, if the above does not hold, turn the whole thing off! */
+        cpus_per_node = cpus_per_node == 0 ? curr_cpus : cpus_per_node;
+        if (cpus_per_node != curr_cpus)
+            return 0;
+    }
+    return cpus_per_node;
+}
+
+/*
+ * Looks for the placement candidates that satisfyies some specific
+ * conditions and return the best one according to the provided
+ * comparison function.
+ */
+static int ref_get_numa_candidate(libxl__gc *gc,
+                                  uint64_t min_free_memkb, int min_cpus,
+                                  int min_nodes, int max_nodes,
+                                  const libxl_bitmap *suitable_cpumap,
+                                  libxl__numa_candidate_cmpf numa_cmpf,
+                                  libxl__numa_candidate *cndt_out,
+                                  int *cndt_found)
+{
+    libxl__numa_candidate new_cndt;
+    libxl_cputopology *tinfo = NULL;
+    libxl_numainfo *ninfo = NULL;
+    int nr_nodes = 0, nr_suit_nodes, nr_cpus = 0;
+    libxl_bitmap suitable_nodemap, nodemap;
+    int *vcpus_on_node, rc = 0;
+
+    libxl_bitmap_init(&nodemap);
+    libxl_bitmap_init(&suitable_nodemap);
+    libxl__numa_candidate_init(&new_cndt);
+
+    /* Get platform info and prepare the map for testing the combinations */
+    ninfo = libxl_get_numainfo(CTX, &nr_nodes);
+    if (ninfo == NULL)
+        return ERROR_FAIL;
+
+    if (nr_nodes <= 1) {
+        *cndt_found = 0;
+        goto out;
+    }
+
+    GCNEW_ARRAY(vcpus_on_node, nr_nodes);
+
+    tinfo = libxl_get_cpu_topology(CTX, &nr_cpus);
+    if (tinfo == NULL) {
+        rc = ERROR_FAIL;
+        goto out;
+    }
+
+    rc = libxl_node_bitmap_alloc(CTX, &nodemap, 0);
+    if (rc)
+        goto out;
+    rc = libxl__numa_candidate_alloc(gc, &new_cndt);
+    if (rc)
+        goto out;
+
+    /* Allocate and prepare the map of the node that can be utilized for
+     * placement, basing on the map of suitable cpus. */
+    rc = libxl_node_bitmap_alloc(CTX, &suitable_nodemap, 0);
+    if (rc)
+        goto out;
+    rc = libxl_cpumap_to_nodemap(CTX, suitable_cpumap, &suitable_nodemap);
+    if (rc)
+        goto out;
+
+    /*
+     * Later on, we will try to figure out how many vcpus are runnable on
+     * each candidate (as a part of choosing the best one of them). That
+     * requires going through all the vcpus of all the domains and check
+     * their affinities. So, instead of doing that for each candidate,
+     * let's count here the number of vcpus runnable on each node, so that
+     * all we have to do later is summing up the right elements of the
+     * vcpus_on_node array.
+     */
+    rc = ref_nr_vcpus_on_nodes(gc, tinfo, nr_cpus, suitable_cpumap,
+                               vcpus_on_node);
+    if (rc)
+        goto out;
+
+    /*
+     * If the minimum number of NUMA nodes is not explicitly specified
+     * (i.e., min_nodes == 0), we try to figure out a sensible number of nodes
+     * from where to start generating candidates, if possible (or just start
+     * from 1 otherwise). The maximum number of nodes should not exceed the
+     * number of existent NUMA nodes on the host, or the candidate generation
+     * won't work properly.
+     */
+    if (!min_nodes) {
+        int cpus_per_node;
+
+        cpus_per_node = ref_count_cpus_per_node(tinfo, nr_cpus, nr_nodes);
+        if (cpus_per_node == 0)
+            min_nodes = 1;
+        else
+            min_nodes = (min_cpus + cpus_per_node - 1) / cpus_per_node;
+    }
+    /* We also need to be sure we do not exceed the number of
+     * nodes we are allowed to use. */
+    nr_suit_nodes = libxl_bitmap_count_set(&suitable_nodemap);
+
+    if (min_nodes > nr_suit_nodes)
+        min_nodes = nr_suit_nodes;
+    if (!max_nodes || max_nodes > nr_suit_nodes)
+        max_nodes = nr_suit_nodes;
+    if (min_nodes > max_nodes) {
+        LOG(ERROR, "Inconsistent minimum or maximum number of guest nodes");
+        rc = ERROR_INVAL;
+        goto out;
+    }
+
+    /* This is up to the caller to be disposed */
+    rc = libxl__numa_candidate_alloc(gc, cndt_out);
+    if (rc)
+        goto out;
+
+    /*
+     * Consider all the combinations with sizes in [min_nodes, max_nodes]
+     * (see comb_init() and comb_next()). Note that, since the fewer the
+     * number of nodes the better, it is guaranteed that any candidate
+     * found during the i-eth step will be better than any other one we
+     * could find during the (i+1)-eth and all the subsequent steps (they
+     * all will have more nodes). It's thus pointless to keep going if
+     * we already found something.
+     */
+    *cndt_found = 0;
+    while (min_nodes <= max_nodes && *cndt_found == 0) {
+        ref_comb_iter_t comb_iter;
+        int comb_ok;
+
+        /*
+         * And here it is. Each step of this cycle generates a combination of
+         * nodes as big as min_nodes mandates.  Each of these combinations is
+         * checked against the constraints provided by the caller (namely,
+         * amount of free memory and number of cpus) and it can concur to
+         * become our best placement iff it passes the check.
+         */
+        for (comb_ok = ref_comb_init(gc, &comb_iter, nr_suit_nodes, min_nodes);
+             comb_ok;
+             comb_ok = ref_comb_next(comb_iter, nr_suit_nodes, min_nodes)) {
+            uint64_t nodes_free_memkb;
+            int nodes_cpus;
+
+            /* Get the nodemap for the combination, only considering
+             * suitable nodes. */
+            ref_comb_get_nodemap(comb_iter, &suitable_nodemap,
+                                 &nodemap, min_nodes);
+
+            /* If there is not enough memory in this combination, skip it
+             * and go generating the next one... */
+            nodes_free_memkb = ref_nodemap_to_free_memkb(ninfo, &nodemap);
+            if (min_free_memkb && nodes_free_memkb < min_free_memkb)
+                continue;
+
+            /* And the same applies if this combination is short in cpus */
+            nodes_cpus = ref_nodemap_to_nr_cpus(tinfo, nr_cpus,
+                                                suitable_cpumap, &nodemap);
+            if (min_cpus && nodes_cpus < min_cpus)
+                continue;
+
+            /*
+             * Conditions are met, we can compare this candidate with the
+             * current best one (if any).
+             */
+            libxl__numa_candidate_put_nodemap(gc, &new_cndt, &nodemap);
+            new_cndt.nr_vcpus = ref_nodemap_to_nr_vcpus(gc, vcpus_on_node,
+                                                        &nodemap);
+            new_cndt.free_memkb = nodes_free_memkb;
+            new_cndt.nr_nodes = libxl_bitmap_count_set(&nodemap);
+            new_cndt.nr_cpus = nodes_cpus;
+
+            /*
+             * Check if the new candidate we is better the what we found up
+             * to now by means of the comparison function. If no comparison
+             * function is provided, just return as soon as we find our first
+             * candidate.
+             */
+            if (*cndt_found == 0 || numa_cmpf(&new_cndt, cndt_out) < 0) {
+                *cndt_found = 1;
+
+                LOG(DEBUG, "New best NUMA placement candidate found: "
+                           "nr_nodes=%d, nr_cpus=%d, nr_vcpus=%d, "
+                           "free_memkb=%"PRIu64"", new_cndt.nr_nodes,
+                           new_cndt.nr_cpus, new_cndt.nr_vcpus,
+                           new_cndt.free_memkb / 1024);
+
+                libxl__numa_candidate_put_nodemap(gc, cndt_out, &nodemap);
+                cndt_out->nr_vcpus = new_cndt.nr_vcpus;
+                cndt_out->free_memkb = new_cndt.free_memkb;
+                cndt_out->nr_nodes = new_cndt.nr_nodes;
+                cndt_out->nr_cpus = new_cndt.nr_cpus;
+
+                if (numa_cmpf == NULL)
+                    break;
+            }
+        }
+        min_nodes++;
+    }
+
+    if (*cndt_found == 0)
+        LOG(NOTICE, "NUMA placement failed, performance might be affected");
+
+ out:
+    libxl_bitmap_dispose(&nodemap);
+    libxl_bitmap_dispose(&suitable_nodemap);
+    libxl__numa_candidate_dispose(&new_cndt);
+    libxl_numainfo_list_free(ninfo, nr_nodes);
+    libxl_cputopology_list_free(tinfo, nr_cpus);
+    return rc;
+}
+
+
+/* The comparison libxl uses for placing domains (see libxl_dom.c). */
+static int numa_cmpf(const libxl__numa_candidate *c1,
+                     const libxl__numa_candidate *c2)
+{
+    if (c1->nr_vcpus != c2->nr_vcpus)
+        return c1->nr_vcpus - c2->nr_vcpus;
+
+    return c2->free_memkb - c1->free_memkb;
+}
+
+static libxl_ctx ctx;
+static libxl__gc gc_ = { .owner = &ctx };
+static libxl__gc *gc = &gc_;
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void node_cpumap(libxl_bitmap *cpumap, int node)
+{
+    int i;
+
+    libxl_bitmap_set_none(cpumap);
+    for (i = 0; i < CPUS_PER_NODE; i++)
+        libxl_bitmap_set(cpumap, node * CPUS_PER_NODE + i);
+}
+
+/* Create a domain, taking its memory evenly from the nodes in nodemap. */
+static struct host_dom *add_dom(uint32_t pool, int nr_vcpus, uint64_t memkb,
+                                const libxl_bitmap *cpumap,
+                                const libxl_bitmap *nodemap)
+{
+    struct host_dom *d = &host.doms[host.nr_doms++];
+    int i, nr = libxl_bitmap_count_set(nodemap);
+
+    assert(host.nr_doms <= MAX_DOMS);
+    d->domid = host.next_domid++;
+    memset(&d->uuid, 0, sizeof(d->uuid));
+    memcpy(d->uuid.uuid, &d->domid, sizeof(d->domid));
+    d->cpupool = pool;
+    d->nr_vcpus = nr_vcpus;
+    d->memkb = memkb;
+    libxl_bitmap_copy_alloc(&ctx, &d->cpumap, cpumap);
+    libxl_bitmap_copy_alloc(&ctx, &d->nodemap, nodemap);
+
+    libxl_for_each_set_bit(i, *nodemap) {
+        uint64_t bytes = memkb * 1024 / nr;
+
+        host.free[i] = host.free[i] > bytes ? host.free[i] - bytes : 0;
+    }
+
+    return d;
+}
+
+static void del_dom(int idx)
+{
+    const struct host_dom *d = &host.doms[idx];
+    int i, nr = libxl_bitmap_count_set(&d->nodemap);
+
+    libxl_for_each_set_bit(i, d->nodemap)
+        host.free[i] += d->memkb * 1024 / nr;
+
+    libxl_bitmap_dispose(&host.doms[idx].cpumap);
+    libxl_bitmap_dispose(&host.doms[idx].nodemap);
+    memmove(&host.doms[idx], &host.doms[idx + 1],
+            (host.nr_doms - idx - 1) * sizeof(host.doms[0]));
+    host.nr_doms--;
+}
+
+static void host_init(int nr_nodes, int nr_doms, unsigned int seed)
+{
+    libxl_bitmap cpumap, nodemap;
+    int i, j;
+
+    srand(seed);
+    while (host.nr_doms)
+        del_dom(host.nr_doms - 1);
+    libxl_bitmap_dispose(&host.pool_cpumap[0]);
+    libxl_bitmap_dispose(&host.pool_cpumap[1]);
+    libxl__numa_cache_dispose(&ctx);
+    memset(&ctx, 0, sizeof(ctx));
+
+    host.nr_nodes = nr_nodes;
+    host.nr_cpus = nr_nodes * CPUS_PER_NODE;
+    host.next_domid = 1;
+
+    for (i = 0; i < nr_nodes; i++) {
+        host.free[i] = (64ULL + rand() % 64) << 30;
+        for (j = 0; j < nr_nodes; j++)
+            host.dists[i][j] = i == j ? 10 : i / 2 == j / 2 ? 16 :
+                               20 + 2 * abs(i / 4 - j / 4);
+    }
+
+    libxl_bitmap_alloc(&ctx, &host.pool_cpumap[0], host.nr_cpus);
+    libxl_bitmap_alloc(&ctx, &host.pool_cpumap[1], host.nr_cpus);
+    for (i = 0; i < host.nr_cpus; i++)
+        libxl_bitmap_set(&host.pool_cpumap[i / CPUS_PER_NODE >=
+                                           nr_nodes * 3 / 4], i);
+
+    libxl_bitmap_alloc(&ctx, &cpumap, host.nr_cpus);
+    libxl_node_bitmap_alloc(&ctx, &nodemap, 0);
+    for (i = 0; i < nr_doms; i++) {
+        uint32_t pool = rand() % 4 == 0;
+        int first = pool ? nr_nodes * 3 / 4 : 0;
+        int last = pool ? nr_nodes : nr_nodes * 3 / 4;
+        int node = first + rand() % (last - first);
+
+        /* Mostly placed on one node, some pinned, some all over. */
+        libxl_bitmap_copy(&ctx, &cpumap, &host.pool_cpumap[pool]);
+        libxl_bitmap_set_none(&nodemap);
+        if (rand() % 10 == 0)
+            memset(nodemap.map, 0xff, nodemap.size);
+        else
+            libxl_bitmap_set(&nodemap, node);
+        if (rand() % 10 == 0)
+            node_cpumap(&cpumap, node);
+
+        add_dom(pool, 1 + rand() % 8, (256 + rand() % 1792) << 10,
+                &cpumap, &nodemap);
+    }
+    libxl_bitmap_dispose(&cpumap);
+    libxl_bitmap_dispose(&nodemap);
+}
+
+static bool same_candidate(const libxl__numa_candidate *a,
+                           const libxl__numa_candidate *b)
+{
+    return a->nr_nodes == b->nr_nodes && a->nr_cpus == b->nr_cpus &&
+           a->nr_vcpus == b->nr_vcpus && a->free_memkb == b->free_memkb &&
+           libxl_bitmap_equal(&a->nodemap, &b->nodemap, 0);
+}
+
+/*
+ * Place a domain with libxl, checking the choice against the reference if
+ * asked to, and then create it there.
+ */
+static void place(uint32_t pool, int nr_vcpus, uint64_t memkb, bool check)
+{
+    libxl__numa_candidate cndt, ref;
+    int found, ref_found, rc;
+
+    libxl__numa_candidate_init(&cndt);
+    libxl__numa_candidate_init(&ref);
+
+    rc = libxl__get_numa_candidate(gc, memkb, nr_vcpus, 0, 0,
+                                   &host.pool_cpumap[pool], numa_cmpf,
+                                   &cndt, &found);
+    assert(!rc);
+
+    if (check) {
+        rc = ref_get_numa_candidate(gc, memkb, nr_vcpus, 0, 0,
+                                    &host.pool_cpumap[pool], numa_cmpf,
+                                    &ref, &ref_found);
+        assert(!rc);
+        if (found != ref_found || (found && !same_candidate(&cndt, &ref))) {
+            fprintf(stderr, "%d nodes, %d domains: placing %d vcpus, "
+                    "%"PRIu64"kB in pool %u: got %d nodes %d vcpus "
+                    "%"PRIu64"kB, expected %d nodes %d vcpus %"PRIu64"kB\n",
+                    host.nr_nodes, host.nr_doms, nr_vcpus, memkb, pool,
+                    cndt.nr_nodes, cndt.nr_vcpus, cndt.free_memkb,
+                    ref.nr_nodes, ref.nr_vcpus, ref.free_memkb);
+            abort();
+        }
+    }
+
+    if (found) {
+        assert(cndt.free_memkb >= memkb && cndt.nr_cpus >= nr_vcpus);
+        add_dom(pool, nr_vcpus, memkb, &host.pool_cpumap[pool],
+                &cndt.nodemap);
+    }
+
+    libxl__numa_candidate_dispose(&cndt);
+    libxl__numa_candidate_dispose(&ref);
+    gc_free(gc);
+}
+
+/* Ask libxl for a placement, without creating anything. */
+static void lookup(void)
+{
+    libxl__numa_candidate cndt;
+    int found;
+
+    libxl__numa_candidate_init(&cndt);
+    assert(!libxl__get_numa_candidate(gc, 1 << 20, 4, 0, 0,
+                                      &host.pool_cpumap[0], numa_cmpf,
+                                      &cndt, &found));
+    libxl__numa_candidate_dispose(&cndt);
+    gc_free(gc);
+}
+
+/*
+ * On big hosts, also ask for candidates with enough nodes for there to be
+ * too many combinations to try them all.
+ */
+static void random_place(bool check)
+{
+    int max_vcpus = host.nr_nodes > 16 ? 48 : 24;
+
+    place(rand() % 4 == 0, 1 + rand() % max_vcpus, (1 + rand() % 16) << 20,
+          check);
+}
+
+static void test(int nr_nodes, int nr_doms)
+{
+    libxl_bitmap nodemap;
+    unsigned long calls;
+    int i;
+
+    host_init(nr_nodes, nr_doms, nr_nodes * 1000 + nr_doms);
+
+    for (i = 0; i < 100; i++) {
+        /* Domains coming and going, sometimes having affinity changed. */
+        if (host.nr_doms && rand() % 4 == 0)
+            del_dom(rand() % host.nr_doms);
+        if (host.nr_doms && rand() % 4 == 0) {
+            struct host_dom *d = &host.doms[rand() % host.nr_doms];
+
+            libxl_bitmap_set_none(&d->nodemap);
+            libxl_bitmap_set(&d->nodemap, rand() % nr_nodes);
+            libxl__numa_cache_invalidate(gc, d->domid);
+        }
+
+        random_place(nr_nodes <= 16);
+    }
+
+    /* Once the cache is up to date, the load all comes from there... */
+    lookup();
+    calls = nr_list_vcpu;
+    lookup();
+    assert(nr_list_vcpu == calls);
+
+    /* ... but for the domains created meanwhile. */
+    libxl_node_bitmap_alloc(&ctx, &nodemap, 0);
+    libxl_bitmap_set(&nodemap, 0);
+    add_dom(0, 4, 1 << 20, &host.pool_cpumap[0], &nodemap);
+    libxl_bitmap_dispose(&nodemap);
+    lookup();
+    assert(nr_list_vcpu == calls + 1);
+}
+
+/*
+ * A domain placed but not built yet hasn't taken any memory from its node,
+ * so the next placement has to see it from the pending record.
+ */
+static void test_pending(void)
+{
+    libxl__numa_candidate cndt;
+    uint64_t memkb = 48 << 20;
+    int i, node, found;
+
+    host_init(4, 0, 1);
+    for (i = 0; i < host.nr_nodes; i++)
+        host.free[i] = 64ULL << 30;
+
+    libxl__numa_candidate_init(&cndt);
+    assert(!libxl__get_numa_candidate(gc, memkb, 4, 0, 0,
+                                      &host.pool_cpumap[0], numa_cmpf,
+                                      &cndt, &found));
+    assert(found && cndt.nr_nodes == 1);
+    for (node = 0; !libxl_bitmap_test(&cndt.nodemap, node); node++)
+        ;
+    libxl__numa_candidate_dispose(&cndt);
+    gc_free(gc);
+
+    host.pending[node] = memkb;
+    libxl__numa_candidate_init(&cndt);
+    assert(!libxl__get_numa_candidate(gc, memkb, 4, 0, 0,
+                                      &host.pool_cpumap[0], numa_cmpf,
+                                      &cndt, &found));
+    assert(found && cndt.nr_nodes == 1 &&
+           !libxl_bitmap_test(&cndt.nodemap, node));
+    libxl__numa_candidate_dispose(&cndt);
+    gc_free(gc);
+    host.pending[node] = 0;
+}
+
+static void bench(int nr_nodes, int nr_doms)
+{
+    const int nr = nr_nodes <= 16 ? 50 : 20;
+    uint64_t t, ref_ns = 0, cold_ns = 0, warm_ns = 0;
+    libxl__numa_candidate cndt;
+    int i, found, seed = nr_nodes * 1000 + nr_doms;
+
+    /* The same sequence of placements, with and without cache. */
+    host_init(nr_nodes, nr_doms, seed);
+    for (i = 0; i < nr; i++) {
+        libxl__numa_cache_dispose(&ctx);
+        memset(&ctx, 0, sizeof(ctx));
+        t = now_ns();
+        random_place(false);
+        cold_ns += now_ns() - t;
+    }
+
+    host_init(nr_nodes, nr_doms, seed);
+    for (i = 0; i < nr; i++) {
+        t = now_ns();
+        random_place(false);
+        warm_ns += now_ns() - t;
+    }
+
+    /* The reference can't cope with big hosts, so only do it up to 16. */
+    if (nr_nodes <= 16) {
+        host_init(nr_nodes, nr_doms, seed);
+        for (i = 0; i < nr; i++) {
+            uint32_t pool = rand() % 4 == 0;
+            int nr_vcpus = 1 + rand() % 24;
+            uint64_t memkb = (1 + rand() % 16) << 20;
+
+            libxl__numa_candidate_init(&cndt);
+            t = now_ns();
+            ref_get_numa_candidate(gc, memkb, nr_vcpus, 0, 0,
+                                   &host.pool_cpumap[pool], numa_cmpf,
+                                   &cndt, &found);
+            ref_ns += now_ns() - t;
+            if (found)
+                add_dom(pool, nr_vcpus, memkb, &host.pool_cpumap[pool],
+                        &cndt.nodemap);
+            libxl__numa_candidate_dispose(&cndt);
+            gc_free(gc);
+        }
+    }
+
+    printf("%2d nodes, %4d domains: ", nr_nodes, nr_doms);
+    if (ref_ns)
+        printf("exhaustive %8.1fus, ", ref_ns / 1e3 / nr);
+    else
+        printf("exhaustive        -  , ");
+    printf("uncached %8.1fus, cached %8.1fus per placement\n",
+           cold_ns / 1e3 / nr, warm_ns / 1e3 / nr);
+}
+
+int
+main(int argc, char **argv)
+{
+    if (argc > 1 && !strcmp(argv[1], "bench")) {
+        bench(8, 100);
+        bench(8, 500);
+        bench(16, 500);
+        bench(16, 2000);
+        bench(32, 2000);
+        bench(64, 2000);
+        return 0;
+    }
+
+    test(2, 10);
+    test(4, 50);
+    test(8, 200);
+    test(12, 300);
+    test(16, 500);
+    test(32, 500);
+    test(64, 1000);
+    test_pending();
+
+    return 0;
+}
+
+/*
+ * Local variables:
+ * mode: C
+ * c-file-style: "BSD"
+ * c-basic-offset: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
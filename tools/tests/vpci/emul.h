@@ -34,8 +34,13 @@
 })
 
 #define smp_wmb()
+#define smp_rmb()
+#define cpu_relax()
+#define read_atomic(p) (*(p))
+#define write_atomic(p, v) (*(p) = (v))
 #define prefetch(x) __builtin_prefetch(x)
 #define ASSERT(x) assert(x)
+#define ARRAY_SIZE(a) (sizeof(a) / sizeof(*(a)))
 #define __must_check __attribute__((__warn_unused_result__))
 
 #include "list.h"
@@ -60,6 +65,16 @@ typedef bool spinlock_t;
 #define spin_lock(l) (*(l) = true)
 #define spin_unlock(l) (*(l) = false)
 
+/* Single threaded, hence RCU callbacks can be invoked right away. */
+struct rcu_head {
+};
+#define DEFINE_RCU_READ_LOCK(x) bool x
+#define rcu_read_lock(l)
+#define rcu_read_unlock(l)
+#define rcu_dereference(p) (p)
+#define rcu_assign_pointer(p, v) ((p) = (v))
+#define call_rcu(h, f) (f)(h)
+
 typedef union {
     uint32_t sbdf;
     struct {
@@ -89,6 +104,9 @@ typedef union {
 
 #define xzalloc(type) ((type *)calloc(1, sizeof(type)))
 #define xmalloc(type) ((type *)malloc(sizeof(type)))
+#define xmalloc_array(type, nr) ((type *)malloc(sizeof(type) * (nr)))
+#define xmalloc_flex_struct(type, field, nr) \
+    ((type *)malloc(offsetof(type, field[nr])))
 #define xfree(p) free(p)
 
 #define pci_get_pdev_by_domain(...) &test_pdev
@@ -18,6 +18,9 @@
 
 #include "emul.h"
 
+#include <string.h>
+#include <time.h>
+
 /* Single vcpu (current), and single domain with a single PCI device. */
 static struct vpci vpci;
 
@@ -141,6 +144,25 @@ void multiwrite4_check(unsigned int reg)
     multiread4_check(reg, val);
 }
 
+/* Time repeated reads of the given register, for rough comparisons. */
+static void bench(unsigned int reg, unsigned int size)
+{
+    const unsigned int nr = 10000000;
+    struct timespec start, end;
+    unsigned int i;
+    uint32_t rd;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for ( i = 0; i < nr; i++ )
+        VPCI_READ(reg, size, rd);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    printf("%#05x/%u: %u reads, %.1fns per read\n", reg, size, nr,
+           ((end.tv_sec - start.tv_sec) * 1e9 +
+            (end.tv_nsec - start.tv_nsec)) / nr);
+    (void)rd;
+}
+
 int
 main(int argc, char **argv)
 {
@@ -154,6 +176,8 @@ main(int argc, char **argv)
     uint16_t r20[2] = { };
     uint32_t r24 = 0;
     uint8_t r28, r30;
+    uint32_t r100[16] = { };
+    uint16_t rffc = 0;
     unsigned int i;
     int rc;
 
@@ -296,6 +320,36 @@ main(int argc, char **argv)
     VPCI_REMOVE_INVALID_REG(16, 2);
     VPCI_REMOVE_INVALID_REG(30, 2);
 
+    /*
+     * Check dispatch with registers spread over the extended config space,
+     * leaving empty dwords in between.
+     */
+    for ( i = 0; i < ARRAY_SIZE(r100); i++ )
+        VPCI_ADD_REG(vpci_read32, vpci_write32, 0x100 + i * 8, 4, r100[i]);
+    VPCI_ADD_REG(vpci_read16, vpci_write16, 0xffe, 2, rffc);
+
+    for ( i = 0; i < ARRAY_SIZE(r100); i++ )
+    {
+        VPCI_WRITE_CHECK(0x100 + i * 8, 4, 0x01010101 * i);
+        VPCI_READ_CHECK(0x104 + i * 8, 4, 0xffffffff);
+    }
+    VPCI_READ_CHECK(0x800, 4, 0xffffffff);
+    VPCI_WRITE_CHECK(0xffe, 2, 0x1234);
+    VPCI_READ_CHECK(0xffc, 4, 0x1234ffff);
+
+    /* Removing the highest register shrinks the table. */
+    VPCI_REMOVE_REG(0xffe, 2);
+    VPCI_READ_CHECK(0xffc, 4, 0xffffffff);
+    multiread4_check(0x178, 0x0f0f0f0f);
+
+    if ( argc > 1 && !strcmp(argv[1], "bench") )
+    {
+        bench(0x100, 4);
+        bench(0x178, 2);
+        bench(0x800, 4);
+        bench(4, 4);
+    }
+
     return 0;
 }
 
@@ -907,6 +907,7 @@ int main(int argc, char **argv)
 
     ctxt.regs = &regs;
     ctxt.force_writeback = 0;
+    ctxt.decode_cache = NULL;
     ctxt.cpuid     = &cp;
     ctxt.lma       = sizeof(void *) == 8;
     ctxt.addr_size = 8 * sizeof(void *);
@@ -1188,6 +1189,51 @@ int main(int argc, char **argv)
         goto rmw_restart;
     }
 
+    printf("%-40s", "Testing decode cache...");
+    ctxt.decode_cache = x86_decode_cache_alloc();
+    if ( !ctxt.decode_cache )
+        goto fail;
+    ctxt.insn_bytes = (void *)instr;
+    ctxt.insn_bytes_len = MAX_INST_LEN;
+    instr[0] = 0x01; instr[1] = 0x48; instr[2] = 0x10;
+    res[0]      = 1;
+    res[1]      = 2;
+    regs.eflags = EFLAGS_ALWAYS_SET;
+    regs.eip    = (unsigned long)&instr[0];
+    regs.eax    = (unsigned long)res - 0x10;
+    regs.ecx    = 5;
+    rc = x86_emulate(&ctxt, &emulops);
+    if ( (rc != X86EMUL_OKAY) || ctxt.decode_cached || (res[0] != 6) ||
+         (regs.eip != (unsigned long)&instr[3]) )
+        goto fail;
+    regs.eip    = (unsigned long)&instr[0];
+    regs.eax    = (unsigned long)(res + 1) - 0x10;
+    rc = x86_emulate(&ctxt, &emulops);
+    if ( (rc != X86EMUL_OKAY) || !ctxt.decode_cached || (res[1] != 7) ||
+         (res[0] != 6) || (regs.eip != (unsigned long)&instr[3]) )
+        goto fail;
+    instr[2] = 0x14;
+    regs.eip    = (unsigned long)&instr[0];
+    regs.eax    = (unsigned long)res - 0x14;
+    rc = x86_emulate(&ctxt, &emulops);
+    if ( (rc != X86EMUL_OKAY) || ctxt.decode_cached || (res[0] != 11) )
+        goto fail;
+    regs.eip    = (unsigned long)&instr[0];
+    regs.eax    = (unsigned long)(res + 1) - 0x14;
+    rc = x86_emulate(&ctxt, &emulops);
+    if ( (rc != X86EMUL_OKAY) || !ctxt.decode_cached || (res[1] != 12) )
+        goto fail;
+    instr[0] = 0x29;
+    regs.eip    = (unsigned long)&instr[0];
+    regs.eax    = (unsigned long)res - 0x14;
+    rc = x86_emulate(&ctxt, &emulops);
+    if ( (rc != X86EMUL_OKAY) || ctxt.decode_cached || (res[0] != 6) ||
+         (regs.eip != (unsigned long)&instr[3]) )
+        goto fail;
+    x86_decode_cache_free(ctxt.decode_cache);
+    ctxt.decode_cache = NULL;
+    printf("okay\n");
+
     printf("%-40s", "Testing rep movsw...");
     instr[0] = 0xf3; instr[1] = 0x66; instr[2] = 0xa5;
     *res        = 0x22334455;
@@ -67,6 +67,9 @@
 
 #define is_canonical_address(x) (((int64_t)(x) >> 47) == ((int64_t)(x) >> 63))
 
+#define xzalloc(type) ((type *)calloc(1, sizeof(type)))
+#define xfree free
+
 extern uint32_t mxcsr_mask;
 extern struct cpuid_policy cp;
 
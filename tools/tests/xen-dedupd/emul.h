@@ -0,0 +1,108 @@
+/*
+ * Stand-ins for the parts of libxenctrl and libxenforeignmemory used by
+ * xen-dedupd, for testing it against simulated domains.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms and conditions of the GNU General Public
+ * License, version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program; If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _TEST_XEN_DEDUPD_
+#define _TEST_XEN_DEDUPD_
+
+#include <errno.h>
+#include <getopt.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define ARRAY_SIZE(a) (sizeof(a) / sizeof(*(a)))
+#define min(x, y) ((x) < (y) ? (x) : (y))
+
+#define PROT_READ 1
+
+#define LOG_ERR     3
+#define LOG_WARNING 4
+#define LOG_INFO    6
+#define LOG_PID     0
+#define LOG_PERROR  0
+#define LOG_DAEMON  0
+static inline void openlog(const char *ident, int option, int facility) {}
+static inline void syslog(int priority, const char *format, ...) {}
+
+#define XC_PAGE_SHIFT 12
+#define XC_PAGE_SIZE  (1UL << XC_PAGE_SHIFT)
+
+#define XEN_DOMINF_dying     (1U << 0)
+#define XEN_DOMINF_hvm_guest (1U << 1)
+#define XEN_DOMINF_shutdown  (1U << 2)
+
+typedef struct xc_interface_core xc_interface;
+typedef struct xenforeignmemory_handle xenforeignmemory_handle;
+typedef uint64_t xen_pfn_t;
+typedef uint8_t xen_domain_handle_t[16];
+typedef uint8_t *xc_nodemap_t;
+
+typedef struct {
+    uint32_t domain;
+    uint32_t flags;
+    xen_domain_handle_t handle;
+} xc_domaininfo_t;
+
+typedef struct {
+    uint64_t source_gfn;
+    uint64_t client_gfn;
+    uint16_t source_domain;
+    uint16_t pad;
+    int32_t rc;
+} xen_mem_sharing_dedup_t;
+
+xc_interface *xc_interface_open(void *logger, void *dombuild_logger,
+                                unsigned int open_flags);
+int xc_interface_close(xc_interface *xch);
+xenforeignmemory_handle *xenforeignmemory_open(void *logger,
+                                               unsigned int open_flags);
+int xenforeignmemory_close(xenforeignmemory_handle *fh);
+void *xenforeignmemory_map(xenforeignmemory_handle *fh, uint32_t dom,
+                           int prot, size_t pages, const xen_pfn_t arr[],
+                           int err[]);
+int xenforeignmemory_unmap(xenforeignmemory_handle *fh, void *addr,
+                           size_t pages);
+
+int xc_get_max_nodes(xc_interface *xch);
+xc_nodemap_t xc_nodemap_alloc(xc_interface *xch);
+int xc_domain_node_getaffinity(xc_interface *xch, uint32_t domid,
+                               xc_nodemap_t nodemap);
+int xc_domain_getinfolist(xc_interface *xch, uint32_t first_domain,
+                          unsigned int max_domains, xc_domaininfo_t *info);
+int xc_domain_nr_gpfns(xc_interface *xch, uint32_t domid, xen_pfn_t *gpfns);
+int xc_memshr_control(xc_interface *xch, uint32_t domid, int enable);
+int xc_memshr_dedup(xc_interface *xch, uint32_t domid,
+                    xen_mem_sharing_dedup_t *pairs, unsigned int nr,
+                    unsigned int *nr_shared);
+long xc_sharing_freed_pages(xc_interface *xch);
+long xc_sharing_cow_breaks(xc_interface *xch);
+
+#endif
+
+/*
+ * Local variables:
+ * mode: C
+ * c-file-style: "BSD"
+ * c-basic-offset: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
@@ -0,0 +1,283 @@
+/*
+ * Tests for xen-dedupd's passes, against simulated HVM domains.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms and conditions of the GNU General Public
+ * License, version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program; If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <assert.h>
+#include <limits.h>
+
+/* The daemon's state is all static. */
+#include "xen-dedupd.c"
+
+#define NR_DOMS     2
+#define NR_PAGES    64
+#define NR_CONTENTS 8
+
+/*
+ * Every word of a page holds the same value.  Pages sharing a frame have
+ * the same group, private pages none (-1).
+ */
+static struct {
+    uint64_t val;
+    int group;
+} sim[NR_DOMS][NR_PAGES];
+static int next_group;
+static bool map_shared;         /* As a PV dom0 can, unlike an HVM one. */
+static unsigned int nr_submitted;
+static long nr_freed;
+
+static struct xc_interface_core { int dummy; } xc;
+static struct xenforeignmemory_handle { int dummy; } fm;
+
+xc_interface *xc_interface_open(void *logger, void *dombuild_logger,
+                                unsigned int open_flags)
+{
+    return &xc;
+}
+
+int xc_interface_close(xc_interface *xch)
+{
+    return 0;
+}
+
+xenforeignmemory_handle *xenforeignmemory_open(void *logger,
+                                               unsigned int open_flags)
+{
+    return &fm;
+}
+
+int xenforeignmemory_close(xenforeignmemory_handle *fh)
+{
+    return 0;
+}
+
+void *xenforeignmemory_map(xenforeignmemory_handle *fh, uint32_t dom,
+                           int prot, size_t pages, const xen_pfn_t arr[],
+                           int err[])
+{
+    uint64_t *va = malloc(pages * XC_PAGE_SIZE);
+    size_t i, j;
+
+    assert(va && dom >= 1 && dom <= NR_DOMS);
+
+    for ( i = 0; i < pages; i++ )
+    {
+        assert(arr[i] < NR_PAGES);
+        err[i] = sim[dom - 1][arr[i]].group >= 0 && !map_shared ? -EPERM : 0;
+        for ( j = 0; j < XC_PAGE_SIZE / sizeof(*va); j++ )
+            va[i * XC_PAGE_SIZE / sizeof(*va) + j] =
+                err[i] ? 0 : sim[dom - 1][arr[i]].val;
+    }
+
+    return va;
+}
+
+int xenforeignmemory_unmap(xenforeignmemory_handle *fh, void *addr,
+                           size_t pages)
+{
+    free(addr);
+    return 0;
+}
+
+int xc_get_max_nodes(xc_interface *xch)
+{
+    return 1;
+}
+
+xc_nodemap_t xc_nodemap_alloc(xc_interface *xch)
+{
+    return calloc(1, 1);
+}
+
+int xc_domain_node_getaffinity(xc_interface *xch, uint32_t domid,
+                               xc_nodemap_t nodemap)
+{
+    nodemap[0] = 1;
+    return 0;
+}
+
+int xc_domain_getinfolist(xc_interface *xch, uint32_t first_domain,
+                          unsigned int max_domains, xc_domaininfo_t *info)
+{
+    unsigned int n = 0;
+    uint32_t d;
+
+    for ( d = first_domain ?: 1; d <= NR_DOMS && n < max_domains; d++, n++ )
+    {
+        memset(&info[n], 0, sizeof(info[n]));
+        info[n].domain = d;
+        info[n].flags = XEN_DOMINF_hvm_guest;
+        info[n].handle[0] = d;
+    }
+
+    return n;
+}
+
+int xc_domain_nr_gpfns(xc_interface *xch, uint32_t domid, xen_pfn_t *gpfns)
+{
+    *gpfns = NR_PAGES;
+    return 0;
+}
+
+int xc_memshr_control(xc_interface *xch, uint32_t domid, int enable)
+{
+    return 0;
+}
+
+/* Like XENMEM_sharing_op_dedup: pages only get shared if they are equal. */
+int xc_memshr_dedup(xc_interface *xch, uint32_t domid,
+                    xen_mem_sharing_dedup_t *pairs, unsigned int nr,
+                    unsigned int *nr_shared)
+{
+    unsigned int i, d, p;
+
+    for ( i = 0; i < nr; i++ )
+    {
+        xen_mem_sharing_dedup_t *pair = &pairs[i];
+        int sgroup, cgroup;
+
+        assert(pair->source_domain >= 1 && pair->source_domain <= NR_DOMS);
+        assert(pair->source_gfn < NR_PAGES && pair->client_gfn < NR_PAGES);
+        nr_submitted++;
+
+        if ( sim[pair->source_domain - 1][pair->source_gfn].val !=
+             sim[domid - 1][pair->client_gfn].val )
+        {
+            pair->rc = -ENODATA;
+            continue;
+        }
+        pair->rc = 0;
+
+        sgroup = sim[pair->source_domain - 1][pair->source_gfn].group;
+        cgroup = sim[domid - 1][pair->client_gfn].group;
+        if ( sgroup >= 0 && sgroup == cgroup )
+            continue;
+        if ( sgroup < 0 )
+            sgroup = sim[pair->source_domain - 1][pair->source_gfn].group =
+                next_group++;
+        if ( cgroup < 0 )
+        {
+            sim[domid - 1][pair->client_gfn].group = sgroup;
+            nr_freed++;
+            continue;
+        }
+
+        /* Merge the client's group into the source's. */
+        for ( d = 0; d < NR_DOMS; d++ )
+            for ( p = 0; p < NR_PAGES; p++ )
+                if ( sim[d][p].group == cgroup )
+                {
+                    sim[d][p].group = sgroup;
+                    nr_freed++;
+                }
+        nr_freed--;
+    }
+
+    return 0;
+}
+
+long xc_sharing_freed_pages(xc_interface *xch)
+{
+    return nr_freed;
+}
+
+long xc_sharing_cow_breaks(xc_interface *xch)
+{
+    return 0;
+}
+
+/* Runs a pass, checking how many pairs got handed to Xen and shared. */
+#define PASS_CHECK(nr_pairs, nr_shared) ({                      \
+    nr_submitted = 0;                                           \
+    do_pass();                                                  \
+    assert(nr_submitted == (nr_pairs));                         \
+    assert(pass.shared == (nr_shared));                         \
+    assert(pass.failed == 0);                                   \
+})
+
+/* A guest write, which gets the page its own copy. */
+static void write_page(uint32_t domid, xen_pfn_t gfn, uint64_t val)
+{
+    sim[domid - 1][gfn].val = val;
+    sim[domid - 1][gfn].group = -1;
+}
+
+static void test(bool pv_dom0)
+{
+    unsigned int d, p;
+
+    map_shared = pv_dom0;
+    next_group = 0;
+    nr_freed = 0;
+    for ( d = 0; d < NR_DOMS; d++ )
+        for ( p = 0; p < NR_PAGES; p++ )
+        {
+            sim[d][p].val = p % NR_CONTENTS + 1;
+            sim[d][p].group = -1;
+        }
+
+    for ( d = 0; d < nr_doms; d++ )
+        free(doms[d].last);
+    nr_doms = 0;
+
+    /* The first pass only hashes the pages. */
+    PASS_CHECK(0, 0);
+
+    /* The second one shares all but one page of each contents. */
+    PASS_CHECK(NR_DOMS * NR_PAGES - NR_CONTENTS,
+               NR_DOMS * NR_PAGES - NR_CONTENTS);
+    assert(nr_freed == NR_DOMS * NR_PAGES - NR_CONTENTS);
+    for ( d = 0; d < NR_DOMS; d++ )
+        for ( p = 0; p < NR_PAGES; p++ )
+            assert(sim[d][p].group >= 0);
+
+    /* Shared pages don't get handed to Xen again. */
+    PASS_CHECK(0, 0);
+
+    /*
+     * A page written to is only shared again once its contents have stayed
+     * the same for a pass, and then joins the other pages with them.
+     */
+    write_page(2, 5, 3);
+    PASS_CHECK(0, 0);
+    PASS_CHECK(1, 1);
+    assert(sim[1][5].group == sim[0][2].group);
+    PASS_CHECK(0, 0);
+
+    /* Nor does a page which differs from all others. */
+    write_page(1, 7, 1000);
+    PASS_CHECK(0, 0);
+    PASS_CHECK(0, 0);
+}
+
+int
+main(int argc, char **argv)
+{
+    ignore_numa = true;
+    rate = UINT_MAX;
+
+    test(false);
+    test(true);
+
+    return 0;
+}
+
+/*
+ * Local variables:
+ * mode: C
+ * c-file-style: "BSD"
+ * c-basic-offset: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
@@ -0,0 +1,236 @@
+/**
+ * @file
+ * @section LICENSE
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this program; If not, see <http://www.gnu.org/licenses/>.
+ *
+ * @section DESCRIPTION
+ *
+ * Measures the throughput or round trip latency of a vchan, passing messages
+ * through the ring or as bulk transfers.  The server sends, and the client
+ * receives (and echoes, for latency).  The server reports the results.
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <libxenvchan.h>
+
+#define RING_SIZE (64 * 1024)
+#define NR_BUFS 8
+
+enum mode { MODE_COPY, MODE_BULK, MODE_MAP };
+
+static enum mode mode = MODE_COPY;
+static size_t size = 4096;
+static unsigned long count = 10000;
+
+static void *bufs[NR_BUFS];
+static unsigned int next_buf;
+static char *rbuf;
+
+static void die(const char *what)
+{
+	perror(what);
+	exit(1);
+}
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void send_msg(struct libxenvchan *ctrl, size_t len)
+{
+	size_t pos = 0;
+	void *buf;
+	int ret;
+
+	if (mode == MODE_COPY) {
+		while (pos < len) {
+			ret = libxenvchan_write(ctrl, rbuf + pos, len - pos);
+			if (ret <= 0)
+				die("libxenvchan_write");
+			pos += ret;
+		}
+		return;
+	}
+
+	/* Wait for the peer to be done with the oldest buffer. */
+	buf = bufs[next_buf++ % NR_BUFS];
+	while (libxenvchan_bulk_busy(ctrl, buf))
+		if (libxenvchan_wait(ctrl))
+			die("libxenvchan_wait");
+	if (libxenvchan_send_bulk(ctrl, buf, len) != len)
+		die("libxenvchan_send_bulk");
+}
+
+static void recv_msg(struct libxenvchan *ctrl, size_t len)
+{
+	const void *data;
+	size_t pos = 0;
+	int ret;
+
+	switch (mode) {
+	case MODE_COPY:
+		while (pos < len) {
+			ret = libxenvchan_read(ctrl, rbuf + pos, len - pos);
+			if (ret <= 0)
+				die("libxenvchan_read");
+			pos += ret;
+		}
+		break;
+	case MODE_BULK:
+		if (libxenvchan_recv_bulk(ctrl, rbuf, size) != len)
+			die("libxenvchan_recv_bulk");
+		break;
+	case MODE_MAP:
+		if (libxenvchan_recv_bulk_map(ctrl, &data) != len)
+			die("libxenvchan_recv_bulk_map");
+		rbuf[0] = *(const char *)data;
+		if (libxenvchan_bulk_release(ctrl))
+			die("libxenvchan_bulk_release");
+		break;
+	}
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr,
+		"usage: %s [-c] [-l] [-m copy|bulk|map] [-s size] [-n count] [-p usecs] domid nodepath\n"
+		"  -c  act as the client, which receives and echoes\n"
+		"  -l  measure round trip latency rather than throughput\n"
+		"  -m  pass messages through the ring (copy, the default), or grant\n"
+		"      them and have the receiver grant copy (bulk) or map (map) them\n"
+		"  -s  size of the messages (default 4096)\n"
+		"  -n  number of messages (default 10000)\n"
+		"  -p  poll the ring for up to usecs before waiting for events\n",
+		prog);
+	exit(2);
+}
+
+int main(int argc, char **argv)
+{
+	struct libxenvchan *ctrl;
+	int client = 0, latency = 0, opt;
+	unsigned int busy_poll_us = 0, i;
+	unsigned long n;
+	double start, t;
+
+	while ((opt = getopt(argc, argv, "clm:s:n:p:")) != -1) {
+		switch (opt) {
+		case 'c':
+			client = 1;
+			break;
+		case 'l':
+			latency = 1;
+			break;
+		case 'm':
+			if (!strcmp(optarg, "copy"))
+				mode = MODE_COPY;
+			else if (!strcmp(optarg, "bulk"))
+				mode = MODE_BULK;
+			else if (!strcmp(optarg, "map"))
+				mode = MODE_MAP;
+			else
+				usage(argv[0]);
+			break;
+		case 's':
+			size = strtoul(optarg, NULL, 0);
+			break;
+		case 'n':
+			count = strtoul(optarg, NULL, 0);
+			break;
+		case 'p':
+			busy_poll_us = strtoul(optarg, NULL, 0);
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (argc - optind != 2 || !size || !count)
+		usage(argv[0]);
+
+	if (client)
+		ctrl = libxenvchan_client_init(NULL, atoi(argv[optind]),
+					       argv[optind + 1]);
+	else
+		ctrl = libxenvchan_server_init(NULL, atoi(argv[optind]),
+					       argv[optind + 1],
+					       RING_SIZE, RING_SIZE);
+	if (!ctrl)
+		die("libxenvchan_*_init");
+	ctrl->blocking = 1;
+	ctrl->busy_poll_us = busy_poll_us;
+
+	rbuf = calloc(1, size);
+	if (!rbuf)
+		die("calloc");
+	if (mode != MODE_COPY) {
+		for (i = 0; i < NR_BUFS; i++) {
+			bufs[i] = libxenvchan_bulk_alloc(ctrl, size);
+			if (!bufs[i])
+				die("libxenvchan_bulk_alloc");
+			memset(bufs[i], i, size);
+		}
+	}
+
+	if (client) {
+		for (n = 0; n < count; n++) {
+			recv_msg(ctrl, size);
+			if (latency)
+				send_msg(ctrl, size);
+		}
+		/* Tell the server that all has arrived. */
+		if (!latency)
+			send_msg(ctrl, 1);
+		/* And let it receive that before the vchan goes away. */
+		while (libxenvchan_is_open(ctrl))
+			if (libxenvchan_wait(ctrl))
+				break;
+		libxenvchan_close(ctrl);
+		return 0;
+	}
+
+	while (libxenvchan_is_open(ctrl) == 2)
+		if (libxenvchan_wait(ctrl))
+			die("libxenvchan_wait");
+
+	start = now();
+	for (n = 0; n < count; n++) {
+		send_msg(ctrl, size);
+		if (latency)
+			recv_msg(ctrl, size);
+	}
+	if (!latency)
+		recv_msg(ctrl, 1);
+	t = now() - start;
+
+	if (latency)
+		printf("%lu round trips of %zu bytes: %.2fus each\n",
+		       count, size, t * 1e6 / count);
+	else
+		printf("%lu messages of %zu bytes in %.3fs: %.0f msgs/s, %.1f MiB/s\n",
+		       count, size, t, count / t, count * size / t / (1 << 20));
+
+	libxenvchan_close(ctrl);
+	return 0;
+}
@@ -0,0 +1,181 @@
+/*
+ *  xenstatd - collect xenstat nodes once, for any number of readers
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; under version 2 of the License.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Keeps a libxenstat handle, with its cached state, across samples and
+ * publishes every node it gets to a shared memory file which xentop -S and
+ * other readers use (see xenstat_get_shared_node()).  Besides sampling
+ * every interval, it samples as soon as domains come or go.
+ */
+
+#include <errno.h>
+#include <getopt.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <xenstat.h>
+#include <xenstore.h>
+
+#define DEFAULT_INTERVAL_MS 1000
+/* Don't sample more often than this, however busy domain creation gets. */
+#define MIN_INTERVAL_MS 100
+
+static volatile sig_atomic_t interrupted;
+
+static void usage(const char *prog)
+{
+	fprintf(stderr,
+		"Usage: %s [OPTION]...\n"
+		"Collect Xen statistics and publish them for xentop -S and\n"
+		"other libxenstat readers.\n"
+		"\n"
+		"-i, --interval=MS  sample every MS milliseconds (default %u)\n"
+		"-p, --path=FILE    publish to FILE instead of the default\n"
+		"-F, --foreground   do not daemonize\n"
+		"-h, --help         display this help and exit\n",
+		prog, DEFAULT_INTERVAL_MS);
+	exit(1);
+}
+
+static void handle_signal(int sig)
+{
+	interrupted = 1;
+}
+
+static unsigned long long now_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000ULL + ts.tv_nsec / 1000000;
+}
+
+int main(int argc, char **argv)
+{
+	static const struct option lopts[] = {
+		{ "interval",   required_argument, NULL, 'i' },
+		{ "path",       required_argument, NULL, 'p' },
+		{ "foreground", no_argument,       NULL, 'F' },
+		{ "help",       no_argument,       NULL, 'h' },
+		{ 0, 0, 0, 0 },
+	};
+	unsigned int interval = DEFAULT_INTERVAL_MS;
+	const char *path = NULL;
+	int foreground = 0, opt;
+	xenstat_handle *xhandle;
+	struct xs_handle *xsh;
+	struct sigaction sa;
+	unsigned long long next, last = 0;
+	bool domains_changed = false;
+
+	while ((opt = getopt_long(argc, argv, "i:p:Fh", lopts, NULL)) != -1) {
+		switch (opt) {
+		case 'i':
+			interval = strtoul(optarg, NULL, 0);
+			if (interval < MIN_INTERVAL_MS)
+				interval = MIN_INTERVAL_MS;
+			break;
+		case 'p':
+			path = optarg;
+			break;
+		case 'F':
+			foreground = 1;
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (optind != argc)
+		usage(argv[0]);
+
+	/*
+	 * Before opening any xenstore connection: their reader threads, and
+	 * hence watches, don't survive the fork.
+	 */
+	if (!foreground && daemon(0, 0)) {
+		perror("daemon");
+		return 1;
+	}
+
+	xhandle = xenstat_init();
+	if (xhandle == NULL) {
+		fprintf(stderr, "Failed to initialize xenstat library\n");
+		return 1;
+	}
+
+	/* Sample straight away when domains are created or destroyed. */
+	xsh = xs_open(0);
+	if (xsh == NULL ||
+	    !xs_watch(xsh, "@introduceDomain", "domains") ||
+	    !xs_watch(xsh, "@releaseDomain", "domains")) {
+		perror("Failed to watch for domain changes");
+		return 1;
+	}
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = handle_signal;
+	sigaction(SIGTERM, &sa, NULL);
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGHUP, &sa, NULL);
+
+	next = now_ms();
+	while (!interrupted) {
+		unsigned long long now = now_ms();
+		struct pollfd pfd = { .fd = xs_fileno(xsh), .events = POLLIN };
+		char **vec;
+
+		if (now >= next ||
+		    (domains_changed && now >= last + MIN_INTERVAL_MS)) {
+			xenstat_node *node = xenstat_get_node(xhandle,
+							      XENSTAT_ALL);
+
+			if (node == NULL)
+				perror("Failed to retrieve statistics");
+			else {
+				if (xenstat_publish_node(xhandle, node, path,
+							 interval))
+					perror("Failed to publish statistics");
+				xenstat_free_node(node);
+			}
+
+			last = now;
+			domains_changed = false;
+			/* Keep to the interval's grid, skipping missed slots. */
+			while (next <= now)
+				next += interval;
+		}
+
+		if (domains_changed)
+			poll(NULL, 0, last + MIN_INTERVAL_MS - now);
+		else if (poll(&pfd, 1, next - now) > 0)
+			while ((vec = xs_check_watch(xsh)) != NULL) {
+				domains_changed = true;
+				free(vec);
+			}
+	}
+
+	xenstat_unpublish(xhandle);
+	xenstat_uninit(xhandle);
+	xs_close(xsh);
+
+	return 0;
+}
@@ -211,6 +211,7 @@ int show_networks = 0;
 int show_vbds = 0;
 int repeat_header = 0;
 int show_full_name = 0;
+int use_shared = 0;
 #define PROMPT_VAL_LEN 80
 const char *prompt = NULL;
 char prompt_val[PROMPT_VAL_LEN];
@@ -240,6 +241,8 @@ static void usage(const char *program)
 	       "-b, --batch	     output in batch mode, no user input accepted\n"
 	       "-i, --iterations     number of iterations before exiting\n"
 	       "-f, --full-name      output the full domain name (not truncated)\n"
+	       "-S, --shared         use the statistics published by xenstatd, if\n"
+	       "                     it is running, rather than collecting them\n"
 	       "\n" XENTOP_BUGSTO,
 	       program);
 	return;
@@ -511,8 +514,15 @@ static double get_cpu_pct(xenstat_domain *domain)
 		return 0.0;
 
 	/* Calculate the time elapsed in microseconds */
-	us_elapsed = ((curtime.tv_sec-oldtime.tv_sec)*1000000.0
-		      +(curtime.tv_usec - oldtime.tv_usec));
+	if (use_shared)
+		/* Between samples, which needn't be our refreshes */
+		us_elapsed = (xenstat_node_sample_ns(cur_node)
+			      - xenstat_node_sample_ns(prev_node)) / 1000.0;
+	else
+		us_elapsed = ((curtime.tv_sec-oldtime.tv_sec)*1000000.0
+			      +(curtime.tv_usec - oldtime.tv_usec));
+	if (us_elapsed <= 0)
+		return 0.0;
 
 	/* In the following, nanoseconds must be multiplied by 1000.0 to
 	 * convert to microseconds, then divided by 100.0 to get a percentage,
@@ -1168,7 +1178,11 @@ static void top(void)
 	if (prev_node != NULL)
 		xenstat_free_node(prev_node);
 	prev_node = cur_node;
-	cur_node = xenstat_get_node(xhandle, XENSTAT_ALL);
+	cur_node = NULL;
+	if (use_shared)
+		cur_node = xenstat_get_shared_node(xhandle, XENSTAT_ALL, NULL);
+	if (cur_node == NULL)
+		cur_node = xenstat_get_node(xhandle, XENSTAT_ALL);
 	if (cur_node == NULL)
 		fail("Failed to retrieve statistics from libxenstat\n");
 
@@ -1242,9 +1256,10 @@ int main(int argc, char **argv)
 		{ "batch",	   no_argument,	      NULL, 'b' },
 		{ "iterations",	   required_argument, NULL, 'i' },
 		{ "full-name",     no_argument,       NULL, 'f' },
+		{ "shared",        no_argument,       NULL, 'S' },
 		{ 0, 0, 0, 0 },
 	};
-	const char *sopts = "hVnxrvd:bi:f";
+	const char *sopts = "hVnxrvd:bi:fS";
 
 	if (atexit(cleanup) != 0)
 		fail("Failed to install cleanup handler.\n");
@@ -1286,6 +1301,9 @@ int main(int argc, char **argv)
 		case 'f':
 			show_full_name = 1;
 			break;
+		case 'S':
+			use_shared = 1;
+			break;
 		}
 	}
 
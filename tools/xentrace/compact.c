@@ -0,0 +1,730 @@
+/*
+ * compact.c: Compact, compressed xentrace output format
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <xen/trace.h>
+#include "compact.h"
+
+/* Decompression is done by the hypervisor's LZ4 decoder, as in libxenguest. */
+typedef uint8_t u8;
+typedef uint16_t u16;
+typedef uint32_t u32;
+typedef uint64_t u64;
+
+#define likely(a) a
+#define unlikely(a) a
+
+#define get_unaligned(p) \
+    (((const struct { typeof(*(p)) x; } __attribute__((packed)) *)(p))->x)
+#define put_unaligned(v, p) \
+    (((struct { typeof(*(p)) x; } __attribute__((packed)) *)(p))->x = (v))
+
+static inline uint_fast16_t le16_to_cpup(const unsigned char *buf)
+{
+    return buf[0] | (buf[1] << 8);
+}
+
+#include "../../xen/include/xen/lz4.h"
+#include "../../xen/common/decompress.h"
+#include "../../xen/common/lz4/decompress.c"
+
+/* Flush a block once this much encoded data has accumulated. */
+#define COMPACT_BLOCK_TARGET (1U << 20)
+/* Refuse to decode blocks larger than this. */
+#define COMPACT_BLOCK_MAX    (1U << 30)
+
+#define DICT_MAX      1024
+#define DICT_HASH     2048    /* Power of 2, > DICT_MAX */
+
+#define LZ_HASH_BITS  12
+#define LZ_MIN_MATCH  4
+#define LZ_LAST_LITERALS 5
+#define LZ_MF_LIMIT   12      /* No match may start in the last 12 bytes */
+#define LZ_MAX_OFFSET 65535
+
+struct cpu_change_rec {
+    uint32_t header;
+    uint32_t cpu;
+    uint32_t window_size;
+};
+
+#define CPU_CHANGE_HEADER                                               \
+    (TRC_TRACE_CPU_CHANGE                                               \
+     | (((sizeof(struct cpu_change_rec) / sizeof(uint32_t)) - 1)        \
+        << TRACE_EXTRA_SHIFT))
+
+struct compact_enc {
+    int fd;
+
+    uint8_t *buf;               /* Block being encoded */
+    size_t len, size;
+    uint8_t *out;               /* Compressed block */
+    size_t out_size;
+
+    uint64_t *last_tsc;         /* Per cpu, previous tsc in this block */
+    unsigned int nr_tsc;
+
+    struct {
+        uint32_t event_plus1;   /* 0: free slot */
+        uint32_t idx;
+    } dict[DICT_HASH];
+    unsigned int nr_dict;
+
+    uint32_t lz_table[1U << LZ_HASH_BITS];
+};
+
+static int write_all(int fd, const void *p, size_t len)
+{
+    while ( len )
+    {
+        ssize_t r = write(fd, p, len);
+
+        if ( r < 0 && errno == EINTR )
+            continue;
+        if ( r <= 0 )
+            return -1;
+
+        p = (const uint8_t *)p + r;
+        len -= r;
+    }
+
+    return 0;
+}
+
+static ssize_t read_all(int fd, void *p, size_t len)
+{
+    size_t done = 0;
+
+    while ( done < len )
+    {
+        ssize_t r = read(fd, (uint8_t *)p + done, len - done);
+
+        if ( r < 0 && errno == EINTR )
+            continue;
+        if ( r < 0 )
+            return -1;
+        if ( r == 0 )
+            break;
+
+        done += r;
+    }
+
+    return done;
+}
+
+static int grow(uint8_t **buf, size_t *size, size_t need)
+{
+    size_t new_size = *size ? *size : 4096;
+    uint8_t *p;
+
+    if ( need <= *size )
+        return 0;
+
+    while ( new_size < need )
+        new_size *= 2;
+
+    p = realloc(*buf, new_size);
+    if ( !p )
+        return -1;
+
+    *buf = p;
+    *size = new_size;
+
+    return 0;
+}
+
+static inline uint32_t read32(const uint8_t *p)
+{
+    uint32_t v;
+
+    memcpy(&v, p, sizeof(v));
+
+    return v;
+}
+
+/*
+ * LZ4 block format compressor: greedy, single hash probe.  Trades ratio
+ * for speed, which is what matters when keeping up with Xen.  @dst must
+ * have room for lz4_compressbound(@len) bytes.
+ */
+static size_t compact_lz4_compress(uint32_t *table, const uint8_t *src,
+                                   size_t len, uint8_t *dst)
+{
+    const uint8_t *ip = src, *anchor = src, *end = src + len;
+    uint8_t *op = dst;
+    size_t lit;
+
+    memset(table, 0, sizeof(*table) << LZ_HASH_BITS);
+
+    if ( len > LZ_MF_LIMIT )
+    {
+        const uint8_t *mflimit = end - LZ_MF_LIMIT;
+        const uint8_t *matchlimit = end - LZ_LAST_LITERALS;
+
+        while ( ip < mflimit )
+        {
+            uint32_t seq = read32(ip);
+            uint32_t h = (seq * 2654435761U) >> (32 - LZ_HASH_BITS);
+            uint32_t cand = table[h];
+            const uint8_t *ref = src + cand - 1;
+            const uint8_t *m;
+            uint8_t *token;
+            size_t mlen;
+
+            table[h] = ip - src + 1;
+
+            if ( !cand || ip - ref > LZ_MAX_OFFSET || read32(ref) != seq )
+            {
+                ip++;
+                continue;
+            }
+
+            for ( m = ip + LZ_MIN_MATCH, ref += LZ_MIN_MATCH;
+                  m < matchlimit && *m == *ref; m++, ref++ )
+                ;
+
+            lit = ip - anchor;
+            mlen = m - ip - LZ_MIN_MATCH;
+
+            token = op++;
+            *token = ((lit < 15 ? lit : 15) << 4) | (mlen < 15 ? mlen : 15);
+            if ( lit >= 15 )
+            {
+                size_t l = lit - 15;
+
+                for ( ; l >= 255; l -= 255 )
+                    *op++ = 255;
+                *op++ = l;
+            }
+            memcpy(op, anchor, lit);
+            op += lit;
+
+            *op++ = (m - ref) & 0xff;
+            *op++ = (m - ref) >> 8;
+
+            if ( mlen >= 15 )
+            {
+                size_t l = mlen - 15;
+
+                for ( ; l >= 255; l -= 255 )
+                    *op++ = 255;
+                *op++ = l;
+            }
+
+            ip = anchor = m;
+        }
+    }
+
+    /* Last literals */
+    lit = end - anchor;
+    *op++ = (lit < 15 ? lit : 15) << 4;
+    if ( lit >= 15 )
+    {
+        size_t l = lit - 15;
+
+        for ( ; l >= 255; l -= 255 )
+            *op++ = 255;
+        *op++ = l;
+    }
+    memcpy(op, anchor, lit);
+    op += lit;
+
+    return op - dst;
+}
+
+static inline void put_varint(uint8_t **p, uint64_t v)
+{
+    while ( v >= 0x80 )
+    {
+        *(*p)++ = v | 0x80;
+        v >>= 7;
+    }
+    *(*p)++ = v;
+}
+
+static int get_varint(const uint8_t **p, const uint8_t *end, uint64_t *v)
+{
+    unsigned int shift = 0;
+
+    *v = 0;
+    while ( *p < end && shift < 64 )
+    {
+        uint8_t b = *(*p)++;
+
+        *v |= (uint64_t)(b & 0x7f) << shift;
+        if ( !(b & 0x80) )
+            return 0;
+        shift += 7;
+    }
+
+    return -1;
+}
+
+static inline size_t rec_size(uint32_t hdr)
+{
+    return sizeof(uint32_t) * (1 + TRC_HD_EXTRA(hdr)) +
+           (TRC_HD_CYCLE_FLAG & hdr ? sizeof(uint64_t) : 0);
+}
+
+static void enc_reset(struct compact_enc *e)
+{
+    e->len = 0;
+    memset(e->dict, 0, sizeof(e->dict));
+    e->nr_dict = 0;
+    if ( e->last_tsc )
+        memset(e->last_tsc, 0, e->nr_tsc * sizeof(*e->last_tsc));
+}
+
+static int enc_flush(struct compact_enc *e)
+{
+    struct compact_block_header hdr;
+    const uint8_t *data = e->out;
+
+    if ( !e->len )
+        return 0;
+
+    if ( grow(&e->out, &e->out_size, lz4_compressbound(e->len)) )
+        return -1;
+
+    hdr.raw_size = e->len;
+    hdr.comp_size = compact_lz4_compress(e->lz_table, e->buf, e->len, e->out);
+    data = e->out;
+    if ( hdr.comp_size >= hdr.raw_size )
+    {
+        hdr.comp_size = hdr.raw_size;
+        data = e->buf;
+    }
+
+    if ( write_all(e->fd, &hdr, sizeof(hdr)) ||
+         write_all(e->fd, data, hdr.comp_size) )
+        return -1;
+
+    enc_reset(e);
+
+    return 0;
+}
+
+struct compact_enc *compact_enc_open(int fd)
+{
+    struct compact_file_header hdr = {
+        .magic = COMPACT_MAGIC,
+        .version = COMPACT_VERSION,
+    };
+    struct compact_enc *e = calloc(1, sizeof(*e));
+
+    if ( !e )
+        return NULL;
+
+    e->fd = fd;
+
+    if ( write_all(fd, &hdr, sizeof(hdr)) )
+    {
+        free(e);
+        return NULL;
+    }
+
+    return e;
+}
+
+int compact_enc_close(struct compact_enc *e)
+{
+    int rc = enc_flush(e);
+
+    free(e->buf);
+    free(e->out);
+    free(e->last_tsc);
+    free(e);
+
+    return rc;
+}
+
+/* Does @p consist of whole records? */
+static int chunk_parses(const uint8_t *p, size_t len)
+{
+    while ( len )
+    {
+        size_t size;
+
+        if ( len < sizeof(uint32_t) )
+            return 0;
+
+        size = rec_size(read32(p));
+        if ( size > len )
+            return 0;
+
+        p += size;
+        len -= size;
+    }
+
+    return 1;
+}
+
+static int dict_lookup(struct compact_enc *e, uint32_t event, uint32_t *idx)
+{
+    unsigned int h = (event * 2654435761U) & (DICT_HASH - 1);
+
+    for ( ; e->dict[h].event_plus1; h = (h + 1) & (DICT_HASH - 1) )
+        if ( e->dict[h].event_plus1 == event + 1 )
+        {
+            *idx = e->dict[h].idx;
+            return 1;
+        }
+
+    /* Add it, if there is room, for the decoder to do likewise. */
+    if ( e->nr_dict < DICT_MAX )
+    {
+        e->dict[h].event_plus1 = event + 1;
+        e->dict[h].idx = e->nr_dict++;
+    }
+
+    return 0;
+}
+
+static void enc_records(struct compact_enc *e, unsigned int cpu,
+                        const uint8_t *p, size_t len)
+{
+    uint8_t *op = e->buf + e->len;
+
+    while ( len )
+    {
+        uint32_t hdr = read32(p), event = TRC_HD_TO_EVENT(hdr), idx;
+        unsigned int i, extra = TRC_HD_EXTRA(hdr);
+        uint8_t *flags = op++;
+
+        *flags = extra << COMPACT_REC_EXTRA_SHIFT;
+        if ( dict_lookup(e, event, &idx) )
+        {
+            *flags |= COMPACT_REC_DICT;
+            put_varint(&op, idx);
+        }
+        else
+            put_varint(&op, event);
+        p += sizeof(uint32_t);
+
+        if ( hdr & TRC_HD_CYCLE_FLAG )
+        {
+            uint64_t tsc = read32(p) | ((uint64_t)read32(p + 4) << 32);
+            int64_t delta = tsc - e->last_tsc[cpu];
+
+            *flags |= COMPACT_REC_CYCLES;
+            put_varint(&op, ((uint64_t)delta << 1) ^ (delta >> 63));
+            e->last_tsc[cpu] = tsc;
+            p += sizeof(uint64_t);
+        }
+
+        for ( i = 0; i < extra; i++, p += sizeof(uint32_t) )
+            put_varint(&op, read32(p));
+
+        len -= rec_size(hdr);
+    }
+
+    e->len = op - e->buf;
+}
+
+int compact_enc_window(struct compact_enc *e, unsigned int cpu,
+                       const struct iovec *iov, unsigned int nr,
+                       unsigned long window_size)
+{
+    int records = 1;
+    unsigned int i;
+    uint8_t *op;
+
+    if ( cpu >= e->nr_tsc )
+    {
+        unsigned int nr_tsc = cpu + 1;
+        uint64_t *t = realloc(e->last_tsc, nr_tsc * sizeof(*t));
+
+        if ( !t )
+            return -1;
+        memset(t + e->nr_tsc, 0, (nr_tsc - e->nr_tsc) * sizeof(*t));
+        e->last_tsc = t;
+        e->nr_tsc = nr_tsc;
+    }
+
+    for ( i = 0; i < nr; i++ )
+        records &= chunk_parses(iov[i].iov_base, iov[i].iov_len);
+
+    /*
+     * Header, plus the larger of the raw and encoded-records forms.  Each
+     * 4 (8) bytes of a record encode to at most 5 (10) bytes.
+     */
+    if ( grow(&e->buf, &e->size, e->len + 1 + 10 + 10 + window_size +
+              window_size / 4) )
+        return -1;
+
+    op = e->buf + e->len;
+    *op++ = records ? COMPACT_WIN_RECORDS : COMPACT_WIN_RAW;
+    put_varint(&op, cpu);
+    put_varint(&op, window_size);
+    e->len = op - e->buf;
+
+    for ( i = 0; i < nr; i++ )
+    {
+        if ( records )
+            enc_records(e, cpu, iov[i].iov_base, iov[i].iov_len);
+        else
+        {
+            memcpy(e->buf + e->len, iov[i].iov_base, iov[i].iov_len);
+            e->len += iov[i].iov_len;
+        }
+    }
+
+    if ( e->len >= COMPACT_BLOCK_TARGET )
+        return enc_flush(e);
+
+    return 0;
+}
+
+int compact_detect(int fd)
+{
+    struct compact_file_header hdr;
+
+    return pread(fd, &hdr, sizeof(hdr), 0) == sizeof(hdr) &&
+           hdr.magic == COMPACT_MAGIC;
+}
+
+struct dec_state {
+    uint32_t dict[DICT_MAX];
+    unsigned int nr_dict;
+    uint64_t *last_tsc;
+    unsigned int nr_tsc;
+    uint8_t *out;
+    size_t out_size;
+};
+
+/* Decode one window, appending the raw form to d->out at *@olen. */
+static int dec_window(struct dec_state *d, const uint8_t **pp,
+                      const uint8_t *end, size_t *olen)
+{
+    const uint8_t *p = *pp;
+    struct cpu_change_rec cc = { .header = CPU_CHANGE_HEADER };
+    uint64_t cpu, window_size, v;
+    uint8_t type;
+    size_t done = 0;
+    uint8_t *op;
+
+    if ( p >= end )
+        return -1;
+    type = *p++;
+    if ( get_varint(&p, end, &cpu) || get_varint(&p, end, &window_size) ||
+         cpu > UINT32_MAX || window_size > COMPACT_BLOCK_MAX )
+        return -1;
+
+    if ( cpu >= d->nr_tsc )
+    {
+        uint64_t *t = realloc(d->last_tsc, (cpu + 1) * sizeof(*t));
+
+        if ( !t )
+            return -1;
+        memset(t + d->nr_tsc, 0, (cpu + 1 - d->nr_tsc) * sizeof(*t));
+        d->last_tsc = t;
+        d->nr_tsc = cpu + 1;
+    }
+
+    if ( grow(&d->out, &d->out_size, *olen + sizeof(cc) + window_size) )
+        return -1;
+
+    cc.cpu = cpu;
+    cc.window_size = window_size;
+    op = d->out + *olen;
+    memcpy(op, &cc, sizeof(cc));
+    op += sizeof(cc);
+
+    if ( type == COMPACT_WIN_RAW )
+    {
+        if ( (uint64_t)(end - p) < window_size )
+            return -1;
+        memcpy(op, p, window_size);
+        p += window_size;
+        op += window_size;
+    }
+    else if ( type == COMPACT_WIN_RECORDS )
+    {
+        while ( done < window_size )
+        {
+            uint8_t flags;
+            uint32_t hdr, event;
+            unsigned int i, extra;
+
+            if ( p >= end )
+                return -1;
+            flags = *p++;
+            extra = (flags >> COMPACT_REC_EXTRA_SHIFT) & TRACE_EXTRA_MAX;
+
+            if ( get_varint(&p, end, &v) )
+                return -1;
+            if ( flags & COMPACT_REC_DICT )
+            {
+                if ( v >= d->nr_dict )
+                    return -1;
+                event = d->dict[v];
+            }
+            else
+            {
+                event = TRC_HD_TO_EVENT(v);
+                if ( d->nr_dict < DICT_MAX )
+                    d->dict[d->nr_dict++] = event;
+            }
+
+            hdr = event | (extra << TRACE_EXTRA_SHIFT);
+            if ( flags & COMPACT_REC_CYCLES )
+                hdr |= TRC_HD_CYCLE_FLAG;
+
+            done += rec_size(hdr);
+            if ( done > window_size )
+                return -1;
+
+            memcpy(op, &hdr, sizeof(hdr));
+            op += sizeof(hdr);
+
+            if ( flags & COMPACT_REC_CYCLES )
+            {
+                uint64_t tsc;
+
+                if ( get_varint(&p, end, &v) )
+                    return -1;
+                tsc = d->last_tsc[cpu] + ((v >> 1) ^ -(v & 1));
+                d->last_tsc[cpu] = tsc;
+                memcpy(op, &tsc, sizeof(tsc));
+                op += sizeof(tsc);
+            }
+
+            for ( i = 0; i < extra; i++ )
+            {
+                uint32_t x;
+
+                if ( get_varint(&p, end, &v) )
+                    return -1;
+                x = v;
+                memcpy(op, &x, sizeof(x));
+                op += sizeof(x);
+            }
+        }
+    }
+    else
+        return -1;
+
+    *olen = op - d->out;
+    *pp = p;
+
+    return 0;
+}
+
+int compact_decode(int in, int out)
+{
+    struct compact_file_header fh;
+    struct compact_block_header bh;
+    struct dec_state d = { 0 };
+    uint8_t *cbuf = NULL, *rbuf = NULL;
+    size_t csize = 0, rsize = 0;
+    ssize_t r;
+    int rc = -1;
+
+    if ( read_all(in, &fh, sizeof(fh)) != sizeof(fh) ||
+         fh.magic != COMPACT_MAGIC || fh.version != COMPACT_VERSION )
+    {
+        errno = EINVAL;
+        return -1;
+    }
+
+    while ( (r = read_all(in, &bh, sizeof(bh))) == sizeof(bh) )
+    {
+        const uint8_t *p, *end;
+        size_t dlen, olen = 0;
+
+        if ( bh.raw_size > COMPACT_BLOCK_MAX || bh.comp_size > bh.raw_size )
+            goto bad;
+
+        if ( grow(&cbuf, &csize, bh.comp_size) )
+            goto out;
+        r = read_all(in, cbuf, bh.comp_size);
+        if ( r < 0 )
+            goto out;
+        if ( r != bh.comp_size )
+        {
+            fprintf(stderr, "Compact trace truncated, ignoring last block\n");
+            break;
+        }
+
+        if ( bh.comp_size == bh.raw_size )
+            p = cbuf;
+        else
+        {
+            if ( grow(&rbuf, &rsize, bh.raw_size) )
+                goto out;
+            dlen = bh.raw_size;
+            if ( lz4_decompress_unknownoutputsize(cbuf, bh.comp_size,
+                                                  rbuf, &dlen) ||
+                 dlen != bh.raw_size )
+                goto bad;
+            p = rbuf;
+        }
+        end = p + bh.raw_size;
+
+        /* Blocks are self-contained. */
+        d.nr_dict = 0;
+        if ( d.last_tsc )
+            memset(d.last_tsc, 0, d.nr_tsc * sizeof(*d.last_tsc));
+
+        while ( p < end )
+        {
+            if ( dec_window(&d, &p, end, &olen) )
+                goto bad;
+
+            if ( olen >= COMPACT_BLOCK_TARGET )
+            {
+                if ( write_all(out, d.out, olen) )
+                    goto out;
+                olen = 0;
+            }
+        }
+
+        if ( write_all(out, d.out, olen) )
+            goto out;
+    }
+
+    if ( r < 0 )
+        goto out;
+    if ( r > 0 )
+        fprintf(stderr, "Compact trace truncated, ignoring last block\n");
+
+    rc = 0;
+    goto out;
+
+ bad:
+    fprintf(stderr, "Corrupt block in compact trace\n");
+    errno = EINVAL;
+ out:
+    free(cbuf);
+    free(rbuf);
+    free(d.out);
+    free(d.last_tsc);
+    return rc;
+}
+
+/*
+ * Local variables:
+ * mode: C
+ * c-file-style: "BSD"
+ * c-basic-offset: 4
+ * tab-width: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
@@ -0,0 +1,65 @@
+#ifndef __XENTRACE_COMPACT_H
+#define __XENTRACE_COMPACT_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/uio.h>
+
+/*
+ * Compact xentrace output format.
+ *
+ * The file starts with a struct compact_file_header, followed by blocks.
+ * Each block is a struct compact_block_header followed by comp_size bytes:
+ * the block's encoded windows, LZ4 (block format) compressed, or stored as
+ * is if comp_size == raw_size.  Blocks decode independently of each other.
+ *
+ * Decoded, a block is a sequence of trace buffer windows:
+ *   u8 COMPACT_WIN_RECORDS or COMPACT_WIN_RAW, varint cpu,
+ *   varint window_size, then either window_size raw bytes (RAW) or
+ *   records (RECORDS) until window_size bytes of t_rec have been described.
+ * Each record is:
+ *   u8 flags: bit 0 cycles included, bits 1-3 extra_u32 count,
+ *             bit 4 event is an index into the block's event dictionary;
+ *   varint dictionary index, or varint event (which is then added to the
+ *   dictionary);
+ *   if cycles included, zigzag varint delta from the cpu's previous tsc in
+ *   this block;
+ *   a varint for each extra_u32.
+ *
+ * Decoding reproduces the normal xentrace output byte for byte.
+ */
+#define COMPACT_MAGIC        0x5a435458 /* "XTCZ" */
+#define COMPACT_VERSION      1
+
+#define COMPACT_WIN_RECORDS  0
+#define COMPACT_WIN_RAW      1
+
+#define COMPACT_REC_CYCLES   0x01
+#define COMPACT_REC_EXTRA_SHIFT 1
+#define COMPACT_REC_DICT     0x10
+
+struct compact_file_header {
+    uint32_t magic;
+    uint32_t version;
+};
+
+struct compact_block_header {
+    uint32_t raw_size;
+    uint32_t comp_size;
+};
+
+struct compact_enc;
+
+struct compact_enc *compact_enc_open(int fd);
+/* Encode a window; returns 0, or -1 with errno set on write errors. */
+int compact_enc_window(struct compact_enc *e, unsigned int cpu,
+                       const struct iovec *iov, unsigned int nr,
+                       unsigned long window_size);
+int compact_enc_close(struct compact_enc *e);
+
+/* Is @fd (at offset 0) a compact trace? */
+int compact_detect(int fd);
+/* Decode compact trace @in into normal xentrace format on @out. */
+int compact_decode(int in, int out);
+
+#endif /* __XENTRACE_COMPACT_H */
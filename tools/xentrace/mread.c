@@ -1,4 +1,5 @@
 #include <stdio.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <strings.h>
 #include <sys/types.h>
@@ -27,6 +28,18 @@ mread_handle_t mread_init(int fd)
     fstat(fd, &s);
     h->file_size = s.st_size;
 
+    /*
+     * If the address space allows, map the whole file once: every pcpu
+     * reads from a different part of the file, and with many pcpus the
+     * windows below would otherwise be mapped and unmapped constantly.
+     */
+    if ( h->file_size > 0 && (uintmax_t)h->file_size <= SIZE_MAX )
+    {
+        h->whole = mmap(NULL, h->file_size, PROT_READ, MAP_SHARED, fd, 0);
+        if ( h->whole == MAP_FAILED )
+            h->whole = NULL;
+    }
+
     return h;
 }
 
@@ -66,6 +79,12 @@ ssize_t mread64(mread_handle_t h, void *rec, ssize_t len, off_t offset)
         len = h->file_size - offset;
     }
 
+    if ( h->whole )
+    {
+        bcopy(h->whole + offset, rec, len);
+        return len;
+    }
+
     /* Try to find the offset in our range */
     dprintf(warn, " Trying last, %d\n", last);
     if ( h->map[h->last].buffer
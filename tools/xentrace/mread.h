@@ -1,3 +1,8 @@
+#ifndef __XENALYZE_MREAD_H
+#define __XENALYZE_MREAD_H
+
+#include <sys/types.h>
+
 #define MREAD_MAPS 8
 #define MREAD_BUF_SHIFT 9
 #define PAGE_SHIFT 12
@@ -6,6 +11,7 @@
 typedef struct mread_ctrl {
     int fd;
     off_t file_size;
+    char *whole; /* Whole file, if it could be mapped in one go */
     struct mread_buffer {
         char * buffer;
         off_t start_offset;
@@ -16,3 +22,5 @@ typedef struct mread_ctrl {
 
 mread_handle_t mread_init(int fd);
 ssize_t mread64(mread_handle_t h, void *dst, ssize_t len, off_t offset);
+
+#endif /* __XENALYZE_MREAD_H */
@@ -0,0 +1,457 @@
+/*
+ * tindex.c: Per-cpu window index and readahead for xenalyze
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <xen/trace.h>
+#include "tindex.h"
+
+struct cpu_change_rec {
+    uint32_t header;
+    uint32_t cpu;
+    uint32_t window_size;
+};
+
+#define CPU_CHANGE_HEADER                                               \
+    (TRC_TRACE_CPU_CHANGE                                               \
+     | (((sizeof(struct cpu_change_rec) / sizeof(uint32_t)) - 1)        \
+        << TRACE_EXTRA_SHIFT))
+
+/* On-disk format of a saved index */
+#define TINDEX_MAGIC   "XAIDX\0\0\0"
+#define TINDEX_VERSION 1
+
+struct tindex_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t pad;
+    uint64_t file_size;
+    int64_t mtime;
+    uint64_t nr_windows;
+};
+
+struct tindex_entry {
+    uint64_t offset;
+    uint32_t cpu;
+    uint32_t size;
+};
+
+static int trace_index_init(struct trace_index *idx, int max_cpus)
+{
+    memset(idx, 0, sizeof(*idx));
+
+    idx->cpu = calloc(max_cpus, sizeof(*idx->cpu));
+    if ( !idx->cpu )
+        return -1;
+
+    return 0;
+}
+
+static int trace_index_add(struct trace_index *idx, int max_cpus,
+                           unsigned int cpu, off_t offset, unsigned int size)
+{
+    struct trace_index_cpu *c;
+
+    if ( cpu >= max_cpus )
+    {
+        fprintf(stderr, "%s: cpu %u exceeds MAX_CPUS %d!\n",
+                __func__, cpu, max_cpus);
+        errno = ERANGE;
+        return -1;
+    }
+
+    c = &idx->cpu[cpu];
+    if ( c->nr == c->max )
+    {
+        unsigned int max = c->max ? c->max * 2 : 64;
+        struct trace_window *w = realloc(c->w, max * sizeof(*w));
+
+        if ( !w )
+            return -1;
+
+        c->w = w;
+        c->max = max;
+    }
+
+    c->w[c->nr].offset = offset;
+    c->w[c->nr].size = size;
+    c->nr++;
+
+    if ( cpu >= idx->nr_cpus )
+        idx->nr_cpus = cpu + 1;
+    idx->nr_windows++;
+
+    return 0;
+}
+
+void trace_index_free(struct trace_index *idx)
+{
+    int i;
+
+    if ( idx->cpu )
+        for ( i = 0; i < idx->nr_cpus; i++ )
+            free(idx->cpu[i].w);
+    free(idx->cpu);
+    memset(idx, 0, sizeof(*idx));
+}
+
+/*
+ * Walk the chain of cpu_change records from the start of the file.  Only
+ * the headers are read, so this is cheap compared to the analysis proper.
+ * A truncated final window is indexed as far as it goes.
+ */
+int trace_index_build(struct trace_index *idx, mread_handle_t h, int max_cpus)
+{
+    struct cpu_change_rec rec;
+    off_t offset = 0;
+
+    if ( trace_index_init(idx, max_cpus) )
+        return -1;
+
+    while ( mread64(h, &rec, sizeof(rec), offset) == sizeof(rec) )
+    {
+        if ( rec.header != CPU_CHANGE_HEADER )
+        {
+            fprintf(stderr, "%s: no cpu_change record at offset %llx, "
+                    "stopping\n", __func__, (unsigned long long)offset);
+            break;
+        }
+
+        if ( trace_index_add(idx, max_cpus, rec.cpu, offset,
+                             rec.window_size) )
+            goto err;
+
+        offset += sizeof(rec) + rec.window_size;
+    }
+
+    return 0;
+
+ err:
+    trace_index_free(idx);
+    return -1;
+}
+
+/* Load a saved index, provided it was built from this very file. */
+int trace_index_load(struct trace_index *idx, const char *fn,
+                     const struct stat *trace, int max_cpus)
+{
+    struct tindex_header hdr;
+    struct tindex_entry e;
+    unsigned long long i;
+    FILE *f;
+
+    f = fopen(fn, "r");
+    if ( !f )
+        return -1;
+
+    if ( trace_index_init(idx, max_cpus) )
+        goto err_close;
+
+    if ( fread(&hdr, sizeof(hdr), 1, f) != 1
+         || memcmp(hdr.magic, TINDEX_MAGIC, sizeof(hdr.magic))
+         || hdr.version != TINDEX_VERSION
+         || hdr.file_size != trace->st_size
+         || hdr.mtime != trace->st_mtime )
+    {
+        errno = ESTALE;
+        goto err;
+    }
+
+    for ( i = 0; i < hdr.nr_windows; i++ )
+    {
+        if ( fread(&e, sizeof(e), 1, f) != 1 )
+        {
+            errno = EIO;
+            goto err;
+        }
+
+        if ( trace_index_add(idx, max_cpus, e.cpu, e.offset, e.size) )
+            goto err;
+    }
+
+    fclose(f);
+    return 0;
+
+ err:
+    trace_index_free(idx);
+ err_close:
+    fclose(f);
+    return -1;
+}
+
+int trace_index_save(const struct trace_index *idx, const char *fn,
+                     const struct stat *trace)
+{
+    struct tindex_header hdr = {
+        .version = TINDEX_VERSION,
+        .file_size = trace->st_size,
+        .mtime = trace->st_mtime,
+        .nr_windows = idx->nr_windows,
+    };
+    unsigned int *pos;
+    unsigned long long i;
+    FILE *f;
+
+    memcpy(hdr.magic, TINDEX_MAGIC, sizeof(hdr.magic));
+
+    pos = calloc(idx->nr_cpus ?: 1, sizeof(*pos));
+    if ( !pos )
+        return -1;
+
+    f = fopen(fn, "w");
+    if ( !f )
+        goto err_free;
+
+    if ( fwrite(&hdr, sizeof(hdr), 1, f) != 1 )
+        goto err;
+
+    /* Entries are saved in file order, merging the per-cpu lists back. */
+    for ( i = 0; i < idx->nr_windows; i++ )
+    {
+        struct tindex_entry e = { .offset = ~0ULL };
+        int cpu;
+
+        for ( cpu = 0; cpu < idx->nr_cpus; cpu++ )
+        {
+            const struct trace_index_cpu *c = &idx->cpu[cpu];
+
+            if ( pos[cpu] < c->nr && c->w[pos[cpu]].offset < e.offset )
+            {
+                e.offset = c->w[pos[cpu]].offset;
+                e.cpu = cpu;
+                e.size = c->w[pos[cpu]].size;
+            }
+        }
+
+        pos[e.cpu]++;
+        if ( fwrite(&e, sizeof(e), 1, f) != 1 )
+            goto err;
+    }
+
+    if ( fclose(f) )
+        goto err_unlink;
+    free(pos);
+    return 0;
+
+ err:
+    fclose(f);
+ err_unlink:
+    unlink(fn);
+ err_free:
+    free(pos);
+    return -1;
+}
+
+/*
+ * Readahead.  The analysis merges all pcpus in tsc order, so at any point
+ * it is reading from as many places in the file as there are pcpus; on a
+ * cold multi-GB trace it spends most of its time waiting for page faults
+ * one at a time.  Helper threads fault in the next windows of each pcpu
+ * in parallel, so that the analysis finds them in memory.
+ */
+struct prefetch_worker {
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    int id;
+    int kicked;
+};
+
+static struct {
+    const struct trace_index *idx;
+    const char *base;
+    off_t file_size, ahead;
+    long page_size;
+    int nr_threads;
+    unsigned int *cursor;   /* Per cpu: window being analysed */
+    unsigned int *done;     /* Per cpu: first window not yet prefetched */
+    struct prefetch_worker *workers;
+    int stop;
+} pf;
+
+static volatile unsigned char prefetch_sink;
+
+static void prefetch_window(const struct trace_window *w)
+{
+    off_t start = w->offset & ~(off_t)(pf.page_size - 1);
+    off_t end = w->offset + sizeof(struct cpu_change_rec) + w->size;
+    unsigned char sum = 0;
+
+    if ( end > pf.file_size )
+        end = pf.file_size;
+
+    for ( ; start < end; start += pf.page_size )
+        sum += ((const volatile unsigned char *)pf.base)[start];
+
+    prefetch_sink = sum;
+}
+
+static void *prefetch_thread(void *arg)
+{
+    struct prefetch_worker *wk = arg;
+    int cpu, busy, stop;
+
+    do {
+        busy = 0;
+
+        /* One window per pcpu per round, so all pcpus make progress. */
+        for ( cpu = wk->id; cpu < pf.idx->nr_cpus; cpu += pf.nr_threads )
+        {
+            const struct trace_index_cpu *c = &pf.idx->cpu[cpu];
+            unsigned int cur = __atomic_load_n(&pf.cursor[cpu],
+                                               __ATOMIC_RELAXED);
+
+            if ( pf.done[cpu] < cur )
+                pf.done[cpu] = cur;
+
+            if ( pf.done[cpu] < c->nr
+                 && c->w[pf.done[cpu]].offset <= c->w[cur].offset + pf.ahead )
+            {
+                prefetch_window(&c->w[pf.done[cpu]]);
+                pf.done[cpu]++;
+                busy = 1;
+            }
+        }
+
+        pthread_mutex_lock(&wk->lock);
+        while ( !busy && !wk->kicked && !pf.stop )
+            pthread_cond_wait(&wk->cond, &wk->lock);
+        wk->kicked = 0;
+        stop = pf.stop;
+        pthread_mutex_unlock(&wk->lock);
+    } while ( !stop );
+
+    return NULL;
+}
+
+int trace_prefetch_start(const struct trace_index *idx, mread_handle_t h,
+                         int threads, off_t ahead)
+{
+    int i, rc;
+
+    if ( !h->whole || threads <= 0 || !idx->nr_cpus )
+    {
+        errno = EINVAL;
+        return -1;
+    }
+
+    pf.idx = idx;
+    pf.base = h->whole;
+    pf.file_size = h->file_size;
+    pf.ahead = ahead;
+    pf.page_size = sysconf(_SC_PAGESIZE);
+    pf.nr_threads = threads;
+    pf.stop = 0;
+
+    pf.cursor = calloc(idx->nr_cpus, sizeof(*pf.cursor));
+    pf.done = calloc(idx->nr_cpus, sizeof(*pf.done));
+    pf.workers = calloc(threads, sizeof(*pf.workers));
+    if ( !pf.cursor || !pf.done || !pf.workers )
+        goto err;
+
+    for ( i = 0; i < threads; i++ )
+    {
+        struct prefetch_worker *wk = &pf.workers[i];
+
+        wk->id = i;
+        pthread_mutex_init(&wk->lock, NULL);
+        pthread_cond_init(&wk->cond, NULL);
+
+        rc = pthread_create(&wk->thread, NULL, prefetch_thread, wk);
+        if ( rc )
+        {
+            pf.nr_threads = i;
+            trace_prefetch_stop();
+            errno = rc;
+            return -1;
+        }
+    }
+
+    return 0;
+
+ err:
+    free(pf.cursor);
+    free(pf.done);
+    free(pf.workers);
+    pf.workers = NULL;
+    return -1;
+}
+
+void trace_prefetch_advance(int cpu, off_t offset)
+{
+    const struct trace_index_cpu *c;
+    struct prefetch_worker *wk;
+    unsigned int pos;
+
+    if ( !pf.workers || cpu >= pf.idx->nr_cpus )
+        return;
+
+    c = &pf.idx->cpu[cpu];
+    pos = pf.cursor[cpu];
+    while ( pos + 1 < c->nr && c->w[pos + 1].offset <= offset )
+        pos++;
+
+    if ( pos == pf.cursor[cpu] )
+        return;
+
+    __atomic_store_n(&pf.cursor[cpu], pos, __ATOMIC_RELAXED);
+
+    wk = &pf.workers[cpu % pf.nr_threads];
+    pthread_mutex_lock(&wk->lock);
+    wk->kicked = 1;
+    pthread_cond_signal(&wk->cond);
+    pthread_mutex_unlock(&wk->lock);
+}
+
+void trace_prefetch_stop(void)
+{
+    int i;
+
+    if ( !pf.workers )
+        return;
+
+    for ( i = 0; i < pf.nr_threads; i++ )
+    {
+        struct prefetch_worker *wk = &pf.workers[i];
+
+        pthread_mutex_lock(&wk->lock);
+        pf.stop = 1;
+        pthread_cond_signal(&wk->cond);
+        pthread_mutex_unlock(&wk->lock);
+    }
+
+    for ( i = 0; i < pf.nr_threads; i++ )
+        pthread_join(pf.workers[i].thread, NULL);
+
+    free(pf.cursor);
+    free(pf.done);
+    free(pf.workers);
+    pf.workers = NULL;
+}
+
+/*
+ * Local variables:
+ * mode: C
+ * c-set-style: "BSD"
+ * c-basic-offset: 4
+ * tab-width: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
@@ -0,0 +1,47 @@
+#ifndef __XENALYZE_TINDEX_H
+#define __XENALYZE_TINDEX_H
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include "mread.h"
+
+/*
+ * Per-cpu index of the buffer windows in a xentrace file.  Each window
+ * starts with a cpu_change record and holds window size bytes of trace
+ * records for that cpu.
+ */
+struct trace_window {
+    off_t offset;           /* Of the cpu_change record */
+    unsigned int size;      /* Trace data following the cpu_change record */
+};
+
+struct trace_index_cpu {
+    struct trace_window *w;
+    unsigned int nr, max;
+};
+
+struct trace_index {
+    struct trace_index_cpu *cpu;
+    int nr_cpus;
+    unsigned long long nr_windows;
+};
+
+int trace_index_build(struct trace_index *idx, mread_handle_t h, int max_cpus);
+int trace_index_load(struct trace_index *idx, const char *fn,
+                     const struct stat *trace, int max_cpus);
+int trace_index_save(const struct trace_index *idx, const char *fn,
+                     const struct stat *trace);
+void trace_index_free(struct trace_index *idx);
+
+/*
+ * Fault in the windows the analysis is about to reach, from @threads
+ * helper threads, staying at most @ahead bytes of file ahead of each cpu.
+ * Requires @h to have the whole file mapped.
+ */
+int trace_prefetch_start(const struct trace_index *idx, mread_handle_t h,
+                         int threads, off_t ahead);
+/* Tell the prefetchers the analysis of @cpu has reached @offset */
+void trace_prefetch_advance(int cpu, off_t offset);
+void trace_prefetch_stop(void);
+
+#endif /* __XENALYZE_TINDEX_H */
@@ -32,6 +32,8 @@
 #include <xen/trace.h>
 #include "analyze.h"
 #include "mread.h"
+#include "tindex.h"
+#include "compact.h"
 #include "pv.h"
 #include <errno.h>
 #include <strings.h>
@@ -48,6 +50,7 @@ struct mread_ctrl;
 #define DEFAULT_SAMPLE_SIZE 1024
 #define DEFAULT_SAMPLE_MAX  1024*1024*32
 #define DEFAULT_INTERVAL_LENGTH 1000
+#define DEFAULT_PREFETCH_AHEAD (256ULL<<20)
 
 struct array_struct {
     unsigned long long *values;
@@ -72,6 +75,9 @@ struct {
     char * trace_file;
     int output_defined;
     off_t file_size;
+    char * index_file;
+    int prefetch_threads;
+    struct trace_index index;
     struct {
         off_t update_offset;
         int pipe[2];
@@ -85,6 +91,8 @@ struct {
     .trace_file = NULL,
     .output_defined = 0,
     .file_size = 0,
+    .index_file = NULL,
+    .prefetch_threads = 0,
     .progress = { .update_offset = 0 },
 };
 
@@ -9334,6 +9342,9 @@ void process_cpu_change(struct pcpu_info *p) {
             volume_clear(&p->volume.last_buffer);
         }
 
+        if ( G.prefetch_threads )
+            trace_prefetch_advance(p->pid, p->file_offset);
+
         p->file_offset += ri->size;
         p->next_cpu_change_offset = p->file_offset + r->window_size;
 
@@ -10045,6 +10056,8 @@ enum {
     /* Misc */
     OPT_PROGRESS,
     OPT_TOLERANCE,
+    OPT_INDEX_FILE,
+    OPT_THREADS,
     OPT_TSC_LOOP_FATAL,
     /* Specific letters */
     OPT_DUMP_ALL='a',
@@ -10526,6 +10539,20 @@ error_t cmd_parser(int key, char *arg, struct argp_state *state)
         opt.tsc_loop_fatal = 1;
         break;
 
+    case OPT_INDEX_FILE:
+        G.index_file = arg;
+        break;
+
+    case OPT_THREADS:
+    {
+        char * inval;
+
+        G.prefetch_threads = (int)strtol(arg, &inval, 0);
+        if ( inval == arg || G.prefetch_threads < 0 )
+            argp_usage(state);
+    }
+    break;
+
     case ARGP_KEY_ARG:
     {
         /* FIXME - strcpy */
@@ -10820,6 +10847,16 @@ const struct argp_option cmd_opts[] =  {
       .arg = "errlevel",
       .doc = "Sets tolerance for errors found in the file.  Default is 3; max is 6.", },
 
+    { .name = "index-file",
+      .key = OPT_INDEX_FILE,
+      .arg = "filename",
+      .doc = "Save the index of each pcpu's buffer windows, which --threads needs, in filename, or reuse it from there if it still matches the trace.  Without --threads the index is only built and saved.  It holds no timestamps, and doesn't let the analysis skip any part of the trace.", },
+
+    { .name = "threads",
+      .key = OPT_THREADS,
+      .arg = "N",
+      .doc = "Use N threads to read ahead each pcpu's part of the trace file in parallel with the analysis.  Output is unchanged.", },
+
 
     { 0 },
 };
@@ -10834,6 +10871,84 @@ const struct argp parser_def = {
 const char *argp_program_bug_address = "George Dunlap <george.dunlap@eu.citrix.com>";
 
 
+/*
+ * Analysis needs random access to the records, so expand a compact trace
+ * (xentrace -z) into an unlinked temporary file, in $TMPDIR or /tmp, first.
+ * This needs as much space as the trace uncompressed, and has to complete
+ * before the analysis can start.
+ */
+int expand_compact_trace(int fd) {
+    const char *dir = getenv("TMPDIR");
+    char path[PATH_MAX];
+    int tmp;
+
+    if ( snprintf(path, sizeof(path), "%s/xenalyze.XXXXXX",
+                  dir && *dir ? dir : "/tmp") >= sizeof(path) ) {
+        fprintf(stderr, "TMPDIR too long\n");
+        error(ERR_SYSTEM, NULL);
+    }
+
+    tmp = mkstemp(path);
+    if ( tmp < 0 ) {
+        perror(path);
+        error(ERR_SYSTEM, NULL);
+    }
+    unlink(path);
+
+    fprintf(stderr, "Expanding compact trace %s into %s\n",
+            G.trace_file, path);
+
+    if ( compact_decode(fd, tmp) ) {
+        perror("Expanding compact trace");
+        error(ERR_SYSTEM, NULL);
+    }
+
+    close(fd);
+
+    return tmp;
+}
+
+/*
+ * Index the file's per-cpu buffer windows (or load a saved index) and start
+ * the readahead threads.  Messages go to stderr, so that dump output is the
+ * same as without.
+ */
+void init_index(void) {
+    struct stat s;
+
+    /* Of the file given, which may be a compact trace since expanded. */
+    if ( stat(G.trace_file, &s) ) {
+        perror("stat");
+        error(ERR_SYSTEM, NULL);
+    }
+
+    if ( G.index_file
+         && !trace_index_load(&G.index, G.index_file, &s, MAX_CPUS) ) {
+        fprintf(stderr, "Loaded index of %llu windows on %d pcpus from %s\n",
+                G.index.nr_windows, G.index.nr_cpus, G.index_file);
+    } else {
+        if ( trace_index_build(&G.index, G.mh, MAX_CPUS) ) {
+            perror("Building trace index");
+            error(ERR_SYSTEM, NULL);
+        }
+        fprintf(stderr, "Indexed %llu windows on %d pcpus\n",
+                G.index.nr_windows, G.index.nr_cpus);
+
+        if ( G.index_file
+             && trace_index_save(&G.index, G.index_file, &s) )
+            fprintf(stderr, "Could not save index to %s: %s\n",
+                    G.index_file, strerror(errno));
+    }
+
+    if ( G.prefetch_threads
+         && trace_prefetch_start(&G.index, G.mh, G.prefetch_threads,
+                                 DEFAULT_PREFETCH_AHEAD) ) {
+        fprintf(stderr, "Readahead threads disabled: %s\n",
+                strerror(errno));
+        G.prefetch_threads = 0;
+    }
+}
+
 int main(int argc, char *argv[]) {
     /* Start with warn at stderr. */
     warn = stderr;
@@ -10848,6 +10963,10 @@ int main(int argc, char *argv[]) {
         error(ERR_SYSTEM, NULL);
     } else {
         struct stat s;
+
+        if ( compact_detect(G.fd) )
+            G.fd = expand_compact_trace(G.fd);
+
         fstat(G.fd, &s);
         G.file_size = s.st_size;
     }
@@ -10858,6 +10977,9 @@ int main(int argc, char *argv[]) {
     if (G.symbol_file != NULL)
         parse_symbol_file(G.symbol_file);
 
+    if (G.index_file || G.prefetch_threads)
+        init_index();
+
     if(opt.dump_all)
         warn = stdout;
 
@@ -10868,6 +10990,9 @@ int main(int argc, char *argv[]) {
 
     process_records();
 
+    if (G.prefetch_threads)
+        trace_prefetch_stop();
+
     if(opt.interval_mode)
         interval_tail();
 
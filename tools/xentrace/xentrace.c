@@ -25,7 +25,9 @@
 #include <assert.h>
 #include <ctype.h>
 #include <poll.h>
+#include <pthread.h>
 #include <sys/statvfs.h>
+#include <sys/uio.h>
 
 #include <xen/xen.h>
 #include <xen/trace.h>
@@ -34,6 +36,8 @@
 #include <xenevtchn.h>
 #include <xenctrl.h>
 
+#include "compact.h"
+
 #define PERROR(_m, _a...)                                       \
 do {                                                            \
     int __saved_errno = errno;                                  \
@@ -60,9 +64,15 @@ typedef struct settings_st {
     unsigned long disk_rsvd;
     unsigned long timeout;
     unsigned long memory_buffer;
+    unsigned long lost_report; /* seconds between lost record reports */
     uint8_t discard:1,
         disable_tracing:1,
-        start_disabled:1;
+        start_disabled:1,
+        threads:1,
+        per_cpu_files:1,
+        compact:1,
+        flight_recorder:1,
+        snapshot:1;
 } settings_t;
 
 struct t_struct {
@@ -71,6 +81,18 @@ struct t_struct {
     unsigned char **data;   /* Pointers to trace buffer data areas */
 };
 
+/* Consumer state for a single per-CPU trace buffer. */
+struct cpu_reader {
+    unsigned int cpu;
+    struct t_buf *meta;     /* trace buffer metadata */
+    unsigned char *data;    /* trace buffer data area */
+    int fd;                 /* output file (-P), else outfd */
+    struct compact_enc *enc; /* encoder for fd (-z) */
+    pthread_t thread;       /* consumer thread (-p) */
+    unsigned long lost;     /* records Xen reported lost on this CPU */
+    unsigned long lost_reported;
+};
+
 settings_t opts;
 
 int interrupted = 0; /* gets set if we get a SIGHUP */
@@ -79,6 +101,17 @@ static xc_interface *xc_handle;
 static xenevtchn_handle *xce_handle = NULL;
 static int virq_port = -1;
 static int outfd = 1;
+static unsigned long data_size; /* size of each per-CPU data area */
+
+/* Serialises windows written to the merged output stream (or memory buffer). */
+static pthread_mutex_t out_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct compact_enc *out_enc; /* merged output encoder (-z) */
+
+/* Used by the main thread to kick the per-CPU consumer threads. */
+static pthread_mutex_t wake_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t wake_cond = PTHREAD_COND_INITIALIZER;
+static unsigned long wake_gen;
+static int stopping;
 
 static void close_handler(int signal)
 {
@@ -332,97 +365,213 @@ fail:
     return;
 }
 
-/**
- * write_buffer - write a section of the trace buffer
- * @cpu      - source buffer CPU ID
- * @start
- * @size     - size of write (may be less than total window size)
- * @total_size - total size of the window (0 on 2nd write of wrapped windows)
- * @out      - output stream
- *
- * Outputs the trace buffer to a filestream, prepending the CPU and size
- * of the buffer write.
- */
-static void write_buffer(unsigned int cpu, unsigned char *start, int size,
-                         int total_size)
+/* Exit if writing @size bytes to @fd would eat into the reserved space. */
+static void check_disk_space(int fd, unsigned long size)
 {
     struct statvfs stat;
-    size_t written = 0;
-    
-    if ( opts.memory_buffer == 0 && opts.disk_rsvd != 0 )
-    {
-        unsigned long long freespace;
+    unsigned long long freespace;
 
-        /* Check that filesystem has enough space. */
-        if ( fstatvfs (outfd, &stat) )
-        {
-            fprintf(stderr, "Statfs failed!\n");
-            goto fail;
-        }
+    if ( opts.memory_buffer != 0 || opts.disk_rsvd == 0 )
+        return;
+
+    /* Check that filesystem has enough space. */
+    if ( fstatvfs(fd, &stat) )
+    {
+        PERROR("Statfs failed");
+        exit(EXIT_FAILURE);
+    }
 
-        freespace = stat.f_frsize * (unsigned long long)stat.f_bfree;
+    freespace = stat.f_frsize * (unsigned long long)stat.f_bfree;
+    freespace -= size;
+    freespace >>= 20; /* Convert to MB */
 
-        if ( total_size )
-            freespace -= total_size;
-        else
-            freespace -= size;
+    if ( freespace <= opts.disk_rsvd )
+    {
+        fprintf(stderr, "Disk space limit reached (free space: %lluMB, limit: %luMB).\n", freespace, opts.disk_rsvd);
+        exit (EXIT_FAILURE);
+    }
+}
 
-        freespace >>= 20; /* Convert to MB */
+/* writev() the whole of @iov, coping with short writes. */
+static void writev_all(int fd, struct iovec *iov, int cnt)
+{
+    while ( cnt )
+    {
+        ssize_t written = writev(fd, iov, cnt);
 
-        if ( freespace <= opts.disk_rsvd )
+        if ( written < 0 && errno == EINTR )
+            continue;
+        if ( written <= 0 )
         {
-            fprintf(stderr, "Disk space limit reached (free space: %lluMB, limit: %luMB).\n", freespace, opts.disk_rsvd);
-            exit (EXIT_FAILURE);
+            PERROR("Failed to write trace data");
+            exit(EXIT_FAILURE);
         }
-    }
 
-    /* Write a CPU_BUF record on each buffer "window" written.  Wrapped
-     * windows may involve two writes, so only write the record on the
-     * first write. */
-    if ( total_size != 0 )
-    {
-        if ( opts.memory_buffer )
+        while ( cnt && written >= iov->iov_len )
         {
-            membuf_reserve_window(cpu, total_size);
+            written -= iov->iov_len;
+            iov++;
+            cnt--;
         }
-        else
+        if ( cnt )
         {
-            struct cpu_change_record rec;
+            iov->iov_base = (char *)iov->iov_base + written;
+            iov->iov_len -= written;
+        }
+    }
+}
 
-            rec.header = CPU_CHANGE_HEADER;
-            rec.data.cpu = cpu;
-            rec.data.window_size = total_size;
+/**
+ * write_window - write a window of a trace buffer
+ * @r        - reader of the source buffer
+ * @iov      - the window, straight out of the mapped trace buffer (two
+ *             chunks if it wraps)
+ * @nr       - number of chunks in @iov
+ * @window_size - total size of the window
+ *
+ * Outputs the window prefixed by a CPU_BUF record, using a single writev()
+ * so that neither the record nor the trace data needs to be copied.  In
+ * compact mode the window is handed to the encoder instead.
+ */
+static void write_window(struct cpu_reader *r, const struct iovec *iov,
+                         unsigned int nr, unsigned long window_size)
+{
+    struct cpu_change_record rec;
+    struct iovec vec[3];
+    unsigned int i;
 
-            written = write(outfd, &rec, sizeof(rec));
-            if ( written != sizeof(rec) )
-            {
-                fprintf(stderr, "Cannot write cpu change (write returned %zd)\n",
-                        written);
-                goto fail;
-            }
+    check_disk_space(r->fd, window_size);
+
+    if ( r->enc )
+    {
+        if ( compact_enc_window(r->enc, r->cpu, iov, nr, window_size) )
+        {
+            PERROR("Failed to write trace data");
+            exit(EXIT_FAILURE);
         }
+        return;
     }
 
     if ( opts.memory_buffer )
     {
-        membuf_write(start, size);
+        membuf_reserve_window(r->cpu, window_size);
+        for ( i = 0; i < nr; i++ )
+            membuf_write(iov[i].iov_base, iov[i].iov_len);
+        return;
     }
+
+    rec.header = CPU_CHANGE_HEADER;
+    rec.data.cpu = r->cpu;
+    rec.data.window_size = window_size;
+
+    vec[0].iov_base = &rec;
+    vec[0].iov_len = sizeof(rec);
+    for ( i = 0; i < nr; i++ )
+        vec[i + 1] = iov[i];
+
+    writev_all(r->fd, vec, nr + 1);
+}
+
+/*
+ * Account for TRC_LOST_RECORDS records in a chunk of trace data.  Records
+ * never straddle the end of the data area (Xen pads with a wrap record), so
+ * each chunk of a window can be walked on its own.
+ */
+static void count_lost_records(struct cpu_reader *r, const unsigned char *p,
+                               size_t len)
+{
+    unsigned long lost = 0;
+
+    while ( len >= sizeof(uint32_t) )
+    {
+        const struct t_rec *rec = (const struct t_rec *)p;
+        size_t size = sizeof(uint32_t) + rec->extra_u32 * sizeof(uint32_t);
+
+        if ( rec->cycles_included )
+            size += sizeof(uint64_t);
+        if ( size > len )
+            break;
+
+        if ( rec->event == TRC_LOST_RECORDS && rec->extra_u32 )
+            lost += rec->cycles_included ? rec->u.cycles.extra_u32[0]
+                                         : rec->u.nocycles.extra_u32[0];
+
+        p += size;
+        len -= size;
+    }
+
+    if ( lost )
+        __atomic_add_fetch(&r->lost, lost, __ATOMIC_RELAXED);
+}
+
+/**
+ * consume_buffer - write out everything currently in a trace buffer
+ * @r:              the buffer's reader
+ */
+static void consume_buffer(struct cpu_reader *r)
+{
+    struct t_buf *meta = r->meta;
+    unsigned long start_offset, end_offset, window_size, cons, prod;
+    struct iovec iov[2];
+    unsigned int i, nr = 1;
+
+    /* Read window information only once. */
+    cons = meta->cons;
+    prod = meta->prod;
+    xen_rmb(); /* read prod, then read item. */
+
+    if ( cons == prod )
+        return;
+
+    assert(cons < 2*data_size);
+    assert(prod < 2*data_size);
+
+    // NB: if (prod<cons), then (prod-cons)%data_size will not yield
+    // the correct answer because data_size is not a power of 2.
+    if ( prod < cons )
+        window_size = (prod + 2*data_size) - cons;
+    else
+        window_size = prod - cons;
+    assert(window_size > 0);
+    assert(window_size <= data_size);
+
+    start_offset = cons % data_size;
+    end_offset = prod % data_size;
+
+    iov[0].iov_base = r->data + start_offset;
+    if ( end_offset > start_offset )
+        /* If window does not wrap, write in one big chunk */
+        iov[0].iov_len = window_size;
     else
     {
-        written = write(outfd, start, size);
-        if ( written != size )
+        /* If wrapped, write in two chunks:
+         * - first, start to the end of the buffer
+         * - second, start of buffer to end of window
+         */
+        iov[0].iov_len = data_size - start_offset;
+        if ( end_offset )
         {
-            fprintf(stderr, "Write failed! (size %d, returned %zd)\n",
-                    size, written);
-            goto fail;
+            iov[1].iov_base = r->data;
+            iov[1].iov_len = end_offset;
+            nr = 2;
         }
     }
 
-    return;
+    if ( opts.lost_report )
+        for ( i = 0; i < nr; i++ )
+            count_lost_records(r, iov[i].iov_base, iov[i].iov_len);
 
-fail:
-    PERROR("Failed to write trace data");
-    exit(EXIT_FAILURE);
+    if ( opts.per_cpu_files )
+        write_window(r, iov, nr, window_size);
+    else
+    {
+        pthread_mutex_lock(&out_lock);
+        write_window(r, iov, nr, window_size);
+        pthread_mutex_unlock(&out_lock);
+    }
+
+    xen_mb(); /* read buffer, then update cons. */
+    meta->cons = prod;
 }
 
 static void disable_tbufs(void)
@@ -664,6 +813,236 @@ static void wait_for_event_or_timeout(unsigned long milliseconds)
 }
 
 
+/**
+ * report_lost - print the rate at which Xen has been dropping records
+ * @readers:     per-CPU readers
+ * @num:         number of readers
+ * @elapsed:     seconds since the previous report
+ */
+static void report_lost(struct cpu_reader *readers, unsigned int num,
+                        double elapsed)
+{
+    unsigned long lost, delta, total = 0, interval = 0, worst = 0;
+    unsigned int i, worst_cpu = 0;
+
+    for ( i = 0; i < num; i++ )
+    {
+        if ( !readers[i].meta )
+            continue;
+
+        lost = __atomic_load_n(&readers[i].lost, __ATOMIC_RELAXED);
+        delta = lost - readers[i].lost_reported;
+        readers[i].lost_reported = lost;
+
+        total += lost;
+        interval += delta;
+        if ( delta > worst )
+        {
+            worst = delta;
+            worst_cpu = i;
+        }
+    }
+
+    if ( interval )
+        fprintf(stderr,
+                "lost records: %lu in %.1fs (%.0f/s, worst cpu%u: %lu), %lu total\n",
+                interval, elapsed, interval / elapsed, worst_cpu, worst, total);
+    else
+        fprintf(stderr, "lost records: none in %.1fs, %lu total\n",
+                elapsed, total);
+}
+
+static double now_secs(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/**
+ * reader_thread - per-CPU consumer thread, used with -p
+ *
+ * Drains its buffer each time the main thread passes on a VIRQ_TBUF or poll
+ * timeout, and once more after tracing has been stopped.
+ */
+static void *reader_thread(void *arg)
+{
+    struct cpu_reader *r = arg;
+    unsigned long gen = 0;
+    int stop;
+
+    do {
+        consume_buffer(r);
+
+        pthread_mutex_lock(&wake_lock);
+        while ( wake_gen == gen && !stopping )
+            pthread_cond_wait(&wake_cond, &wake_lock);
+        gen = wake_gen;
+        stop = stopping;
+        pthread_mutex_unlock(&wake_lock);
+    } while ( !stop );
+
+    consume_buffer(r);
+
+    return NULL;
+}
+
+static void wake_readers(int stop)
+{
+    pthread_mutex_lock(&wake_lock);
+    wake_gen++;
+    stopping = stop;
+    pthread_cond_broadcast(&wake_cond);
+    pthread_mutex_unlock(&wake_lock);
+}
+
+/* *BSD has no O_LARGEFILE */
+#ifndef O_LARGEFILE
+#define O_LARGEFILE	0
+#endif
+
+static int open_outfile(const char *name)
+{
+    int fd = open(name, O_WRONLY | O_CREAT | O_TRUNC | O_LARGEFILE, 0644);
+
+    if ( fd < 0 )
+    {
+        PERROR("Could not open output file %s", name);
+        exit(EXIT_FAILURE);
+    }
+
+    return fd;
+}
+
+static struct compact_enc *open_compact(int fd)
+{
+    struct compact_enc *enc = compact_enc_open(fd);
+
+    if ( !enc )
+    {
+        PERROR("Failed to start compact output");
+        exit(EXIT_FAILURE);
+    }
+
+    return enc;
+}
+
+/* Flush out the last block of compact output. */
+static void close_compact(struct compact_enc *enc)
+{
+    if ( enc && compact_enc_close(enc) )
+    {
+        PERROR("Failed to write trace data");
+        exit(EXIT_FAILURE);
+    }
+}
+
+/*
+ * In flight recorder mode Xen overwrites the oldest records, so it owns the
+ * consumer index until the buffers are frozen.
+ */
+static void setup_flight_recorder(void)
+{
+    uint32_t mode;
+    unsigned long mfn, size;
+
+    if ( xc_tbuf_get_mode(xc_handle, &mode) )
+    {
+        PERROR("Failed to get trace buffer mode");
+        exit(EXIT_FAILURE);
+    }
+
+    if ( opts.flight_recorder )
+    {
+        if ( !opts.tbuf_size )
+            opts.tbuf_size = DEFAULT_TBUF_SIZE;
+
+        if ( xc_tbuf_set_mode(xc_handle,
+                              XEN_SYSCTL_TBUF_MODE_flight_recorder |
+                              XEN_SYSCTL_TBUF_MODE_freeze_on_crash |
+                              XEN_SYSCTL_TBUF_MODE_freeze_on_watchdog |
+                              XEN_SYSCTL_TBUF_MODE_freeze_on_nmi) ||
+             xc_tbuf_enable(xc_handle, opts.tbuf_size, &mfn, &size) )
+        {
+            PERROR("Failed to start flight recorder");
+            exit(EXIT_FAILURE);
+        }
+        exit(EXIT_SUCCESS);
+    }
+
+    if ( opts.snapshot )
+    {
+        if ( !(mode & XEN_SYSCTL_TBUF_MODE_flight_recorder) )
+        {
+            fprintf(stderr, "Flight recorder is not running\n");
+            exit(EXIT_FAILURE);
+        }
+        if ( !(mode & XEN_SYSCTL_TBUF_MODE_frozen) )
+            fprintf(stderr, "Freezing flight recorder\n");
+        else
+            fprintf(stderr, "Flight recorder was frozen by Xen\n");
+        if ( xc_tbuf_freeze(xc_handle) )
+        {
+            PERROR("Failed to freeze flight recorder");
+            exit(EXIT_FAILURE);
+        }
+
+        /* Read through the buffers once, and leave tracing on. */
+        opts.disable_tracing = 0;
+        interrupted = 1;
+        return;
+    }
+
+    if ( (mode & XEN_SYSCTL_TBUF_MODE_flight_recorder) )
+    {
+        fprintf(stderr, "Stopping flight recorder, streaming instead\n");
+        if ( xc_tbuf_set_mode(xc_handle, 0) )
+        {
+            PERROR("Failed to stop flight recorder");
+            exit(EXIT_FAILURE);
+        }
+    }
+}
+
+/**
+ * start_readers - start one consumer thread per trace buffer
+ *
+ * Termination signals stay with the main thread, which is the only one
+ * sleeping in poll().
+ */
+static void start_readers(struct cpu_reader *readers, unsigned int num)
+{
+    sigset_t set, old;
+    unsigned int i;
+    int rc;
+
+    sigemptyset(&set);
+    sigaddset(&set, SIGHUP);
+    sigaddset(&set, SIGTERM);
+    sigaddset(&set, SIGINT);
+    sigaddset(&set, SIGALRM);
+    pthread_sigmask(SIG_BLOCK, &set, &old);
+
+    for ( i = 0; i < num; i++ )
+    {
+        if ( !readers[i].meta )
+            continue;
+
+        rc = pthread_create(&readers[i].thread, NULL, reader_thread,
+                            &readers[i]);
+        if ( rc )
+        {
+            errno = rc;
+            PERROR("Failed to create reader thread for cpu%u", i);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+}
+
 /**
  * monitor_tbufs - monitor the contents of tbufs and output to a file
  * @logfile:       the FILE * representing the file to log to
@@ -676,12 +1055,12 @@ static int monitor_tbufs(void)
     struct t_buf **meta;         /* pointers to the trace buffer metadata    */
     unsigned char **data;        /* pointers to the trace buffer data areas
                                   * where they are mapped into user space.   */
+    struct cpu_reader *readers;  /* per-CPU consumer state                   */
     unsigned long tbufs_mfn;     /* mfn of the tbufs                         */
     unsigned int  num;           /* number of trace buffers / logical CPUS   */
     unsigned long tinfo_size;    /* size of t_info metadata map */
     unsigned long size;          /* size of a single trace buffer            */
-
-    unsigned long data_size;
+    double last_report = 0;
 
     int last_read = 1;
 
@@ -706,68 +1085,70 @@ static int monitor_tbufs(void)
     meta = tbufs->meta;
     data = tbufs->data;
 
+    readers = calloc(num, sizeof(*readers));
+    if ( readers == NULL )
+    {
+        PERROR("Failed to allocate memory for buffer readers");
+        exit(EXIT_FAILURE);
+    }
+
+    for ( i = 0; i < num; i++ )
+    {
+        readers[i].cpu = i;
+        readers[i].meta = meta[i];
+        readers[i].data = data[i];
+        readers[i].fd = outfd;
+
+        if ( meta[i] && opts.per_cpu_files )
+        {
+            char name[strlen(opts.outfile) + 12];
+
+            snprintf(name, sizeof(name), "%s.%u", opts.outfile, i);
+            readers[i].fd = open_outfile(name);
+            if ( opts.compact )
+                readers[i].enc = open_compact(readers[i].fd);
+        }
+        else if ( opts.compact && !opts.per_cpu_files )
+        {
+            if ( !out_enc )
+                out_enc = open_compact(outfd);
+            readers[i].enc = out_enc;
+        }
+    }
+
     if ( opts.discard )
         for ( i = 0; i < num; i++ )
             if ( meta[i] )
                 meta[i]->cons = meta[i]->prod;
 
+    if ( opts.lost_report )
+        last_report = now_secs();
+
+    if ( opts.threads )
+        start_readers(readers, num);
+
     /* now, scan buffers for events */
     while ( 1 )
     {
-        for ( i = 0; i < num; i++ )
+        if ( opts.threads )
         {
-            unsigned long start_offset, end_offset, window_size, cons, prod;
-
-            if ( !meta[i] )
-                continue;
-
-            /* Read window information only once. */
-            cons = meta[i]->cons;
-            prod = meta[i]->prod;
-            xen_rmb(); /* read prod, then read item. */
-
-            if ( cons == prod )
-                continue;
-           
-            assert(cons < 2*data_size);
-            assert(prod < 2*data_size);
-
-            // NB: if (prod<cons), then (prod-cons)%data_size will not yield
-            // the correct answer because data_size is not a power of 2.
-            if ( prod < cons )
-                window_size = (prod + 2*data_size) - cons;
-            else
-                window_size = prod - cons;
-            assert(window_size > 0);
-            assert(window_size <= data_size);
+            if ( !interrupted )
+                wake_readers(0);
+        }
+        else
+            for ( i = 0; i < num; i++ )
+                if ( readers[i].meta )
+                    consume_buffer(&readers[i]);
 
-            start_offset = cons % data_size;
-            end_offset = prod % data_size;
+        if ( opts.lost_report )
+        {
+            double now = now_secs();
 
-            if ( end_offset > start_offset )
-            {
-                /* If window does not wrap, write in one big chunk */
-                write_buffer(i, data[i]+start_offset,
-                             window_size,
-                             window_size);
-            }
-            else
+            if ( now - last_report >= opts.lost_report )
             {
-                /* If wrapped, write in two chunks:
-                 * - first, start to the end of the buffer
-                 * - second, start of buffer to end of window
-                 */
-                write_buffer(i, data[i] + start_offset,
-                             data_size - start_offset,
-                             window_size);
-                write_buffer(i, data[i],
-                             end_offset,
-                             0);
+                report_lost(readers, num, now - last_report);
+                last_report = now;
             }
-
-            xen_mb(); /* read buffer, then update cons. */
-            meta[i]->cons = prod;
-
         }
 
         if ( interrupted )
@@ -787,14 +1168,36 @@ static int monitor_tbufs(void)
         wait_for_event_or_timeout(opts.poll_sleep);
     }
 
+    if ( opts.threads )
+    {
+        /* Each thread drains its buffer one last time before exiting. */
+        wake_readers(1);
+        for ( i = 0; i < num; i++ )
+            if ( readers[i].meta )
+                pthread_join(readers[i].thread, NULL);
+    }
+
+    if ( opts.lost_report )
+        report_lost(readers, num, now_secs() - last_report);
+
     if ( opts.memory_buffer )
         membuf_dump();
 
     /* cleanup */
+    if ( opts.per_cpu_files )
+        for ( i = 0; i < num; i++ )
+            if ( readers[i].meta )
+            {
+                close_compact(readers[i].enc);
+                close(readers[i].fd);
+            }
+    close_compact(out_enc);
+    free(readers);
     free(meta);
     free(data);
     /* don't need to munmap - cleanup is automatic */
-    close(outfd);
+    if ( outfd >= 0 )
+        close(outfd);
 
     return 0;
 }
@@ -845,6 +1248,20 @@ static void usage(void)
 "  -r  --reserve-disk-space=n Before writing trace records to disk, check to see\n" \
 "                          that after the write there will be at least n space\n" \
 "                          left on the disk.\n" \
+"  -p  --per-cpu-threads   Drain each CPU's trace buffer from its own thread.\n" \
+"  -P  --per-cpu-files     Write the records of CPU n to <output file>.n\n" \
+"                          rather than to a single merged file.  Implies -p.\n" \
+"  -L  --lost-report=s     Every s seconds, report how many records Xen had to\n" \
+"                          drop because the trace buffers were full.\n" \
+"  -z  --compact           Write a compact, compressed trace (delta-encoded\n" \
+"                          timestamps, LZ4 blocks).  xenalyze and\n" \
+"                          xentrace_format read it transparently.\n" \
+"  -F  --flight-recorder   Keep tracing into Xen's buffers, overwriting the\n" \
+"                          oldest records, and exit.  Xen freezes the\n" \
+"                          buffers on a domain crash, watchdog or NMI.\n" \
+"                          No output file is needed.\n" \
+"  -f  --snapshot          Freeze the flight recorder, write its contents\n" \
+"                          to the output file, and resume recording.\n" \
 "\n" \
 "This tool is used to capture trace buffer data from Xen. The\n" \
 "data is output in a binary format, in the following order:\n" \
@@ -1093,12 +1510,18 @@ static void parse_args(int argc, char **argv)
         { "discard-buffers", no_argument,      0, 'D' },
         { "dont-disable-tracing", no_argument, 0, 'x' },
         { "start-disabled", no_argument,       0, 'X' },
+        { "per-cpu-threads", no_argument,      0, 'p' },
+        { "per-cpu-files",  no_argument,       0, 'P' },
+        { "lost-report",    required_argument, 0, 'L' },
+        { "compact",        no_argument,       0, 'z' },
+        { "flight-recorder", no_argument,      0, 'F' },
+        { "snapshot",       no_argument,       0, 'f' },
         { "help",           no_argument,       0, '?' },
         { "version",        no_argument,       0, 'V' },
         { 0, 0, 0, 0 }
     };
 
-    while ( (option = getopt_long(argc, argv, "t:s:c:e:S:r:T:M:DxX?V",
+    while ( (option = getopt_long(argc, argv, "t:s:c:e:S:r:T:M:L:DxXpPzFf?V",
                     long_options, NULL)) != -1) 
     {
         switch ( option )
@@ -1147,22 +1570,61 @@ static void parse_args(int argc, char **argv)
             opts.memory_buffer = sargtol(optarg, 0);
             break;
 
+        case 'p': /* One consumer thread per CPU */
+            opts.threads = 1;
+            break;
+
+        case 'P': /* One output file per CPU */
+            opts.threads = 1;
+            opts.per_cpu_files = 1;
+            break;
+
+        case 'L': /* Lost record report interval */
+            opts.lost_report = argtol(optarg, 0);
+            break;
+
+        case 'z': /* Compact output format */
+            opts.compact = 1;
+            break;
+
+        case 'F': /* Start the flight recorder */
+            opts.flight_recorder = 1;
+            break;
+
+        case 'f': /* Snapshot the flight recorder */
+            opts.snapshot = 1;
+            break;
+
         default:
             usage();
         }
     }
 
+    if ( opts.flight_recorder )
+    {
+        if ( optind != argc || opts.snapshot )
+            usage();
+        return;
+    }
+
     /* get outfile (required last argument) */
     if (optind != (argc-1))
         usage();
 
     opts.outfile = argv[optind];
-}
 
-/* *BSD has no O_LARGEFILE */
-#ifndef O_LARGEFILE
-#define O_LARGEFILE	0
-#endif
+    if ( opts.per_cpu_files && opts.memory_buffer )
+    {
+        fprintf(stderr, "--per-cpu-files cannot be used with --memory-buffer\n\n");
+        usage();
+    }
+
+    if ( opts.compact && opts.memory_buffer )
+    {
+        fprintf(stderr, "--compact cannot be used with --memory-buffer\n\n");
+        usage();
+    }
+}
 
 int main(int argc, char **argv)
 {
@@ -1177,6 +1639,7 @@ int main(int argc, char **argv)
     opts.disable_tracing = 1;
     opts.start_disabled = 0;
     opts.timeout = 0;
+    opts.lost_report = 0;
 
     parse_args(argc, argv);
 
@@ -1196,21 +1659,17 @@ int main(int argc, char **argv)
             exit(EXIT_FAILURE);
     }
 
+    setup_flight_recorder();
+
     if ( opts.timeout != 0 ) 
         alarm(opts.timeout);
 
-    if ( opts.outfile )
-        outfd = open(opts.outfile,
-                     O_WRONLY | O_CREAT | O_TRUNC | O_LARGEFILE,
-                     0644);
+    if ( opts.per_cpu_files )
+        outfd = -1;
+    else if ( opts.outfile )
+        outfd = open_outfile(opts.outfile);
 
-    if ( outfd < 0 )
-    {
-        perror("Could not open output file");
-        exit(EXIT_FAILURE);
-    }        
-
-    if ( isatty(outfd) )
+    if ( outfd >= 0 && isatty(outfd) )
     {
         fprintf(stderr, "Cannot output to a TTY, specify a log file.\n");
         exit(EXIT_FAILURE);
@@ -1230,6 +1689,9 @@ int main(int argc, char **argv)
 
     ret = monitor_tbufs();
 
+    if ( opts.snapshot && xc_tbuf_thaw(xc_handle) )
+        PERROR("Failed to resume flight recorder");
+
     return ret;
 }
 
@@ -28,6 +28,9 @@ const struct cmd_spec cmd_table[] = {
       "-p                      Leave the domain paused after it is created.\n"
       "-c                      Connect to the console after the domain is created.\n"
       "-f FILE, --defconfig=FILE\n                     Use the given configuration file.\n"
+      "-t DOMAIN, --template=DOMAIN\n"
+      "                        Fork the domain off DOMAIN, a paused PVH domain\n"
+      "                        which was never unpaused, instead of building it.\n"
       "-q, --quiet             Quiet.\n"
       "-n, --dryrun            Dry run - prints the resulting configuration\n"
       "                         (deprecated in favour of global -N option).\n"
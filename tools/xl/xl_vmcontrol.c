@@ -678,9 +678,18 @@ int create_domain(struct domain_create *dom_info)
     int notify_pipe[2] = { -1, -1 };
     struct save_file_header hdr;
     uint32_t domid_soft_reset = INVALID_DOMID;
+    uint32_t template_domid = INVALID_DOMID;
 
     int restoring = (restore_file || (migrate_fd >= 0));
 
+    if (dom_info->template_domain &&
+        libxl_domain_qualifier_to_domid(ctx, dom_info->template_domain,
+                                        &template_domid)) {
+        fprintf(stderr, "%s is an invalid domain identifier\n",
+                dom_info->template_domain);
+        return ERROR_INVAL;
+    }
+
     libxl_domain_config_init(&d_config);
 
     if (restoring) {
@@ -885,7 +894,9 @@ start:
             goto error_out;
     }
 
-    if (domid_soft_reset == INVALID_DOMID) {
+    /* A fork only needs memory as it writes to the template's. */
+    if (domid_soft_reset == INVALID_DOMID &&
+        template_domid == INVALID_DOMID) {
         if (!freemem(domid, &d_config)) {
             fprintf(stderr, "failed to free memory for the domain\n");
             ret = ERROR_FAIL;
@@ -939,6 +950,10 @@ start:
                                       0, autoconnect_console_how);
         domid = domid_soft_reset;
         domid_soft_reset = INVALID_DOMID;
+    } else if (template_domid != INVALID_DOMID) {
+        ret = libxl_domain_create_from_template(ctx, &d_config, &domid,
+                                                template_domid, 0,
+                                                autoconnect_console_how);
     } else {
         ret = libxl_domain_create_new(ctx, &d_config, &domid,
                                       0, autoconnect_console_how);
@@ -1166,6 +1181,7 @@ int main_create(int argc, char **argv)
 {
     const char *filename = NULL;
     struct domain_create dom_info;
+    const char *template_domain = NULL;
     int paused = 0, debug = 0, daemonize = 1, console_autoconnect = 0,
         quiet = 0, monitor = 1, vnc = 0, vncautopass = 0, ignore_masks = 0;
     int opt, rc;
@@ -1173,6 +1189,7 @@ int main_create(int argc, char **argv)
         {"dryrun", 0, 0, 'n'},
         {"quiet", 0, 0, 'q'},
         {"defconfig", 1, 0, 'f'},
+        {"template", 1, 0, 't'},
         {"vncviewer", 0, 0, 'V'},
         {"vncviewer-autopass", 0, 0, 'A'},
         {"ignore-global-affinity-masks", 0, 0, 'i'},
@@ -1186,10 +1203,13 @@ int main_create(int argc, char **argv)
         argc--; argv++;
     }
 
-    SWITCH_FOREACH_OPT(opt, "Fnqf:pcdeVAi", opts, "create", 0) {
+    SWITCH_FOREACH_OPT(opt, "Fnqf:t:pcdeVAi", opts, "create", 0) {
     case 'f':
         filename = optarg;
         break;
+    case 't':
+        template_domain = optarg;
+        break;
     case 'p':
         paused = 1;
         break;
@@ -1245,6 +1265,7 @@ int main_create(int argc, char **argv)
     dom_info.dryrun = dryrun_only;
     dom_info.quiet = quiet;
     dom_info.config_file = filename;
+    dom_info.template_domain = template_domain;
     dom_info.migrate_fd = -1;
     dom_info.send_back_fd = -1;
     dom_info.vnc = vnc;
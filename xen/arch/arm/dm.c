@@ -39,6 +39,8 @@ int dm_op(const struct dmop_args *op_args)
         [XEN_DMOP_destroy_ioreq_server]             = sizeof(struct xen_dm_op_destroy_ioreq_server),
         [XEN_DMOP_set_irq_level]                    = sizeof(struct xen_dm_op_set_irq_level),
         [XEN_DMOP_nr_vcpus]                         = sizeof(struct xen_dm_op_nr_vcpus),
+        [XEN_DMOP_map_posted_io_range]              = sizeof(struct xen_dm_op_ioreq_server_range),
+        [XEN_DMOP_unmap_posted_io_range]            = sizeof(struct xen_dm_op_ioreq_server_range),
     };
 
     rc = rcu_lock_remote_domain_by_id(op_args->domid, &d);
@@ -1510,6 +1510,7 @@ long arch_memory_op(int op, XEN_GUEST_HANDLE_PARAM(void) arg)
     /* XXX: memsharing not working yet */
     case XENMEM_get_sharing_shared_pages:
     case XENMEM_get_sharing_freed_pages:
+    case XENMEM_get_sharing_cow_breaks:
         return 0;
 
     default:
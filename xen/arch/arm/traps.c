@@ -1570,6 +1570,10 @@ enum mc_disposition arch_do_multicall_call(struct mc_state *state)
            ? mc_continue : mc_preempt;
 }
 
+void arch_multicall_end(struct mc_state *state)
+{
+}
+
 /*
  * stolen from arch/arm/kernel/opcodes.c
  *
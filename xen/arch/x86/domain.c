@@ -2419,6 +2419,7 @@ int domain_relinquish_resources(struct domain *d)
                 d->parent = NULL;
                 domain_unpause(parent);
                 put_domain(parent);
+                XFREE(d->arch.hvm.mem_sharing.reset_gfns);
             }
         }
 #endif
@@ -2482,6 +2483,9 @@ void cpuid_policy_updated(struct vcpu *v)
 void arch_dump_domain_info(struct domain *d)
 {
     paging_dump_domain_info(d);
+
+    if ( is_hvm_domain(d) )
+        pt_dump_domain_info(d);
 }
 
 void arch_dump_vcpu_info(struct vcpu *v)
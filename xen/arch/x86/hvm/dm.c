@@ -360,6 +360,8 @@ int dm_op(const struct dmop_args *op_args)
         [XEN_DMOP_relocate_memory]                  = sizeof(struct xen_dm_op_relocate_memory),
         [XEN_DMOP_pin_memory_cacheattr]             = sizeof(struct xen_dm_op_pin_memory_cacheattr),
         [XEN_DMOP_nr_vcpus]                         = sizeof(struct xen_dm_op_nr_vcpus),
+        [XEN_DMOP_map_posted_io_range]              = sizeof(struct xen_dm_op_ioreq_server_range),
+        [XEN_DMOP_unmap_posted_io_range]            = sizeof(struct xen_dm_op_ioreq_server_range),
     };
 
     rc = rcu_lock_remote_domain_by_id(op_args->domid, &d);
@@ -9,11 +9,13 @@
  *    Keir Fraser <keir@xen.org>
  */
 
+#include <xen/domstats.h>
 #include <xen/init.h>
 #include <xen/ioreq.h>
 #include <xen/lib.h>
 #include <xen/sched.h>
 #include <xen/paging.h>
+#include <xen/perfc.h>
 #include <xen/trace.h>
 #include <xen/vm_event.h>
 #include <asm/event.h>
@@ -2646,6 +2648,8 @@ static int _hvm_emulate_one(struct hvm_emulate_ctxt *hvmemul_ctxt,
     hvio->mmio_retry = 0;
 
     rc = x86_emulate(&hvmemul_ctxt->ctxt, ops);
+    if ( hvmemul_ctxt->ctxt.decode_cached )
+        perfc_incr(emul_decode_cached);
     if ( rc == X86EMUL_OKAY && hvio->mmio_retry )
         rc = X86EMUL_RETRY;
 
@@ -2718,7 +2722,13 @@ int hvm_emulate_one(
     struct hvm_emulate_ctxt *hvmemul_ctxt,
     enum vio_completion completion)
 {
-    return _hvm_emulate_one(hvmemul_ctxt, &hvm_emulate_ops, completion);
+    struct vcpu *curr = current;
+    s_time_t start = domstats_start(curr);
+    int rc = _hvm_emulate_one(hvmemul_ctxt, &hvm_emulate_ops, completion);
+
+    domstats_emulation(curr, start);
+
+    return rc;
 }
 
 int hvm_emulate_one_mmio(unsigned long mfn, unsigned long gla)
@@ -2850,6 +2860,8 @@ void hvm_emulate_init_once(
     hvmemul_ctxt->ctxt.regs = regs;
     hvmemul_ctxt->ctxt.cpuid = curr->domain->arch.cpuid;
     hvmemul_ctxt->ctxt.force_writeback = true;
+    hvmemul_ctxt->ctxt.decode_cache = curr->arch.hvm.hvm_io.decode_cache;
+    hvmemul_ctxt->ctxt.insn_bytes = hvmemul_ctxt->insn_buf;
 }
 
 void hvm_emulate_init_per_insn(
@@ -2902,6 +2914,7 @@ void hvm_emulate_init_per_insn(
             sizeof(hvmemul_ctxt->insn_buf) : 0;
     }
 
+    hvmemul_ctxt->ctxt.insn_bytes_len = hvmemul_ctxt->insn_buf_bytes;
     hvmemul_ctxt->is_mem_access = false;
 }
 
@@ -2983,6 +2996,13 @@ int hvmemul_cache_init(struct vcpu *v)
     if ( !cache )
         return -ENOMEM;
 
+    v->arch.hvm.hvm_io.decode_cache = x86_decode_cache_alloc();
+    if ( !v->arch.hvm.hvm_io.decode_cache )
+    {
+        xfree(cache);
+        return -ENOMEM;
+    }
+
     /* Cache is disabled initially. */
     cache->num_ents = nents + 1;
     cache->max_ents = nents;
@@ -1547,8 +1547,7 @@ int hvm_vcpu_initialise(struct vcpu *v)
 
     hvm_asid_flush_vcpu(v);
 
-    spin_lock_init(&v->arch.hvm.tm_lock);
-    INIT_LIST_HEAD(&v->arch.hvm.tm_list);
+    pt_vcpu_init(v); /* teardown: pt_vcpu_deinit */
 
     rc = hvm_vcpu_cacheattr_init(v); /* teardown: vcpu_cacheattr_destroy */
     if ( rc != 0 )
@@ -1614,6 +1613,7 @@ int hvm_vcpu_initialise(struct vcpu *v)
     hvm_vcpu_cacheattr_destroy(v);
  fail1:
     viridian_vcpu_deinit(v);
+    pt_vcpu_deinit(v);
     return rc;
 }
 
@@ -1635,6 +1635,8 @@ void hvm_vcpu_destroy(struct vcpu *v)
 
     vlapic_destroy(v);
 
+    pt_vcpu_deinit(v);
+
     hvm_vcpu_cacheattr_destroy(v);
 }
 
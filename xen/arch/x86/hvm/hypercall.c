@@ -19,6 +19,7 @@
  * Copyright (c) 2017 Citrix Systems Ltd.
  */
 #include <xen/lib.h>
+#include <xen/domstats.h>
 #include <xen/hypercall.h>
 #include <xen/ioreq.h>
 #include <xen/nospec.h>
@@ -170,6 +171,7 @@ int hvm_hypercall(struct cpu_user_regs *regs)
     int mode = hvm_guest_x86_mode(curr);
     unsigned long eax = regs->eax;
     unsigned int token;
+    s_time_t start;
 
     switch ( mode )
     {
@@ -231,6 +233,7 @@ int hvm_hypercall(struct cpu_user_regs *regs)
     token = hvmemul_cache_disable(curr);
 
     curr->hcall_preempted = false;
+    start = domstats_start(curr);
 
     if ( mode == 8 )
     {
@@ -325,6 +328,8 @@ int hvm_hypercall(struct cpu_user_regs *regs)
 
     hvmemul_cache_restore(curr, token);
 
+    domstats_hypercall(curr, eax, start);
+
     HVM_DBG_LOG(DBG_LEVEL_HCALL, "hcall%lu -> %lx", eax, regs->rax);
 
     if ( unlikely(curr->mapcache_invalidate) )
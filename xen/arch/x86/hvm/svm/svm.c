@@ -25,6 +25,7 @@
 #include <xen/softirq.h>
 #include <xen/hypercall.h>
 #include <xen/domain_page.h>
+#include <xen/domstats.h>
 #include <xen/xenoprof.h>
 #include <asm/current.h>
 #include <asm/io.h>
@@ -943,6 +944,8 @@ static void svm_ctxt_switch_from(struct vcpu *v)
 {
     int cpu = smp_processor_id();
 
+    domstats_exit_end(v);
+
     /*
      * Return early if trying to do a context switch without SVM enabled,
      * this can happen when the hypervisor shuts down with HVM guests
@@ -1047,6 +1050,8 @@ void svm_vmenter_helper(const struct cpu_user_regs *regs)
 
     ASSERT(hvmemul_cache_disabled(curr));
 
+    domstats_exit_end(curr);
+
     svm_asid_handle_vmrun();
 
     if ( unlikely(tb_init_done) )
@@ -2572,6 +2577,15 @@ void svm_vmexit_handler(struct cpu_user_regs *regs)
                     1/*cycles*/, 2, exit_reason,
                     regs->eip, 0, 0, 0, 0);
 
+    /* Fold the nested paging and AVIC exit codes in after the others. */
+    if ( exit_reason <= VMEXIT_RDPRU )
+        domstats_exit_start(v, exit_reason);
+    else if ( exit_reason >= VMEXIT_NPF )
+        domstats_exit_start(v, min(exit_reason - VMEXIT_NPF + 0x90,
+                                   DOMSTATS_NR_EXITS - 1UL));
+    else
+        domstats_exit_start(v, DOMSTATS_NR_EXITS - 1);
+
     if ( vcpu_guestmode )
     {
         enum nestedhvm_vmexits nsret;
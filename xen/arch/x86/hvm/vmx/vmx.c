@@ -24,6 +24,7 @@
 #include <xen/irq.h>
 #include <xen/softirq.h>
 #include <xen/domain_page.h>
+#include <xen/domstats.h>
 #include <xen/hypercall.h>
 #include <xen/perfc.h>
 #include <asm/current.h>
@@ -885,6 +886,8 @@ static void vmx_fpu_leave(struct vcpu *v)
 
 static void vmx_ctxt_switch_from(struct vcpu *v)
 {
+    domstats_exit_end(v);
+
     /*
      * Return early if trying to do a context switch without VMX enabled,
      * this can happen when the hypervisor shuts down with HVM guests
@@ -3871,6 +3874,7 @@ void vmx_vmexit_handler(struct cpu_user_regs *regs)
                     regs->eip, 0, 0, 0, 0);
 
     perfc_incra(vmexits, exit_reason);
+    domstats_exit_start(v, (uint16_t)exit_reason);
 
     /* Handle the interrupt we missed before allowing any more in. */
     switch ( (uint16_t)exit_reason )
@@ -4565,6 +4569,8 @@ bool vmx_vmenter_helper(const struct cpu_user_regs *regs)
      if ( nestedhvm_vcpu_in_guestmode(curr) && vcpu_nestedhvm(curr).stale_np2m )
          return false;
 
+    domstats_exit_end(curr);
+
     if ( curr->domain->arch.hvm.pi_ops.vcpu_block )
         vmx_pi_do_resume(curr);
 
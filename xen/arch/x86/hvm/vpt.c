@@ -16,6 +16,7 @@
  * this program; If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <xen/param.h>
 #include <xen/time.h>
 #include <asm/hvm/support.h>
 #include <asm/hvm/vpt.h>
@@ -27,6 +28,10 @@
 #define mode_is(d, name) \
     ((d)->arch.hvm.params[HVM_PARAM_TIMER_MODE] == HVMPTM_##name)
 
+/* How late (in ns) virtual platform timer ticks may be delivered. */
+static unsigned int __read_mostly vpt_timer_slack;
+integer_param("vpt_timer_slack", vpt_timer_slack);
+
 void hvm_init_guest_time(struct domain *d)
 {
     struct pl_time *pl = d->arch.hvm.pl_time;
@@ -231,6 +236,35 @@ static void pt_thaw_time(struct vcpu *v)
     v->arch.hvm.guest_time = 0;
 }
 
+/*
+ * The periodic timers of a vCPU share one host timer, armed for the
+ * earliest tick due of those of them which are armed.  Called with the
+ * vCPU's tm_lock held.
+ */
+static void pt_vcpu_timer_update(struct vcpu *v)
+{
+    struct periodic_time *pt;
+    s_time_t next = STIME_MAX;
+
+    list_for_each_entry ( pt, &v->arch.hvm.tm_list, list )
+        if ( pt->armed )
+            next = min(next, pt->scheduled);
+
+    if ( next != STIME_MAX )
+        set_timer(&v->arch.hvm.pt_timer, next);
+    else
+        stop_timer(&v->arch.hvm.pt_timer);
+}
+
+static void pt_arm(struct periodic_time *pt)
+{
+    struct timer *timer = &pt->vcpu->arch.hvm.pt_timer;
+
+    pt->armed = true;
+    if ( !timer_expires_before(timer, pt->scheduled) )
+        set_timer(timer, pt->scheduled);
+}
+
 void pt_save_timer(struct vcpu *v)
 {
     struct list_head *head = &v->arch.hvm.tm_list;
@@ -243,7 +277,8 @@ void pt_save_timer(struct vcpu *v)
 
     list_for_each_entry ( pt, head, list )
         if ( !pt->do_not_freeze )
-            stop_timer(&pt->timer);
+            pt->armed = false;
+    pt_vcpu_timer_update(v);
 
     pt_freeze_time(v);
 
@@ -262,28 +297,81 @@ void pt_restore_timer(struct vcpu *v)
         if ( pt->pending_intr_nr == 0 )
         {
             pt_process_missed_ticks(pt);
-            set_timer(&pt->timer, pt->scheduled);
+            pt->armed = true;
         }
     }
+    pt_vcpu_timer_update(v);
 
     pt_thaw_time(v);
 
     pt_vcpu_unlock(v);
 }
 
+/*
+ * Whether a tick can be held back without waking the vCPU: it is halted,
+ * and the tick's interrupt is masked, so that pt_update_irq() would only
+ * suspend the timer anyway.  pt_resume() wakes the vCPU when the interrupt
+ * gets unmasked.
+ */
+static bool pt_tick_deferrable(struct vcpu *v, struct periodic_time *pt)
+{
+    return (v->pause_flags & VPF_blocked) && !pt->level &&
+           (pt->irq != RTC_IRQ || !pt->priv) && pt_irq_masked(pt) > 0;
+}
+
 static void pt_timer_fn(void *data)
 {
-    struct periodic_time *pt = data;
+    struct vcpu *v = data;
+    struct periodic_time *pt, *tmp;
+    s_time_t now = NOW();
+    bool kick = false;
 
-    pt_lock(pt);
+    pt_vcpu_lock(v);
 
-    pt->pending_intr_nr++;
-    pt->scheduled += pt->period;
-    pt->do_not_freeze = 0;
+    /* Deliver the ticks of all the vCPU's timers due by now at once. */
+    list_for_each_entry_safe ( pt, tmp, &v->arch.hvm.tm_list, list )
+    {
+        if ( !pt->armed || pt->scheduled > now )
+            continue;
 
-    vcpu_kick(pt->vcpu);
+        pt->armed = false;
+        pt->pending_intr_nr++;
+        pt->scheduled += pt->period;
+        pt->do_not_freeze = 0;
 
-    pt_unlock(pt);
+        if ( pt_tick_deferrable(v, pt) )
+        {
+            /* suspend timer emulation */
+            list_del(&pt->list);
+            pt->on_list = 0;
+            continue;
+        }
+
+        kick = true;
+    }
+
+    pt_vcpu_timer_update(v);
+
+    if ( kick )
+    {
+        v->arch.hvm.pt_wakeups++;
+        vcpu_kick(v);
+    }
+
+    pt_vcpu_unlock(v);
+}
+
+void pt_vcpu_init(struct vcpu *v)
+{
+    spin_lock_init(&v->arch.hvm.tm_lock);
+    INIT_LIST_HEAD(&v->arch.hvm.tm_list);
+    init_timer(&v->arch.hvm.pt_timer, pt_timer_fn, v, v->processor);
+    set_timer_slack(&v->arch.hvm.pt_timer, vpt_timer_slack);
+}
+
+void pt_vcpu_deinit(struct vcpu *v)
+{
+    kill_timer(&v->arch.hvm.pt_timer);
 }
 
 static void pt_irq_fired(struct vcpu *v, struct periodic_time *pt)
@@ -303,7 +391,7 @@ static void pt_irq_fired(struct vcpu *v, struct periodic_time *pt)
         pt->last_plt_gtime = hvm_get_guest_time(v);
         pt_process_missed_ticks(pt);
         pt->pending_intr_nr = 0; /* 'collapse' all missed ticks */
-        set_timer(&pt->timer, pt->scheduled);
+        pt_arm(pt);
     }
     else
     {
@@ -312,7 +400,7 @@ static void pt_irq_fired(struct vcpu *v, struct periodic_time *pt)
         {
             pt_process_missed_ticks(pt);
             if ( pt->pending_intr_nr == 0 )
-                set_timer(&pt->timer, pt->scheduled);
+                pt_arm(pt);
         }
     }
 
@@ -483,15 +571,7 @@ void pt_intr_post(struct vcpu *v, struct hvm_intack intack)
 
 void pt_migrate(struct vcpu *v)
 {
-    struct list_head *head = &v->arch.hvm.tm_list;
-    struct periodic_time *pt;
-
-    pt_vcpu_lock(v);
-
-    list_for_each_entry ( pt, head, list )
-        migrate_timer(&pt->timer, v->processor);
-
-    pt_vcpu_unlock(v);
+    migrate_timer(&v->arch.hvm.pt_timer, v->processor);
 }
 
 void create_periodic_time(
@@ -554,12 +634,10 @@ void create_periodic_time(
     pt->cb = cb;
     pt->priv = data;
 
-    init_timer(&pt->timer, pt_timer_fn, pt, v->processor);
-    set_timer(&pt->timer, pt->scheduled);
-
     pt_vcpu_lock(v);
     pt->on_list = 1;
     list_add(&pt->list, &v->arch.hvm.tm_list);
+    pt_arm(pt);
     pt_vcpu_unlock(v);
 
     write_unlock(&v->domain->arch.hvm.pl_time->pt_migrate);
@@ -571,18 +649,17 @@ void destroy_periodic_time(struct periodic_time *pt)
     if ( pt->vcpu == NULL )
         return;
 
+    /*
+     * pt_timer_fn() only looks at the timers on the vCPU's list, under its
+     * lock, so the vCPU's host timer is left to find nothing to do.
+     */
     pt_lock(pt);
     if ( pt->on_list )
         list_del(&pt->list);
     pt->on_list = 0;
+    pt->armed = false;
     pt->pending_intr_nr = 0;
     pt_unlock(pt);
-
-    /*
-     * pt_timer_fn() can run until this kill_timer() returns. We must do this
-     * outside pt_lock() otherwise we can deadlock with pt_timer_fn().
-     */
-    kill_timer(&pt->timer);
 }
 
 static void pt_adjust_vcpu(struct periodic_time *pt, struct vcpu *v)
@@ -608,7 +685,8 @@ static void pt_adjust_vcpu(struct periodic_time *pt, struct vcpu *v)
     if ( pt->on_list )
     {
         list_add(&pt->list, &v->arch.hvm.tm_list);
-        migrate_timer(&pt->timer, v->processor);
+        if ( pt->armed )
+            pt_arm(pt);
     }
     pt_vcpu_unlock(v);
 
@@ -679,3 +757,25 @@ void pt_may_unmask_irq(struct domain *d, struct periodic_time *vlapic_pt)
     if ( vlapic_pt )
         pt_resume(vlapic_pt);
 }
+
+void pt_dump_domain_info(struct domain *d)
+{
+    struct pl_time *pl = d->arch.hvm.pl_time;
+    const struct vcpu *v;
+    unsigned long wakeups = 0;
+    s_time_t now = NOW(), elapsed;
+
+    for_each_vcpu ( d, v )
+        wakeups += v->arch.hvm.pt_wakeups;
+
+    elapsed = now - pl->dump_time;
+    printk("    vpt: %lu wakeups", wakeups);
+    if ( pl->dump_time && elapsed > 0 )
+        printk(", %lu/s since last dump",
+               (unsigned long)((wakeups - pl->dump_wakeups) * SECONDS(1) /
+                               elapsed));
+    printk("\n");
+
+    pl->dump_wakeups = wakeups;
+    pl->dump_time = now;
+}
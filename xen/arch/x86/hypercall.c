@@ -21,6 +21,7 @@
 
 #include <xen/hypercall.h>
 #include <asm/multicall.h>
+#include <asm/pv/mm.h>
 
 #ifdef CONFIG_COMPAT
 #define ARGS(x, n)                              \
@@ -287,6 +288,12 @@ enum mc_disposition arch_do_multicall_call(struct mc_state *state)
     return mc_exit;
 }
 
+void arch_multicall_end(struct mc_state *state)
+{
+    if ( is_pv_vcpu(current) )
+        pv_multicall_flush();
+}
+
 /*
  * Local variables:
  * mode: C
@@ -4376,6 +4376,102 @@ int steal_page(
 }
 
 #ifdef CONFIG_PV
+/*
+ * Within a multicall, the TLB flushes requested by a run of update_va_mapping
+ * calls are merged, and carried out once the run ends (pv_multicall_flush()),
+ * rather than each sending IPIs of its own.  So within a multicall, such
+ * flushes are only guaranteed to have happened once the multicall returns or
+ * gets preempted: the guest's other vCPUs keep running meanwhile, and may see
+ * an entry's result written back before its flush.  Xen doesn't depend on
+ * them: pages freed by the updates are flushed from all TLBs before they get
+ * reused anyway.
+ */
+struct mc_flush {
+    unsigned int nr;         /* Flushes merged so far. */
+    bool local;              /* Flush the local TLB. */
+    enum {
+        MC_FLUSH_NONE,
+        MC_FLUSH_VA,         /* Flush va from the domain's dirty CPUs. */
+        MC_FLUSH_FULL,       /* Flush all of the domain's dirty CPUs. */
+    } all;
+    unsigned long va;
+};
+
+static DEFINE_PER_CPU(struct mc_flush, mc_flush);
+
+static bool mc_defer_flush(const struct vcpu *v, unsigned long va,
+                           unsigned long flags)
+{
+    struct mc_flush *mcf = &this_cpu(mc_flush);
+
+    if ( !(v->mc_state.flags & MCSF_in_multicall) )
+        return false;
+
+    /* Flushes of a set of vCPUs' TLBs are rare, and are not merged. */
+    switch ( flags )
+    {
+    case UVMF_TLB_FLUSH | UVMF_LOCAL:
+        mcf->local = true;
+        break;
+
+    case UVMF_TLB_FLUSH | UVMF_ALL:
+        mcf->all = MC_FLUSH_FULL;
+        break;
+
+    case UVMF_INVLPG | UVMF_ALL:
+        if ( mcf->all == MC_FLUSH_NONE )
+        {
+            mcf->all = MC_FLUSH_VA;
+            mcf->va = va;
+        }
+        else if ( mcf->all == MC_FLUSH_VA && mcf->va != va )
+            mcf->all = MC_FLUSH_FULL;
+        break;
+
+    default:
+        return false;
+    }
+
+    mcf->nr++;
+
+    return true;
+}
+
+void pv_multicall_flush(void)
+{
+    struct mc_flush *mcf = &this_cpu(mc_flush);
+    const struct domain *d = current->domain;
+
+    if ( likely(!mcf->nr) )
+        return;
+
+    perfc_incr(update_va_flushes);
+    perfc_add(update_va_flushes_merged, mcf->nr);
+
+    switch ( mcf->all )
+    {
+    case MC_FLUSH_FULL:
+        flush_tlb_mask(d->dirty_cpumask);
+        if ( cpumask_test_cpu(smp_processor_id(), d->dirty_cpumask) )
+            mcf->local = false;
+        break;
+
+    case MC_FLUSH_VA:
+        flush_tlb_one_mask(d->dirty_cpumask, mcf->va);
+        break;
+
+    case MC_FLUSH_NONE:
+        break;
+    }
+
+    if ( mcf->local )
+        flush_tlb_local();
+
+    mcf->nr = 0;
+    mcf->local = false;
+    mcf->all = MC_FLUSH_NONE;
+}
+
 static int __do_update_va_mapping(
     unsigned long va, u64 val64, unsigned long flags, struct domain *pg_owner)
 {
@@ -4428,7 +4524,7 @@ static int __do_update_va_mapping(
      * flush, as it won't do anything useful.  Furthermore, va is guest
      * controlled and not necesserily audited by this point.
      */
-    if ( rc )
+    if ( rc || mc_defer_flush(v, va, flags) )
         return rc;
 
     switch ( flags & UVMF_FLUSHTYPE_MASK )
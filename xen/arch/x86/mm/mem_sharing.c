@@ -202,6 +202,7 @@ static shr_handle_t get_next_handle(void)
 
 static atomic_t nr_saved_mfns   = ATOMIC_INIT(0);
 static atomic_t nr_shared_mfns  = ATOMIC_INIT(0);
+static atomic_t nr_cow_breaks   = ATOMIC_INIT(0);
 
 /*
  * Reverse map
@@ -691,6 +692,11 @@ unsigned int mem_sharing_get_nr_shared_mfns(void)
     return atomic_read(&nr_shared_mfns);
 }
 
+unsigned int mem_sharing_get_nr_cow_breaks(void)
+{
+    return atomic_read(&nr_cow_breaks);
+}
+
 /* Functions that change a page's type and ownership */
 static int page_make_sharable(struct domain *d,
                               struct page_info *page,
@@ -1001,8 +1007,26 @@ out:
     return ret;
 }
 
+static bool pages_equal(struct page_info *a, struct page_info *b)
+{
+    const void *va = __map_domain_page(a);
+    const void *vb = __map_domain_page(b);
+    bool equal = !memcmp(va, vb, PAGE_SIZE);
+
+    unmap_domain_page(vb);
+    unmap_domain_page(va);
+
+    return equal;
+}
+
+/*
+ * With same_content, the pages are only shared if their contents are the
+ * same.  They can't change while the pages are locked: being shared, they
+ * are read-only to the guests, and unsharing takes the page lock.
+ */
 static int share_pages(struct domain *sd, gfn_t sgfn, shr_handle_t sh,
-                       struct domain *cd, gfn_t cgfn, shr_handle_t ch)
+                       struct domain *cd, gfn_t cgfn, shr_handle_t ch,
+                       bool same_content)
 {
     struct page_info *spage, *cpage, *firstpg, *secondpg;
     gfn_info_t *gfn;
@@ -1085,6 +1109,14 @@ static int share_pages(struct domain *sd, gfn_t sgfn, shr_handle_t sh,
         goto err_out;
     }
 
+    if ( same_content && !pages_equal(spage, cpage) )
+    {
+        ret = -ENODATA;
+        mem_sharing_page_unlock(secondpg);
+        mem_sharing_page_unlock(firstpg);
+        goto err_out;
+    }
+
     /* Merge the lists together */
     rmap_seed_iterator(cpage, &ri);
     while ( (gfn = rmap_iterate(cpage, &ri)) != NULL)
@@ -1250,6 +1282,43 @@ err_out:
     return ret;
 }
 
+/* Beyond this, going through all the fork's pages on reset is as good. */
+#define FORK_RESET_LOG_MAX (1u << 18)
+
+/*
+ * Logs a page the fork made private, for its reset to get rid of.  Called
+ * with the fork's p2m locked.
+ */
+static void fork_log_page(struct domain *d, unsigned long gfn)
+{
+    struct mem_sharing_domain *msd = &d->arch.hvm.mem_sharing;
+
+    if ( msd->reset_log_incomplete )
+        return;
+
+    if ( msd->nr_reset_gfns == msd->max_reset_gfns )
+    {
+        unsigned int max = max(msd->max_reset_gfns * 2, 64U);
+        unsigned long *gfns = NULL;
+
+        if ( max <= FORK_RESET_LOG_MAX )
+            gfns = xmalloc_array(unsigned long, max);
+        if ( !gfns )
+        {
+            msd->reset_log_incomplete = true;
+            return;
+        }
+
+        if ( msd->nr_reset_gfns )
+            memcpy(gfns, msd->reset_gfns,
+                   msd->nr_reset_gfns * sizeof(*gfns));
+        xfree(msd->reset_gfns);
+        msd->reset_gfns = gfns;
+        msd->max_reset_gfns = max;
+    }
+
+    msd->reset_gfns[msd->nr_reset_gfns++] = gfn;
+}
 
 /*
  * A note on the rationale for unshare error handling:
@@ -1265,9 +1334,13 @@ err_out:
  *     4.3. do not corrupt guest memory
  *     4.4. let the guest deal with it if the error propagation will reach it
  */
-int __mem_sharing_unshare_page(struct domain *d,
-                               unsigned long gfn,
-                               bool destroy)
+/*
+ * With nominated set, this only undoes that nomination: the page is only
+ * made private if it still has that handle and no other gfn shares it, and
+ * doing so isn't a copy-on-write break.
+ */
+static int unshare_page(struct domain *d, unsigned long gfn, bool destroy,
+                        shr_handle_t nominated)
 {
     p2m_type_t p2mt;
     mfn_t mfn;
@@ -1302,6 +1375,13 @@ int __mem_sharing_unshare_page(struct domain *d,
         BUG();
     }
 
+    if ( nominated &&
+         (page->sharing->handle != nominated || rmap_count(page) != 1) )
+    {
+        mem_sharing_page_unlock(page);
+        goto out;
+    }
+
     gfn_info = rmap_retrieve(d->domain_id, gfn, page);
     if ( unlikely(gfn_info == NULL) )
     {
@@ -1377,6 +1457,9 @@ int __mem_sharing_unshare_page(struct domain *d,
     put_page_and_type(old_page);
 
  private_page_found:
+    if ( !nominated )
+        atomic_inc(&nr_cow_breaks);
+
     if ( p2m_change_type_one(d, gfn, p2m_ram_shared, p2m_ram_rw) )
     {
         gdprintk(XENLOG_ERR, "Could not change p2m type d %pd gfn %lx.\n",
@@ -1387,6 +1470,9 @@ int __mem_sharing_unshare_page(struct domain *d,
     /* Update m2p entry */
     set_gpfn_from_mfn(mfn_x(page_to_mfn(page)), gfn);
 
+    if ( mem_sharing_is_fork(d) )
+        fork_log_page(d, gfn);
+
     /*
      * Now that the gfn<->mfn map is properly established,
      * marking dirty is feasible
@@ -1407,6 +1493,13 @@ int __mem_sharing_unshare_page(struct domain *d,
     return rc;
 }
 
+int __mem_sharing_unshare_page(struct domain *d,
+                               unsigned long gfn,
+                               bool destroy)
+{
+    return unshare_page(d, gfn, destroy, 0);
+}
+
 int relinquish_shared_pages(struct domain *d)
 {
     int rc = 0;
@@ -1490,7 +1583,8 @@ static int range_share(struct domain *d, struct domain *cd,
             if ( !rc )
             {
                 /* If we get here this should be guaranteed to succeed. */
-                rc = share_pages(d, _gfn(start), sh, cd, _gfn(start), ch);
+                rc = share_pages(d, _gfn(start), sh, cd, _gfn(start), ch,
+                                 false);
                 ASSERT(!rc);
             }
         }
@@ -1617,8 +1711,12 @@ int mem_sharing_fork_page(struct domain *d, gfn_t gfn, bool unsharing)
 
     put_gfn(parent, gfn_l);
 
-    return p2m->set_entry(p2m, gfn, new_mfn, PAGE_ORDER_4K, p2m_ram_rw,
-                          p2m->default_access, -1);
+    rc = p2m->set_entry(p2m, gfn, new_mfn, PAGE_ORDER_4K, p2m_ram_rw,
+                        p2m->default_access, -1);
+    if ( !rc )
+        fork_log_page(d, gfn_l);
+
+    return rc;
 }
 
 static int bring_up_vcpus(struct domain *cd, struct domain *d)
@@ -1869,11 +1967,52 @@ static int fork(struct domain *cd, struct domain *d)
     return rc;
 }
 
+/*
+ * Drops a page the fork made private, for it to be forked from the parent
+ * again on its next access.
+ */
+static void fork_reset_page(struct domain *d, gfn_t gfn)
+{
+    struct p2m_domain *p2m = p2m_get_hostp2m(d);
+    struct page_info *page;
+    shr_handle_t sh;
+    p2m_type_t t;
+    mfn_t mfn;
+    int rc;
+
+    /*
+     * We only want to remove pages from the fork here that were copied
+     * from the parent but could be potentially re-populated using memory
+     * sharing after the reset. These pages all must be regular pages with
+     * no extra reference held to them, thus should be possible to make
+     * them sharable. Unfortunately p2m_is_sharable check is not sufficient
+     * to test this as it doesn't check the page's reference count. We thus
+     * check whether the page is convertable to the shared type using
+     * nominate_page. In case the page is already shared (ie. a share
+     * handle is returned) then we don't remove it.
+     */
+    if ( nominate_page(d, gfn, 0, true, &sh) || sh )
+        return;
+
+    mfn = get_gfn_query_unlocked(d, gfn_x(gfn), &t);
+    page = mfn_to_page(mfn);
+
+    /* forked memory is 4k, not splitting large pages so this must work */
+    rc = p2m->set_entry(p2m, gfn, INVALID_MFN, PAGE_ORDER_4K,
+                        p2m_invalid, p2m_access_rwx, -1);
+    ASSERT(!rc);
+
+    put_page_alloc_ref(page);
+    put_page_and_type(page);
+}
+
 /*
  * The fork reset operation is intended to be used on short-lived forks only.
  * There is no hypercall continuation operation implemented for this reason.
  * For forks that obtain a larger memory footprint it is likely going to be
  * more performant to create a new fork instead of resetting an existing one.
+ * Unless the fork got pages other than by forking them from its parent, the
+ * reset only visits the pages it forked since it was created or last reset.
  *
  * TODO: In case this hypercall would become useful on forks with larger memory
  * footprints the hypercall continuation should be implemented (or if this
@@ -1883,49 +2022,203 @@ static int mem_sharing_fork_reset(struct domain *d, struct domain *pd)
 {
     int rc;
     struct p2m_domain *p2m = p2m_get_hostp2m(d);
+    struct mem_sharing_domain *msd = &d->arch.hvm.mem_sharing;
     struct page_info *page, *tmp;
+    unsigned long *gfns;
+    unsigned int i, nr, max;
+    bool incomplete;
 
     domain_pause(d);
 
+    /*
+     * Take the log over.  Foreign mappings may still fork pages meanwhile,
+     * which go to a new log.
+     */
+    p2m_lock(p2m);
+    gfns = msd->reset_gfns;
+    nr = msd->nr_reset_gfns;
+    max = msd->max_reset_gfns;
+    incomplete = msd->reset_log_incomplete;
+    msd->reset_gfns = NULL;
+    msd->nr_reset_gfns = msd->max_reset_gfns = 0;
+    msd->reset_log_incomplete = false;
+    p2m_unlock(p2m);
+
     /* need recursive lock because we will free pages */
     spin_lock_recursive(&d->page_alloc_lock);
-    page_list_for_each_safe(page, tmp, &d->page_list)
+    if ( incomplete )
+        page_list_for_each_safe(page, tmp, &d->page_list)
+            fork_reset_page(d, mfn_to_gfn(d, page_to_mfn(page)));
+    else
+        for ( i = 0; i < nr; i++ )
+            fork_reset_page(d, _gfn(gfns[i]));
+    spin_unlock_recursive(&d->page_alloc_lock);
+
+    /* Keep the log's memory for the next run, unless replaced already. */
+    p2m_lock(p2m);
+    if ( !msd->reset_gfns )
     {
-        shr_handle_t sh;
-        mfn_t mfn = page_to_mfn(page);
-        gfn_t gfn = mfn_to_gfn(d, mfn);
+        msd->reset_gfns = gfns;
+        msd->max_reset_gfns = max;
+        gfns = NULL;
+    }
+    p2m_unlock(p2m);
+    xfree(gfns);
 
-        /*
-         * We only want to remove pages from the fork here that were copied
-         * from the parent but could be potentially re-populated using memory
-         * sharing after the reset. These pages all must be regular pages with
-         * no extra reference held to them, thus should be possible to make
-         * them sharable. Unfortunately p2m_is_sharable check is not sufficient
-         * to test this as it doesn't check the page's reference count. We thus
-         * check whether the page is convertable to the shared type using
-         * nominate_page. In case the page is already shared (ie. a share
-         * handle is returned) then we don't remove it.
-         */
-        if ( (rc = nominate_page(d, gfn, 0, true, &sh)) || sh )
-            continue;
+    rc = copy_settings(d, pd);
 
-        /* forked memory is 4k, not splitting large pages so this must work */
-        rc = p2m->set_entry(p2m, gfn, INVALID_MFN, PAGE_ORDER_4K,
-                            p2m_invalid, p2m_access_rwx, -1);
-        ASSERT(!rc);
+    domain_unpause(d);
 
-        put_page_alloc_ref(page);
-        put_page_and_type(page);
+    return rc;
+}
+
+/*
+ * Forks cd off d, if that wasn't done already, and populates the hot pages
+ * starting from the hot_done-th, with preemption.
+ */
+static int fork_bulk_one(struct domain *cd, struct domain *d,
+                         struct mem_sharing_op_fork_bulk *bulk)
+{
+    unsigned int q = (bulk->flags & XENMEM_FORK_HOT_PRIVATE)
+                     ? P2M_UNSHARE : P2M_ALLOC;
+    int rc;
+
+    if ( !bulk->hot_done )
+    {
+        rc = -EINVAL;
+        if ( d->max_vcpus != cd->max_vcpus )
+            return rc;
+
+        if ( !mem_sharing_enabled(cd) &&
+             (rc = mem_sharing_control(cd, true, bulk->flags)) )
+            return rc;
+
+        if ( (rc = fork(cd, d)) )
+            return rc;
+
+        if ( bulk->flags & XENMEM_FORK_BLOCK_INTERRUPTS )
+            cd->arch.hvm.mem_sharing.block_interrupts = true;
     }
-    spin_unlock_recursive(&d->page_alloc_lock);
 
-    rc = copy_settings(d, pd);
+    while ( bulk->hot_done < bulk->nr_hot )
+    {
+        uint64_t gfn;
+        p2m_type_t t;
 
-    domain_unpause(d);
+        if ( copy_from_guest_offset(&gfn, bulk->hot_gfns, bulk->hot_done, 1) )
+            return -EFAULT;
+
+        /* Holes in the parent just stay holes. */
+        get_gfn_type(cd, gfn, &t, q);
+        put_gfn(cd, gfn);
+
+        if ( ++bulk->hot_done < bulk->nr_hot && hypercall_preempt_check() )
+            return -ERESTART;
+    }
+
+    return 0;
+}
+
+static int fork_bulk(struct domain *d, struct mem_sharing_op_fork_bulk *bulk)
+{
+    int rc = 0;
+
+    while ( bulk->nr_done < bulk->nr_forks )
+    {
+        struct domain *cd;
+        domid_t domid;
+
+        if ( copy_from_guest_offset(&domid, bulk->forks, bulk->nr_done, 1) )
+            return -EFAULT;
+
+        if ( (rc = rcu_lock_live_remote_domain_by_id(domid, &cd)) )
+            return rc;
+
+        rc = xsm_mem_sharing(XSM_DM_PRIV, cd);
+        if ( !rc )
+            rc = fork_bulk_one(cd, d, bulk);
+
+        rcu_unlock_domain(cd);
+
+        if ( rc )
+            return rc;
+
+        bulk->hot_done = 0;
+        if ( ++bulk->nr_done < bulk->nr_forks && hypercall_preempt_check() )
+            return -ERESTART;
+    }
+
+    return 0;
+}
+
+static int dedup_pair(struct domain *cd, struct xen_mem_sharing_dedup *pair)
+{
+    struct domain *sd;
+    shr_handle_t sh, ch;
+    int rc;
+
+    if ( pair->pad )
+        return -EINVAL;
+
+    /* The source may be cd itself, e.g. for its many zeroed pages. */
+    if ( (rc = rcu_lock_live_remote_domain_by_id(pair->source_domain, &sd)) )
+        return rc;
+
+    rc = xsm_mem_sharing_op(XSM_DM_PRIV, sd, cd, XENMEM_sharing_op_share);
+    if ( !rc && !mem_sharing_enabled(sd) )
+        rc = -EINVAL;
+    if ( !rc )
+        rc = nominate_page(sd, _gfn(pair->source_gfn), 0, false, &sh);
+    if ( !rc )
+        rc = nominate_page(cd, _gfn(pair->client_gfn), 0, false, &ch);
+    if ( !rc )
+        rc = share_pages(sd, _gfn(pair->source_gfn), sh,
+                         cd, _gfn(pair->client_gfn), ch, true);
+
+    /*
+     * Pages which differ would otherwise stay nominated, and be unshared
+     * again on their next write, for nothing.  Undoing the nomination can't
+     * fail for want of memory, as it copies nothing.
+     */
+    if ( rc == -ENODATA )
+    {
+        unshare_page(sd, pair->source_gfn, false, sh);
+        unshare_page(cd, pair->client_gfn, false, ch);
+    }
+
+    rcu_unlock_domain(sd);
 
     return rc;
 }
 
+static int dedup(struct domain *cd, struct mem_sharing_op_dedup *op)
+{
+    XEN_GUEST_HANDLE(xen_mem_sharing_dedup_t) pairs =
+        guest_handle_cast(op->pairs, xen_mem_sharing_dedup_t);
+
+    while ( op->nr_done < op->nr_pairs )
+    {
+        struct xen_mem_sharing_dedup pair;
+
+        if ( copy_from_guest_offset(&pair, pairs, op->nr_done, 1) )
+            return -EFAULT;
+
+        pair.rc = dedup_pair(cd, &pair);
+        if ( pair.rc == -ENOMEM )
+            return -ENOMEM;
+        if ( !pair.rc )
+            op->nr_shared++;
+
+        if ( copy_to_guest_offset(pairs, op->nr_done, &pair, 1) )
+            return -EFAULT;
+
+        if ( ++op->nr_done < op->nr_pairs && hypercall_preempt_check() )
+            return -ERESTART;
+    }
+
+    return 0;
+}
+
 int mem_sharing_memop(XEN_GUEST_HANDLE_PARAM(xen_mem_sharing_op_t) arg)
 {
     int rc;
@@ -1947,8 +2240,11 @@ int mem_sharing_memop(XEN_GUEST_HANDLE_PARAM(xen_mem_sharing_op_t) arg)
     if ( rc )
         goto out;
 
+    /* A bulk fork's parent is the domain the op is for. */
     if ( !mem_sharing_enabled(d) &&
-         (rc = mem_sharing_control(d, true, 0)) )
+         (rc = mem_sharing_control(d, true,
+                                   mso.op == XENMEM_sharing_op_fork_bulk
+                                   ? mso.u.fork_bulk.flags : 0)) )
         return rc;
 
     switch ( mso.op )
@@ -2037,7 +2333,7 @@ int mem_sharing_memop(XEN_GUEST_HANDLE_PARAM(xen_mem_sharing_op_t) arg)
         sh = mso.u.share.source_handle;
         ch = mso.u.share.client_handle;
 
-        rc = share_pages(d, sgfn, sh, cd, cgfn, ch);
+        rc = share_pages(d, sgfn, sh, cd, cgfn, ch, false);
 
         rcu_unlock_domain(cd);
     }
@@ -2224,6 +2520,53 @@ int mem_sharing_memop(XEN_GUEST_HANDLE_PARAM(xen_mem_sharing_op_t) arg)
         break;
     }
 
+    case XENMEM_sharing_op_fork_bulk:
+        rc = -EINVAL;
+        if ( mso.u.fork_bulk.pad ||
+             (mso.u.fork_bulk.flags &
+              ~(XENMEM_FORK_WITH_IOMMU_ALLOWED | XENMEM_FORK_BLOCK_INTERRUPTS |
+                XENMEM_FORK_HOT_PRIVATE)) ||
+             mso.u.fork_bulk.nr_done > mso.u.fork_bulk.nr_forks ||
+             mso.u.fork_bulk.hot_done > mso.u.fork_bulk.nr_hot )
+            goto out;
+
+        rc = fork_bulk(d, &mso.u.fork_bulk);
+
+        if ( rc == -ERESTART )
+        {
+            if ( __copy_to_guest(arg, &mso, 1) )
+                rc = -EFAULT;
+            else
+                rc = hypercall_create_continuation(__HYPERVISOR_memory_op,
+                                                   "lh", XENMEM_sharing_op,
+                                                   arg);
+        }
+        else if ( rc )
+            /* Let the caller know which forks are done. */
+            __copy_to_guest(arg, &mso, 1);
+        break;
+
+    case XENMEM_sharing_op_dedup:
+        rc = -EINVAL;
+        if ( mso.u.dedup.pad || mso.u.dedup.nr_done > mso.u.dedup.nr_pairs )
+            goto out;
+
+        rc = dedup(d, &mso.u.dedup);
+
+        if ( rc == -ERESTART )
+        {
+            if ( __copy_to_guest(arg, &mso, 1) )
+                rc = -EFAULT;
+            else
+                rc = hypercall_create_continuation(__HYPERVISOR_memory_op,
+                                                   "lh", XENMEM_sharing_op,
+                                                   arg);
+        }
+        else if ( rc )
+            /* Let the caller know which pairs are done. */
+            __copy_to_guest(arg, &mso, 1);
+        break;
+
     case XENMEM_sharing_op_fork_reset:
     {
         struct domain *pd;
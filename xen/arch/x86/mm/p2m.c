@@ -1034,6 +1034,8 @@ guest_physmap_add_entry(struct domain *d, gfn_t gfn, mfn_t mfn,
             for ( i = 0; i < (1UL << page_order); i++ )
                 set_gpfn_from_mfn(mfn_x(mfn_add(mfn, i)),
                                   gfn_x(gfn_add(gfn, i)));
+
+            mem_sharing_fork_page_added(d);
         }
     }
 
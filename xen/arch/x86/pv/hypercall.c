@@ -20,10 +20,12 @@
  */
 
 #include <xen/compiler.h>
+#include <xen/domstats.h>
 #include <xen/hypercall.h>
 #include <xen/nospec.h>
 #include <xen/trace.h>
 #include <asm/multicall.h>
+#include <asm/pv/mm.h>
 #include <irq_vectors.h>
 
 #ifdef CONFIG_PV32
@@ -113,6 +115,7 @@ void pv_hypercall(struct cpu_user_regs *regs)
 {
     struct vcpu *curr = current;
     unsigned long eax;
+    s_time_t start;
 
     ASSERT(guest_kernel_mode(curr, regs));
 
@@ -136,6 +139,7 @@ void pv_hypercall(struct cpu_user_regs *regs)
     }
 
     curr->hcall_preempted = false;
+    start = domstats_start(curr);
 
     if ( !is_pv_32bit_vcpu(curr) )
     {
@@ -244,6 +248,18 @@ void pv_hypercall(struct cpu_user_regs *regs)
         regs->rip -= 2;
 
     perfc_incr(hypercalls);
+    domstats_hypercall(curr, eax, start);
+}
+
+/*
+ * update_va_mapping calls in a multicall defer their TLB flushes, to merge
+ * them.  Carry those out before any other call, which may depend on them.
+ */
+static void pv_multicall_end_run(unsigned long op)
+{
+    if ( op != __HYPERVISOR_update_va_mapping &&
+         op != __HYPERVISOR_update_va_mapping_otherdomain )
+        pv_multicall_flush();
 }
 
 enum mc_disposition pv_do_multicall_call(struct mc_state *state)
@@ -257,6 +273,7 @@ enum mc_disposition pv_do_multicall_call(struct mc_state *state)
         struct compat_multicall_entry *call = &state->compat_call;
 
         op = call->op;
+        pv_multicall_end_run(op);
         if ( (op < ARRAY_SIZE(pv_hypercall_table)) &&
              pv_hypercall_table[op].compat )
             call->result = pv_hypercall_table[op].compat(
@@ -271,6 +288,7 @@ enum mc_disposition pv_do_multicall_call(struct mc_state *state)
         struct multicall_entry *call = &state->call;
 
         op = call->op;
+        pv_multicall_end_run(op);
         if ( (op < ARRAY_SIZE(pv_hypercall_table)) &&
              pv_hypercall_table[op].native )
             call->result = pv_hypercall_table[op].native(
@@ -1799,6 +1799,8 @@ void do_nmi(const struct cpu_user_regs *regs)
     /* Only the BSP gets external NMIs from the system. */
     if ( cpu == nmi_cpu )
     {
+        if ( (reason & 0xc0) || handle_unknown )
+            trace_freeze(TRACE_FREEZE_NMI);
         if ( reason & 0x80 )
             pci_serr_error(regs);
         if ( reason & 0x40 )
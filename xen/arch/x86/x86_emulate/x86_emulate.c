@@ -885,6 +885,15 @@ struct x86_emulate_state {
      */
     struct operand ea;
 
+    /*
+     * Recipe for re-computing ea.mem.off from register state: GPR numbers
+     * of base and index (-1 if absent; index is scaled by sib_scale), the
+     * accumulated displacement, and whether the address is rIP-relative.
+     */
+    int8_t ea_base, ea_index;
+    bool ea_pc_rel;
+    unsigned long ea_disp;
+
     /* Immediate operand values, if any. Use otherwise unused fields. */
 #define imm1 ea.val
 #define imm2 ea.orig_val
@@ -2921,6 +2930,25 @@ x86_decode_0f3a(
     return X86EMUL_OKAY;
 }
 
+/*
+ * Compute the memory operand's offset from the decoded address recipe and
+ * the current register state.
+ */
+static void
+decode_ea(struct x86_emulate_state *state)
+{
+    unsigned long off = state->ea_disp;
+
+    if ( state->ea_base >= 0 )
+        off += *decode_gpr(state->regs, state->ea_base);
+    if ( state->ea_index >= 0 )
+        off += *decode_gpr(state->regs, state->ea_index) << state->sib_scale;
+    if ( state->ea_pc_rel )
+        off += state->ip;
+
+    ea.mem.off = truncate_ea(off);
+}
+
 static int
 x86_decode(
     struct x86_emulate_state *state,
@@ -2930,7 +2958,6 @@ x86_decode(
     uint8_t b, d;
     unsigned int def_op_bytes, def_ad_bytes, opcode;
     enum x86_segment override_seg = x86_seg_none;
-    bool pc_rel = false;
     int rc = X86EMUL_OKAY;
 
     ASSERT(ops->insn_fetch);
@@ -2939,6 +2966,7 @@ x86_decode(
     ea.type = OP_NONE;
     ea.mem.seg = x86_seg_ds;
     ea.reg = PTR_POISON;
+    state->ea_base = state->ea_index = -1;
     state->regs = ctxt->regs;
     state->ip = ctxt->regs->r(ip);
 
@@ -3383,33 +3411,37 @@ x86_decode(
             switch ( modrm_rm )
             {
             case 0:
-                ea.mem.off = state->regs->bx + state->regs->si;
+                state->ea_base = 3; /* %bx */
+                state->ea_index = 6; /* %si */
                 break;
             case 1:
-                ea.mem.off = state->regs->bx + state->regs->di;
+                state->ea_base = 3; /* %bx */
+                state->ea_index = 7; /* %di */
                 break;
             case 2:
                 ea.mem.seg = x86_seg_ss;
-                ea.mem.off = state->regs->bp + state->regs->si;
+                state->ea_base = 5; /* %bp */
+                state->ea_index = 6; /* %si */
                 break;
             case 3:
                 ea.mem.seg = x86_seg_ss;
-                ea.mem.off = state->regs->bp + state->regs->di;
+                state->ea_base = 5; /* %bp */
+                state->ea_index = 7; /* %di */
                 break;
             case 4:
-                ea.mem.off = state->regs->si;
+                state->ea_base = 6; /* %si */
                 break;
             case 5:
-                ea.mem.off = state->regs->di;
+                state->ea_base = 7; /* %di */
                 break;
             case 6:
                 if ( modrm_mod == 0 )
                     break;
                 ea.mem.seg = x86_seg_ss;
-                ea.mem.off = state->regs->bp;
+                state->ea_base = 5; /* %bp */
                 break;
             case 7:
-                ea.mem.off = state->regs->bx;
+                state->ea_base = 3; /* %bx */
                 break;
             }
             switch ( modrm_mod )
@@ -3441,34 +3473,30 @@ x86_decode(
                     state->sib_index |= (mode_64bit() && evex_encoded() &&
                                          !evex.RX) << 4;
                 else if ( state->sib_index != 4 )
-                {
-                    ea.mem.off = *decode_gpr(state->regs, state->sib_index);
-                    ea.mem.off <<= state->sib_scale;
-                }
+                    state->ea_index = state->sib_index;
                 if ( (modrm_mod == 0) && ((sib_base & 7) == 5) )
                     ea.mem.off += insn_fetch_type(int32_t);
                 else if ( sib_base == 4 )
                 {
                     ea.mem.seg  = x86_seg_ss;
-                    ea.mem.off += state->regs->r(sp);
+                    state->ea_base = sib_base;
                     if ( !ext && (b == 0x8f) )
                         /* POP <rm> computes its EA post increment. */
                         ea.mem.off += ((mode_64bit() && (op_bytes == 4))
                                        ? 8 : op_bytes);
                 }
-                else if ( sib_base == 5 )
+                else
                 {
-                    ea.mem.seg  = x86_seg_ss;
-                    ea.mem.off += state->regs->r(bp);
+                    if ( sib_base == 5 )
+                        ea.mem.seg  = x86_seg_ss;
+                    state->ea_base = sib_base;
                 }
-                else
-                    ea.mem.off += *decode_gpr(state->regs, sib_base);
             }
             else
             {
                 generate_exception_if(d & vSIB, EXC_UD);
                 modrm_rm |= (rex_prefix & 1) << 3;
-                ea.mem.off = *decode_gpr(state->regs, modrm_rm);
+                state->ea_base = modrm_rm;
                 if ( (modrm_rm == 5) && (modrm_mod != 0) )
                     ea.mem.seg = x86_seg_ss;
             }
@@ -3477,8 +3505,9 @@ x86_decode(
             case 0:
                 if ( (modrm_rm & 7) != 5 )
                     break;
+                state->ea_base = -1;
                 ea.mem.off = insn_fetch_type(int32_t);
-                pc_rel = mode_64bit();
+                state->ea_pc_rel = mode_64bit();
                 break;
             case 1:
                 ea.mem.off += insn_fetch_type(int8_t) * (1 << disp8scale);
@@ -3578,10 +3607,8 @@ x86_decode(
 
     if ( ea.type == OP_MEM )
     {
-        if ( pc_rel )
-            ea.mem.off += state->ip;
-
-        ea.mem.off = truncate_ea(ea.mem.off);
+        state->ea_disp = ea.mem.off;
+        decode_ea(state);
     }
 
     /*
@@ -3681,6 +3708,105 @@ x86_decode(
 #undef insn_fetch_bytes
 #undef insn_fetch_type
 
+/*
+ * Decoding depends only on the instruction bytes and a few bits of mode
+ * state, so a cached decode can be re-used for any instruction with the
+ * same bytes, with just the memory operand's offset re-computed from the
+ * current register state.  Keying on the bytes themselves (rather than on
+ * rIP and the address space) means modified code can't hit stale entries.
+ */
+#define DECODE_CACHE_ENTRIES 8
+
+struct x86_emulate_decode_cache {
+    unsigned int next;
+    struct decode_cache_entry {
+        const struct cpuid_policy *cpuid;
+        uint8_t len, addr_size;
+        bool vm86, realmode;
+        uint8_t bytes[MAX_INST_LEN];
+        unsigned int opcode;
+        struct x86_emulate_state state;
+    } ent[DECODE_CACHE_ENTRIES];
+};
+
+struct x86_emulate_decode_cache *x86_decode_cache_alloc(void)
+{
+    return xzalloc(struct x86_emulate_decode_cache);
+}
+
+void x86_decode_cache_free(struct x86_emulate_decode_cache *cache)
+{
+    xfree(cache);
+}
+
+static bool
+decode_cache_mode_match(
+    const struct decode_cache_entry *ent,
+    struct x86_emulate_ctxt *ctxt,
+    const struct x86_emulate_ops *ops)
+{
+    return ent->len && ent->cpuid == ctxt->cpuid &&
+           ent->addr_size == ctxt->addr_size &&
+           ent->vm86 == !!(ctxt->regs->eflags & X86_EFLAGS_VM) &&
+           (ctxt->addr_size == 64 ||
+            ent->realmode == in_realmode(ctxt, ops));
+}
+
+static bool
+decode_cache_lookup(
+    struct x86_emulate_state *state,
+    struct x86_emulate_ctxt *ctxt,
+    const struct x86_emulate_ops *ops)
+{
+    const struct x86_emulate_decode_cache *cache = ctxt->decode_cache;
+    unsigned int i;
+
+    for ( i = 0; i < ARRAY_SIZE(cache->ent); ++i )
+    {
+        const struct decode_cache_entry *ent = &cache->ent[i];
+
+        if ( ent->len > ctxt->insn_bytes_len ||
+             memcmp(ent->bytes, ctxt->insn_bytes, ent->len) ||
+             !decode_cache_mode_match(ent, ctxt, ops) )
+            continue;
+
+        *state = ent->state;
+        state->regs = ctxt->regs;
+        state->ip = ctxt->regs->r(ip) + ent->len;
+        if ( ea.type == OP_MEM )
+            decode_ea(state);
+        ctxt->opcode = ent->opcode;
+
+        return true;
+    }
+
+    return false;
+}
+
+static void
+decode_cache_insert(
+    const struct x86_emulate_state *state,
+    struct x86_emulate_ctxt *ctxt,
+    const struct x86_emulate_ops *ops)
+{
+    struct x86_emulate_decode_cache *cache = ctxt->decode_cache;
+    struct decode_cache_entry *ent;
+    unsigned int len = state->ip - ctxt->regs->r(ip);
+
+    if ( !len || len > MAX_INST_LEN || len > ctxt->insn_bytes_len )
+        return;
+
+    ent = &cache->ent[cache->next++ % ARRAY_SIZE(cache->ent)];
+    ent->cpuid = ctxt->cpuid;
+    ent->len = len;
+    ent->addr_size = ctxt->addr_size;
+    ent->vm86 = ctxt->regs->eflags & X86_EFLAGS_VM;
+    ent->realmode = ctxt->addr_size != 64 && in_realmode(ctxt, ops);
+    memcpy(ent->bytes, ctxt->insn_bytes, len);
+    ent->opcode = ctxt->opcode;
+    ent->state = *state;
+}
+
 /* Undo DEBUG wrapper. */
 #undef x86_emulate
 
@@ -3721,9 +3847,19 @@ x86_emulate(
                            (_regs.eflags & X86_EFLAGS_VIP)),
                           EXC_GP, 0);
 
-    rc = x86_decode(&state, ctxt, ops);
-    if ( rc != X86EMUL_OKAY )
-        return rc;
+    ctxt->decode_cached = ctxt->decode_cache &&
+                          decode_cache_lookup(&state, ctxt, ops);
+    if ( ctxt->decode_cached )
+        rc = X86EMUL_OKAY;
+    else
+    {
+        rc = x86_decode(&state, ctxt, ops);
+        if ( rc != X86EMUL_OKAY )
+            return rc;
+
+        if ( ctxt->decode_cache )
+            decode_cache_insert(&state, ctxt, ops);
+    }
 
     /* Sync rIP to post decode value. */
     _regs.r(ip) = state.ip;
@@ -559,6 +559,7 @@ struct x86_emulate_ops
 };
 
 struct cpu_user_regs;
+struct x86_emulate_decode_cache;
 
 struct x86_emulate_ctxt
 {
@@ -575,6 +576,15 @@ struct x86_emulate_ctxt
     /* Caller data that can be used by x86_emulate_ops' routines. */
     void *data;
 
+    /*
+     * Optional cache of decoded instructions (see x86_decode_cache_alloc()),
+     * along with the instruction bytes already fetched from rIP onwards.
+     * Only instructions lying entirely within these bytes get cached.
+     */
+    struct x86_emulate_decode_cache *decode_cache;
+    const uint8_t *insn_bytes;
+    unsigned int insn_bytes_len;
+
     /*
      * Input/output state:
      */
@@ -612,6 +622,9 @@ struct x86_emulate_ctxt
 
     bool event_pending;
     struct x86_event event;
+
+    /* Decoding was satisfied from decode_cache. */
+    bool decode_cached;
 };
 
 /*
@@ -754,6 +767,9 @@ x86_decode_insn(
         void *p_data, unsigned int bytes,
         struct x86_emulate_ctxt *ctxt));
 
+struct x86_emulate_decode_cache *x86_decode_cache_alloc(void);
+void x86_decode_cache_free(struct x86_emulate_decode_cache *cache);
+
 unsigned int
 x86_insn_opsize(const struct x86_emulate_state *state);
 int
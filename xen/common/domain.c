@@ -20,6 +20,7 @@
 #include <xen/softirq.h>
 #include <xen/tasklet.h>
 #include <xen/domain_page.h>
+#include <xen/domstats.h>
 #include <xen/rangeset.h>
 #include <xen/guest_access.h>
 #include <xen/hypercall.h>
@@ -215,6 +216,7 @@ static int vcpu_teardown(struct vcpu *v)
  */
 static void vcpu_destroy(struct vcpu *v)
 {
+    domstats_vcpu_destroy(v);
     free_vcpu_struct(v);
 }
 
@@ -269,6 +271,9 @@ struct vcpu *vcpu_create(struct domain *d, unsigned int vcpu_id)
     if ( vmtrace_alloc_buffer(v) != 0 )
         goto fail_wq;
 
+    if ( !is_idle_domain(d) && domstats_vcpu_init(v) != 0 )
+        goto fail_sched;
+
     if ( arch_vcpu_create(v) != 0 )
         goto fail_sched;
 
@@ -957,12 +962,14 @@ void __domain_crash(struct domain *d)
     }
     else if ( d == current->domain )
     {
+        trace_freeze(TRACE_FREEZE_CRASH);
         printk("Domain %d (vcpu#%d) crashed on cpu#%d:\n",
                d->domain_id, current->vcpu_id, smp_processor_id());
         show_execution_state(guest_cpu_user_regs());
     }
     else
     {
+        trace_freeze(TRACE_FREEZE_CRASH);
         printk("Domain %d reported crashed by domain %d on cpu#%d:\n",
                d->domain_id, current->domain->domain_id, smp_processor_id());
     }
@@ -0,0 +1,306 @@
+/******************************************************************************
+ * domstats.c
+ *
+ * Per-domain statistics of VM exits, hypercalls and instruction emulation,
+ * presented in hypfs as /domain/<domid>/{exits,hypercalls,emulation}.
+ */
+
+#include <xen/domstats.h>
+#include <xen/err.h>
+#include <xen/guest_access.h>
+#include <xen/hypfs.h>
+#include <xen/init.h>
+#include <xen/lib.h>
+#include <xen/rcupdate.h>
+#include <xen/sched.h>
+#include <xen/xmalloc.h>
+
+int domstats_vcpu_init(struct vcpu *v)
+{
+    v->stats = xzalloc(struct vcpu_stats);
+
+    return v->stats ? 0 : -ENOMEM;
+}
+
+void domstats_vcpu_destroy(struct vcpu *v)
+{
+    XFREE(v->stats);
+}
+
+struct domstats_dyndata {
+    struct hypfs_dyndir_id id;          /* Must be first. */
+
+    /* Text of the leaf last read, generated once per hypfs operation. */
+    const struct hypfs_entry *entry;
+    char *text;
+    unsigned int len;
+};
+
+struct domstats_sum {
+    uint64_t count;
+    uint64_t total_ns;
+    uint64_t bucket[DOMSTATS_NR_BUCKETS];
+};
+
+static HYPFS_DIR_INIT(domstats_domdir, "%u");
+
+static int domstats_leaf_read(const struct hypfs_entry *entry,
+                              XEN_GUEST_HANDLE_PARAM(void) uaddr);
+static unsigned int domstats_leaf_getsize(const struct hypfs_entry *entry);
+
+static const struct hypfs_funcs domstats_leaf_funcs = {
+    .enter = hypfs_node_enter,
+    .exit = hypfs_node_exit,
+    .read = domstats_leaf_read,
+    .write = hypfs_write_deny,
+    .getsize = domstats_leaf_getsize,
+    .findentry = hypfs_leaf_findentry,
+};
+
+static HYPFS_VARSIZE_INIT(domstats_exits_leaf, XEN_HYPFS_TYPE_STRING,
+                          "exits", 0, &domstats_leaf_funcs);
+static HYPFS_VARSIZE_INIT(domstats_hypercalls_leaf, XEN_HYPFS_TYPE_STRING,
+                          "hypercalls", 0, &domstats_leaf_funcs);
+static HYPFS_VARSIZE_INIT(domstats_emulation_leaf, XEN_HYPFS_TYPE_STRING,
+                          "emulation", 0, &domstats_leaf_funcs);
+
+/*
+ * One line per index with any events: the index (omitted for emulation),
+ * the number of events, their total time in ns and the histogram buckets.
+ */
+static unsigned int format(char *buf, unsigned int size,
+                           const struct domstats_sum *sum, unsigned int nr,
+                           bool indexed)
+{
+    unsigned int i, j, len = 0;
+
+    for ( i = 0; i < nr; i++ )
+    {
+        if ( !sum[i].count )
+            continue;
+
+        if ( indexed )
+            len += snprintf(buf + len, size > len ? size - len : 0, "%u ", i);
+        len += snprintf(buf + len, size > len ? size - len : 0,
+                        "%"PRIu64" %"PRIu64, sum[i].count, sum[i].total_ns);
+        for ( j = 0; j < DOMSTATS_NR_BUCKETS; j++ )
+            len += snprintf(buf + len, size > len ? size - len : 0,
+                            " %"PRIu64, sum[i].bucket[j]);
+        len += snprintf(buf + len, size > len ? size - len : 0, "\n");
+    }
+
+    return len;
+}
+
+static int domstats_generate(const struct hypfs_entry *entry)
+{
+    struct domstats_dyndata *data = hypfs_get_dyndata();
+    const struct domain *d = data->id.data;
+    const struct vcpu *v;
+    struct domstats_sum *sum;
+    unsigned int nr, offs, i, j, len;
+    char *text;
+
+    if ( data->entry == entry )
+        return 0;
+
+    if ( entry == &domstats_exits_leaf.e )
+    {
+        offs = offsetof(struct vcpu_stats, exit);
+        nr = DOMSTATS_NR_EXITS;
+    }
+    else if ( entry == &domstats_hypercalls_leaf.e )
+    {
+        offs = offsetof(struct vcpu_stats, hypercall);
+        nr = NR_hypercalls;
+    }
+    else
+    {
+        offs = offsetof(struct vcpu_stats, emulation);
+        nr = 1;
+    }
+
+    sum = xzalloc_array(struct domstats_sum, nr);
+    if ( !sum )
+        return -ENOMEM;
+
+    /* The vCPUs keep counting meanwhile, so take a snapshot to format. */
+    for_each_vcpu ( d, v )
+    {
+        const struct domstats_hist *h;
+
+        if ( !v->stats )
+            continue;
+
+        h = (const void *)v->stats + offs;
+        for ( i = 0; i < nr; i++ )
+        {
+            sum[i].total_ns += read_atomic(&h[i].total_ns);
+            for ( j = 0; j < DOMSTATS_NR_BUCKETS; j++ )
+            {
+                uint32_t n = read_atomic(&h[i].bucket[j]);
+
+                sum[i].bucket[j] += n;
+                sum[i].count += n;
+            }
+        }
+    }
+
+    len = format(NULL, 0, sum, nr, nr > 1) + 1;
+    text = xmalloc_array(char, len);
+    if ( !text )
+    {
+        xfree(sum);
+        return -ENOMEM;
+    }
+    format(text, len, sum, nr, nr > 1);
+    xfree(sum);
+
+    xfree(data->text);
+    data->entry = entry;
+    data->text = text;
+    data->len = len;
+
+    return 0;
+}
+
+static unsigned int domstats_leaf_getsize(const struct hypfs_entry *entry)
+{
+    const struct domstats_dyndata *data = hypfs_get_dyndata();
+
+    /* A failure is reported by the read. */
+    return domstats_generate(entry) ? 0 : data->len;
+}
+
+static int domstats_leaf_read(const struct hypfs_entry *entry,
+                              XEN_GUEST_HANDLE_PARAM(void) uaddr)
+{
+    const struct domstats_dyndata *data = hypfs_get_dyndata();
+
+    /* Always preceded by a getsize(), which generated the text. */
+    if ( data->entry != entry )
+        return -ENOMEM;
+
+    return copy_to_guest(uaddr, data->text, data->len) ? -EFAULT : 0;
+}
+
+static int domstats_dir_read(const struct hypfs_entry *entry,
+                             XEN_GUEST_HANDLE_PARAM(void) uaddr)
+{
+    const struct domain *d;
+    int ret = 0;
+
+    rcu_read_lock(&domlist_read_lock);
+
+    for_each_domain ( d )
+    {
+        ret = hypfs_read_dyndir_id_entry(&domstats_domdir, d->domain_id,
+                                         !d->next_in_list, &uaddr);
+        if ( ret )
+            break;
+    }
+
+    rcu_read_unlock(&domlist_read_lock);
+
+    return ret;
+}
+
+static unsigned int domstats_dir_getsize(const struct hypfs_entry *entry)
+{
+    const struct domain *d;
+    unsigned int size = 0;
+
+    rcu_read_lock(&domlist_read_lock);
+
+    for_each_domain ( d )
+        size += hypfs_dynid_entry_size(entry, d->domain_id);
+
+    rcu_read_unlock(&domlist_read_lock);
+
+    return size;
+}
+
+static const struct hypfs_entry *domstats_dir_enter(
+    const struct hypfs_entry *entry)
+{
+    struct domstats_dyndata *data;
+
+    data = hypfs_alloc_dyndata(struct domstats_dyndata);
+    if ( !data )
+        return ERR_PTR(-ENOMEM);
+    data->id.id = DOMID_INVALID;
+
+    return entry;
+}
+
+static void domstats_dir_exit(const struct hypfs_entry *entry)
+{
+    struct domstats_dyndata *data = hypfs_get_dyndata();
+
+    if ( data->id.data )
+        put_domain((struct domain *)data->id.data);
+    xfree(data->text);
+
+    hypfs_free_dyndata();
+}
+
+static struct hypfs_entry *domstats_dir_findentry(
+    const struct hypfs_entry_dir *dir, const char *name, unsigned int name_len)
+{
+    struct domstats_dyndata *data = hypfs_get_dyndata();
+    unsigned long id;
+    const char *end;
+    struct domain *d;
+
+    id = simple_strtoul(name, &end, 10);
+    if ( end != name + name_len || id >= DOMID_FIRST_RESERVED )
+        return ERR_PTR(-ENOENT);
+
+    /* The reference keeps the vCPUs' statistics until the exit() hook. */
+    d = get_domain_by_id(id);
+    if ( !d )
+        return ERR_PTR(-ENOENT);
+
+    if ( data->id.data )
+        put_domain((struct domain *)data->id.data);
+
+    return hypfs_gen_dyndir_id_entry(&domstats_domdir, id, d);
+}
+
+static const struct hypfs_funcs domstats_dir_funcs = {
+    .enter = domstats_dir_enter,
+    .exit = domstats_dir_exit,
+    .read = domstats_dir_read,
+    .write = hypfs_write_deny,
+    .getsize = domstats_dir_getsize,
+    .findentry = domstats_dir_findentry,
+};
+
+static HYPFS_DIR_INIT_FUNC(domstats_dir, "domain", &domstats_dir_funcs);
+
+static int __init domstats_hypfs_init(void)
+{
+    hypfs_add_dir(&hypfs_root, &domstats_dir, true);
+    hypfs_add_dyndir(&domstats_dir, &domstats_domdir);
+
+    /* The leaves' content is generated on access. */
+    hypfs_string_set_reference(&domstats_emulation_leaf, "");
+    hypfs_add_leaf(&domstats_domdir, &domstats_emulation_leaf, true);
+    hypfs_string_set_reference(&domstats_exits_leaf, "");
+    hypfs_add_leaf(&domstats_domdir, &domstats_exits_leaf, true);
+    hypfs_string_set_reference(&domstats_hypercalls_leaf, "");
+    hypfs_add_leaf(&domstats_domdir, &domstats_hypercalls_leaf, true);
+
+    return 0;
+}
+__initcall(domstats_hypfs_init);
+
+/*
+ * Local variables:
+ * mode: C
+ * c-file-style: "BSD"
+ * c-basic-offset: 4
+ * tab-width: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
@@ -24,6 +24,7 @@
 #include <xen/irq.h>
 #include <xen/lib.h>
 #include <xen/paging.h>
+#include <xen/perfc.h>
 #include <xen/sched.h>
 #include <xen/softirq.h>
 #include <xen/trace.h>
@@ -500,6 +501,9 @@ static void ioreq_server_free_rangesets(struct ioreq_server *s)
 
     for ( i = 0; i < NR_IO_RANGE_TYPES; i++ )
         rangeset_destroy(s->range[i]);
+
+    for ( i = 0; i < NR_POSTED_RANGE_TYPES; i++ )
+        rangeset_destroy(s->posted[i]);
 }
 
 static int ioreq_server_alloc_rangesets(struct ioreq_server *s,
@@ -532,6 +536,29 @@ static int ioreq_server_alloc_rangesets(struct ioreq_server *s,
         rangeset_limit(s->range[i], MAX_NR_IO_RANGES);
     }
 
+    for ( i = 0; i < NR_POSTED_RANGE_TYPES; i++ )
+    {
+        char *name;
+
+        rc = asprintf(&name, "ioreq_server %d posted %s", id,
+                      (i == XEN_DMOP_IO_RANGE_PORT) ? "port" :
+                      (i == XEN_DMOP_IO_RANGE_MEMORY) ? "memory" :
+                      "");
+        if ( rc )
+            goto fail;
+
+        s->posted[i] = rangeset_new(s->target, name,
+                                    RANGESETF_prettyprint_hex);
+
+        xfree(name);
+
+        rc = -ENOMEM;
+        if ( !s->posted[i] )
+            goto fail;
+
+        rangeset_limit(s->posted[i], MAX_NR_IO_RANGES);
+    }
+
     return 0;
 
  fail:
@@ -941,6 +968,96 @@ static int ioreq_server_unmap_io_range(struct domain *d, ioservid_t id,
 
     rc = rangeset_remove_range(r, start, end);
 
+    /* Writes to a range no longer emulated by the server cannot be posted. */
+    if ( !rc && type < NR_POSTED_RANGE_TYPES )
+        rc = rangeset_remove_range(s->posted[type], start, end);
+
+ out:
+    spin_unlock_recursive(&d->ioreq_server.lock);
+
+    return rc;
+}
+
+static int ioreq_server_map_posted_range(struct domain *d, ioservid_t id,
+                                         uint32_t type, uint64_t start,
+                                         uint64_t end)
+{
+    struct ioreq_server *s;
+    int rc;
+
+    if ( start > end )
+        return -EINVAL;
+
+    spin_lock_recursive(&d->ioreq_server.lock);
+
+    s = get_ioreq_server(d, id);
+
+    rc = -ENOENT;
+    if ( !s )
+        goto out;
+
+    rc = -EPERM;
+    if ( s->emulator != current->domain )
+        goto out;
+
+    rc = -EOPNOTSUPP;
+    if ( !HANDLE_BUFIOREQ(s) )
+        goto out;
+
+    rc = -EINVAL;
+    if ( type >= NR_POSTED_RANGE_TYPES )
+        goto out;
+
+    type = array_index_nospec(type, NR_POSTED_RANGE_TYPES);
+    if ( !rangeset_contains_range(s->range[type], start, end) )
+        goto out;
+
+    rc = -EEXIST;
+    if ( rangeset_overlaps_range(s->posted[type], start, end) )
+        goto out;
+
+    rc = rangeset_add_range(s->posted[type], start, end);
+
+ out:
+    spin_unlock_recursive(&d->ioreq_server.lock);
+
+    return rc;
+}
+
+static int ioreq_server_unmap_posted_range(struct domain *d, ioservid_t id,
+                                           uint32_t type, uint64_t start,
+                                           uint64_t end)
+{
+    struct ioreq_server *s;
+    int rc;
+
+    if ( start > end )
+        return -EINVAL;
+
+    spin_lock_recursive(&d->ioreq_server.lock);
+
+    s = get_ioreq_server(d, id);
+
+    rc = -ENOENT;
+    if ( !s )
+        goto out;
+
+    rc = -EPERM;
+    if ( s->emulator != current->domain )
+        goto out;
+
+    rc = -EINVAL;
+    if ( type >= NR_POSTED_RANGE_TYPES )
+        goto out;
+
+    type = array_index_nospec(type, NR_POSTED_RANGE_TYPES);
+
+    rc = -ENOENT;
+    if ( !rangeset_contains_range(s->posted[type], start, end) )
+        goto out;
+
+    rc = rangeset_remove_range(s->posted[type], start, end);
+
  out:
     spin_unlock_recursive(&d->ioreq_server.lock);
 
@@ -1157,83 +1274,54 @@ struct ioreq_server *ioreq_server_select(struct domain *d,
     return NULL;
 }
 
-static int ioreq_send_buffered(struct ioreq_server *s, ioreq_t *p)
+static int ioreq_buffered_size(unsigned int size)
 {
-    struct domain *d = current->domain;
-    struct ioreq_page *iorp;
-    buffered_iopage_t *pg;
-    buf_ioreq_t bp = { .data = p->data,
-                       .addr = p->addr,
-                       .type = p->type,
-                       .dir = p->dir };
-    /* Timeoffset sends 64b data, but no address. Use two consecutive slots. */
-    int qw = 0;
-
-    /* Ensure buffered_iopage fits in a page */
-    BUILD_BUG_ON(sizeof(buffered_iopage_t) > PAGE_SIZE);
-
-    iorp = &s->bufioreq;
-    pg = iorp->va;
-
-    if ( !pg )
-        return IOREQ_STATUS_UNHANDLED;
-
-    /*
-     * Return 0 for the cases we can't deal with:
-     *  - 'addr' is only a 20-bit field, so we cannot address beyond 1MB
-     *  - we cannot buffer accesses to guest memory buffers, as the guest
-     *    may expect the memory buffer to be synchronously accessed
-     *  - the count field is usually used with data_is_ptr and since we don't
-     *    support data_is_ptr we do not waste space for the count field either
-     */
-    if ( (p->addr > 0xffffful) || p->data_is_ptr || (p->count != 1) )
-        return 0;
-
-    switch ( p->size )
+    switch ( size )
     {
     case 1:
-        bp.size = 0;
-        break;
+        return 0;
     case 2:
-        bp.size = 1;
-        break;
+        return 1;
     case 4:
-        bp.size = 2;
-        break;
+        return 2;
     case 8:
-        bp.size = 3;
-        qw = 1;
-        break;
-    default:
-        gdprintk(XENLOG_WARNING, "unexpected ioreq size: %u\n", p->size);
-        return IOREQ_STATUS_UNHANDLED;
+        return 3;
     }
 
+    gdprintk(XENLOG_WARNING, "unexpected ioreq size: %u\n", size);
+    return -1;
+}
+
+/* Queue @nr consecutive slots on the buffered ring of @s. */
+static int ioreq_buffered_push(struct ioreq_server *s, const buf_ioreq_t *bp,
+                               unsigned int nr)
+{
+    struct domain *d = current->domain;
+    buffered_iopage_t *pg = s->bufioreq.va;
+    unsigned int i;
+
     spin_lock(&s->bufioreq_lock);
 
-    if ( (pg->ptrs.write_pointer - pg->ptrs.read_pointer) >=
-         (IOREQ_BUFFER_SLOT_NUM - qw) )
+    if ( (pg->ptrs.write_pointer - pg->ptrs.read_pointer) >
+         (IOREQ_BUFFER_SLOT_NUM - nr) )
     {
         /* The queue is full: send the iopacket through the normal path. */
         spin_unlock(&s->bufioreq_lock);
         return IOREQ_STATUS_UNHANDLED;
     }
 
-    pg->buf_ioreq[pg->ptrs.write_pointer % IOREQ_BUFFER_SLOT_NUM] = bp;
-
-    if ( qw )
-    {
-        bp.data = p->data >> 32;
-        pg->buf_ioreq[(pg->ptrs.write_pointer+1) % IOREQ_BUFFER_SLOT_NUM] = bp;
-    }
+    for ( i = 0; i < nr; i++ )
+        pg->buf_ioreq[(pg->ptrs.write_pointer + i) % IOREQ_BUFFER_SLOT_NUM] =
+            bp[i];
 
     /* Make the ioreq_t visible /before/ write_pointer. */
     smp_wmb();
-    pg->ptrs.write_pointer += qw ? 2 : 1;
+    pg->ptrs.write_pointer += nr;
 
     /* Canonicalize read/write pointers to prevent their overflow. */
+    i = nr - 1;
     while ( (s->bufioreq_handling == HVM_IOREQSRV_BUFIOREQ_ATOMIC) &&
-            qw++ < IOREQ_BUFFER_SLOT_NUM &&
+            i++ < IOREQ_BUFFER_SLOT_NUM &&
             pg->ptrs.read_pointer >= IOREQ_BUFFER_SLOT_NUM )
     {
         union bufioreq_pointers old = pg->ptrs, new;
@@ -1250,6 +1338,100 @@ static int ioreq_send_buffered(struct ioreq_server *s, ioreq_t *p)
     return IOREQ_STATUS_HANDLED;
 }
 
+static int ioreq_send_buffered(struct ioreq_server *s, ioreq_t *p)
+{
+    buf_ioreq_t bp[2] = {
+        { .data = p->data,
+          .addr = p->addr,
+          .type = p->type,
+          .dir = p->dir },
+    };
+    int size;
+
+    /* Ensure buffered_iopage fits in a page */
+    BUILD_BUG_ON(sizeof(buffered_iopage_t) > PAGE_SIZE);
+
+    if ( !s->bufioreq.va )
+        return IOREQ_STATUS_UNHANDLED;
+
+    /*
+     * Return 0 for the cases we can't deal with:
+     *  - 'addr' is only a 20-bit field, so we cannot address beyond 1MB
+     *  - we cannot buffer accesses to guest memory buffers, as the guest
+     *    may expect the memory buffer to be synchronously accessed
+     *  - the count field is usually used with data_is_ptr and since we don't
+     *    support data_is_ptr we do not waste space for the count field either
+     */
+    if ( (p->addr > 0xffffful) || p->data_is_ptr || (p->count != 1) )
+        return 0;
+
+    size = ioreq_buffered_size(p->size);
+    if ( size < 0 )
+        return IOREQ_STATUS_UNHANDLED;
+
+    bp[0].size = size;
+    if ( p->size != 8 )
+        return ioreq_buffered_push(s, bp, 1);
+
+    /* Timeoffset sends 64b data, but no address. Use two consecutive slots. */
+    bp[1] = bp[0];
+    bp[1].data = p->data >> 32;
+
+    return ioreq_buffered_push(s, bp, 2);
+}
+
+static bool ioreq_is_posted(const struct ioreq_server *s, const ioreq_t *p)
+{
+    if ( p->dir != IOREQ_WRITE || p->data_is_ptr || p->count != 1 )
+        return false;
+
+    switch ( p->type )
+    {
+    case IOREQ_TYPE_PIO:
+        return rangeset_contains_range(s->posted[XEN_DMOP_IO_RANGE_PORT],
+                                       p->addr, p->addr + p->size - 1);
+
+    case IOREQ_TYPE_COPY:
+        return rangeset_contains_range(s->posted[XEN_DMOP_IO_RANGE_MEMORY],
+                                       ioreq_mmio_first_byte(p),
+                                       ioreq_mmio_last_byte(p));
+    }
+
+    return false;
+}
+
+/*
+ * Post a write without waiting for the device model. Unlike the legacy
+ * buffered path the full address is conveyed, using an extension slot.
+ */
+static int ioreq_send_posted(struct ioreq_server *s, const ioreq_t *p)
+{
+    buf_ioreq_t bp[3] = {
+        { .data = p->data,
+          .addr = p->addr & ((1u << BUF_IOREQ_ADDR_SHIFT) - 1),
+          .type = p->type,
+          .dir = IOREQ_WRITE,
+          .ext = 1 },
+    };
+    unsigned int nr = 1;
+    int size = ioreq_buffered_size(p->size);
+
+    if ( size < 0 )
+        return IOREQ_STATUS_UNHANDLED;
+
+    bp[0].size = size;
+    if ( p->size == 8 )
+    {
+        bp[nr] = bp[0];
+        bp[nr++].data = p->data >> 32;
+    }
+
+    bp[nr].type = p->type;
+    bp[nr++].data = p->addr >> BUF_IOREQ_ADDR_SHIFT;
+
+    return ioreq_buffered_push(s, bp, nr);
+}
+
 int ioreq_send(struct ioreq_server *s, ioreq_t *proto_p,
                bool buffered)
 {
@@ -1262,6 +1444,18 @@ int ioreq_send(struct ioreq_server *s, ioreq_t *proto_p,
     if ( buffered )
         return ioreq_send_buffered(s, proto_p);
 
+    if ( ioreq_is_posted(s, proto_p) )
+    {
+        if ( ioreq_send_posted(s, proto_p) == IOREQ_STATUS_HANDLED )
+        {
+            perfc_incr(ioreq_posted);
+            return IOREQ_STATUS_HANDLED;
+        }
+
+        /* The ring is full: fall back to the synchronous path. */
+        perfc_incr(ioreq_posted_full);
+    }
+
     if ( unlikely(!vcpu_start_shutdown_deferral(curr)) )
         return IOREQ_STATUS_RETRY;
 
@@ -1406,6 +1600,34 @@ int ioreq_server_dm_op(struct xen_dm_op *op, struct domain *d, bool *const_op)
         break;
     }
 
+    case XEN_DMOP_map_posted_io_range:
+    {
+        const struct xen_dm_op_ioreq_server_range *data =
+            &op->u.map_posted_io_range;
+
+        rc = -EINVAL;
+        if ( data->pad )
+            break;
+
+        rc = ioreq_server_map_posted_range(d, data->id, data->type,
+                                           data->start, data->end);
+        break;
+    }
+
+    case XEN_DMOP_unmap_posted_io_range:
+    {
+        const struct xen_dm_op_ioreq_server_range *data =
+            &op->u.unmap_posted_io_range;
+
+        rc = -EINVAL;
+        if ( data->pad )
+            break;
+
+        rc = ioreq_server_unmap_posted_range(d, data->id, data->type,
+                                             data->start, data->end);
+        break;
+    }
+
     case XEN_DMOP_set_ioreq_server_state:
     {
         const struct xen_dm_op_set_ioreq_server_state *data =
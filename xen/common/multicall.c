@@ -113,12 +113,14 @@ do_multicall(
     if ( unlikely(disp == mc_preempt) && i < nr_calls )
         goto preempted;
 
+    arch_multicall_end(mcs);
     perfc_incr(calls_to_multicall);
     perfc_add(calls_from_multicall, i);
     mcs->flags = 0;
     return rc;
 
  preempted:
+    arch_multicall_end(mcs);
     perfc_add(calls_from_multicall, i);
     mcs->flags = 0;
     return hypercall_create_continuation(
@@ -44,10 +44,31 @@
 #include <xen/percpu.h>
 #include <xen/softirq.h>
 #include <xen/cpu.h>
+#include <xen/keyhandler.h>
 #include <xen/stop_machine.h>
 
 DEFINE_PER_CPU(unsigned int, rcu_lock_cnt);
 
+/*
+ * Quiescent states are tracked in a two level tree: CPUs report theirs to
+ * the leaf node of their group of RCU_FANOUT_LEAF CPUs, and only the last
+ * CPU of a leaf to do so in a grace period reports on to rcu_ctrlblk.  The
+ * global lock thus sees one report per group rather than one per CPU.
+ */
+#define RCU_FANOUT_LEAF 16
+#define RCU_NR_LEAVES   DIV_ROUND_UP(NR_CPUS, RCU_FANOUT_LEAF)
+
+struct rcu_node {
+    spinlock_t    lock;
+    long          cur;      /* Batch number qsmask is for.          */
+    unsigned long qsmask;   /* CPUs yet to pass a quiescent state.  */
+} __cacheline_aligned;
+
+static struct rcu_node rcu_leaves[RCU_NR_LEAVES];
+
+/* Grace period latency histogram: < 1ms, < 2ms, ... , >= 64ms. */
+#define RCU_GP_BUCKETS 8
+
 /* Global control variables for rcupdate callback mechanism. */
 static struct rcu_ctrlblk {
     long cur;           /* Current batch number.                      */
@@ -55,15 +76,73 @@ static struct rcu_ctrlblk {
     int  next_pending;  /* Is the next batch already waiting?         */
 
     spinlock_t  lock __cacheline_aligned;
-    cpumask_t   cpumask; /* CPUs that need to switch in order ... */
+    /* Leaves with CPUs that need to switch in order ... */
+    DECLARE_BITMAP(leafmask, RCU_NR_LEAVES);
     cpumask_t   idle_cpumask; /* ... unless they are already idle */
     /* for current batch to proceed.        */
+
+    /* Grace period statistics. */
+    s_time_t      gp_start;
+    s_time_t      gp_total;
+    s_time_t      gp_max;
+    unsigned long gp_count;
+    unsigned long gp_hist[RCU_GP_BUCKETS];
 } __cacheline_aligned rcu_ctrlblk = {
     .cur = -300,
     .completed = -300,
     .lock = SPIN_LOCK_UNLOCKED,
 };
 
+/*
+ * Callbacks of the CPUs in rcu_nocb_cpumask, once their grace period is
+ * over, are handed to other CPUs to invoke, idle ones if there are any.
+ * They all go onto one list, which only one CPU at a time takes callbacks
+ * from, so they run in the order they were queued in and rcu_barrier()
+ * keeps working.
+ */
+static cpumask_t __read_mostly rcu_nocb_cpumask;
+
+static struct rcu_offload {
+    spinlock_t       lock;
+    bool             running; /* A CPU is invoking callbacks off the list. */
+    struct rcu_head *list;
+    struct rcu_head **tail;
+    long             qlen;
+    unsigned long    total;   /* Callbacks ever offloaded. */
+} rcu_offload = {
+    .lock = SPIN_LOCK_UNLOCKED,
+    .tail = &rcu_offload.list,
+};
+
+static int __init parse_rcu_nocbs(const char *s)
+{
+    const char *ss;
+    unsigned long start, end;
+
+    do {
+        start = end = simple_strtoul(s, &ss, 0);
+        if ( ss == s )
+            return -EINVAL;
+        if ( *ss == '-' )
+        {
+            s = ss + 1;
+            end = simple_strtoul(s, &ss, 0);
+            if ( ss == s || end < start )
+                return -EINVAL;
+        }
+        if ( end >= NR_CPUS )
+            return -EINVAL;
+
+        for ( ; start <= end; start++ )
+            cpumask_set_cpu(start, &rcu_nocb_cpumask);
+
+        s = ss + 1;
+    } while ( *ss == ',' );
+
+    return *ss ? -EINVAL : 0;
+}
+custom_param("rcu-nocbs", parse_rcu_nocbs);
+
 /*
  * Per-CPU data for Read-Copy Update.
  * nxtlist - new callbacks are added here
@@ -245,6 +324,35 @@ static inline int rcu_batch_before(long a, long b)
     return (a - b) < 0;
 }
 
+static unsigned int rcu_nr_leaves(void)
+{
+    return DIV_ROUND_UP(nr_cpu_ids, RCU_FANOUT_LEAF);
+}
+
+/* The batch the grace period of the CPU's leaf is for. */
+static long rcu_leaf_cur(const struct rcu_data *rdp)
+{
+    return read_atomic(&rcu_leaves[rdp->cpu / RCU_FANOUT_LEAF].cur);
+}
+
+/* The CPUs the current grace period waits for (racy, as a hint only). */
+static void rcu_waiting_cpus(const struct rcu_ctrlblk *rcp, cpumask_t *mask)
+{
+    unsigned int i, j;
+    unsigned long qsmask;
+
+    cpumask_clear(mask);
+    for ( i = 0; i < rcu_nr_leaves(); i++ )
+    {
+        if ( !test_bit(i, rcp->leafmask) )
+            continue;
+        qsmask = read_atomic(&rcu_leaves[i].qsmask);
+        for ( j = 0; j < RCU_FANOUT_LEAF; j++ )
+            if ( qsmask & (1UL << j) )
+                __cpumask_set_cpu(i * RCU_FANOUT_LEAF + j, mask);
+    }
+}
+
 static void force_quiescent_state(struct rcu_data *rdp,
                                   struct rcu_ctrlblk *rcp)
 {
@@ -256,7 +364,8 @@ static void force_quiescent_state(struct rcu_data *rdp,
          * Don't send IPI to itself. With irqs disabled,
          * rdp->cpu is the current cpu.
          */
-        cpumask_andnot(&cpumask, &rcp->cpumask, cpumask_of(rdp->cpu));
+        rcu_waiting_cpus(rcp, &cpumask);
+        __cpumask_clear_cpu(rdp->cpu, &cpumask);
         cpumask_raise_softirq(&cpumask, RCU_SOFTIRQ);
     }
 }
@@ -320,30 +429,128 @@ static void rcu_do_batch(struct rcu_data *rdp)
     }
 }
 
+/*
+ * Pick the CPU to invoke offloaded callbacks.  Should all online CPUs be in
+ * rcu_nocb_cpumask, @cpu invokes them itself.
+ */
+static unsigned int rcu_offload_target(unsigned int cpu)
+{
+    cpumask_t mask;
+    unsigned int target;
+
+    cpumask_andnot(&mask, &rcu_ctrlblk.idle_cpumask, &rcu_nocb_cpumask);
+    cpumask_and(&mask, &mask, &cpu_online_map);
+    if ( cpumask_empty(&mask) )
+        cpumask_andnot(&mask, &cpu_online_map, &rcu_nocb_cpumask);
+    target = cpumask_cycle(cpu, &mask);
+
+    return target < nr_cpu_ids ? target : cpu;
+}
+
+/* Whether @cpu is one to invoke offloaded callbacks. */
+static bool rcu_offload_consumer(unsigned int cpu)
+{
+    return !cpumask_test_cpu(cpu, &rcu_nocb_cpumask) ||
+           cpumask_subset(&cpu_online_map, &rcu_nocb_cpumask);
+}
+
+/*
+ * Hand the completed callbacks of a CPU in rcu_nocb_cpumask over to another
+ * CPU.  They go onto the offload list even if there is no other CPU to take
+ * them, so as not to overtake callbacks queued there earlier.
+ */
+static void rcu_offload_batch(struct rcu_data *rdp)
+{
+    struct rcu_head *head;
+    long n = 0;
+
+    for ( head = rdp->donelist; head; head = head->next )
+        n++;
+
+    spin_lock(&rcu_offload.lock);
+    *rcu_offload.tail = rdp->donelist;
+    rcu_offload.tail = rdp->donetail;
+    rcu_offload.qlen += n;
+    rcu_offload.total += n;
+    spin_unlock(&rcu_offload.lock);
+
+    rdp->donelist = NULL;
+    rdp->donetail = &rdp->donelist;
+    local_irq_disable();
+    rdp->qlen -= n;
+    if (rdp->blimit == INT_MAX && rdp->qlen <= qlowmark)
+        rdp->blimit = blimit;
+    local_irq_enable();
+
+    cpu_raise_softirq(rcu_offload_target(rdp->cpu), RCU_SOFTIRQ);
+}
+
+/* Invoke callbacks handed over by CPUs in rcu_nocb_cpumask. */
+static void rcu_do_offloaded(void)
+{
+    struct rcu_head *list, *next, **tail;
+    long count = 0, limit;
+
+    spin_lock(&rcu_offload.lock);
+    /* Whoever runs the callbacks ahead of ours raises the softirq again. */
+    if ( rcu_offload.running )
+    {
+        spin_unlock(&rcu_offload.lock);
+        return;
+    }
+    rcu_offload.running = true;
+    limit = rcu_offload.qlen > qhimark ? LONG_MAX : blimit;
+    list = rcu_offload.list;
+    for ( tail = &rcu_offload.list; *tail && count < limit; count++ )
+        tail = &(*tail)->next;
+    rcu_offload.list = *tail;
+    *tail = NULL;
+    if ( !rcu_offload.list )
+        rcu_offload.tail = &rcu_offload.list;
+    rcu_offload.qlen -= count;
+    spin_unlock(&rcu_offload.lock);
+
+    while ( list )
+    {
+        next = list->next;
+        list->func(list);
+        list = next;
+    }
+
+    spin_lock(&rcu_offload.lock);
+    rcu_offload.running = false;
+    list = rcu_offload.list;
+    spin_unlock(&rcu_offload.lock);
+
+    if ( list )
+        raise_softirq(RCU_SOFTIRQ);
+}
+
 /*
  * Grace period handling:
  * The grace period handling consists out of two steps:
  * - A new grace period is started.
- *   This is done by rcu_start_batch. The start is not broadcasted to
- *   all cpus, they must pick this up by comparing rcp->cur with
- *   rdp->quiescbatch. All cpus are recorded  in the
- *   rcu_ctrlblk.cpumask bitmap.
+ *   This is done by rcu_start_batch and rcu_start_leaves. The start is not
+ *   broadcasted to all cpus, they must pick this up by comparing their
+ *   leaf's cur with rdp->quiescbatch. All cpus are recorded in the qsmask
+ *   of their leaf, and all leaves in the rcu_ctrlblk.leafmask bitmap.
  * - All cpus must go through a quiescent state.
  *   Since the start of the grace period is not broadcasted, at least two
  *   calls to rcu_check_quiescent_state are required:
  *   The first call just notices that a new grace period is running. The
  *   following calls check if there was a quiescent state since the beginning
- *   of the grace period. If so, it updates rcu_ctrlblk.cpumask. If
- *   the bitmap is empty, then the grace period is completed.
- *   rcu_check_quiescent_state calls rcu_start_batch(0) to start the next grace
- *   period (if necessary).
+ *   of the grace period. If so, it updates the leaf's qsmask, and once that
+ *   is empty rcu_ctrlblk.leafmask. If the latter is empty, then the grace
+ *   period is completed, and rcu_report_leaf starts the next grace period
+ *   (if necessary).
  */
 /*
  * Register a new batch of callbacks, and start it up if there is currently no
  * active batch and the batch to be registered has not already occurred.
- * Caller must hold rcu_ctrlblk.lock.
+ * Caller must hold rcu_ctrlblk.lock, and call rcu_start_leaves() after
+ * dropping it if this returns true.
  */
-static void rcu_start_batch(struct rcu_ctrlblk *rcp)
+static bool rcu_start_batch(struct rcu_ctrlblk *rcp)
 {
     if (rcp->next_pending &&
         rcp->completed == rcp->cur) {
@@ -354,33 +561,124 @@ static void rcu_start_batch(struct rcu_ctrlblk *rcp)
          */
         smp_wmb();
         rcp->cur++;
+        rcp->gp_start = NOW();
+        bitmap_fill(rcp->leafmask, rcu_nr_leaves());
+        return true;
+    }
+
+    return false;
+}
+
+static void rcu_report_leaf(struct rcu_ctrlblk *rcp, unsigned int leaf,
+                            long batch);
+
+/*
+ * Start the grace period for batch on the leaves, recording which of their
+ * CPUs need to pass through a quiescent state.  CPUs only notice the grace
+ * period once their leaf has been set up.
+ */
+static void rcu_start_leaves(struct rcu_ctrlblk *rcp, long batch)
+{
+    struct rcu_node *rnp;
+    unsigned int i, j, cpu;
+    unsigned long qsmask;
+
+    for ( i = 0; i < rcu_nr_leaves(); i++ )
+    {
+        rnp = &rcu_leaves[i];
 
-       /*
-        * Make sure the increment of rcp->cur is visible so, even if a
-        * CPU that is about to go idle, is captured inside rcp->cpumask,
-        * rcu_pending() will return false, which then means cpu_quiet()
-        * will be invoked, before the CPU would actually enter idle.
-        *
-        * This barrier is paired with the one in rcu_idle_enter().
-        */
+        spin_lock(&rnp->lock);
+        rnp->cur = batch;
+
+        /*
+         * Make sure the update of rnp->cur is visible so, even if a
+         * CPU that is about to go idle, is captured inside rnp->qsmask,
+         * rcu_pending() will return false, which then means cpu_quiet()
+         * will be invoked, before the CPU would actually enter idle.
+         *
+         * This barrier is paired with the one in rcu_idle_enter().
+         */
         smp_mb();
-        cpumask_andnot(&rcp->cpumask, &cpu_online_map, &rcp->idle_cpumask);
+
+        qsmask = 0;
+        for ( j = 0; j < RCU_FANOUT_LEAF; j++ )
+        {
+            cpu = i * RCU_FANOUT_LEAF + j;
+            if ( cpu < nr_cpu_ids && cpu_online(cpu) &&
+                 !cpumask_test_cpu(cpu, &rcp->idle_cpumask) )
+                qsmask |= 1UL << j;
+        }
+        rnp->qsmask = qsmask;
+        spin_unlock(&rnp->lock);
+
+        if ( !qsmask )
+            rcu_report_leaf(rcp, i, batch);
     }
 }
 
 /*
- * cpu went through a quiescent state since the beginning of the grace period.
- * Clear it from the cpu mask and complete the grace period if it was the last
- * cpu. Start another grace period if someone has further entries pending
+ * All CPUs of a leaf went through a quiescent state in the grace period for
+ * batch.  Complete it if this was the last leaf, and start another grace
+ * period if someone has further entries pending.
  */
-static void cpu_quiet(int cpu, struct rcu_ctrlblk *rcp)
+static void rcu_report_leaf(struct rcu_ctrlblk *rcp, unsigned int leaf,
+                            long batch)
 {
-    cpumask_clear_cpu(cpu, &rcp->cpumask);
-    if (cpumask_empty(&rcp->cpumask)) {
+    bool started = false;
+    s_time_t gp;
+
+    spin_lock(&rcp->lock);
+    if ( rcp->cur == batch && test_and_clear_bit(leaf, rcp->leafmask) &&
+         bitmap_empty(rcp->leafmask, rcu_nr_leaves()) )
+    {
         /* batch completed ! */
         rcp->completed = rcp->cur;
-        rcu_start_batch(rcp);
+
+        gp = NOW() - rcp->gp_start;
+        rcp->gp_count++;
+        rcp->gp_total += gp;
+        rcp->gp_max = max(rcp->gp_max, gp);
+        rcp->gp_hist[min(gp >= MILLISECS(1) ? flsl(gp / MILLISECS(1)) : 0,
+                         RCU_GP_BUCKETS - 1)]++;
+
+        started = rcu_start_batch(rcp);
+        batch = rcp->cur;
     }
+    spin_unlock(&rcp->lock);
+
+    if ( started )
+        rcu_start_leaves(rcp, batch);
+}
+
+/*
+ * cpu went through a quiescent state since the beginning of the grace period
+ * for batch.  Clear it from its leaf's mask, and report the leaf if it was
+ * the leaf's last cpu.  With batch NULL, for whichever grace period is on.
+ */
+static void cpu_quiet(unsigned int cpu, struct rcu_ctrlblk *rcp,
+                      const long *batch)
+{
+    unsigned int leaf = cpu / RCU_FANOUT_LEAF;
+    unsigned long bit = 1UL << (cpu % RCU_FANOUT_LEAF);
+    struct rcu_node *rnp = &rcu_leaves[leaf];
+    bool done = false;
+    long cur;
+
+    spin_lock(&rnp->lock);
+    /*
+     * rdp->quiescbatch/rnp->cur and the cpu bitmap can come out of sync
+     * during cpu startup. Ignore the quiescent state.
+     */
+    cur = rnp->cur;
+    if ( (!batch || *batch == cur) && (rnp->qsmask & bit) )
+    {
+        rnp->qsmask &= ~bit;
+        done = !rnp->qsmask;
+    }
+    spin_unlock(&rnp->lock);
+
+    if ( done )
+        rcu_report_leaf(rcp, leaf, cur);
 }
 
 /*
@@ -391,10 +689,12 @@ static void cpu_quiet(int cpu, struct rcu_ctrlblk *rcp)
 static void rcu_check_quiescent_state(struct rcu_ctrlblk *rcp,
                                       struct rcu_data *rdp)
 {
-    if (rdp->quiescbatch != rcp->cur) {
+    long cur = rcu_leaf_cur(rdp);
+
+    if (rdp->quiescbatch != cur) {
         /* start new grace period: */
         rdp->qs_pending = 1;
-        rdp->quiescbatch = rcp->cur;
+        rdp->quiescbatch = cur;
         return;
     }
 
@@ -407,15 +707,7 @@ static void rcu_check_quiescent_state(struct rcu_ctrlblk *rcp,
 
     rdp->qs_pending = 0;
 
-    spin_lock(&rcp->lock);
-    /*
-     * rdp->quiescbatch/rcp->cur and the cpu bitmap can come out of sync
-     * during cpu startup. Ignore the quiescent state.
-     */
-    if (likely(rdp->quiescbatch == rcp->cur))
-        cpu_quiet(rdp->cpu, rcp);
-
-    spin_unlock(&rcp->lock);
+    cpu_quiet(rdp->cpu, rcp, &rdp->quiescbatch);
 }
 
 
@@ -452,24 +744,38 @@ static void __rcu_process_callbacks(struct rcu_ctrlblk *rcp,
         smp_rmb();
 
         if (!rcp->next_pending) {
+            bool started;
+            long batch;
+
             /* and start it/schedule start if it's a new batch */
             spin_lock(&rcp->lock);
             rcp->next_pending = 1;
-            rcu_start_batch(rcp);
+            started = rcu_start_batch(rcp);
+            batch = rcp->cur;
             spin_unlock(&rcp->lock);
+
+            if (started)
+                rcu_start_leaves(rcp, batch);
         }
     } else {
         local_irq_enable();
     }
     rcu_check_quiescent_state(rcp, rdp);
-    if (rdp->donelist)
-        rcu_do_batch(rdp);
+    if (rdp->donelist) {
+        if (cpumask_test_cpu(rdp->cpu, &rcu_nocb_cpumask))
+            rcu_offload_batch(rdp);
+        else
+            rcu_do_batch(rdp);
+    }
 }
 
 static void rcu_process_callbacks(void)
 {
     struct rcu_data *rdp = &this_cpu(rcu_data);
 
+    if ( read_atomic(&rcu_offload.list) && rcu_offload_consumer(rdp->cpu) )
+        rcu_do_offloaded();
+
     if ( rdp->process_callbacks )
     {
         rdp->process_callbacks = false;
@@ -501,7 +807,7 @@ static int __rcu_pending(struct rcu_ctrlblk *rcp, struct rcu_data *rdp)
         return 1;
 
     /* The rcu core waits for a quiescent state from the cpu */
-    if (rdp->quiescbatch != rcp->cur || rdp->qs_pending)
+    if (rdp->quiescbatch != rcu_leaf_cur(rdp) || rdp->qs_pending)
         return 1;
 
     /* nothing to do */
@@ -579,7 +885,7 @@ static void rcu_idle_timer_handler(void* data)
 {
     perfc_incr(rcu_idle_timer);
 
-    if ( !cpumask_empty(&rcu_ctrlblk.cpumask) )
+    if ( rcu_ctrlblk.cur != rcu_ctrlblk.completed )
         idle_timer_period = min(idle_timer_period + IDLE_TIMER_PERIOD_INCR,
                                 IDLE_TIMER_PERIOD_MAX);
     else
@@ -613,10 +919,7 @@ static void rcu_offline_cpu(struct rcu_data *this_rdp,
     /* If the cpu going offline owns the grace period we can block
      * indefinitely waiting for it, so flush it here.
      */
-    spin_lock(&rcp->lock);
-    if (rcp->cur != rcp->completed)
-        cpu_quiet(rdp->cpu, rcp);
-    spin_unlock(&rcp->lock);
+    cpu_quiet(rdp->cpu, rcp, NULL);
 
     rcu_move_batch(this_rdp, rdp->donelist, rdp->donetail);
     rcu_move_batch(this_rdp, rdp->curlist, rdp->curtail);
@@ -625,6 +928,10 @@ static void rcu_offline_cpu(struct rcu_data *this_rdp,
     local_irq_disable();
     this_rdp->qlen += rdp->qlen;
     local_irq_enable();
+
+    /* The cpu may have been the one to invoke offloaded callbacks. */
+    if ( read_atomic(&rcu_offload.list) )
+        cpu_raise_softirq(rcu_offload_target(this_rdp->cpu), RCU_SOFTIRQ);
 }
 
 static void rcu_init_percpu_data(int cpu, struct rcu_ctrlblk *rcp,
@@ -667,9 +974,32 @@ static struct notifier_block cpu_nfb = {
     .notifier_call = cpu_callback
 };
 
+static void rcu_dump(unsigned char key)
+{
+    struct rcu_ctrlblk *rcp = &rcu_ctrlblk;
+    cpumask_t waiting;
+    unsigned int i;
+
+    rcu_waiting_cpus(rcp, &waiting);
+
+    printk("RCU: batch %ld, completed %ld, waiting for CPUs {%*pbl}\n",
+           rcp->cur, rcp->completed, CPUMASK_PR(&waiting));
+    printk("  grace periods %lu, avg %"PRI_stime"us, max %"PRI_stime"us\n",
+           rcp->gp_count,
+           rcp->gp_count ? rcp->gp_total / rcp->gp_count / MICROSECS(1) : 0,
+           rcp->gp_max / MICROSECS(1));
+    printk("  by duration (ms):");
+    for ( i = 0; i < RCU_GP_BUCKETS - 1; i++ )
+        printk(" <%u: %lu", 1U << i, rcp->gp_hist[i]);
+    printk(" >=%u: %lu\n", 1U << (i - 1), rcp->gp_hist[i]);
+    printk("  offloaded callbacks %lu, queued %ld, from CPUs {%*pbl}\n",
+           rcu_offload.total, rcu_offload.qlen, CPUMASK_PR(&rcu_nocb_cpumask));
+}
+
 void __init rcu_init(void)
 {
     void *cpu = (void *)(long)smp_processor_id();
+    unsigned int i;
     static unsigned int __initdata idle_timer_period_ms =
                                     IDLE_TIMER_PERIOD_DEFAULT / MILLISECS(1);
     integer_param("rcu-idle-timer-period-ms", idle_timer_period_ms);
@@ -685,10 +1015,17 @@ void __init rcu_init(void)
     }
     idle_timer_period = MILLISECS(idle_timer_period_ms);
 
+    for ( i = 0; i < ARRAY_SIZE(rcu_leaves); i++ )
+    {
+        spin_lock_init(&rcu_leaves[i].lock);
+        rcu_leaves[i].cur = rcu_ctrlblk.cur;
+    }
+
     cpumask_clear(&rcu_ctrlblk.idle_cpumask);
     cpu_callback(&cpu_nfb, CPU_UP_PREPARE, cpu);
     register_cpu_notifier(&cpu_nfb);
     open_softirq(RCU_SOFTIRQ, rcu_process_callbacks);
+    register_keyhandler('y', rcu_dump, "dump RCU state", 1);
 }
 
 /*
@@ -701,11 +1038,12 @@ void rcu_idle_enter(unsigned int cpu)
     cpumask_set_cpu(cpu, &rcu_ctrlblk.idle_cpumask);
     /*
      * If some other CPU is starting a new grace period, we'll notice that
-     * by seeing a new value in rcp->cur (different than our quiescbatch).
-     * That will force us all the way until cpu_quiet(), clearing our bit
-     * in rcp->cpumask, even in case we managed to get in there.
+     * by seeing a new value in our leaf's cur (different than our
+     * quiescbatch).  That will force us all the way until cpu_quiet(),
+     * clearing our bit in its qsmask, even in case we managed to get in
+     * there.
      *
-     * Se the comment before cpumask_andnot() in  rcu_start_batch().
+     * Se the comment before the qsmask update in rcu_start_leaves().
      */
     smp_mb();
 
@@ -63,6 +63,10 @@ boolean_param("sched_smt_power_savings", sched_smt_power_savings);
 int sched_ratelimit_us = SCHED_DEFAULT_RATELIMIT_US;
 integer_param("sched_ratelimit_us", sched_ratelimit_us);
 
+/* How late (in ns) vcpu timers may fire, to share timer interrupts. */
+static unsigned int __read_mostly vcpu_timer_slack;
+integer_param("vcpu_timer_slack", vcpu_timer_slack);
+
 /* Number of vcpus per struct sched_unit. */
 bool __read_mostly sched_disable_smt_switching;
 cpumask_t sched_res_mask;
@@ -550,6 +554,12 @@ int sched_init_vcpu(struct vcpu *v)
     init_timer(&v->periodic_timer, vcpu_periodic_timer_fn, v, processor);
     init_timer(&v->singleshot_timer, vcpu_singleshot_timer_fn, v, processor);
     init_timer(&v->poll_timer, poll_timer_fn, v, processor);
+    if ( vcpu_timer_slack && !is_idle_domain(d) )
+    {
+        set_timer_slack(&v->periodic_timer, vcpu_timer_slack);
+        set_timer_slack(&v->singleshot_timer, vcpu_timer_slack);
+        set_timer_slack(&v->poll_timer, vcpu_timer_slack);
+    }
 
     /* If this is not the first vcpu of the unit we are done. */
     if ( unit->priv != NULL )
@@ -1542,6 +1552,7 @@ static void domain_watchdog_timeout(void *data)
     if ( d->is_shutting_down || d->is_dying )
         return;
 
+    trace_freeze(TRACE_FREEZE_WATCHDOG);
     printk("Watchdog timer fired for domain %u\n", d->domain_id);
     domain_shutdown(d, SHUTDOWN_watchdog);
 }
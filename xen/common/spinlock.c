@@ -116,6 +116,17 @@ void spin_debug_disable(void)
 
 #ifdef CONFIG_DEBUG_LOCK_PROFILE
 
+static void lock_profile_block(struct lock_profile *prof, s_time_t wait)
+{
+    unsigned int b = wait > 0 ? flsl(wait) : 0;
+
+    b = b > XEN_SYSCTL_LOCKPROF_HIST_SHIFT
+        ? b - XEN_SYSCTL_LOCKPROF_HIST_SHIFT : 0;
+    prof->time_block += wait;
+    prof->block_cnt++;
+    prof->block_hist[min(b, XEN_SYSCTL_LOCKPROF_NR_BUCKETS - 1U)]++;
+}
+
 #define LOCK_PROFILE_REL                                                     \
     if (lock->profile)                                                       \
     {                                                                        \
@@ -129,10 +140,8 @@ void spin_debug_disable(void)
     {                                                                        \
         lock->profile->time_locked = NOW();                                  \
         if (block)                                                           \
-        {                                                                    \
-            lock->profile->time_block += lock->profile->time_locked - block; \
-            lock->profile->block_cnt++;                                      \
-        }                                                                    \
+            lock_profile_block(lock->profile,                                \
+                               lock->profile->time_locked - block);          \
     }
 
 #else
@@ -144,6 +153,140 @@ void spin_debug_disable(void)
 
 #endif
 
+#ifdef CONFIG_MCS_SPINLOCK
+
+/*
+ * Queued (MCS) spinlocks: a CPU failing to get a lock queues up behind the
+ * last one waiting for it, and spins on a flag in its own per-CPU node
+ * until its predecessor makes it the head of the queue.  Only the head of
+ * the queue watches the lock itself, and hands the headship on once it
+ * got it.  The lock's tail names the last CPU queued, together with its
+ * nesting level, as locks may be taken in IRQ context while spinning for
+ * another one.
+ */
+struct mcs_node {
+    struct mcs_node *next;
+    bool head;
+};
+
+#define MCS_NESTING        4
+#define MCS_TAIL(cpu, idx) ((((cpu) + 1) << 2) | (idx))
+
+static DEFINE_PER_CPU(struct mcs_node[MCS_NESTING], mcs_nodes);
+static DEFINE_PER_CPU(unsigned int, mcs_nesting);
+
+static struct mcs_node *mcs_tail_node(u16 tail)
+{
+    return &per_cpu(mcs_nodes, (tail >> 2) - 1)[tail & 3];
+}
+
+static always_inline spinlock_queue_t observe_queue(spinlock_queue_t *q)
+{
+    spinlock_queue_t v;
+
+    smp_rmb();
+    v.val = read_atomic(&q->val);
+    return v;
+}
+
+static bool queue_trylock(spinlock_queue_t *q)
+{
+    spinlock_queue_t old = observe_queue(q), new;
+
+    if ( (old.owner & SPINLOCK_QUEUE_LOCKED) || old.tail )
+        return false;
+
+    new = old;
+    new.owner |= SPINLOCK_QUEUE_LOCKED;
+    return cmpxchg(&q->val, old.val, new.val) == old.val;
+}
+
+static void queue_lock(spinlock_queue_t *q, void (*cb)(void *), void *data)
+{
+    unsigned int idx = this_cpu(mcs_nesting)++;
+    struct mcs_node *node, *next;
+    spinlock_queue_t old, new;
+    u32 cur;
+    u16 tail;
+
+    /* Nested too deeply for a node of our own: spin on the lock. */
+    if ( unlikely(idx >= MCS_NESTING) )
+    {
+        while ( !queue_trylock(q) )
+        {
+            if ( unlikely(cb) )
+                cb(data);
+            arch_lock_relax();
+        }
+        goto out;
+    }
+
+    node = &this_cpu(mcs_nodes)[idx];
+    node->next = NULL;
+    node->head = false;
+    tail = MCS_TAIL(smp_processor_id(), idx);
+
+    /* Make the node's initialisation visible before publishing it. */
+    smp_wmb();
+    for ( old = observe_queue(q); ; old.val = cur )
+    {
+        new = old;
+        new.tail = tail;
+        cur = cmpxchg(&q->val, old.val, new.val);
+        if ( cur == old.val )
+            break;
+    }
+
+    if ( old.tail )
+    {
+        write_atomic(&mcs_tail_node(old.tail)->next, node);
+        while ( !read_atomic(&node->head) )
+        {
+            if ( unlikely(cb) )
+                cb(data);
+            arch_lock_relax();
+        }
+        smp_rmb();
+    }
+
+    /* Head of the queue: wait for the lock to be released. */
+    for ( ; ; )
+    {
+        old = observe_queue(q);
+        if ( !(old.owner & SPINLOCK_QUEUE_LOCKED) )
+        {
+            if ( old.tail != tail )
+                break;
+
+            /* Nobody queued behind us: take the lock, emptying the queue. */
+            new.owner = old.owner | SPINLOCK_QUEUE_LOCKED;
+            new.tail = 0;
+            if ( cmpxchg(&q->val, old.val, new.val) == old.val )
+                goto out;
+            continue;
+        }
+        if ( unlikely(cb) )
+            cb(data);
+        arch_lock_relax();
+    }
+
+    /*
+     * Others are queued behind us, so the lock can't be taken but by the
+     * head of the queue.  Take it, and make our successor the head.
+     */
+    write_atomic(&q->owner, old.owner | SPINLOCK_QUEUE_LOCKED);
+    while ( !(next = read_atomic(&node->next)) )
+        cpu_relax();
+    smp_mb();
+    write_atomic(&next->head, true);
+    arch_lock_signal();
+
+ out:
+    this_cpu(mcs_nesting)--;
+}
+
+#else /* CONFIG_MCS_SPINLOCK */
+
 static always_inline spinlock_tickets_t observe_lock(spinlock_tickets_t *t)
 {
     spinlock_tickets_t v;
@@ -159,13 +302,24 @@ static always_inline u16 observe_head(spinlock_tickets_t *t)
     return read_atomic(&t->head);
 }
 
+#endif /* CONFIG_MCS_SPINLOCK */
+
 void inline _spin_lock_cb(spinlock_t *lock, void (*cb)(void *), void *data)
 {
+#ifndef CONFIG_MCS_SPINLOCK
     spinlock_tickets_t tickets = SPINLOCK_TICKET_INC;
+#endif
     LOCK_PROFILE_VAR;
 
     check_lock(&lock->debug, false);
     preempt_disable();
+#ifdef CONFIG_MCS_SPINLOCK
+    if ( !queue_trylock(&lock->queue) )
+    {
+        LOCK_PROFILE_BLOCK;
+        queue_lock(&lock->queue, cb, data);
+    }
+#else
     tickets.head_tail = arch_fetch_and_add(&lock->tickets.head_tail,
                                            tickets.head_tail);
     while ( tickets.tail != observe_head(&lock->tickets) )
@@ -175,6 +329,7 @@ void inline _spin_lock_cb(spinlock_t *lock, void (*cb)(void *), void *data)
             cb(data);
         arch_lock_relax();
     }
+#endif
     arch_lock_acquire_barrier();
     got_lock(&lock->debug);
     LOCK_PROFILE_GOT;
@@ -206,7 +361,14 @@ void _spin_unlock(spinlock_t *lock)
     LOCK_PROFILE_REL;
     rel_lock(&lock->debug);
     arch_lock_release_barrier();
+#ifdef CONFIG_MCS_SPINLOCK
+    /* Only the holder writes the owner, but a queuing CPU may cmpxchg(). */
+    write_atomic(&lock->queue.owner,
+                 (lock->queue.owner + SPINLOCK_QUEUE_GEN) &
+                 ~SPINLOCK_QUEUE_LOCKED);
+#else
     add_sized(&lock->tickets.head, 1);
+#endif
     arch_lock_signal();
     preempt_enable();
 }
@@ -230,17 +392,32 @@ int _spin_is_locked(spinlock_t *lock)
      * "false" here, making this function suitable only for use in
      * ASSERT()s and alike.
      */
+#ifdef CONFIG_MCS_SPINLOCK
+    return lock->recurse_cpu == SPINLOCK_NO_CPU
+           ? (lock->queue.owner & SPINLOCK_QUEUE_LOCKED) || lock->queue.tail
+           : lock->recurse_cpu == smp_processor_id();
+#else
     return lock->recurse_cpu == SPINLOCK_NO_CPU
            ? lock->tickets.head != lock->tickets.tail
            : lock->recurse_cpu == smp_processor_id();
+#endif
 }
 
 int _spin_trylock(spinlock_t *lock)
 {
+#ifndef CONFIG_MCS_SPINLOCK
     spinlock_tickets_t old, new;
+#endif
 
     preempt_disable();
     check_lock(&lock->debug, true);
+#ifdef CONFIG_MCS_SPINLOCK
+    if ( !queue_trylock(&lock->queue) )
+    {
+        preempt_enable();
+        return 0;
+    }
+#else
     old = observe_lock(&lock->tickets);
     if ( old.head != old.tail )
     {
@@ -255,6 +432,7 @@ int _spin_trylock(spinlock_t *lock)
         preempt_enable();
         return 0;
     }
+#endif
     /*
      * cmpxchg() is a full barrier so no need for an
      * arch_lock_acquire_barrier().
@@ -269,24 +447,34 @@ int _spin_trylock(spinlock_t *lock)
 
 void _spin_barrier(spinlock_t *lock)
 {
+#ifdef CONFIG_MCS_SPINLOCK
+    spinlock_queue_t sample;
+#else
     spinlock_tickets_t sample;
+#endif
 #ifdef CONFIG_DEBUG_LOCK_PROFILE
     s_time_t block = NOW();
 #endif
 
     check_barrier(&lock->debug);
     smp_mb();
+#ifdef CONFIG_MCS_SPINLOCK
+    /* Wait for the holder, if any, to release the lock. */
+    sample = observe_queue(&lock->queue);
+    if ( sample.owner & SPINLOCK_QUEUE_LOCKED )
+    {
+        while ( observe_queue(&lock->queue).owner == sample.owner )
+            arch_lock_relax();
+#else
     sample = observe_lock(&lock->tickets);
     if ( sample.head != sample.tail )
     {
         while ( observe_head(&lock->tickets) == sample.head )
             arch_lock_relax();
+#endif
 #ifdef CONFIG_DEBUG_LOCK_PROFILE
         if ( lock->profile )
-        {
-            lock->profile->time_block += NOW() - block;
-            lock->profile->block_cnt++;
-        }
+            lock_profile_block(lock->profile, NOW() - block);
 #endif
     }
     smp_mb();
@@ -383,14 +571,28 @@ static void spinlock_profile_print_elem(struct lock_profile *data,
     printk("%s ", lock_profile_ancs[type].name);
     if ( type != LOCKPROF_TYPE_GLOBAL )
         printk("%d ", idx);
+#ifdef CONFIG_MCS_SPINLOCK
+    printk("%s: addr=%p, lockval=%08x, ", data->name, lock, lock->queue.val);
+#else
     printk("%s: addr=%p, lockval=%08x, ", data->name, lock,
            lock->tickets.head_tail);
+#endif
     if ( lock->debug.cpu == SPINLOCK_NO_CPU )
         printk("not locked\n");
     else
         printk("cpu=%d\n", lock->debug.cpu);
     printk("  lock:%" PRId64 "(%" PRI_stime "), block:%" PRId64 "(%" PRI_stime ")\n",
            data->lock_cnt, data->time_hold, data->block_cnt, data->time_block);
+    if ( data->block_cnt )
+    {
+        unsigned int i;
+
+        printk("  block by duration (log2 ns from %u):",
+               XEN_SYSCTL_LOCKPROF_HIST_SHIFT);
+        for ( i = 0; i < XEN_SYSCTL_LOCKPROF_NR_BUCKETS; i++ )
+            printk(" %u", data->block_hist[i]);
+        printk("\n");
+    }
 }
 
 void spinlock_profile_printall(unsigned char key)
@@ -411,6 +613,7 @@ static void spinlock_profile_reset_elem(struct lock_profile *data,
     data->block_cnt = 0;
     data->time_hold = 0;
     data->time_block = 0;
+    memset(data->block_hist, 0, sizeof(data->block_hist));
 }
 
 void spinlock_profile_reset(unsigned char key)
@@ -446,6 +649,8 @@ static void spinlock_profile_ucopy_elem(struct lock_profile *data,
         elem.block_cnt = data->block_cnt;
         elem.lock_time = data->time_hold;
         elem.block_time = data->time_block;
+        BUILD_BUG_ON(sizeof(elem.block_hist) != sizeof(data->block_hist));
+        memcpy(elem.block_hist, data->block_hist, sizeof(elem.block_hist));
         if ( copy_to_guest_offset(p->pc->data, p->pc->nr_elem, &elem, 1) )
             p->rc = -EFAULT;
     }
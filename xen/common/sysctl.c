@@ -113,6 +113,75 @@ long do_sysctl(XEN_GUEST_HANDLE_PARAM(xen_sysctl_t) u_sysctl)
     }
     break;
 
+    case XEN_SYSCTL_getvcpuinfolist:
+    {
+        struct xen_sysctl_getvcpuinfolist *vi = &op->u.getvcpuinfolist;
+        struct xen_sysctl_vcpuinfo info = { 0 };
+        struct vcpu_runstate_info runstate;
+        struct domain *d;
+        const struct vcpu *v;
+        unsigned int i;
+
+        vi->num_vcpus = 0;
+
+        rcu_read_lock(&domlist_read_lock);
+
+        for_each_domain ( d )
+        {
+            if ( d->domain_id < vi->first_domain )
+                continue;
+
+            if ( xsm_getdomaininfo(XSM_HOOK, d) )
+                continue;
+
+            for ( i = d->domain_id == vi->first_domain ? vi->first_vcpu : 0;
+                  i < d->max_vcpus; i++ )
+            {
+                if ( (v = d->vcpu[i]) == NULL )
+                    continue;
+
+                if ( vi->num_vcpus == vi->max_vcpus ||
+                     (!(vi->num_vcpus & 0x3f) && vi->num_vcpus &&
+                      hypercall_preempt_check()) )
+                {
+                    vi->first_domain = d->domain_id;
+                    vi->first_vcpu = i;
+                    goto getvcpuinfolist_out;
+                }
+
+                vcpu_runstate_get(v, &runstate);
+
+                info.domid = d->domain_id;
+                info.vcpu = i;
+                info.cpu = v->processor;
+                info.online = !(v->pause_flags & VPF_down);
+                info.blocked = !!(v->pause_flags & VPF_blocked);
+                info.running = v->is_running;
+                info.state = runstate.state;
+                info.state_entry_time = runstate.state_entry_time;
+                BUILD_BUG_ON(ARRAY_SIZE(info.time) !=
+                             ARRAY_SIZE(runstate.time));
+                memcpy(info.time, runstate.time, sizeof(info.time));
+
+                if ( copy_to_guest_offset(vi->buffer, vi->num_vcpus,
+                                          &info, 1) )
+                {
+                    ret = -EFAULT;
+                    goto getvcpuinfolist_out;
+                }
+
+                vi->num_vcpus++;
+            }
+        }
+
+        vi->first_domain = DOMID_INVALID;
+        vi->first_vcpu = 0;
+
+    getvcpuinfolist_out:
+        rcu_read_unlock(&domlist_read_lock);
+        break;
+    }
+
 #ifdef CONFIG_PERF_COUNTERS
     case XEN_SYSCTL_perfc_op:
         ret = perfc_control(&op->u.perfc_op);
@@ -10,6 +10,7 @@
 #include <xen/errno.h>
 #include <xen/sched.h>
 #include <xen/lib.h>
+#include <xen/list_sort.h>
 #include <xen/param.h>
 #include <xen/smp.h>
 #include <xen/perfc.h>
@@ -29,12 +30,38 @@
 static unsigned int timer_slop __read_mostly = 50000; /* 50 us */
 integer_param("timer_slop", timer_slop);
 
+/*
+ * Active timers live on a hierarchical timer wheel: level 0 has a slot for
+ * each of the next 64 ticks of 2^16ns (65.5us), and each further level has
+ * slots 64 times as coarse.  Timers are filed on the level whose range
+ * covers their expiry time, and are cascaded down a level each time the
+ * wheel reaches the start of their slot, so that by the time they expire
+ * they are in the level 0 slot of their tick.  Adding and removing timers
+ * thus costs O(1), however many there are.
+ */
+#define WHEEL_TICK_SHIFT  16
+#define WHEEL_LVL_BITS    6
+#define WHEEL_LVL_SIZE    (1U << WHEEL_LVL_BITS)
+#define WHEEL_LVL_MASK    (WHEEL_LVL_SIZE - 1)
+#define WHEEL_LVL_NR      6     /* Covering 2^52ns, i.e. 52 days. */
+#define WHEEL_LVL_SHIFT(l) ((l) * WHEEL_LVL_BITS)
+
 struct timers {
     spinlock_t     lock;
-    struct timer **heap;
-    struct timer  *list;
+    uint64_t       clk;         /* Tick the wheel has advanced to. */
+    uint64_t       pending[WHEEL_LVL_NR]; /* Non-empty slots. */
+    s_time_t       next_deadline; /* As last computed by the softirq. */
     struct timer  *running;
     struct list_head inactive;
+    struct list_head wheel[WHEEL_LVL_NR * WHEEL_LVL_SIZE];
+
+    /* Statistics, for the 'a' debug key. */
+    unsigned long  softirqs;
+    unsigned long  executed;
+    unsigned long  cascaded;
+    s_time_t       softirq_ns;  /* Time spent in the softirq, ... */
+    s_time_t       softirq_max_ns;
+    s_time_t       callback_ns; /* ... of which in timer callbacks. */
 } __cacheline_aligned;
 
 static DEFINE_PER_CPU(struct timers, timers);
@@ -45,134 +72,163 @@ static DEFINE_RCU_READ_LOCK(timer_cpu_read_lock);
 DEFINE_PER_CPU(s_time_t, timer_deadline);
 
 /****************************************************************************
- * HEAP OPERATIONS.
- *
- * Slot 0 of the heap is never a valid timer pointer, and instead holds the
- * heap metadata.
+ * WHEEL OPERATIONS.
  */
 
-struct heap_metadata {
-    uint16_t size, limit;
-};
-
-static struct heap_metadata *heap_metadata(struct timer **heap)
+/* Latest time @t may fire at. */
+static s_time_t timer_latest(const struct timer *t)
 {
-    /* Check that our type-punning doesn't overflow into heap[1] */
-    BUILD_BUG_ON(sizeof(struct heap_metadata) > sizeof(struct timer *));
-
-    return (struct heap_metadata *)&heap[0];
+    return t->expires > STIME_MAX - t->slack ? STIME_MAX
+                                             : t->expires + t->slack;
 }
 
-/* Sink down element @pos of @heap. */
-static void down_heap(struct timer **heap, unsigned int pos)
+static uint64_t wheel_tick(s_time_t t)
 {
-    unsigned int sz = heap_metadata(heap)->size, nxt;
-    struct timer *t = heap[pos];
-
-    while ( (nxt = (pos << 1)) <= sz )
-    {
-        if ( ((nxt+1) <= sz) && (heap[nxt+1]->expires < heap[nxt]->expires) )
-            nxt++;
-        if ( heap[nxt]->expires > t->expires )
-            break;
-        heap[pos] = heap[nxt];
-        heap[pos]->heap_offset = pos;
-        pos = nxt;
-    }
-
-    heap[pos] = t;
-    t->heap_offset = pos;
+    return t > 0 ? (uint64_t)t >> WHEEL_TICK_SHIFT : 0;
 }
 
-/* Float element @pos up @heap. */
-static void up_heap(struct timer **heap, unsigned int pos)
+/*
+ * Offset, from slot @pos on, of the first pending slot of level @lvl at
+ * least @from slots on (wrapping around), or WHEEL_LVL_SIZE if none.
+ */
+static unsigned int wheel_next_pending(const struct timers *ts,
+                                       unsigned int lvl, unsigned int pos,
+                                       unsigned int from)
 {
-    struct timer *t = heap[pos];
+    uint64_t bits = ts->pending[lvl];
 
-    while ( (pos > 1) && (t->expires < heap[pos>>1]->expires) )
-    {
-        heap[pos] = heap[pos>>1];
-        heap[pos]->heap_offset = pos;
-        pos >>= 1;
-    }
+    if ( pos )
+        bits = (bits >> pos) | (bits << (WHEEL_LVL_SIZE - pos));
+    bits &= ~0ULL << from;
 
-    heap[pos] = t;
-    t->heap_offset = pos;
+    return bits ? ffs64(bits) - 1 : WHEEL_LVL_SIZE;
 }
 
-
-/* Delete @t from @heap. Return TRUE if new top of heap. */
-static int remove_from_heap(struct timer **heap, struct timer *t)
+static void wheel_add(struct timers *ts, struct timer *t)
 {
-    unsigned int sz = heap_metadata(heap)->size;
-    unsigned int pos = t->heap_offset;
+    uint64_t tick = max(wheel_tick(t->expires), ts->clk);
+    uint64_t delta = tick - ts->clk;
+    unsigned int lvl, slot;
 
-    if ( unlikely(pos == sz) )
-    {
-        heap_metadata(heap)->size = sz - 1;
-        goto out;
-    }
+    for ( lvl = 0; lvl < WHEEL_LVL_NR - 1; lvl++ )
+        if ( delta < (1ULL << WHEEL_LVL_SHIFT(lvl + 1)) )
+            break;
 
-    heap[pos] = heap[sz];
-    heap[pos]->heap_offset = pos;
+    /* Beyond the wheel's range: revisit at the end of it. */
+    if ( delta >= (1ULL << WHEEL_LVL_SHIFT(WHEEL_LVL_NR)) )
+        tick = ts->clk + (1ULL << WHEEL_LVL_SHIFT(WHEEL_LVL_NR)) - 1;
 
-    heap_metadata(heap)->size = --sz;
+    slot = (tick >> WHEEL_LVL_SHIFT(lvl)) & WHEEL_LVL_MASK;
+    t->wheel_slot = lvl * WHEEL_LVL_SIZE + slot;
+    list_add_tail(&t->wheel_list, &ts->wheel[t->wheel_slot]);
+    ts->pending[lvl] |= 1ULL << slot;
+}
 
-    if ( (pos > 1) && (heap[pos]->expires < heap[pos>>1]->expires) )
-        up_heap(heap, pos);
-    else
-        down_heap(heap, pos);
+static void wheel_del(struct timers *ts, struct timer *t)
+{
+    unsigned int lvl = t->wheel_slot / WHEEL_LVL_SIZE;
 
- out:
-    return (pos == 1);
+    list_del(&t->wheel_list);
+    if ( list_empty(&ts->wheel[t->wheel_slot]) )
+        ts->pending[lvl] &= ~(1ULL << (t->wheel_slot % WHEEL_LVL_SIZE));
 }
 
-
-/* Add new entry @t to @heap. Return TRUE if new top of heap. */
-static int add_to_heap(struct timer **heap, struct timer *t)
+/* Refile the timers of slot @slot of level @lvl, now that it is due. */
+static void wheel_cascade(struct timers *ts, unsigned int lvl,
+                          unsigned int slot)
 {
-    unsigned int sz = heap_metadata(heap)->size;
+    struct list_head *head = &ts->wheel[lvl * WHEEL_LVL_SIZE + slot];
+    struct timer *t;
+    LIST_HEAD(list);
 
-    /* Fail if the heap is full. */
-    if ( unlikely(sz == heap_metadata(heap)->limit) )
-        return 0;
+    if ( !(ts->pending[lvl] & (1ULL << slot)) )
+        return;
 
-    heap_metadata(heap)->size = ++sz;
-    heap[sz] = t;
-    t->heap_offset = sz;
-    up_heap(heap, sz);
+    list_splice_init(head, &list);
+    ts->pending[lvl] &= ~(1ULL << slot);
 
-    return (t->heap_offset == 1);
+    while ( !list_empty(&list) )
+    {
+        t = list_first_entry(&list, struct timer, wheel_list);
+        list_del(&t->wheel_list);
+        wheel_add(ts, t);
+        ts->cascaded++;
+    }
 }
 
-
-/****************************************************************************
- * LINKED LIST OPERATIONS.
+/*
+ * Advance the wheel by at least a tick, but not beyond @target, skipping
+ * over ticks with nothing to expire or to cascade.
  */
-
-static int remove_from_list(struct timer **pprev, struct timer *t)
+static void wheel_advance(struct timers *ts, uint64_t target)
 {
-    struct timer *curr, **_pprev = pprev;
+    uint64_t next = ts->clk + 1;
+    unsigned int lvl, shift, pos;
+
+    for ( lvl = 0; lvl < WHEEL_LVL_NR - 1; lvl++ )
+    {
+        shift = WHEEL_LVL_SHIFT(lvl);
+        pos = (ts->clk >> shift) & WHEEL_LVL_MASK;
+
+        /* Skipping past this level's wrap skips a whole lower level. */
+        if ( lvl && ts->pending[lvl - 1] )
+            break;
+        if ( wheel_next_pending(ts, lvl, pos, 1) < WHEEL_LVL_SIZE - pos )
+            break;
 
-    while ( (curr = *_pprev) != t )
-        _pprev = &curr->list_next;
+        next = ((ts->clk >> (shift + WHEEL_LVL_BITS)) + 1) <<
+               (shift + WHEEL_LVL_BITS);
+    }
 
-    *_pprev = t->list_next;
+    ts->clk = min(next, target);
 
-    return (_pprev == pprev);
+    for ( lvl = WHEEL_LVL_NR - 1; lvl > 0; lvl-- )
+        if ( !(ts->clk & ((1ULL << WHEEL_LVL_SHIFT(lvl)) - 1)) )
+            wheel_cascade(ts, lvl, (ts->clk >> WHEEL_LVL_SHIFT(lvl)) &
+                                   WHEEL_LVL_MASK);
 }
 
-static int add_to_list(struct timer **pprev, struct timer *t)
+/*
+ * Earliest time a timer must fire at, or, if earlier, the wheel must reach
+ * to cascade timers (which can then be told apart) to a lower level.
+ */
+static s_time_t wheel_next_deadline(const struct timers *ts)
 {
-    struct timer *curr, **_pprev = pprev;
-
-    while ( ((curr = *_pprev) != NULL) && (curr->expires <= t->expires) )
-        _pprev = &curr->list_next;
+    s_time_t deadline = STIME_MAX;
+    const struct timer *t;
+    unsigned int lvl, pos, off, shift;
+    uint64_t start;
+
+    /* Level 0 slots are exact to a tick.  Account for the timers' slack. */
+    pos = ts->clk & WHEEL_LVL_MASK;
+    for ( off = wheel_next_pending(ts, 0, pos, 0); off < WHEEL_LVL_SIZE;
+          off = wheel_next_pending(ts, 0, pos, off + 1) )
+    {
+        if ( (s_time_t)((ts->clk + off) << WHEEL_TICK_SHIFT) >= deadline )
+            break;
+        list_for_each_entry ( t, &ts->wheel[(pos + off) & WHEEL_LVL_MASK],
+                              wheel_list )
+            deadline = min(deadline, timer_latest(t));
+        if ( off == WHEEL_LVL_SIZE - 1 )
+            break;
+    }
 
-    t->list_next = curr;
-    *_pprev = t;
+    /* Further levels: when the first pending slot is due for cascading. */
+    for ( lvl = 1; lvl < WHEEL_LVL_NR; lvl++ )
+    {
+        if ( !ts->pending[lvl] )
+            continue;
+
+        shift = WHEEL_LVL_SHIFT(lvl);
+        pos = (ts->clk >> shift) & WHEEL_LVL_MASK;
+        /* None but the slot at pos means that slot, next time round. */
+        off = wheel_next_pending(ts, lvl, pos, 1);
+        start = ((ts->clk >> shift) + off) << shift;
+        deadline = min_t(s_time_t, deadline,
+                         (s_time_t)(start << WHEEL_TICK_SHIFT));
+    }
 
-    return (_pprev == pprev);
+    return deadline;
 }
 
 
@@ -180,45 +236,33 @@ static int add_to_list(struct timer **pprev, struct timer *t)
  * TIMER OPERATIONS.
  */
 
+/* Returns TRUE if the CPU's deadline is affected. */
 static int remove_entry(struct timer *t)
 {
     struct timers *timers = &per_cpu(timers, t->cpu);
-    int rc;
 
-    switch ( t->status )
-    {
-    case TIMER_STATUS_in_heap:
-        rc = remove_from_heap(timers->heap, t);
-        break;
-    case TIMER_STATUS_in_list:
-        rc = remove_from_list(&timers->list, t);
-        break;
-    default:
-        rc = 0;
-        BUG();
-    }
+    BUG_ON(t->status != TIMER_STATUS_in_wheel);
+
+    /*
+     * A later deadline can wait for the softirq to run at the current one,
+     * and find nothing to do.
+     */
+    wheel_del(timers, t);
 
     t->status = TIMER_STATUS_invalid;
-    return rc;
+    return 0;
 }
 
 static int add_entry(struct timer *t)
 {
     struct timers *timers = &per_cpu(timers, t->cpu);
-    int rc;
 
     ASSERT(t->status == TIMER_STATUS_invalid);
 
-    /* Try to add to heap. t->heap_offset indicates whether we succeed. */
-    t->heap_offset = 0;
-    t->status = TIMER_STATUS_in_heap;
-    rc = add_to_heap(timers->heap, t);
-    if ( t->heap_offset != 0 )
-        return rc;
+    t->status = TIMER_STATUS_in_wheel;
+    wheel_add(timers, t);
 
-    /* Fall back to adding to the slower linked list. */
-    t->status = TIMER_STATUS_in_list;
-    return add_to_list(&timers->list, t);
+    return timer_latest(t) < timers->next_deadline;
 }
 
 static inline void activate_timer(struct timer *timer)
@@ -290,6 +334,19 @@ static bool active_timer(const struct timer *timer)
 }
 
 
+void set_timer_slack(struct timer *timer, unsigned int slack)
+{
+    unsigned long flags;
+
+    if ( !timer_lock_irqsave(timer, flags) )
+        return;
+
+    timer->slack = slack;
+
+    timer_unlock_irqrestore(timer, flags);
+}
+
+
 void init_timer(
     struct timer *timer,
     void        (*function)(void *),
@@ -438,90 +495,94 @@ static void execute_timer(struct timers *ts, struct timer *t)
 {
     void (*fn)(void *) = t->function;
     void *data = t->data;
+    s_time_t start;
 
     t->status = TIMER_STATUS_inactive;
     list_add(&t->inactive, &ts->inactive);
 
     ts->running = t;
     spin_unlock_irq(&ts->lock);
+    start = NOW();
     (*fn)(data);
+    ts->callback_ns += NOW() - start;
     spin_lock_irq(&ts->lock);
     ts->running = NULL;
+    ts->executed++;
 }
 
 
-static void timer_softirq_action(void)
+static int cmp_expires(void *priv, struct list_head *a, struct list_head *b)
 {
-    struct timer  *t, **heap, *next;
-    struct timers *ts;
-    s_time_t       now, deadline;
+    const struct timer *ta = list_entry(a, struct timer, wheel_list);
+    const struct timer *tb = list_entry(b, struct timer, wheel_list);
 
-    ts = &this_cpu(timers);
-    heap = ts->heap;
+    return ta->expires > tb->expires ? 1 : ta->expires < tb->expires ? -1 : 0;
+}
 
-    /* If we overflowed the heap, try to allocate a larger heap. */
-    if ( unlikely(ts->list != NULL) )
+/* Execute the timers of the current level 0 slot which expired by @now. */
+static void expire_slot(struct timers *ts, s_time_t now)
+{
+    unsigned int slot = ts->clk & WHEEL_LVL_MASK;
+    struct timer *t, *tmp;
+    LIST_HEAD(expired);
+
+    for ( ; ; )
     {
-        /* old_limit == (2^n)-1; new_limit == (2^(n+4))-1 */
-        unsigned int old_limit = heap_metadata(heap)->limit;
-        unsigned int new_limit = ((old_limit + 1) << 4) - 1;
-        struct timer **newheap = NULL;
-
-        /* Don't grow the heap beyond what is representable in its metadata. */
-        if ( new_limit == (typeof(heap_metadata(heap)->limit))new_limit &&
-             new_limit + 1 )
-            newheap = xmalloc_array(struct timer *, new_limit + 1);
-        else
-            printk_once(XENLOG_WARNING "CPU%u: timer heap limit reached\n",
-                        smp_processor_id());
-        if ( newheap != NULL )
+        list_for_each_entry_safe ( t, tmp, &ts->wheel[slot], wheel_list )
+            if ( t->expires < now )
+                list_move_tail(&t->wheel_list, &expired);
+        if ( list_empty(&ts->wheel[slot]) )
+            ts->pending[0] &= ~(1ULL << slot);
+
+        if ( list_empty(&expired) )
+            break;
+
+        /*
+         * Within a tick, timers are filed in whatever order they were set
+         * or cascaded in: sort them by expiry, in O(n log n) for the batch.
+         */
+        list_sort(NULL, &expired, cmp_expires);
+
+        /*
+         * The timers stay on the local list (as far as removing them is
+         * concerned) while the lock is dropped to execute them.  Callbacks
+         * may add more expired timers to the slot, hence the loop.
+         */
+        while ( !list_empty(&expired) )
         {
-            spin_lock_irq(&ts->lock);
-            memcpy(newheap, heap, (old_limit + 1) * sizeof(*heap));
-            heap_metadata(newheap)->limit = new_limit;
-            ts->heap = newheap;
-            spin_unlock_irq(&ts->lock);
-            if ( old_limit != 0 )
-                xfree(heap);
-            heap = newheap;
+            t = list_first_entry(&expired, struct timer, wheel_list);
+            list_del(&t->wheel_list);
+            execute_timer(ts, t);
         }
     }
+}
 
-    spin_lock_irq(&ts->lock);
 
-    now = NOW();
+static void timer_softirq_action(void)
+{
+    struct timers *ts;
+    s_time_t       start, now, deadline;
+    uint64_t       target;
 
-    /* Execute ready heap timers. */
-    while ( (heap_metadata(heap)->size != 0) &&
-            ((t = heap[1])->expires < now) )
-    {
-        remove_from_heap(heap, t);
-        execute_timer(ts, t);
-    }
+    ts = &this_cpu(timers);
 
-    /* Execute ready list timers. */
-    while ( ((t = ts->list) != NULL) && (t->expires < now) )
-    {
-        ts->list = t->list_next;
-        execute_timer(ts, t);
-    }
+    spin_lock_irq(&ts->lock);
+
+    start = now = NOW();
+    target = wheel_tick(now);
 
-    /* Try to move timers from linked list to more efficient heap. */
-    next = ts->list;
-    ts->list = NULL;
-    while ( unlikely((t = next) != NULL) )
+    /* Execute ready timers, tick by tick. */
+    for ( ; ; )
     {
-        next = t->list_next;
-        t->status = TIMER_STATUS_invalid;
-        add_entry(t);
+        expire_slot(ts, now);
+        if ( ts->clk >= target )
+            break;
+        wheel_advance(ts, target);
     }
 
-    /* Find earliest deadline from head of linked list and top of heap. */
-    deadline = STIME_MAX;
-    if ( heap_metadata(heap)->size != 0 )
-        deadline = heap[1]->expires;
-    if ( (ts->list != NULL) && (ts->list->expires < deadline) )
-        deadline = ts->list->expires;
+    /* Find earliest deadline. */
+    deadline = wheel_next_deadline(ts);
+    ts->next_deadline = deadline;
     now = NOW();
     this_cpu(timer_deadline) =
         (deadline == STIME_MAX) ? 0 : MAX(deadline, now + timer_slop);
@@ -529,6 +590,10 @@ static void timer_softirq_action(void)
     if ( !reprogram_timer(this_cpu(timer_deadline)) )
         raise_softirq(TIMER_SOFTIRQ);
 
+    ts->softirqs++;
+    ts->softirq_ns += now - start;
+    ts->softirq_max_ns = max(ts->softirq_max_ns, now - start);
+
     spin_unlock_irq(&ts->lock);
 }
 
@@ -560,12 +625,16 @@ static void dump_timerq(unsigned char key)
     {
         ts = &per_cpu(timers, i);
 
-        printk("CPU%02d:\n", i);
         spin_lock_irqsave(&ts->lock, flags);
-        for ( j = 1; j <= heap_metadata(ts->heap)->size; j++ )
-            dump_timer(ts->heap[j], now);
-        for ( t = ts->list; t != NULL; t = t->list_next )
-            dump_timer(t, now);
+        printk("CPU%02d: softirqs %lu (%"PRId64"ns avg, %"PRId64"ns max, "
+               "%"PRId64"ns in callbacks) timers %lu cascaded %lu\n",
+               i, ts->softirqs,
+               ts->softirqs ? ts->softirq_ns / ts->softirqs : 0,
+               ts->softirq_max_ns, ts->callback_ns, ts->executed,
+               ts->cascaded);
+        for ( j = 0; j < ARRAY_SIZE(ts->wheel); j++ )
+            list_for_each_entry ( t, &ts->wheel[j], wheel_list )
+                dump_timer(t, now);
         spin_unlock_irqrestore(&ts->lock, flags);
     }
 }
@@ -576,6 +645,7 @@ static void migrate_timers_from_cpu(unsigned int old_cpu)
     struct timers *old_ts, *new_ts;
     struct timer *t;
     bool_t notify = 0;
+    unsigned int i;
 
     ASSERT(!cpu_online(old_cpu) && cpu_online(new_cpu));
 
@@ -593,12 +663,15 @@ static void migrate_timers_from_cpu(unsigned int old_cpu)
         spin_lock(&old_ts->lock);
     }
 
-    while ( (t = heap_metadata(old_ts->heap)->size
-             ? old_ts->heap[1] : old_ts->list) != NULL )
+    for ( i = 0; i < ARRAY_SIZE(old_ts->wheel); i++ )
     {
-        remove_entry(t);
-        write_atomic(&t->cpu, new_cpu);
-        notify |= add_entry(t);
+        while ( !list_empty(&old_ts->wheel[i]) )
+        {
+            t = list_first_entry(&old_ts->wheel[i], struct timer, wheel_list);
+            remove_entry(t);
+            write_atomic(&t->cpu, new_cpu);
+            notify |= add_entry(t);
+        }
     }
 
     while ( !list_empty(&old_ts->inactive) )
@@ -616,57 +689,33 @@ static void migrate_timers_from_cpu(unsigned int old_cpu)
         cpu_raise_softirq(new_cpu, TIMER_SOFTIRQ);
 }
 
-/*
- * All CPUs initially share an empty dummy heap. Only those CPUs that
- * are brought online will be dynamically allocated their own heap.
- * The size/limit metadata are both 0 by being in .bss
- */
-static struct timer *dummy_heap[1];
-
-static void free_percpu_timers(unsigned int cpu)
-{
-    struct timers *ts = &per_cpu(timers, cpu);
-
-    ASSERT(heap_metadata(ts->heap)->size == 0);
-    if ( heap_metadata(ts->heap)->limit )
-    {
-        xfree(ts->heap);
-        ts->heap = dummy_heap;
-    }
-    else
-        ASSERT(ts->heap == dummy_heap);
-}
-
 static int cpu_callback(
     struct notifier_block *nfb, unsigned long action, void *hcpu)
 {
     unsigned int cpu = (unsigned long)hcpu;
     struct timers *ts = &per_cpu(timers, cpu);
+    unsigned int i;
 
     switch ( action )
     {
     case CPU_UP_PREPARE:
         /* Only initialise ts once. */
-        if ( !ts->heap )
+        if ( !ts->inactive.next )
         {
             INIT_LIST_HEAD(&ts->inactive);
             spin_lock_init(&ts->lock);
-            ts->heap = dummy_heap;
+            for ( i = 0; i < ARRAY_SIZE(ts->wheel); i++ )
+                INIT_LIST_HEAD(&ts->wheel[i]);
         }
+        /* The wheel is empty (again): restart it from now. */
+        ts->clk = wheel_tick(NOW());
+        ts->next_deadline = STIME_MAX;
         break;
 
     case CPU_UP_CANCELED:
     case CPU_DEAD:
     case CPU_RESUME_FAILED:
         migrate_timers_from_cpu(cpu);
-
-        if ( !park_offline_cpus && system_state != SYS_STATE_suspend )
-            free_percpu_timers(cpu);
-        break;
-
-    case CPU_REMOVE:
-        if ( park_offline_cpus )
-            free_percpu_timers(cpu);
         break;
 
     default:
@@ -75,6 +75,50 @@ static cpumask_t tb_cpu_mask;
 /* which tracing events are enabled */
 static u32 tb_event_mask = TRC_ALL;
 
+/* Flight recorder mode (XEN_SYSCTL_TBUF_MODE_*, bar frozen) */
+#define TB_MODE_FREEZE_ON (XEN_SYSCTL_TBUF_MODE_freeze_on_crash |    \
+                           XEN_SYSCTL_TBUF_MODE_freeze_on_watchdog | \
+                           XEN_SYSCTL_TBUF_MODE_freeze_on_nmi)
+#define TB_MODE_MASK (XEN_SYSCTL_TBUF_MODE_flight_recorder | TB_MODE_FREEZE_ON)
+
+static unsigned int tb_mode;
+static bool tb_frozen;
+
+static int __init parse_tbuf_flight_recorder(const char *s)
+{
+    const char *ss;
+    int val, rc = 0;
+
+    do {
+        ss = strchr(s, ',');
+        if ( !ss )
+            ss = strchr(s, '\0');
+
+        if ( (val = parse_bool(s, ss)) >= 0 )
+            tb_mode = val ? TB_MODE_MASK : 0;
+        else if ( (val = parse_boolean("crash", s, ss)) >= 0 )
+            tb_mode = (tb_mode & ~XEN_SYSCTL_TBUF_MODE_freeze_on_crash) |
+                      (val ? XEN_SYSCTL_TBUF_MODE_freeze_on_crash : 0);
+        else if ( (val = parse_boolean("watchdog", s, ss)) >= 0 )
+            tb_mode = (tb_mode & ~XEN_SYSCTL_TBUF_MODE_freeze_on_watchdog) |
+                      (val ? XEN_SYSCTL_TBUF_MODE_freeze_on_watchdog : 0);
+        else if ( (val = parse_boolean("nmi", s, ss)) >= 0 )
+            tb_mode = (tb_mode & ~XEN_SYSCTL_TBUF_MODE_freeze_on_nmi) |
+                      (val ? XEN_SYSCTL_TBUF_MODE_freeze_on_nmi : 0);
+        else
+            rc = -EINVAL;
+
+        s = ss + 1;
+    } while ( *ss );
+
+    /* Choosing what to freeze on implies the mode. */
+    if ( tb_mode )
+        tb_mode |= XEN_SYSCTL_TBUF_MODE_flight_recorder;
+
+    return rc;
+}
+custom_param("tbuf_flight_recorder", parse_tbuf_flight_recorder);
+
 /* Return the number of elements _type necessary to store at least _x bytes of data
  * i.e., sizeof(_type) * ans >= _x. */
 #define fit_to_type(_type, _x) (((_x)+sizeof(_type)-1) / sizeof(_type))
@@ -355,8 +399,8 @@ void __init init_trace_bufs(void)
         }
         else if ( opt_tevt_mask )
         {
-            printk("xentrace: Starting tracing, enabling mask %x\n",
-                   opt_tevt_mask);
+            printk("xentrace: Starting %stracing, enabling mask %x\n",
+                   tb_mode ? "flight recorder " : "", opt_tevt_mask);
             tb_event_mask = opt_tevt_mask;
             tb_init_done=1;
         }
@@ -380,6 +424,7 @@ int tb_control(struct xen_sysctl_tbuf_op *tbc)
         tbc->evt_mask   = tb_event_mask;
         tbc->buffer_mfn = t_info ? virt_to_mfn(t_info) : 0;
         tbc->size = t_info_pages * PAGE_SIZE;
+        tbc->mode = tb_mode | (tb_frozen ? XEN_SYSCTL_TBUF_MODE_frozen : 0);
         break;
     case XEN_SYSCTL_TBUFOP_set_cpu_mask:
     {
@@ -428,6 +473,47 @@ int tb_control(struct xen_sysctl_tbuf_op *tbc)
         }
     }
         break;
+    case XEN_SYSCTL_TBUFOP_set_mode:
+        if ( tbc->mode & ~TB_MODE_MASK )
+        {
+            rc = -EINVAL;
+            break;
+        }
+        /* Leaving flight recorder mode, the consumer owns cons again. */
+        if ( !(tbc->mode & XEN_SYSCTL_TBUF_MODE_flight_recorder) )
+            tbc->mode = 0;
+        write_atomic(&tb_mode, tbc->mode);
+        if ( !tb_mode )
+            write_atomic(&tb_frozen, false);
+        break;
+    case XEN_SYSCTL_TBUFOP_freeze:
+    {
+        int i;
+
+        if ( !(tb_mode & XEN_SYSCTL_TBUF_MODE_flight_recorder) )
+        {
+            rc = -EINVAL;
+            break;
+        }
+
+        write_atomic(&tb_frozen, true);
+        smp_wmb();
+        /*
+         * Wait for records being written to land, so the buffers can be
+         * consumed as soon as this hypercall returns.
+         */
+        for_each_online_cpu(i)
+        {
+            unsigned long flags;
+
+            spin_lock_irqsave(&per_cpu(t_lock, i), flags);
+            spin_unlock_irqrestore(&per_cpu(t_lock, i), flags);
+        }
+    }
+        break;
+    case XEN_SYSCTL_TBUFOP_thaw:
+        write_atomic(&tb_frozen, false);
+        break;
     default:
         rc = -EINVAL;
         break;
@@ -617,6 +703,46 @@ static inline void __insert_record(struct t_buf *buf,
     buf->prod = next;
 }
 
+/*
+ * Flight recorder mode: make room for @size bytes by moving the consumer
+ * index past the oldest records.  Xen owns buf->cons in this mode.
+ */
+static void discard_oldest(struct t_buf *buf, unsigned int size)
+{
+    const uint32_t *mfn_list = (const uint32_t *)t_info;
+    unsigned int mfn_offset = t_info->mfn_offset[smp_processor_id()];
+
+    /* calc_bytes_avail() clears tb_init_done on finding a bogus buffer. */
+    while ( tb_init_done && calc_bytes_avail(buf) < size )
+    {
+        uint32_t cons = buf->cons, x = cons;
+        const struct t_rec *rec;
+        unsigned int rec_size;
+
+        if ( x >= data_size )
+            x -= data_size;
+        x += sizeof(struct t_buf);
+
+        /* Records are word aligned, so the header never spans pages. */
+        rec = mfn_to_virt(mfn_list[mfn_offset + (x >> PAGE_SHIFT)]) +
+              (x & ~PAGE_MASK);
+        rec_size = calc_rec_size(rec->cycles_included,
+                                 rec->extra_u32 * sizeof(u32));
+
+        if ( unlikely(rec_size > calc_unconsumed_bytes(buf)) )
+        {
+            /* Someone else moved cons: start afresh. */
+            buf->cons = buf->prod;
+            break;
+        }
+
+        cons += rec_size;
+        if ( cons >= 2*data_size )
+            cons -= 2*data_size;
+        buf->cons = cons;
+    }
+}
+
 static inline void insert_wrap_record(struct t_buf *buf,
                                       unsigned int size)
 {
@@ -687,9 +813,10 @@ void __trace_var(u32 event, bool_t cycles, unsigned int extra,
     u32 bytes_to_tail, bytes_to_wrap;
     unsigned int rec_size, total_size;
     unsigned int extra_word;
+    unsigned int mode;
     bool_t started_below_highwater;
 
-    if( !tb_init_done )
+    if( !tb_init_done || read_atomic(&tb_frozen) )
         return;
 
     /* Convert byte count into word count, rounding up */
@@ -724,15 +851,24 @@ void __trace_var(u32 event, bool_t cycles, unsigned int extra,
     spin_lock_irqsave(&this_cpu(t_lock), flags);
 
     buf = this_cpu(t_bufs);
+    mode = read_atomic(&tb_mode);
 
-    if ( unlikely(!buf) )
+    /*
+     * Check for the buffers having been frozen again, now holding the lock:
+     * freezing cycles all CPUs' locks to wait for writers which got past the
+     * check above, and none must start writing after that.
+     */
+    if ( unlikely(!buf) || unlikely(read_atomic(&tb_frozen)) )
     {
         /* Make gcc happy */
         started_below_highwater = 0;
         goto unlock;
     }
 
-    started_below_highwater = (calc_unconsumed_bytes(buf) < t_buf_highwater);
+    /* Nobody consumes the buffers in flight recorder mode. */
+    started_below_highwater =
+        !(mode & XEN_SYSCTL_TBUF_MODE_flight_recorder) &&
+        (calc_unconsumed_bytes(buf) < t_buf_highwater);
 
     /* Calculate the record size */
     rec_size = calc_rec_size(cycles, extra);
@@ -773,7 +909,10 @@ void __trace_var(u32 event, bool_t cycles, unsigned int extra,
     total_size += rec_size;
 
     /* Do we have enough space for everything? */
-    if ( total_size > bytes_to_tail )
+    if ( total_size > bytes_to_tail &&
+         (mode & XEN_SYSCTL_TBUF_MODE_flight_recorder) )
+        discard_oldest(buf, total_size);
+    else if ( total_size > bytes_to_tail )
     {
         if ( ++this_cpu(lost_records) == 1 )
             this_cpu(lost_records_first_tsc)=(u64)get_cycles();
@@ -817,6 +956,23 @@ unlock:
         tasklet_schedule(&trace_notify_dom0_tasklet);
 }
 
+void trace_freeze(enum trace_freeze_trigger trigger)
+{
+    static const unsigned int freeze_on[] = {
+        [TRACE_FREEZE_CRASH]    = XEN_SYSCTL_TBUF_MODE_freeze_on_crash,
+        [TRACE_FREEZE_WATCHDOG] = XEN_SYSCTL_TBUF_MODE_freeze_on_watchdog,
+        [TRACE_FREEZE_NMI]      = XEN_SYSCTL_TBUF_MODE_freeze_on_nmi,
+    };
+    unsigned int mode = read_atomic(&tb_mode);
+
+    ASSERT(trigger < ARRAY_SIZE(freeze_on));
+
+    /* No locks or printk(): we may be in NMI context. */
+    if ( (mode & XEN_SYSCTL_TBUF_MODE_flight_recorder) &&
+         (mode & freeze_on[trigger]) )
+        write_atomic(&tb_frozen, true);
+}
+
 void __trace_hypercall(uint32_t event, unsigned long op,
                        const xen_ulong_t *args)
 {
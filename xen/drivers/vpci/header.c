@@ -17,6 +17,7 @@
  * License along with this program; If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <xen/keyhandler.h>
 #include <xen/sched.h>
 #include <xen/softirq.h>
 #include <xen/vpci.h>
@@ -31,12 +32,14 @@
 struct map_data {
     struct domain *d;
     bool map;
+    /* Number of pages processed. */
+    unsigned long done;
 };
 
 static int map_range(unsigned long s, unsigned long e, void *data,
                      unsigned long *c)
 {
-    const struct map_data *map = data;
+    struct map_data *map = data;
     int rc;
 
     for ( ; ; )
@@ -57,6 +60,7 @@ static int map_range(unsigned long s, unsigned long e, void *data,
         if ( rc == 0 )
         {
             *c += size;
+            map->done += size;
             break;
         }
         if ( rc < 0 )
@@ -68,6 +72,7 @@ static int map_range(unsigned long s, unsigned long e, void *data,
         }
         ASSERT(rc < size);
         *c += rc;
+        map->done += rc;
         s += rc;
         if ( general_preempt_check() )
                 return -ERESTART;
@@ -127,6 +132,14 @@ static void modify_decoding(const struct pci_dev *pdev, uint16_t cmd,
         ASSERT_UNREACHABLE();
 }
 
+static void map_done(const struct pci_dev *pdev, unsigned long pages)
+{
+    struct vpci_header *header = &pdev->vpci->header;
+
+    header->map_pages += pages;
+    header->map_time = NOW() - header->map_start;
+}
+
 bool vpci_process_pending(struct vcpu *v)
 {
     if ( v->vpci.mem )
@@ -137,14 +150,18 @@ bool vpci_process_pending(struct vcpu *v)
         };
         int rc = rangeset_consume_ranges(v->vpci.mem, map_range, &data);
 
+        map_done(v->vpci.pdev, data.done);
+
         if ( rc == -ERESTART )
             return true;
 
         spin_lock(&v->vpci.pdev->vpci->lock);
+        vpci_write_begin(v->vpci.pdev->vpci);
         /* Disable memory decoding unconditionally on failure. */
         modify_decoding(v->vpci.pdev,
                         rc ? v->vpci.cmd & ~PCI_COMMAND_MEMORY : v->vpci.cmd,
                         !rc && v->vpci.rom_only);
+        vpci_write_end(v->vpci.pdev->vpci);
         spin_unlock(&v->vpci.pdev->vpci->lock);
 
         rangeset_destroy(v->vpci.mem);
@@ -172,6 +189,7 @@ static int __init apply_map(struct domain *d, const struct pci_dev *pdev,
     while ( (rc = rangeset_consume_ranges(mem, map_range, &data)) == -ERESTART )
         process_pending_softirqs();
     rangeset_destroy(mem);
+    map_done(pdev, data.done);
     if ( !rc )
         modify_decoding(pdev, cmd, false);
 
@@ -213,6 +231,9 @@ static int modify_bars(const struct pci_dev *pdev, uint16_t cmd, bool rom_only)
     if ( !mem )
         return -ENOMEM;
 
+    header->map_start = NOW();
+    header->map_pages = 0;
+
     /*
      * Create a rangeset that represents the current device BARs memory region
      * and compare it against all the currently active BAR memory regions. If
@@ -562,6 +583,62 @@ static int init_bars(struct pci_dev *pdev)
 }
 REGISTER_VPCI_INIT(init_bars, VPCI_PRIORITY_MIDDLE);
 
+static void dump_bars(unsigned char key)
+{
+    const struct domain *d;
+
+    printk("'%c' pressed -> dumping vPCI BAR mapping info\n", key);
+
+    rcu_read_lock(&domlist_read_lock);
+    for_each_domain ( d )
+    {
+        const struct pci_dev *pdev;
+
+        if ( !has_vpci(d) )
+            continue;
+
+        printk("vPCI BARs d%d\n", d->domain_id);
+
+        for_each_pdev ( d, pdev )
+        {
+            const struct vpci_header *header;
+            unsigned int i;
+
+            if ( !pdev->vpci || !spin_trylock(&pdev->vpci->lock) )
+                continue;
+
+            header = &pdev->vpci->header;
+            printk("%pp: last map: %lu pages in %"PRI_stime"us\n",
+                   &pdev->sbdf, header->map_pages,
+                   header->map_time / MICROSECS(1));
+
+            for ( i = 0; i < ARRAY_SIZE(header->bars); i++ )
+            {
+                const struct vpci_bar *bar = &header->bars[i];
+
+                if ( !MAPPABLE_BAR(bar) )
+                    continue;
+
+                printk("  %s%u: %#"PRIx64" size %#"PRIx64"%s\n",
+                       bar->type == VPCI_BAR_ROM ? "ROM" : "BAR", i,
+                       bar->addr, bar->size,
+                       bar->enabled ? " mapped" : "");
+            }
+
+            spin_unlock(&pdev->vpci->lock);
+            process_pending_softirqs();
+        }
+    }
+    rcu_read_unlock(&domlist_read_lock);
+}
+
+static int __init vpci_bars_key_init(void)
+{
+    register_keyhandler('b', dump_bars, "dump vPCI BAR mapping info", 1);
+    return 0;
+}
+__initcall(vpci_bars_key_init);
+
 /*
  * Local variables:
  * mode: C
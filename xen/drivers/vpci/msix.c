@@ -298,6 +298,7 @@ static int msix_write(struct vcpu *v, unsigned long addr, unsigned int len,
     }
 
     spin_lock(&msix->pdev->vpci->lock);
+    vpci_write_begin(msix->pdev->vpci);
     entry = get_entry(msix, addr);
     offset = addr & (PCI_MSIX_ENTRY_SIZE - 1);
 
@@ -370,6 +371,7 @@ static int msix_write(struct vcpu *v, unsigned long addr, unsigned int len,
         ASSERT_UNREACHABLE();
         break;
     }
+    vpci_write_end(msix->pdev->vpci);
     spin_unlock(&msix->pdev->vpci->lock);
 
     return X86EMUL_OKAY;
@@ -28,46 +28,131 @@ struct vpci_register {
     unsigned int offset;
     void *private;
     struct list_head node;
+    struct rcu_head rcu;
 };
 
+/*
+ * Per-device dispatch table, rebuilt whenever a handler is added or removed
+ * and published using RCU, so that finding the handlers for an access
+ * neither walks the whole handler list nor requires holding the vPCI lock.
+ */
+struct vpci_map {
+    unsigned int nr_regs, nr_dwords;
+    /* Registers, sorted by offset. */
+    const struct vpci_register **regs;
+    struct rcu_head rcu;
+    /* Index into regs[] of the first register at or above each dword. */
+    uint16_t first[];
+};
+
+static DEFINE_RCU_READ_LOCK(vpci_rcu_lock);
+
+static void vpci_free_map(struct rcu_head *rcu)
+{
+    struct vpci_map *map = container_of(rcu, struct vpci_map, rcu);
+
+    xfree(map->regs);
+    xfree(map);
+}
+
+static void vpci_free_register(struct rcu_head *rcu)
+{
+    xfree(container_of(rcu, struct vpci_register, rcu));
+}
+
+/*
+ * Config space reads don't take the vPCI lock. Instead anything changing a
+ * device's vPCI state bumps its sequence count, with the vPCI lock held,
+ * before and after doing so (leaving it odd meanwhile), and readers retry
+ * if it changed while they were reading.
+ */
+static unsigned int vpci_read_begin(const struct vpci *vpci)
+{
+    unsigned int seq;
+
+    while ( (seq = read_atomic(&vpci->seq)) & 1 )
+        cpu_relax();
+    smp_rmb();
+
+    return seq;
+}
+
+static bool vpci_read_retry(const struct vpci *vpci, unsigned int seq)
+{
+    smp_rmb();
+
+    return read_atomic(&vpci->seq) != seq;
+}
+
+void vpci_write_begin(struct vpci *vpci)
+{
+    ASSERT(!(vpci->seq & 1));
+    write_atomic(&vpci->seq, vpci->seq + 1);
+    smp_wmb();
+}
+
+void vpci_write_end(struct vpci *vpci)
+{
+    ASSERT(vpci->seq & 1);
+    smp_wmb();
+    write_atomic(&vpci->seq, vpci->seq + 1);
+}
+
 #ifdef __XEN__
 extern vpci_register_init_t *const __start_vpci_array[];
 extern vpci_register_init_t *const __end_vpci_array[];
 #define NUM_VPCI_INIT (__end_vpci_array - __start_vpci_array)
 
-void vpci_remove_device(struct pci_dev *pdev)
+static void vpci_free(struct rcu_head *rcu)
 {
-    spin_lock(&pdev->vpci->lock);
-    while ( !list_empty(&pdev->vpci->handlers) )
+    struct vpci *vpci = container_of(rcu, struct vpci, rcu);
+
+    while ( !list_empty(&vpci->handlers) )
     {
-        struct vpci_register *r = list_first_entry(&pdev->vpci->handlers,
+        struct vpci_register *r = list_first_entry(&vpci->handlers,
                                                    struct vpci_register,
                                                    node);
 
         list_del(&r->node);
         xfree(r);
     }
-    spin_unlock(&pdev->vpci->lock);
-    xfree(pdev->vpci->msix);
-    xfree(pdev->vpci->msi);
-    xfree(pdev->vpci);
-    pdev->vpci = NULL;
+    if ( vpci->map )
+        vpci_free_map(&vpci->map->rcu);
+    xfree(vpci->msix);
+    xfree(vpci->msi);
+    xfree(vpci);
+}
+
+void vpci_remove_device(struct pci_dev *pdev)
+{
+    struct vpci *vpci = pdev->vpci;
+
+    /* Accesses might still be in flight, defer freeing. */
+    rcu_assign_pointer(pdev->vpci, NULL);
+    call_rcu(&vpci->rcu, vpci_free);
 }
 
 int __hwdom_init vpci_add_handlers(struct pci_dev *pdev)
 {
+    struct vpci *vpci;
     unsigned int i;
     int rc = 0;
 
     if ( !has_vpci(pdev->domain) )
         return 0;
 
-    pdev->vpci = xzalloc(struct vpci);
-    if ( !pdev->vpci )
+    vpci = xzalloc(struct vpci);
+    if ( !vpci )
         return -ENOMEM;
 
-    INIT_LIST_HEAD(&pdev->vpci->handlers);
-    spin_lock_init(&pdev->vpci->lock);
+    INIT_LIST_HEAD(&vpci->handlers);
+    spin_lock_init(&vpci->lock);
+    /*
+     * Keep lockless readers out until the handlers are set up: the sequence
+     * count stays odd meanwhile (see vpci_write_begin()).
+     */
+    vpci->seq = 1;
+    rcu_assign_pointer(pdev->vpci, vpci);
 
     for ( i = 0; i < NUM_VPCI_INIT; i++ )
     {
@@ -76,6 +161,11 @@ int __hwdom_init vpci_add_handlers(struct pci_dev *pdev)
             break;
     }
 
+    /*
+     * Even on failure: readers which already found the device would
+     * otherwise wait for the sequence count to become even forever.
+     */
+    vpci_write_end(vpci);
     if ( rc )
         vpci_remove_device(pdev);
 
@@ -111,6 +201,69 @@ static void vpci_ignored_write(const struct pci_dev *pdev, unsigned int reg,
 {
 }
 
+/*
+ * Rebuild the dispatch table from the handler list. Must be called with the
+ * vPCI lock held.
+ */
+static int vpci_update_map(struct vpci *vpci)
+{
+    struct vpci_map *map = NULL, *old = vpci->map;
+    const struct vpci_register *r;
+    unsigned int nr_regs = 0, nr_dwords = 0, i = 0, dw = 0;
+
+    list_for_each_entry ( r, &vpci->handlers, node )
+    {
+        nr_regs++;
+        nr_dwords = r->offset / 4 + 1;
+    }
+
+    if ( nr_regs )
+    {
+        map = xmalloc_flex_struct(struct vpci_map, first, nr_dwords);
+        if ( !map )
+            return -ENOMEM;
+
+        map->regs = xmalloc_array(const struct vpci_register *, nr_regs);
+        if ( !map->regs )
+        {
+            xfree(map);
+            return -ENOMEM;
+        }
+
+        map->nr_regs = nr_regs;
+        map->nr_dwords = nr_dwords;
+
+        list_for_each_entry ( r, &vpci->handlers, node )
+        {
+            /* Registers are naturally aligned, hence never cross a dword. */
+            for ( ; dw <= r->offset / 4; dw++ )
+                map->first[dw] = i;
+            map->regs[i++] = r;
+        }
+    }
+
+    rcu_assign_pointer(vpci->map, map);
+    if ( old )
+        call_rcu(&old->rcu, vpci_free_map);
+
+    return 0;
+}
+
+/* Index of the first register in the dword containing reg. */
+static unsigned int vpci_map_first(const struct vpci_map *map,
+                                   unsigned int reg)
+{
+    if ( !map )
+        return 0;
+
+    return reg / 4 < map->nr_dwords ? map->first[reg / 4] : map->nr_regs;
+}
+
+static unsigned int vpci_map_nr(const struct vpci_map *map)
+{
+    return map ? map->nr_regs : 0;
+}
+
 uint32_t vpci_hw_read16(const struct pci_dev *pdev, unsigned int reg,
                         void *data)
 {
@@ -129,6 +282,8 @@ int vpci_add_register(struct vpci *vpci, vpci_read_t *read_handler,
 {
     struct list_head *prev;
     struct vpci_register *r;
+    bool setup;
+    int rc;
 
     /* Some sanity checks. */
     if ( (size != 1 && size != 2 && size != 4) ||
@@ -147,6 +302,8 @@ int vpci_add_register(struct vpci *vpci, vpci_read_t *read_handler,
     r->private = data;
 
     spin_lock(&vpci->lock);
+    /* Still odd while vpci_add_handlers() sets the device up. */
+    setup = vpci->seq & 1;
 
     /* The list of handlers must be kept sorted at all times. */
     list_for_each ( prev, &vpci->handlers )
@@ -165,9 +322,22 @@ int vpci_add_register(struct vpci *vpci, vpci_read_t *read_handler,
         }
     }
 
+    if ( !setup )
+        vpci_write_begin(vpci);
     list_add_tail(&r->node, prev);
+    rc = vpci_update_map(vpci);
+    if ( rc )
+        list_del(&r->node);
+    if ( !setup )
+        vpci_write_end(vpci);
     spin_unlock(&vpci->lock);
 
+    if ( rc )
+    {
+        xfree(r);
+        return rc;
+    }
+
     return 0;
 }
 
@@ -176,8 +346,10 @@ int vpci_remove_register(struct vpci *vpci, unsigned int offset,
 {
     const struct vpci_register r = { .offset = offset, .size = size };
     struct vpci_register *rm;
+    bool setup;
 
     spin_lock(&vpci->lock);
+    setup = vpci->seq & 1;
     list_for_each_entry ( rm, &vpci->handlers, node )
     {
         int cmp = vpci_register_cmp(&r, rm);
@@ -188,10 +360,21 @@ int vpci_remove_register(struct vpci *vpci, unsigned int offset,
          */
         if ( !cmp && rm->offset == offset && rm->size == size )
         {
+            struct list_head *prev = rm->node.prev;
+            int rc;
+
+            if ( !setup )
+                vpci_write_begin(vpci);
             list_del(&rm->node);
+            rc = vpci_update_map(vpci);
+            if ( rc )
+                list_add(&rm->node, prev);
+            if ( !setup )
+                vpci_write_end(vpci);
             spin_unlock(&vpci->lock);
-            xfree(rm);
-            return 0;
+            if ( !rc )
+                call_rcu(&rm->rcu, vpci_free_register);
+            return rc;
         }
         if ( cmp <= 0 )
             break;
@@ -302,30 +485,17 @@ static uint32_t merge_result(uint32_t data, uint32_t new, unsigned int size,
     return (data & ~(mask << (offset * 8))) | ((new & mask) << (offset * 8));
 }
 
-uint32_t vpci_read(pci_sbdf_t sbdf, unsigned int reg, unsigned int size)
+static uint32_t vpci_read_regs(const struct pci_dev *pdev,
+                               const struct vpci_map *map, pci_sbdf_t sbdf,
+                               unsigned int reg, unsigned int size)
 {
-    const struct domain *d = current->domain;
-    const struct pci_dev *pdev;
-    const struct vpci_register *r;
-    unsigned int data_offset = 0;
+    unsigned int i, data_offset = 0;
     uint32_t data = ~(uint32_t)0;
 
-    if ( !size )
-    {
-        ASSERT_UNREACHABLE();
-        return data;
-    }
-
-    /* Find the PCI dev matching the address. */
-    pdev = pci_get_pdev_by_domain(d, sbdf.seg, sbdf.bus, sbdf.devfn);
-    if ( !pdev )
-        return vpci_read_hw(sbdf, reg, size);
-
-    spin_lock(&pdev->vpci->lock);
-
     /* Read from the hardware or the emulated register handlers. */
-    list_for_each_entry ( r, &pdev->vpci->handlers, node )
+    for ( i = vpci_map_first(map, reg); i < vpci_map_nr(map); i++ )
     {
+        const struct vpci_register *r = map->regs[i];
         const struct vpci_register emu = {
             .offset = reg + data_offset,
             .size = size - data_offset
@@ -373,7 +543,42 @@ uint32_t vpci_read(pci_sbdf_t sbdf, unsigned int reg, unsigned int size)
 
         data = merge_result(data, tmp_data, size - data_offset, data_offset);
     }
-    spin_unlock(&pdev->vpci->lock);
+
+    return data;
+}
+
+uint32_t vpci_read(pci_sbdf_t sbdf, unsigned int reg, unsigned int size)
+{
+    const struct domain *d = current->domain;
+    const struct pci_dev *pdev;
+    const struct vpci *vpci;
+    unsigned int seq;
+    uint32_t data = ~(uint32_t)0;
+
+    if ( !size )
+    {
+        ASSERT_UNREACHABLE();
+        return data;
+    }
+
+    /* Find the PCI dev matching the address. */
+    pdev = pci_get_pdev_by_domain(d, sbdf.seg, sbdf.bus, sbdf.devfn);
+    if ( !pdev )
+        return vpci_read_hw(sbdf, reg, size);
+
+    rcu_read_lock(&vpci_rcu_lock);
+
+    vpci = rcu_dereference(pdev->vpci);
+    if ( !vpci )
+        data = vpci_read_hw(sbdf, reg, size);
+    else
+        do {
+            seq = vpci_read_begin(vpci);
+            data = vpci_read_regs(pdev, rcu_dereference(vpci->map), sbdf,
+                                  reg, size);
+        } while ( vpci_read_retry(vpci, seq) );
+
+    rcu_read_unlock(&vpci_rcu_lock);
 
     return data & (0xffffffff >> (32 - 8 * size));
 }
@@ -409,8 +614,9 @@ void vpci_write(pci_sbdf_t sbdf, unsigned int reg, unsigned int size,
 {
     const struct domain *d = current->domain;
     const struct pci_dev *pdev;
-    const struct vpci_register *r;
-    unsigned int data_offset = 0;
+    struct vpci *vpci;
+    const struct vpci_map *map;
+    unsigned int i, data_offset = 0;
     const unsigned long *ro_map = pci_get_ro_map(sbdf.seg);
 
     if ( !size )
@@ -434,11 +640,24 @@ void vpci_write(pci_sbdf_t sbdf, unsigned int reg, unsigned int size,
         return;
     }
 
-    spin_lock(&pdev->vpci->lock);
+    rcu_read_lock(&vpci_rcu_lock);
+
+    vpci = rcu_dereference(pdev->vpci);
+    if ( !vpci )
+    {
+        rcu_read_unlock(&vpci_rcu_lock);
+        vpci_write_hw(sbdf, reg, size, data);
+        return;
+    }
+
+    spin_lock(&vpci->lock);
+    vpci_write_begin(vpci);
+    map = vpci->map;
 
     /* Write the value to the hardware or emulated registers. */
-    list_for_each_entry ( r, &pdev->vpci->handlers, node )
+    for ( i = vpci_map_first(map, reg); i < vpci_map_nr(map); i++ )
     {
+        const struct vpci_register *r = map->regs[i];
         const struct vpci_register emu = {
             .offset = reg + data_offset,
             .size = size - data_offset
@@ -475,7 +694,10 @@ void vpci_write(pci_sbdf_t sbdf, unsigned int reg, unsigned int size,
         vpci_write_hw(sbdf, reg + data_offset, size - data_offset,
                       data >> (data_offset * 8));
 
-    spin_unlock(&pdev->vpci->lock);
+    vpci_write_end(vpci);
+    spin_unlock(&vpci->lock);
+
+    rcu_read_unlock(&vpci_rcu_lock);
 }
 
 /*
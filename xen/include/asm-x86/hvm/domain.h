@@ -38,6 +38,17 @@ struct mem_sharing_domain
      * to resume the search.
      */
     unsigned long next_shared_gfn_to_relinquish;
+
+    /*
+     * A fork's log of the gfns of pages it made private since it was forked
+     * or last reset, so that a reset can get rid of just those.  The log is
+     * incomplete if the fork got pages in some other way, or the log would
+     * have grown too large: the reset then goes through all the fork's pages.
+     * Protected by the p2m lock.
+     */
+    unsigned long *reset_gfns;
+    unsigned int nr_reset_gfns, max_reset_gfns;
+    bool reset_log_incomplete;
 };
 #endif
 
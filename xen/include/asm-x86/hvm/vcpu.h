@@ -67,6 +67,9 @@ struct hvm_vcpu_io {
     unsigned char mmio_insn[16];
     struct hvmemul_cache *cache;
 
+    /* Recently decoded instructions, for repeatedly emulated ones. */
+    struct x86_emulate_decode_cache *decode_cache;
+
     /*
      * For string instruction emulation we need to be able to signal a
      * necessary retry through other than function return codes.
@@ -148,9 +151,11 @@ struct hvm_vcpu {
     s64                 cache_tsc_offset;
     u64                 guest_time;
 
-    /* Lock and list for virtual platform timers. */
+    /* Lock and list for virtual platform timers, and their host timer. */
     spinlock_t          tm_lock;
     struct list_head    tm_list;
+    struct timer        pt_timer;
+    unsigned long       pt_wakeups;
 
     bool                flag_dr_dirty;
     bool                debug_state_latch;
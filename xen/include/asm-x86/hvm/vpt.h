@@ -37,6 +37,7 @@ struct periodic_time {
     bool irq_issued;
     bool warned_timeout_too_short;
     bool level;
+    bool armed;                 /* waiting for the next tick, on vcpu timer */
 #define PTSRC_isa    1 /* ISA time source */
 #define PTSRC_lapic  2 /* LAPIC time source */
 #define PTSRC_ioapic 3 /* IOAPIC time source */
@@ -47,7 +48,6 @@ struct periodic_time {
     u64 period;                 /* frequency in ns */
     s_time_t scheduled;         /* scheduled timer interrupt */
     u64 last_plt_gtime;         /* platform time when last IRQ is injected */
-    struct timer timer;         /* ac_timer */
     time_cb *cb;
     void *priv;                 /* point back to platform time source */
 };
@@ -147,8 +147,13 @@ struct pl_time {    /* platform time */
     uint64_t last_guest_time;
     spinlock_t pl_time_lock;
     struct domain *domain;
+    /* vCPU wakeups by periodic timers as of the last 'q' debug key dump. */
+    unsigned long dump_wakeups;
+    s_time_t dump_time;
 };
 
+void pt_vcpu_init(struct vcpu *v);
+void pt_vcpu_deinit(struct vcpu *v);
 void pt_save_timer(struct vcpu *v);
 void pt_restore_timer(struct vcpu *v);
 int pt_update_irq(struct vcpu *v);
@@ -163,6 +168,7 @@ void pt_adjust_global_vcpu_target(struct vcpu *v);
      (d)->vcpu ? (d)->vcpu[0] : NULL)
 
 void pt_may_unmask_irq(struct domain *d, struct periodic_time *vlapic_pt);
+void pt_dump_domain_info(struct domain *d);
 
 /* Is given periodic timer active? */
 #define pt_active(pt) ((pt)->on_list || (pt)->pending_intr_nr)
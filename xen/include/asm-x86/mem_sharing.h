@@ -63,6 +63,7 @@ struct page_sharing_info
 
 unsigned int mem_sharing_get_nr_saved_mfns(void);
 unsigned int mem_sharing_get_nr_shared_mfns(void);
+unsigned int mem_sharing_get_nr_cow_breaks(void);
 
 /* Only fails with -ENOMEM. Enforce it with a BUG_ON wrapper. */
 int __mem_sharing_unshare_page(struct domain *d,
@@ -85,6 +86,13 @@ static inline bool mem_sharing_is_fork(const struct domain *d)
 int mem_sharing_fork_page(struct domain *d, gfn_t gfn,
                           bool unsharing);
 
+/* A fork got a page other than by forking it, which its reset must undo. */
+static inline void mem_sharing_fork_page_added(struct domain *d)
+{
+    if ( mem_sharing_is_fork(d) )
+        d->arch.hvm.mem_sharing.reset_log_incomplete = true;
+}
+
 /*
  * If called by a foreign domain, possible errors are
  *   -EBUSY -> ring full
@@ -125,6 +133,11 @@ static inline unsigned int mem_sharing_get_nr_shared_mfns(void)
     return 0;
 }
 
+static inline unsigned int mem_sharing_get_nr_cow_breaks(void)
+{
+    return 0;
+}
+
 static inline int mem_sharing_unshare_page(struct domain *d, unsigned long gfn)
 {
     ASSERT_UNREACHABLE();
@@ -148,6 +161,8 @@ static inline int mem_sharing_fork_page(struct domain *d, gfn_t gfn, bool lock)
     return -EOPNOTSUPP;
 }
 
+static inline void mem_sharing_fork_page_added(struct domain *d) {}
+
 #endif
 
 #endif /* __MEM_SHARING_H__ */
@@ -25,6 +25,8 @@ PERFCOUNTER(calls_to_mmu_update,        "calls to mmu_update")
 PERFCOUNTER(num_page_updates,           "page updates")
 PERFCOUNTER(writable_mmu_updates,       "mmu_updates of writable pages")
 PERFCOUNTER(calls_to_update_va,         "calls to update_va_map")
+PERFCOUNTER(update_va_flushes_merged,   "update_va_map flushes merged")
+PERFCOUNTER(update_va_flushes,          "update_va_map merged flushes done")
 PERFCOUNTER(page_faults,            "page faults")
 PERFCOUNTER(copy_user_faults,       "copy_user faults")
 
@@ -34,6 +36,8 @@ PERFCOUNTER(mmio_ro_emulations,     "mmio ro emulations")
 
 PERFCOUNTER(exception_fixed,        "pre-exception fixed")
 
+PERFCOUNTER(emul_decode_cached,     "emulations using cached decode")
+
 PERFCOUNTER(guest_walk,            "guest pagetable walks")
 
 /* Shadow counters */
@@ -34,6 +34,9 @@ bool pv_destroy_ldt(struct vcpu *v);
 
 int validate_segdesc_page(struct page_info *page);
 
+/* Carry out the TLB flushes deferred by a multicall's update_va_mappings. */
+void pv_multicall_flush(void);
+
 #else
 
 #include <xen/errno.h>
@@ -55,6 +58,8 @@ static inline bool pv_map_ldt_shadow_page(unsigned int off) { return false; }
 static inline bool pv_destroy_ldt(struct vcpu *v)
 { ASSERT_UNREACHABLE(); return false; }
 
+static inline void pv_multicall_flush(void) {}
+
 #endif
 
 #endif /* __X86_PV_MM_H__ */
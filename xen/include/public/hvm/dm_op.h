@@ -461,6 +461,35 @@ struct xen_dm_op_nr_vcpus {
 };
 typedef struct xen_dm_op_nr_vcpus xen_dm_op_nr_vcpus_t;
 
+/*
+ * XEN_DMOP_map_posted_io_range: Allow writes to an I/O range previously
+ *                               registered with
+ *                               XEN_DMOP_map_io_range_to_ioreq_server to
+ *                               be posted to IOREQ Server <id>.
+ * XEN_DMOP_unmap_posted_io_range: Revert writes to an I/O range to being
+ *                                 forwarded synchronously.
+ *
+ * Only XEN_DMOP_IO_RANGE_PORT and XEN_DMOP_IO_RANGE_MEMORY ranges may be
+ * posted, and the IOREQ Server must have been created with buffered ioreq
+ * handling enabled. Single, non-rep writes falling entirely within a posted
+ * range are queued on the buffered ioreq ring (see struct buf_ioreq for the
+ * extended encoding used for addresses above 1MB) and the vCPU resumes
+ * without waiting for a response. If the ring is full, the write is
+ * forwarded synchronously instead.
+ *
+ * Ordering: posted writes are queued before any later synchronous request
+ * from the same vCPU is raised. The device model must therefore drain the
+ * buffered ring before servicing a synchronous request in order for reads
+ * to observe the effect of all earlier posted writes.
+ *
+ * Removing a range via XEN_DMOP_unmap_io_range_from_ioreq_server also
+ * removes any overlapping posted range.
+ */
+#define XEN_DMOP_map_posted_io_range 21
+#define XEN_DMOP_unmap_posted_io_range 22
+
+/* Both use struct xen_dm_op_ioreq_server_range. */
+
 struct xen_dm_op {
     uint32_t op;
     uint32_t pad;
@@ -485,6 +514,8 @@ struct xen_dm_op {
         xen_dm_op_relocate_memory_t relocate_memory;
         xen_dm_op_pin_memory_cacheattr_t pin_memory_cacheattr;
         xen_dm_op_nr_vcpus_t nr_vcpus;
+        xen_dm_op_ioreq_server_range_t map_posted_io_range;
+        xen_dm_op_ioreq_server_range_t unmap_posted_io_range;
     } u;
 };
 
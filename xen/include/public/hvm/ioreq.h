@@ -73,7 +73,7 @@ typedef struct shared_iopage shared_iopage_t;
 
 struct buf_ioreq {
     uint8_t  type;   /* I/O type                    */
-    uint8_t  pad:1;
+    uint8_t  ext:1;  /* address extension slot follows (see below) */
     uint8_t  dir:1;  /* 1=read, 0=write             */
     uint8_t  size:2; /* 0=>1, 1=>2, 2=>4, 3=>8. If 8, use two buf_ioreqs */
     uint32_t addr:20;/* physical address            */
@@ -81,6 +81,15 @@ struct buf_ioreq {
 };
 typedef struct buf_ioreq buf_ioreq_t;
 
+/*
+ * Writes to ranges registered via XEN_DMOP_map_posted_io_range may be
+ * placed on the buffered ring even though they lie above 1MB. Such
+ * requests have <ext> set and occupy one additional slot (after the data
+ * slot of an 8 byte write, if any) whose <data> field holds bits 20-51 of
+ * the address. <ext> is never set for ioreq servers without posted ranges.
+ */
+#define BUF_IOREQ_ADDR_SHIFT      20
+
 #define IOREQ_BUFFER_SLOT_NUM     511 /* 8 bytes each, plus 2 4-byte indexes */
 struct buffered_iopage {
 #ifdef __XEN__
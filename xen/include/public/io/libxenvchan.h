@@ -99,3 +99,18 @@ struct vchan_interface {
 	uint32_t grants[0];
 };
 
+/**
+ * vchan_bulk_msg: header of the messages passed by libxenvchan_send_bulk().
+ * With nr_grants 0, the len bytes of data follow the header in the ring.
+ * Otherwise nr_grants grant references follow it, of pages of the sender
+ * holding the data from offset (less than a page) on in the first of them.
+ * The sender may reuse the pages once the message has been consumed from the
+ * ring, so the receiver only consumes it when done with them.
+ */
+struct vchan_bulk_msg {
+	uint32_t len;
+	uint32_t offset;
+	uint32_t nr_grants;
+	uint32_t grants[0];
+};
+
@@ -394,6 +394,13 @@ typedef struct xen_pod_target xen_pod_target_t;
 #define XENMEM_get_sharing_freed_pages    18
 #define XENMEM_get_sharing_shared_pages   19
 
+/*
+ * Get the number of times a shared page was made private again because a
+ * domain wrote to it, i.e. of copy-on-write breaks.  The count wraps.
+ * The call never fails.
+ */
+#define XENMEM_get_sharing_cow_breaks     29
+
 #define XENMEM_paging_op                    20
 #define XENMEM_paging_op_nominate           0
 #define XENMEM_paging_op_evict              1
@@ -491,6 +498,8 @@ DEFINE_XEN_GUEST_HANDLE(xen_mem_access_op_t);
 #define XENMEM_sharing_op_range_share       8
 #define XENMEM_sharing_op_fork              9
 #define XENMEM_sharing_op_fork_reset        10
+#define XENMEM_sharing_op_fork_bulk         11
+#define XENMEM_sharing_op_dedup             12
 
 #define XENMEM_SHARING_OP_S_HANDLE_INVALID  (-10)
 #define XENMEM_SHARING_OP_C_HANDLE_INVALID  (-9)
@@ -508,6 +517,21 @@ DEFINE_XEN_GUEST_HANDLE(xen_mem_access_op_t);
 #define XENMEM_SHARING_OP_FIELD_GET_GREF(field)        \
     ((field) & (~XENMEM_SHARING_OP_FIELD_IS_GREF_FLAG))
 
+/*
+ * A pair of pages found to have the same contents, for
+ * XENMEM_sharing_op_dedup: client_gfn of the domain the op is for and
+ * source_gfn of source_domain, which may be the same domain.
+ */
+struct xen_mem_sharing_dedup {
+    uint64_aligned_t source_gfn;  /* IN: the gfn of the source page */
+    uint64_aligned_t client_gfn;  /* IN: the gfn of the client page */
+    domid_t source_domain;        /* IN: the source domain id */
+    uint16_t pad;                 /* Must be set to 0 */
+    int32_t rc;                   /* OUT: 0 if shared, or -errno */
+};
+typedef struct xen_mem_sharing_dedup xen_mem_sharing_dedup_t;
+DEFINE_XEN_GUEST_HANDLE(xen_mem_sharing_dedup_t);
+
 struct xen_mem_sharing_op {
     uint8_t     op;     /* XENMEM_sharing_op_* */
     domid_t     domain;
@@ -550,6 +574,43 @@ struct xen_mem_sharing_op {
             uint16_t flags;               /* IN: optional settings */
             uint32_t pad;                 /* Must be set to 0 */
         } fork;
+        /*
+         * Makes each of forks[] a fork of the domain the op is for, and
+         * populates their p2m with the pages listed in hot_gfns[] up front
+         * rather than on their first access.  The hot pages are shared with
+         * the parent, or copied with XENMEM_FORK_HOT_PRIVATE.  The other
+         * XENMEM_FORK_* flags are as for OP_FORK.  On failure, the first
+         * nr_done forks are complete.
+         */
+        struct mem_sharing_op_fork_bulk { /* OP_FORK_BULK */
+            XEN_GUEST_HANDLE_64(uint16) forks;        /* IN: fork domain ids */
+            XEN_GUEST_HANDLE_64(uint64) hot_gfns;     /* IN: gfns to populate */
+            uint32_t nr_forks;            /* IN: entries in forks[] */
+            uint32_t nr_hot;              /* IN: entries in hot_gfns[] */
+/* Copy the hot pages into each fork, for pages the forks are to write */
+#define XENMEM_FORK_HOT_PRIVATE        (1u << 2)
+            uint32_t flags;               /* IN: XENMEM_FORK_* */
+            uint32_t nr_done;             /* IN/OUT: progress, set to 0 */
+            uint32_t hot_done;            /* IN/OUT: progress, set to 0 */
+            uint32_t pad;                 /* Must be set to 0 */
+        } fork_bulk;
+        /*
+         * Shares the pages of each of pairs[], but only if their contents
+         * are still the same once both pages are nominated, i.e. can no
+         * longer be written to without being unshared again.  A pair which
+         * can't be shared gets its error in its rc, -ENODATA if the contents
+         * differ (in which case neither page is left nominated, unless it
+         * was shared already), and the op carries on with the next one.  Running out of
+         * memory stops the op, with the first nr_done pairs processed.
+         */
+        struct mem_sharing_op_dedup {     /* OP_DEDUP */
+            /* IN/OUT: xen_mem_sharing_dedup_t[nr_pairs] */
+            XEN_GUEST_HANDLE_64(void) pairs;
+            uint32_t nr_pairs;            /* IN: entries in pairs[] */
+            uint32_t nr_done;             /* IN/OUT: progress, set to 0 */
+            uint32_t nr_shared;           /* IN/OUT: pairs shared, set to 0 */
+            uint32_t pad;                 /* Must be set to 0 */
+        } dedup;
     } u;
 };
 typedef struct xen_mem_sharing_op xen_mem_sharing_op_t;
@@ -739,7 +800,7 @@ struct xen_vnuma_topology_info {
 typedef struct xen_vnuma_topology_info xen_vnuma_topology_info_t;
 DEFINE_XEN_GUEST_HANDLE(xen_vnuma_topology_info_t);
 
-/* Next available subop number is 29 */
+/* Next available subop number is 30 */
 
 #endif /* __XEN_PUBLIC_MEMORY_H__ */
 
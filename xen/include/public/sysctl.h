@@ -35,7 +35,7 @@
 #include "domctl.h"
 #include "physdev.h"
 
-#define XEN_SYSCTL_INTERFACE_VERSION 0x00000013
+#define XEN_SYSCTL_INTERFACE_VERSION 0x00000014
 
 /*
  * Read console content from Xen buffer ring.
@@ -68,10 +68,29 @@ struct xen_sysctl_tbuf_op {
 #define XEN_SYSCTL_TBUFOP_set_size     3
 #define XEN_SYSCTL_TBUFOP_enable       4
 #define XEN_SYSCTL_TBUFOP_disable      5
+#define XEN_SYSCTL_TBUFOP_set_mode     6
+#define XEN_SYSCTL_TBUFOP_freeze       7
+#define XEN_SYSCTL_TBUFOP_thaw         8
     uint32_t cmd;
     /* IN/OUT variables */
     struct xenctl_bitmap cpu_mask;
     uint32_t             evt_mask;
+    /*
+     * IN for set_mode, OUT for get_info.
+     *
+     * In flight recorder mode a full trace buffer has its oldest records
+     * overwritten, rather than new records being lost, so the buffers always
+     * hold the most recent history without needing a consumer.  The buffers
+     * may only be consumed while frozen: either explicitly (freeze), or
+     * automatically on the events selected by the freeze_on_* flags.  Thaw
+     * resumes recording.
+     */
+#define XEN_SYSCTL_TBUF_MODE_flight_recorder    (1u << 0)
+#define XEN_SYSCTL_TBUF_MODE_freeze_on_crash    (1u << 1) /* domain_crash() */
+#define XEN_SYSCTL_TBUF_MODE_freeze_on_watchdog (1u << 2) /* Xen or domain */
+#define XEN_SYSCTL_TBUF_MODE_freeze_on_nmi      (1u << 3) /* external NMI */
+#define XEN_SYSCTL_TBUF_MODE_frozen             (1u << 31) /* OUT only */
+    uint32_t             mode;
     /* OUT variables */
     uint64_aligned_t buffer_mfn;
     uint32_t size;  /* Also an IN variable! */
@@ -167,6 +186,42 @@ struct xen_sysctl_getdomaininfolist {
     uint32_t              num_domains;
 };
 
+/*
+ * XEN_SYSCTL_getvcpuinfolist
+ *
+ * Get the runstate of all vCPUs of domains from first_domain on (and of
+ * vCPUs from first_vcpu on, in first_domain), in order of domain and vCPU
+ * ids.  On return first_domain and first_vcpu are where a further call is
+ * to carry on from, with first_domain DOMID_INVALID once all vCPUs of all
+ * domains have been reported.  Fewer than max_vcpus entries may be written
+ * before that, if the call was preempted.
+ */
+struct xen_sysctl_vcpuinfo {
+    domid_t               domid;
+    uint16_t              vcpu;
+    uint32_t              cpu;      /* Physical CPU last run on. */
+    uint8_t               online;
+    uint8_t               blocked;
+    uint8_t               running;
+    uint8_t               state;    /* RUNSTATE_* */
+    uint32_t              pad;
+    uint64_aligned_t      state_entry_time;
+    uint64_aligned_t      time[4];  /* ns spent in each RUNSTATE_* */
+};
+typedef struct xen_sysctl_vcpuinfo xen_sysctl_vcpuinfo_t;
+DEFINE_XEN_GUEST_HANDLE(xen_sysctl_vcpuinfo_t);
+
+struct xen_sysctl_getvcpuinfolist {
+    /* IN/OUT variables. */
+    domid_t               first_domain;
+    uint16_t              first_vcpu;
+    /* IN variables. */
+    uint32_t              max_vcpus;
+    XEN_GUEST_HANDLE_64(xen_sysctl_vcpuinfo_t) buffer;
+    /* OUT variables. */
+    uint32_t              num_vcpus;
+};
+
 /* Inject debug keys into Xen. */
 /* XEN_SYSCTL_debug_keys */
 struct xen_sysctl_debug_keys {
@@ -460,6 +515,14 @@ struct xen_sysctl_lockprof_data {
     uint64_aligned_t block_cnt;    /* # of wait for lock */
     uint64_aligned_t lock_time;    /* nsecs lock held */
     uint64_aligned_t block_time;   /* nsecs waited for lock */
+    /*
+     * Waits for the lock by duration: bucket 0 counts those of less than
+     * 256ns, bucket n those of [128ns << n, 256ns << n), and the last one
+     * all longer ones.
+     */
+#define XEN_SYSCTL_LOCKPROF_HIST_SHIFT 8
+#define XEN_SYSCTL_LOCKPROF_NR_BUCKETS 16
+    uint32_t block_hist[XEN_SYSCTL_LOCKPROF_NR_BUCKETS];
 };
 typedef struct xen_sysctl_lockprof_data xen_sysctl_lockprof_data_t;
 DEFINE_XEN_GUEST_HANDLE(xen_sysctl_lockprof_data_t);
@@ -1093,6 +1156,7 @@ struct xen_sysctl {
 #define XEN_SYSCTL_livepatch_op                  27
 /* #define XEN_SYSCTL_set_parameter              28 */
 #define XEN_SYSCTL_get_cpu_policy                29
+#define XEN_SYSCTL_getvcpuinfolist               30
     uint32_t interface_version; /* XEN_SYSCTL_INTERFACE_VERSION */
     union {
         struct xen_sysctl_readconsole       readconsole;
@@ -1104,6 +1168,7 @@ struct xen_sysctl {
         struct xen_sysctl_sched_id          sched_id;
         struct xen_sysctl_perfc_op          perfc_op;
         struct xen_sysctl_getdomaininfolist getdomaininfolist;
+        struct xen_sysctl_getvcpuinfolist   getvcpuinfolist;
         struct xen_sysctl_debug_keys        debug_keys;
         struct xen_sysctl_getcpuinfo        getcpuinfo;
         struct xen_sysctl_availheap         availheap;
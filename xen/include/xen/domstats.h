@@ -0,0 +1,109 @@
+#ifndef __XEN_DOMSTATS_H__
+#define __XEN_DOMSTATS_H__
+
+#include <xen/sched.h>
+#include <xen/time.h>
+
+/*
+ * Per-vCPU counters and latency histograms of VM exits by reason, of
+ * hypercalls by number and of instruction emulation.  They are only
+ * ever updated by the vCPU they belong to, so without atomics; hypfs
+ * sums them up per domain below /domain/<domid>/.
+ *
+ * Histogram bucket 0 counts events taking less than 256ns, bucket n
+ * those taking [128ns << n, 256ns << n), and the last bucket everything
+ * from about 1ms upwards.
+ */
+#define DOMSTATS_HIST_SHIFT   8
+#define DOMSTATS_NR_BUCKETS   14
+
+/*
+ * Exits are indexed by the VMX basic exit reason, or by the SVM exit code
+ * with codes 0x400-0x40e folded down to 0x90-0x9e.  Anything beyond goes
+ * to the last slot.
+ */
+#define DOMSTATS_NR_EXITS     0xa0
+
+struct domstats_hist {
+    uint64_t total_ns;
+    uint32_t bucket[DOMSTATS_NR_BUCKETS];
+};
+
+struct vcpu_stats {
+    struct domstats_hist exit[DOMSTATS_NR_EXITS];
+    struct domstats_hist hypercall[NR_hypercalls];
+    struct domstats_hist emulation;
+
+    /* Exit being handled, closed by the next VM entry or context switch. */
+    s_time_t exit_start;
+    unsigned int exit_reason;
+};
+
+#ifdef CONFIG_DOMAIN_STATS
+
+int domstats_vcpu_init(struct vcpu *v);
+void domstats_vcpu_destroy(struct vcpu *v);
+
+static inline void domstats_record(struct domstats_hist *h, s_time_t ns)
+{
+    unsigned int b = ns > 0 ? flsl(ns) : 0;
+
+    b = b > DOMSTATS_HIST_SHIFT ? b - DOMSTATS_HIST_SHIFT : 0;
+    h->total_ns += ns;
+    h->bucket[min(b, DOMSTATS_NR_BUCKETS - 1U)]++;
+}
+
+static inline s_time_t domstats_start(const struct vcpu *v)
+{
+    return v->stats ? NOW() : 0;
+}
+
+static inline void domstats_exit_start(struct vcpu *v, unsigned int reason)
+{
+    struct vcpu_stats *s = v->stats;
+
+    if ( !s )
+        return;
+
+    s->exit_reason = min(reason, DOMSTATS_NR_EXITS - 1U);
+    s->exit_start = NOW();
+}
+
+static inline void domstats_exit_end(struct vcpu *v)
+{
+    struct vcpu_stats *s = v->stats;
+
+    if ( !s || !s->exit_start )
+        return;
+
+    domstats_record(&s->exit[s->exit_reason], NOW() - s->exit_start);
+    s->exit_start = 0;
+}
+
+static inline void domstats_hypercall(struct vcpu *v, unsigned int op,
+                                      s_time_t start)
+{
+    if ( v->stats && op < NR_hypercalls )
+        domstats_record(&v->stats->hypercall[op], NOW() - start);
+}
+
+static inline void domstats_emulation(struct vcpu *v, s_time_t start)
+{
+    if ( v->stats )
+        domstats_record(&v->stats->emulation, NOW() - start);
+}
+
+#else /* !CONFIG_DOMAIN_STATS */
+
+static inline int domstats_vcpu_init(struct vcpu *v) { return 0; }
+static inline void domstats_vcpu_destroy(struct vcpu *v) {}
+static inline s_time_t domstats_start(const struct vcpu *v) { return 0; }
+static inline void domstats_exit_start(struct vcpu *v, unsigned int reason) {}
+static inline void domstats_exit_end(struct vcpu *v) {}
+static inline void domstats_hypercall(struct vcpu *v, unsigned int op,
+                                      s_time_t start) {}
+static inline void domstats_emulation(struct vcpu *v, s_time_t start) {}
+
+#endif /* CONFIG_DOMAIN_STATS */
+
+#endif /* __XEN_DOMSTATS_H__ */
@@ -37,6 +37,7 @@ struct ioreq_vcpu {
 };
 
 #define NR_IO_RANGE_TYPES (XEN_DMOP_IO_RANGE_PCI + 1)
+#define NR_POSTED_RANGE_TYPES (XEN_DMOP_IO_RANGE_MEMORY + 1)
 #define MAX_NR_IO_RANGES  256
 
 struct ioreq_server {
@@ -53,6 +54,8 @@ struct ioreq_server {
     spinlock_t             bufioreq_lock;
     evtchn_port_t          bufioreq_evtchn;
     struct rangeset        *range[NR_IO_RANGE_TYPES];
+    /* Subsets of the port / memory ranges whose writes may be posted */
+    struct rangeset        *posted[NR_POSTED_RANGE_TYPES];
     bool                   enabled;
     uint8_t                bufioreq_handling;
 };
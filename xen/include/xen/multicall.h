@@ -27,4 +27,7 @@ enum mc_disposition {
     mc_preempt,
 } arch_do_multicall_call(struct mc_state *mc);
 
+/* Called when a multicall returns, whether completed or preempted. */
+void arch_multicall_end(struct mc_state *mc);
+
 #endif /* __XEN_MULTICALL_H__ */
@@ -14,6 +14,9 @@ PERFCOUNTER(ipis,                   "#IPIs")
 
 PERFCOUNTER(rcu_idle_timer,         "RCU: idle_timer")
 
+PERFCOUNTER(ioreq_posted,           "ioreq: posted writes")
+PERFCOUNTER(ioreq_posted_full,      "ioreq: posted writes sent synchronously")
+
 /* Generic scheduler counters (applicable to all schedulers) */
 PERFCOUNTER(sched_irq,              "sched: timer")
 PERFCOUNTER(sched_run,              "sched: runs through scheduler")
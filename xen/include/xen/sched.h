@@ -290,6 +290,11 @@ struct vcpu
         struct page_info *pg; /* One contiguous allocation of d->vmtrace_size */
     } vmtrace;
 
+#ifdef CONFIG_DOMAIN_STATS
+    /* Exit, hypercall and emulation statistics (see xen/domstats.h). */
+    struct vcpu_stats *stats;
+#endif
+
     struct arch_vcpu arch;
 
 #ifdef CONFIG_IOREQ_SERVER
@@ -81,6 +81,8 @@ struct lock_profile {
     s_time_t            time_hold;   /* cumulated lock time */
     s_time_t            time_block;  /* cumulated wait time */
     s_time_t            time_locked; /* system time of last locking */
+    /* wait times, see XEN_SYSCTL_LOCKPROF_NR_BUCKETS */
+    u32                 block_hist[XEN_SYSCTL_LOCKPROF_NR_BUCKETS];
 };
 
 struct lock_profile_qhead {
@@ -89,7 +91,7 @@ struct lock_profile_qhead {
     int32_t                   idx;     /* index for printout */
 };
 
-#define _LOCK_PROFILE(name) { 0, #name, &name, 0, 0, 0, 0, 0 }
+#define _LOCK_PROFILE(name) { 0, #name, &name, 0, 0, 0, 0, 0, { 0 } }
 #define _LOCK_PROFILE_PTR(name)                                               \
     static struct lock_profile * const __lock_profile_##name                  \
     __used_section(".lockprofile.data") =                                     \
@@ -146,6 +148,21 @@ struct lock_profile_qhead { };
 
 #endif
 
+#ifdef CONFIG_MCS_SPINLOCK
+
+typedef union {
+    u32 val;
+    struct {
+        u16 owner;   /* SPINLOCK_QUEUE_LOCKED, and a count of unlocks. */
+        u16 tail;    /* Last CPU queued for the lock (see spinlock.c). */
+    };
+} spinlock_queue_t;
+
+#define SPINLOCK_QUEUE_LOCKED  0x0001
+#define SPINLOCK_QUEUE_GEN     0x0100
+
+#else
+
 typedef union {
     u32 head_tail;
     struct {
@@ -156,8 +173,14 @@ typedef union {
 
 #define SPINLOCK_TICKET_INC { .head_tail = 0x10000, }
 
+#endif
+
 typedef struct spinlock {
+#ifdef CONFIG_MCS_SPINLOCK
+    spinlock_queue_t queue;
+#else
     spinlock_tickets_t tickets;
+#endif
     u16 recurse_cpu:SPINLOCK_CPU_BITS;
 #define SPINLOCK_NO_CPU        ((1u << SPINLOCK_CPU_BITS) - 1)
 #define SPINLOCK_RECURSE_BITS  (16 - SPINLOCK_CPU_BITS)
@@ -20,10 +20,8 @@ struct timer {
 
     /* Position in active-timer data structure. */
     union {
-        /* Timer-heap offset (TIMER_STATUS_in_heap). */
-        unsigned int heap_offset;
-        /* Linked list (TIMER_STATUS_in_list). */
-        struct timer *list_next;
+        /* Timer-wheel slot list (TIMER_STATUS_in_wheel). */
+        struct list_head wheel_list;
         /* Linked list of inactive timers (TIMER_STATUS_inactive). */
         struct list_head inactive;
     };
@@ -40,9 +38,17 @@ struct timer {
 #define TIMER_STATUS_invalid  0 /* Should never see this.           */
 #define TIMER_STATUS_inactive 1 /* Not in use; can be activated.    */
 #define TIMER_STATUS_killed   2 /* Not in use; cannot be activated. */
-#define TIMER_STATUS_in_heap  3 /* In use; on timer heap.           */
-#define TIMER_STATUS_in_list  4 /* In use; on overflow linked list. */
+#define TIMER_STATUS_in_wheel 3 /* In use; on timer wheel.          */
     uint8_t status;
+
+    /* Timer-wheel slot (TIMER_STATUS_in_wheel). */
+    uint16_t wheel_slot;
+
+    /*
+     * Nanoseconds the timer may fire late by, so that the hardware can be
+     * programmed for several timers at once.  0 unless set_timer_slack().
+     */
+    uint32_t slack;
 };
 
 /*
@@ -64,6 +70,13 @@ void init_timer(
 /* Set the expiry time and activate a timer. */
 void set_timer(struct timer *timer, s_time_t expires);
 
+/*
+ * Allow a timer to fire up to @slack ns after its expiry time, when that
+ * saves programming the timer hardware for it separately.  Takes effect
+ * from the next set_timer().  init_timer() resets the slack to 0.
+ */
+void set_timer_slack(struct timer *timer, unsigned int slack);
+
 /*
  * Deactivate a timer This function has no effect if the timer is not currently
  * active.
@@ -84,8 +97,8 @@ bool timer_expires_before(struct timer *timer, s_time_t t);
  */
 static inline bool timer_is_active(const struct timer *timer)
 {
-    ASSERT(timer->status <= TIMER_STATUS_in_list);
-    return timer->status >= TIMER_STATUS_in_heap;
+    ASSERT(timer->status <= TIMER_STATUS_in_wheel);
+    return timer->status == TIMER_STATUS_in_wheel;
 }
 
 /* Migrate a timer to a different CPU. The timer may be currently active. */
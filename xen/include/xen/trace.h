@@ -33,6 +33,13 @@ extern int tb_init_done;
 #include <public/trace.h>
 #include <asm/trace.h>
 
+/* Events which may freeze the flight recorder (see XEN_SYSCTL_TBUF_MODE_*) */
+enum trace_freeze_trigger {
+    TRACE_FREEZE_CRASH,
+    TRACE_FREEZE_WATCHDOG,
+    TRACE_FREEZE_NMI,
+};
+
 #ifdef CONFIG_TRACEBUFFER
 /* Used to initialise trace buffer functionality */
 void init_trace_bufs(void);
@@ -54,6 +61,12 @@ static inline void trace_var(uint32_t event, bool cycles, unsigned int extra,
 void __trace_hypercall(uint32_t event, unsigned long op,
                        const xen_ulong_t *args);
 
+/*
+ * Freeze the flight recorder if it is set up to freeze on @trigger.
+ * Safe to call from any context, including NMI.
+ */
+void trace_freeze(enum trace_freeze_trigger trigger);
+
 #else /* CONFIG_TRACEBUFFER */
 
 #include <xen/errno.h>
@@ -75,6 +88,8 @@ static inline void __trace_var(uint32_t event, bool cycles, unsigned int extra,
                                const void *extra_data) {}
 static inline void __trace_hypercall(uint32_t event, unsigned long op,
                                      const xen_ulong_t *args) {}
+
+static inline void trace_freeze(enum trace_freeze_trigger trigger) {}
 #endif /* CONFIG_TRACEBUFFER */
 
 /* Convenience macros for calling the trace function. */
@@ -6,6 +6,7 @@
 #include <xen/pci.h>
 #include <xen/types.h>
 #include <xen/list.h>
+#include <xen/rcupdate.h>
 
 typedef uint32_t vpci_read_t(const struct pci_dev *pdev, unsigned int reg,
                              void *data);
@@ -55,13 +56,30 @@ uint32_t vpci_hw_read32(const struct pci_dev *pdev, unsigned int reg,
  */
 bool __must_check vpci_process_pending(struct vcpu *v);
 
+struct vpci;
+
+/*
+ * Bracket any change to a device's vPCI state, with its vPCI lock held, for
+ * lockless readers of its config space to notice (see vpci_read()).
+ */
+void vpci_write_begin(struct vpci *vpci);
+void vpci_write_end(struct vpci *vpci);
+
+struct vpci_map;
+
 struct vpci {
     /* List of vPCI handlers for a device. */
     struct list_head handlers;
+    /* Dispatch table for the handlers above, RCU protected. */
+    struct vpci_map *map;
     spinlock_t lock;
+    /* Odd while a write is being processed, see vpci_read(). */
+    unsigned int seq;
 
 #ifdef __XEN__
     /* Hide the rest of the vpci struct from the user-space test harness. */
+    struct rcu_head rcu;
+
     struct vpci_header {
         /* Information about the PCI BARs of this device. */
         struct vpci_bar {
@@ -89,6 +107,10 @@ struct vpci {
          */
         bool rom_enabled      : 1;
         /* FIXME: currently there's no support for SR-IOV. */
+
+        /* Statistics of the last BAR mapping operation. */
+        s_time_t map_start, map_time;
+        unsigned long map_pages;
     } header;
 
     /* MSI data. */